@@ -0,0 +1,797 @@
+#define _POSIX_C_SOURCE 200809L // fstat
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "assembler.h"
+#include "instruction.h"
+#include "printRoutines.h"
+
+#define ARENA_BLOCK_SIZE  (1 << 20)
+#define INITIAL_SYMBOLS   1024
+#define MNEMONIC_SLOTS    128          // power of two, > 2 * mnemonics
+#define ASM_MAX_IMAGE     (1ull << 32) // largest image that is assembled
+
+typedef enum statement_kind {
+  ST_INSTRUCTION,
+  ST_QUAD
+} statement_kind_t;
+
+/* A statement that emits bytes, as parsed by the first pass. If symbol
+   is not NULL, value is the address of that symbol, which is resolved
+   by the second pass. symbol points into the source. */
+typedef struct statement {
+  uint64_t    address;
+  uint64_t    value;
+  const char *symbol;
+  uint32_t    symbolLength;
+  uint32_t    line;
+  uint8_t     kind;
+  uint8_t     icode;
+  uint8_t     ifun;
+  uint8_t     rA;
+  uint8_t     rB;
+} statement_t;
+
+typedef struct mnemonic {
+  const char *name;
+  size_t      length;
+  uint8_t     icode;
+  uint8_t     ifun;
+} mnemonic_t;
+
+typedef struct assembler {
+
+  const char    *fileName;
+  y86_program_t *program;
+
+  // Current line, and position in it. end excludes any comment.
+  uint64_t    line;
+  const char *p;
+  const char *end;
+
+  uint64_t     address;
+  uint64_t     maxAddress;
+  statement_t *statements;
+  uint64_t     numStatements;
+  uint64_t     capacity;
+
+  mnemonic_t mnemonics[MNEMONIC_SLOTS];
+
+} assembler_t;
+
+static int error(assembler_t *as, const char *format, ...) {
+
+  va_list args;
+  int n = snprintf(as->program->error, ASM_MAX_ERROR, "%s:%lu: ",
+		   as->fileName, as->line);
+
+  va_start(args, format);
+  vsnprintf(as->program->error + n, ASM_MAX_ERROR - n, format, args);
+  va_end(args);
+  return 0;
+}
+
+/* Allocates size bytes from the program's arena. Returns NULL if memory
+   could not be allocated. */
+static void *arenaAlloc(y86_program_t *program, size_t size) {
+
+  arena_block_t *block = program->arena;
+
+  size = (size + 7) & ~(size_t) 7;
+  if (!block || block->size - block->used < size)
+  {
+    size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    block = malloc(sizeof(arena_block_t) + blockSize);
+    if (!block)
+      return NULL;
+    block->next = program->arena;
+    block->used = 0;
+    block->size = blockSize;
+    program->arena = block;
+  }
+
+  block->used += size;
+  return block->data + block->used - size;
+}
+
+static inline uint64_t hashName(const char *name, size_t length) {
+
+  uint64_t hash = 0xCBF29CE484222325ull;
+
+  for (size_t i = 0; i < length; i++)
+    hash = (hash ^ (uint8_t) name[i]) * 0x100000001B3ull;
+  return hash;
+}
+
+/* Returns the slot of the symbol with the specified name in the hash
+   table, or the empty slot where it would be added. */
+static uint64_t symbolSlot(const y86_program_t *program, const char *name,
+			   size_t length) {
+
+  uint64_t mask = program->symbolCapacity - 1;
+  uint64_t i = hashName(name, length) & mask;
+
+  while (program->symbols[i] &&
+	 (program->symbols[i]->length != length ||
+	  memcmp(program->symbols[i]->name, name, length) != 0))
+    i = (i + 1) & mask;
+  return i;
+}
+
+static int growSymbols(y86_program_t *program) {
+
+  y86_program_t bigger = *program;
+
+  bigger.symbolCapacity = 2 * program->symbolCapacity;
+  bigger.symbols = calloc(bigger.symbolCapacity, sizeof(y86_symbol_t *));
+  if (!bigger.symbols)
+    return 0;
+
+  for (uint64_t i = 0; i < program->symbolCapacity; i++)
+  {
+    y86_symbol_t *symbol = program->symbols[i];
+    if (symbol)
+      bigger.symbols[symbolSlot(&bigger, symbol->name, symbol->length)] = symbol;
+  }
+
+  free(program->symbols);
+  program->symbols = bigger.symbols;
+  program->symbolCapacity = bigger.symbolCapacity;
+  return 1;
+}
+
+static int defineSymbol(assembler_t *as, const char *name, size_t length) {
+
+  y86_program_t *program = as->program;
+  y86_symbol_t *symbol;
+  char *copy;
+  uint64_t slot;
+
+  if (2 * (program->numSymbols + 1) > program->symbolCapacity &&
+      !growSymbols(program))
+    return error(as, "out of memory");
+
+  slot = symbolSlot(program, name, length);
+  if (program->symbols[slot])
+    return error(as, "label %.*s already defined on line %u", (int) length,
+		 name, program->symbols[slot]->line);
+
+  symbol = arenaAlloc(program, sizeof(y86_symbol_t));
+  copy = arenaAlloc(program, length + 1);
+  if (!symbol || !copy)
+    return error(as, "out of memory");
+  memcpy(copy, name, length);
+  copy[length] = '\0';
+
+  symbol->address = as->address;
+  symbol->line = as->line;
+  symbol->length = length;
+  symbol->name = copy;
+  program->symbols[slot] = symbol;
+  program->numSymbols++;
+  return 1;
+}
+
+/* Fills the table of mnemonics from the names known to printRoutines,
+   so the assembler accepts exactly what the debugger prints. */
+static void initMnemonics(assembler_t *as) {
+
+  for (int icode = 0; icode <= 0xF; icode++)
+  {
+    for (int ifun = 0; ifun <= 0xF; ifun++)
+    {
+      const char *name = instructionName(icode, ifun);
+      if (!name)
+	continue;
+
+      size_t length = strlen(name);
+      uint64_t i = hashName(name, length) & (MNEMONIC_SLOTS - 1);
+      while (as->mnemonics[i].name)
+	i = (i + 1) & (MNEMONIC_SLOTS - 1);
+      as->mnemonics[i].name = name;
+      as->mnemonics[i].length = length;
+      as->mnemonics[i].icode = icode;
+      as->mnemonics[i].ifun = ifun;
+    }
+  }
+}
+
+static const mnemonic_t *findMnemonic(assembler_t *as, const char *name,
+				      size_t length) {
+
+  uint64_t i = hashName(name, length) & (MNEMONIC_SLOTS - 1);
+
+  while (as->mnemonics[i].name)
+  {
+    if (as->mnemonics[i].length == length &&
+	memcmp(as->mnemonics[i].name, name, length) == 0)
+      return &as->mnemonics[i];
+    i = (i + 1) & (MNEMONIC_SLOTS - 1);
+  }
+  return NULL;
+}
+
+static inline int isIdentifierStart(int c) {
+
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '.';
+}
+
+static inline int isIdentifierChar(int c) {
+
+  return isIdentifierStart(c) || (c >= '0' && c <= '9');
+}
+
+static inline void skipSpace(assembler_t *as) {
+
+  while (as->p < as->end && (*as->p == ' ' || *as->p == '\t' || *as->p == '\r' ||
+			     *as->p == '\f' || *as->p == '\v'))
+    as->p++;
+}
+
+/* Returns the length of the identifier at the current position (0 if
+   there is none), without consuming it. */
+static inline size_t identifierLength(assembler_t *as) {
+
+  const char *q = as->p;
+
+  if (q == as->end || !isIdentifierStart(*q))
+    return 0;
+  while (++q < as->end && isIdentifierChar(*q));
+  return q - as->p;
+}
+
+static int expect(assembler_t *as, char c) {
+
+  skipSpace(as);
+  if (as->p == as->end || *as->p != c)
+    return error(as, "expected '%c'", c);
+  as->p++;
+  return 1;
+}
+
+/* Parses a decimal or 0x-prefixed hexadecimal number, optionally
+   negative. Values wrap around to 64 bits. */
+static int parseNumber(assembler_t *as, uint64_t *value) {
+
+  int negative = 0, digits = 0;
+
+  skipSpace(as);
+  if (as->p < as->end && *as->p == '-')
+  {
+    negative = 1;
+    as->p++;
+  }
+
+  *value = 0;
+  if (as->end - as->p > 2 && as->p[0] == '0' && (as->p[1] == 'x' || as->p[1] == 'X'))
+  {
+    as->p += 2;
+    for (; as->p < as->end; as->p++, digits++)
+    {
+      char c = *as->p;
+      int digit = c >= '0' && c <= '9' ? c - '0' :
+	c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+	c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+      if (digit < 0)
+	break;
+      *value = *value << 4 | digit;
+    }
+  }
+  else
+  {
+    for (; as->p < as->end && *as->p >= '0' && *as->p <= '9'; as->p++, digits++)
+      *value = *value * 10 + (*as->p - '0');
+  }
+
+  if (!digits)
+    return error(as, "expected a number");
+  if (as->p < as->end && isIdentifierChar(*as->p))
+    return error(as, "invalid number");
+  if (negative)
+    *value = -*value;
+  return 1;
+}
+
+/* Parses a number or a label, optionally prefixed by $, into the
+   value of st. Labels are resolved in the second pass. */
+static int parseValue(assembler_t *as, statement_t *st) {
+
+  size_t length;
+
+  skipSpace(as);
+  if (as->p < as->end && *as->p == '$')
+    as->p++;
+  length = identifierLength(as);
+  if (length)
+  {
+    st->symbol = as->p;
+    st->symbolLength = length;
+    as->p += length;
+    return 1;
+  }
+  st->symbol = NULL;
+  return parseNumber(as, &st->value);
+}
+
+static int parseRegister(assembler_t *as, uint8_t *reg) {
+
+  size_t length;
+
+  skipSpace(as);
+  if (as->p == as->end || *as->p != '%')
+    return error(as, "expected a register");
+
+  as->p++;
+  length = identifierLength(as);
+  for (int r = 0; r < R_NONE; r++)
+  {
+    const char *name = registerName(r) + 1;
+    if (strlen(name) == length && memcmp(name, as->p, length) == 0)
+    {
+      *reg = r;
+      as->p += length;
+      return 1;
+    }
+  }
+  return error(as, "invalid register %%%.*s", (int) length, as->p);
+}
+
+/* Parses a memory operand: an optional displacement followed by the
+   base register in parentheses. */
+static int parseMemory(assembler_t *as, statement_t *st) {
+
+  skipSpace(as);
+  st->symbol = NULL;
+  st->value = 0;
+  if (as->p < as->end && *as->p != '(' && !parseValue(as, st))
+    return 0;
+  return expect(as, '(') && parseRegister(as, &st->rB) && expect(as, ')');
+}
+
+static statement_t *newStatement(assembler_t *as, statement_kind_t kind) {
+
+  statement_t *st;
+
+  if (as->numStatements == as->capacity)
+  {
+    uint64_t capacity = as->capacity ? 2 * as->capacity : 4096;
+    statement_t *bigger = realloc(as->statements, capacity * sizeof(statement_t));
+    if (!bigger)
+    {
+      error(as, "out of memory");
+      return NULL;
+    }
+    as->statements = bigger;
+    as->capacity = capacity;
+  }
+
+  st = &as->statements[as->numStatements++];
+  memset(st, 0, sizeof(*st));
+  st->kind = kind;
+  st->address = as->address;
+  st->line = as->line;
+  st->rA = st->rB = R_NONE;
+  return st;
+}
+
+static int parseDirective(assembler_t *as, const char *name, size_t length) {
+
+  statement_t *st;
+  uint64_t value;
+
+  if (length == 4 && memcmp(name, ".pos", 4) == 0)
+  {
+    if (!parseNumber(as, &value))
+      return 0;
+    as->address = value;
+  }
+  else if (length == 6 && memcmp(name, ".align", 6) == 0)
+  {
+    if (!parseNumber(as, &value))
+      return 0;
+    if (!value)
+      return error(as, "invalid alignment");
+    as->address = (as->address + value - 1) / value * value;
+  }
+  else if (length == 5 && memcmp(name, ".quad", 5) == 0)
+  {
+    if (!(st = newStatement(as, ST_QUAD)) || !parseValue(as, st))
+      return 0;
+    as->address += 8;
+  }
+  else
+    return error(as, "unknown directive %.*s", (int) length, name);
+  return 1;
+}
+
+static int parseInstruction(assembler_t *as, const char *name, size_t length) {
+
+  const mnemonic_t *mnemonic = findMnemonic(as, name, length);
+  statement_t *st;
+
+  if (!mnemonic)
+    return error(as, "unknown instruction %.*s", (int) length, name);
+  if (!(st = newStatement(as, ST_INSTRUCTION)))
+    return 0;
+  st->icode = mnemonic->icode;
+  st->ifun = mnemonic->ifun;
+
+  switch (st->icode)
+  {
+  case I_RRMVXX:
+  case I_OPQ:
+    if (!parseRegister(as, &st->rA) || !expect(as, ',') ||
+	!parseRegister(as, &st->rB))
+      return 0;
+    break;
+  case I_IRMOVQ:
+    if (!parseValue(as, st) || !expect(as, ',') || !parseRegister(as, &st->rB))
+      return 0;
+    break;
+  case I_RMMOVQ:
+    if (!parseRegister(as, &st->rA) || !expect(as, ',') || !parseMemory(as, st))
+      return 0;
+    break;
+  case I_MRMOVQ:
+    if (!parseMemory(as, st) || !expect(as, ',') || !parseRegister(as, &st->rA))
+      return 0;
+    break;
+  case I_JXX:
+  case I_CALL:
+    if (!parseValue(as, st))
+      return 0;
+    break;
+  case I_PUSHQ:
+  case I_POPQ:
+    if (!parseRegister(as, &st->rA))
+      return 0;
+    break;
+  default:
+    break;
+  }
+
+  as->address += decodeTable[st->icode << 4 | st->ifun].length;
+  return 1;
+}
+
+/* First pass over one line: defines its labels and records the
+   statement it contains, if any. */
+static int parseLine(assembler_t *as) {
+
+  size_t length;
+
+  while (1)
+  {
+    skipSpace(as);
+    length = identifierLength(as);
+    if (!length)
+      break;
+
+    const char *name = as->p;
+    as->p += length;
+    skipSpace(as);
+    if (as->p < as->end && *as->p == ':')
+    {
+      as->p++;
+      if (!defineSymbol(as, name, length))
+	return 0;
+      continue;
+    }
+
+    if (!(*name == '.' ? parseDirective(as, name, length) :
+	  parseInstruction(as, name, length)))
+      return 0;
+    break;
+  }
+
+  if (as->address > as->maxAddress)
+    as->maxAddress = as->address;
+
+  skipSpace(as);
+  if (as->p != as->end)
+    return error(as, "unexpected '%.*s'", (int) (as->end - as->p), as->p);
+  return 1;
+}
+
+static inline void storeQuadLE(uint8_t *p, uint64_t value) {
+
+  for (int i = 0; i < 8; i++, value >>= 8)
+    p[i] = value;
+}
+
+/* Second pass over one statement: resolves its label and writes its
+   bytes to the image. */
+static int emitStatement(assembler_t *as, statement_t *st) {
+
+  y86_program_t *program = as->program;
+  uint8_t *p = program->image + st->address;
+
+  if (st->symbol)
+  {
+    uint64_t slot = symbolSlot(program, st->symbol, st->symbolLength);
+    if (!program->symbols[slot])
+    {
+      as->line = st->line;
+      return error(as, "undefined label %.*s", (int) st->symbolLength,
+		   st->symbol);
+    }
+    st->value = program->symbols[slot]->address;
+  }
+
+  if (st->kind == ST_QUAD)
+  {
+    storeQuadLE(p, st->value);
+    return 1;
+  }
+
+  const y86_decode_entry_t *entry = &decodeTable[st->icode << 4 | st->ifun];
+  p[0] = st->icode << 4 | st->ifun;
+  if (entry->regOffset)
+    p[1] = st->rA << 4 | st->rB;
+  if (entry->valCOffset)
+    storeQuadLE(p + entry->valCOffset, st->value);
+  return 1;
+}
+
+static int compareSymbolAddresses(const void *a, const void *b) {
+
+  const y86_symbol_t *sa = *(y86_symbol_t * const *) a;
+  const y86_symbol_t *sb = *(y86_symbol_t * const *) b;
+
+  if (sa->address != sb->address)
+    return sa->address < sb->address ? -1 : 1;
+  return sa->line < sb->line ? -1 : sa->line > sb->line;
+}
+
+static int compareLines(const void *a, const void *b) {
+
+  const y86_line_t *la = a, *lb = b;
+
+  if (la->address != lb->address)
+    return la->address < lb->address ? -1 : 1;
+  return la->line < lb->line ? -1 : la->line > lb->line;
+}
+
+/* Builds the address-ordered views of the symbols and statements. */
+static int buildMaps(assembler_t *as) {
+
+  y86_program_t *program = as->program;
+  uint64_t n = 0;
+  int sorted = 1;
+
+  program->byAddress = malloc((program->numSymbols + 1) * sizeof(y86_symbol_t *));
+  program->lines = malloc((as->numStatements + 1) * sizeof(y86_line_t));
+  if (!program->byAddress || !program->lines)
+    return error(as, "out of memory");
+
+  for (uint64_t i = 0; i < program->symbolCapacity; i++)
+  {
+    if (program->symbols[i])
+      program->byAddress[n++] = program->symbols[i];
+  }
+  qsort(program->byAddress, n, sizeof(y86_symbol_t *), compareSymbolAddresses);
+
+  for (uint64_t i = 0; i < as->numStatements; i++)
+  {
+    program->lines[i].address = as->statements[i].address;
+    program->lines[i].line = as->statements[i].line;
+    if (i && program->lines[i].address < program->lines[i - 1].address)
+      sorted = 0;
+  }
+  program->numLines = as->numStatements;
+  if (!sorted)
+    qsort(program->lines, program->numLines, sizeof(y86_line_t), compareLines);
+  return 1;
+}
+
+/* Assembles length bytes of Y86-64 source into program, which must be
+   zero-initialized. fileName is only used in error messages. The image
+   extends up to the last byte emitted or position reached with .pos,
+   .align or a label, whichever is highest. Returns 1 in case of
+   success, or 0 with a message in program->error. In both cases the
+   program must be released with programFree. */
+int assemble(const char *fileName, const char *source, size_t length,
+	     y86_program_t *program) {
+
+  assembler_t as;
+  const char *lineStart = source, *sourceEnd = source + length;
+  int ok = 1;
+
+  memset(&as, 0, sizeof(as));
+  as.fileName = fileName;
+  as.program = program;
+  initMnemonics(&as);
+
+  program->symbolCapacity = INITIAL_SYMBOLS;
+  program->symbols = calloc(program->symbolCapacity, sizeof(y86_symbol_t *));
+  if (!program->symbols)
+    return error(&as, "out of memory");
+
+  // First pass: addresses of labels and statements
+  while (ok && lineStart < sourceEnd)
+  {
+    const char *lineEnd = memchr(lineStart, '\n', sourceEnd - lineStart);
+    const char *comment;
+
+    if (!lineEnd)
+      lineEnd = sourceEnd;
+    comment = memchr(lineStart, '#', lineEnd - lineStart);
+
+    as.line++;
+    as.p = lineStart;
+    as.end = comment ? comment : lineEnd;
+    ok = parseLine(&as);
+    lineStart = lineEnd + 1;
+  }
+
+  for (uint64_t i = 0; ok && i < as.numStatements; i++)
+  {
+    statement_t *st = &as.statements[i];
+    uint64_t stEnd = st->address + (st->kind == ST_QUAD ? 8 :
+				    decodeTable[st->icode << 4 | st->ifun].length);
+    if (stEnd < st->address || stEnd > ASM_MAX_IMAGE)
+    {
+      as.line = st->line;
+      ok = error(&as, "address 0x%lx is too large", st->address);
+    }
+    else if (stEnd > as.maxAddress)
+      as.maxAddress = stEnd;
+  }
+  if (ok && as.maxAddress > ASM_MAX_IMAGE)
+    ok = error(&as, "image is too large (0x%lx bytes)", as.maxAddress);
+
+  // Second pass: resolve labels and emit the image
+  if (ok)
+  {
+    program->size = as.maxAddress;
+    program->image = calloc(program->size ? program->size : 1, 1);
+    if (!program->image)
+      ok = error(&as, "out of memory");
+  }
+  for (uint64_t i = 0; ok && i < as.numStatements; i++)
+    ok = emitStatement(&as, &as.statements[i]);
+
+  if (ok)
+    ok = buildMaps(&as);
+
+  free(as.statements);
+  return ok;
+}
+
+/* Reads and assembles the specified file. Returns the same as
+   assemble. */
+int assembleFile(const char *fileName, y86_program_t *program) {
+
+  struct stat st;
+  char *source;
+  int fd, ok;
+
+  fd = open(fileName, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0)
+  {
+    snprintf(program->error, ASM_MAX_ERROR, "%s: %s", fileName, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return 0;
+  }
+
+  if (st.st_size == 0)
+  {
+    close(fd);
+    return assemble(fileName, "", 0, program);
+  }
+
+  source = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (source == MAP_FAILED)
+  {
+    snprintf(program->error, ASM_MAX_ERROR, "%s: %s", fileName, strerror(errno));
+    return 0;
+  }
+
+  ok = assemble(fileName, source, st.st_size, program);
+  munmap(source, st.st_size);
+  return ok;
+}
+
+void programFree(y86_program_t *program) {
+
+  while (program->arena)
+  {
+    arena_block_t *next = program->arena->next;
+    free(program->arena);
+    program->arena = next;
+  }
+  free(program->image);
+  free(program->symbols);
+  free(program->byAddress);
+  free(program->lines);
+  memset(program, 0, sizeof(*program));
+}
+
+/* Returns the symbol with the specified name, or NULL if there is
+   none. */
+const y86_symbol_t *symbolLookup(const y86_program_t *program, const char *name) {
+
+  if (!program->symbols)
+    return NULL;
+  return program->symbols[symbolSlot(program, name, strlen(name))];
+}
+
+/* Returns the first symbol defined at address, or NULL if there is
+   none. */
+const y86_symbol_t *symbolAt(const y86_program_t *program, uint64_t address) {
+
+  uint64_t low = 0, high = program->numSymbols;
+
+  if (!program->byAddress)
+    return NULL;
+  while (low < high)
+  {
+    uint64_t middle = low + (high - low) / 2;
+    if (program->byAddress[middle]->address < address)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low < program->numSymbols && program->byAddress[low]->address == address ?
+    program->byAddress[low] : NULL;
+}
+
+/* Returns the source line of the last statement at or before address,
+   or 0 if there is none. */
+uint64_t lineAt(const y86_program_t *program, uint64_t address) {
+
+  uint64_t low = 0, high = program->numLines;
+
+  while (low < high)
+  {
+    uint64_t middle = low + (high - low) / 2;
+    if (program->lines[middle].address <= address)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low ? program->lines[low - 1].line : 0;
+}
+
+/* Parses a location named in a command: a register (%rax), or a
+   quad-word in memory at a label of program or an address in hex.
+   Stores the register in *reg, R_NONE for memory, and the address in
+   *address. Returns 1 in case of success, or 0 if name is none of
+   those. */
+int parseLocation(const y86_program_t *program, const char *name, int *reg,
+		  uint64_t *address) {
+
+  const y86_symbol_t *symbol;
+  char *end;
+
+  *reg = R_NONE;
+  *address = 0;
+  for (int r = R_RAX; r < R_NONE; r++)
+    if (strcasecmp(name, registerName(r)) == 0)
+    {
+      *reg = r;
+      return 1;
+    }
+
+  if ((symbol = symbolLookup(program, name)))
+  {
+    *address = symbol->address;
+    return 1;
+  }
+
+  errno = 0;
+  *address = strtoull(name, &end, 16);
+  return !errno && end != name && !*end;
+}
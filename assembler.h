@@ -0,0 +1,70 @@
+/* This file contains the prototypes and constants needed to use the
+   Y86-64 assembler defined in assembler.c
+*/
+
+#ifndef _ASSEMBLER_H_
+#define _ASSEMBLER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ASM_MAX_ERROR 256
+
+/* Memory for symbols, handed out in large blocks and released all at
+   once. */
+typedef struct arena_block {
+  struct arena_block *next;
+  size_t              used;
+  size_t              size;
+  char                data[];
+} arena_block_t;
+
+typedef struct y86_symbol {
+  uint64_t    address;
+  uint32_t    line;
+  uint32_t    length;
+  const char *name;     // NUL-terminated, allocated in the arena
+} y86_symbol_t;
+
+/* Source line of the statement emitted at address. */
+typedef struct y86_line {
+  uint64_t address;
+  uint64_t line;
+} y86_line_t;
+
+/* Result of assembling a source file: the memory image, the symbol
+   table and the line map. */
+typedef struct y86_program {
+
+  uint8_t  *image;
+  uint64_t  size;
+
+  arena_block_t *arena;
+
+  // Open-addressing hash table of symbols, by name
+  y86_symbol_t **symbols;
+  uint64_t       symbolCapacity;
+  uint64_t       numSymbols;
+  // The same symbols, ordered by address
+  y86_symbol_t **byAddress;
+
+  // One entry per statement that emits bytes, ordered by address
+  y86_line_t *lines;
+  uint64_t    numLines;
+
+  char error[ASM_MAX_ERROR];
+
+} y86_program_t;
+
+int  assemble(const char *fileName, const char *source, size_t length,
+	      y86_program_t *program);
+int  assembleFile(const char *fileName, y86_program_t *program);
+void programFree(y86_program_t *program);
+
+const y86_symbol_t *symbolLookup(const y86_program_t *program, const char *name);
+const y86_symbol_t *symbolAt(const y86_program_t *program, uint64_t address);
+uint64_t lineAt(const y86_program_t *program, uint64_t address);
+int  parseLocation(const y86_program_t *program, const char *name, int *reg,
+		    uint64_t *address);
+
+#endif /* ASSEMBLER */
@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cache.h"
+
+#define CACHE_INVALID_TAG UINT64_MAX
+
+static int isPowerOfTwo(uint64_t value) {
+
+  return value && !(value & (value - 1));
+}
+
+static unsigned log2Of(uint64_t value) {
+
+  unsigned bits = 0;
+  while (value >>= 1)
+    bits++;
+  return bits;
+}
+
+/* Returns true (non-zero) if the configuration describes a cache that
+   can be simulated: power of two line size and number of sets, at
+   most CACHE_MAX_WAYS ways, and a power of two number of ways for
+   PLRU. */
+int cacheConfigValid(const cache_config_t *config) {
+
+  if (!config->ways || config->ways > CACHE_MAX_WAYS ||
+      !isPowerOfTwo(config->lineSize) || config->lineSize < 8)
+    return 0;
+  if (config->policy == REPL_PLRU && !isPowerOfTwo(config->ways))
+    return 0;
+  if (config->size % ((uint64_t) config->ways * config->lineSize))
+    return 0;
+  return isPowerOfTwo(config->size / config->ways / config->lineSize);
+}
+
+static void freeLevel(cache_level_t *level) {
+
+  free(level->tags);
+  free(level->ages);
+  free(level->plru);
+  level->tags = NULL;
+  level->ages = NULL;
+  level->plru = NULL;
+}
+
+static int initLevel(cache_level_t *level, const cache_config_t *config) {
+
+  memset(level, 0, sizeof(*level));
+  level->config = *config;
+  level->sets = config->size / config->ways / config->lineSize;
+  level->lineShift = log2Of(config->lineSize);
+
+  level->tags = malloc(level->sets * config->ways * sizeof(uint64_t));
+  if (config->policy == REPL_LRU)
+    level->ages = malloc(level->sets * config->ways);
+  else
+    level->plru = malloc(level->sets * sizeof(uint64_t));
+
+  if (!level->tags || (!level->ages && !level->plru))
+  {
+    freeLevel(level);
+    return 0;
+  }
+  return 1;
+}
+
+/* Initializes a cache hierarchy with numLevels levels (L1 first).
+   Configurations must have been validated with cacheConfigValid.
+   Returns 1 in case of success, or 0 if memory could not be
+   allocated. */
+int cacheInit(cache_sim_t *cache, const cache_config_t *configs, int numLevels) {
+
+  memset(cache, 0, sizeof(*cache));
+  if (!pcTableInit(&cache->perPC, NUM_CACHE_PC_COUNTERS))
+    return 0;
+
+  for (int i = 0; i < numLevels; i++)
+  {
+    if (!initLevel(&cache->levels[i], &configs[i]))
+    {
+      cacheFree(cache);
+      return 0;
+    }
+    cache->numLevels++;
+  }
+
+  cacheReset(cache);
+  return 1;
+}
+
+/* Empties all levels and clears the statistics. */
+void cacheReset(cache_sim_t *cache) {
+
+  for (int i = 0; i < cache->numLevels; i++)
+  {
+    cache_level_t *level = &cache->levels[i];
+    uint64_t entries = level->sets * level->config.ways;
+
+    for (uint64_t j = 0; j < entries; j++)
+      level->tags[j] = CACHE_INVALID_TAG;
+    if (level->ages)
+    {
+      for (uint64_t j = 0; j < entries; j++)
+	level->ages[j] = j % level->config.ways;
+    }
+    if (level->plru)
+      memset(level->plru, 0, level->sets * sizeof(uint64_t));
+    level->hits = 0;
+    level->misses = 0;
+  }
+
+  cache->reads = 0;
+  cache->writes = 0;
+  pcTableClear(&cache->perPC);
+}
+
+void cacheFree(cache_sim_t *cache) {
+
+  for (int i = 0; i < cache->numLevels; i++)
+    freeLevel(&cache->levels[i]);
+  cache->numLevels = 0;
+  pcTableFree(&cache->perPC);
+}
+
+/* Marks way as the most recently used in its set. */
+static inline void touch(cache_level_t *level, uint64_t set, unsigned way) {
+
+  unsigned ways = level->config.ways;
+
+  if (level->ages)
+  {
+    uint8_t *ages = level->ages + set * ways;
+    uint8_t age = ages[way];
+    for (unsigned i = 0; i < ways; i++)
+      ages[i] += ages[i] < age;
+    ages[way] = 0;
+  }
+  else
+  {
+    // walk from the root to the leaf, pointing every node away from it
+    uint64_t bits = level->plru[set];
+    unsigned node = 0;
+    for (unsigned depth = log2Of(ways); depth > 0; depth--)
+    {
+      unsigned right = (way >> (depth - 1)) & 1;
+      bits = right ? bits & ~(1ull << node) : bits | (1ull << node);
+      node = 2 * node + 1 + right;
+    }
+    level->plru[set] = bits;
+  }
+}
+
+/* Returns the way to be replaced in the set, preferring empty ways. */
+static inline unsigned victim(cache_level_t *level, uint64_t set) {
+
+  unsigned ways = level->config.ways;
+  uint64_t *tags = level->tags + set * ways;
+
+  for (unsigned i = 0; i < ways; i++)
+  {
+    if (tags[i] == CACHE_INVALID_TAG)
+      return i;
+  }
+
+  if (level->ages)
+  {
+    uint8_t *ages = level->ages + set * ways;
+    for (unsigned i = 0; i < ways; i++)
+    {
+      if (ages[i] == ways - 1)
+	return i;
+    }
+    return 0;
+  }
+  else
+  {
+    // follow the tree bits, which point at the pseudo-LRU side
+    uint64_t bits = level->plru[set];
+    unsigned node = 0, way = 0;
+    for (unsigned depth = log2Of(ways); depth > 0; depth--)
+    {
+      unsigned right = (bits >> node) & 1;
+      way = way << 1 | right;
+      node = 2 * node + 1 + right;
+    }
+    return way;
+  }
+}
+
+/* Looks up one line in one level, filling it on a miss. Returns 1 on
+   a hit, or 0 on a miss. */
+static inline int accessLine(cache_level_t *level, uint64_t line) {
+
+  unsigned ways = level->config.ways;
+  uint64_t set = line & (level->sets - 1);
+  uint64_t *tags = level->tags + set * ways;
+
+  for (unsigned i = 0; i < ways; i++)
+  {
+    if (tags[i] == line)
+    {
+      level->hits++;
+      touch(level, set, i);
+      return 1;
+    }
+  }
+
+  unsigned way = victim(level, set);
+  level->misses++;
+  tags[way] = line;
+  touch(level, set, way);
+  return 0;
+}
+
+/* Simulates an access to the line containing address through the
+   hierarchy (write-allocate, non-inclusive), updating the per-PC
+   counters of pc. */
+static void accessHierarchy(cache_sim_t *cache, uint64_t pc, uint64_t address) {
+
+  uint64_t *counters = pcTableLookup(&cache->perPC, pc);
+  int level;
+
+  for (level = 0; level < cache->numLevels; level++)
+  {
+    cache_level_t *l = &cache->levels[level];
+    if (accessLine(l, address >> l->lineShift))
+      break;
+  }
+
+  if (counters)
+  {
+    counters[CACHE_PC_ACCESSES]++;
+    if (level > 0)
+      counters[CACHE_PC_L1_MISSES]++;
+    if (level > 1)
+      counters[CACHE_PC_L2_MISSES]++;
+  }
+}
+
+/* Simulates one quad-word access made by the instruction at pc. An
+   access that straddles two L1 lines accesses both of them. */
+void cacheAccess(cache_sim_t *cache, uint64_t pc, uint64_t address, int isWrite) {
+
+  unsigned shift = cache->levels[0].lineShift;
+
+  if (isWrite)
+    cache->writes++;
+  else
+    cache->reads++;
+
+  accessHierarchy(cache, pc, address);
+  if ((address >> shift) != ((address + 7) >> shift))
+    accessHierarchy(cache, pc, address + 7);
+}
+
+/* mem_access_hook_t adapter, data is the cache_sim_t. */
+void cacheMemAccessHook(void *data, const y86_instruction_t *instr,
+			uint64_t address, uint64_t value, int isWrite) {
+
+  cacheAccess(data, instr->location, address, isWrite);
+}
+
+static uint64_t missWeight(const uint64_t *counters) {
+
+  return counters[CACHE_PC_L1_MISSES];
+}
+
+/* Prints the hit and miss rates of each level, followed by the (at
+   most) maxPCs instructions with the most L1 misses. */
+int cachePrintReport(FILE *file, cache_sim_t *cache, int maxPCs) {
+
+  int chars = 0;
+
+  chars += fprintf(file, "    # Accesses: %lu reads, %lu writes\n",
+		   cache->reads, cache->writes);
+  for (int i = 0; i < cache->numLevels; i++)
+  {
+    cache_level_t *level = &cache->levels[i];
+    uint64_t total = level->hits + level->misses;
+    chars += fprintf(file, "    # L%d (%lu bytes, %u-way, %u-byte lines, %s): "
+		     "%lu hits, %lu misses, miss rate %.2f%%\n", i + 1,
+		     level->config.size, level->config.ways,
+		     level->config.lineSize,
+		     level->config.policy == REPL_LRU ? "LRU" : "PLRU",
+		     level->hits, level->misses,
+		     total ? 100.0 * level->misses / total : 0.0);
+  }
+
+  uint64_t *slots;
+  uint64_t n = pcTableSort(&cache->perPC, missWeight, &slots);
+  if (!n || maxPCs <= 0)
+  {
+    free(slots);
+    return chars;
+  }
+
+  chars += fprintf(file, "    # %-18s %12s %12s %12s\n",
+		   "PC", "accesses", "L1 misses", "L2 misses");
+  for (uint64_t i = 0; i < n && i < (uint64_t) maxPCs; i++)
+  {
+    uint64_t *counters = pcTableCounters(&cache->perPC, slots[i]);
+    chars += fprintf(file, "    # 0x%-16lx %12lu %12lu %12lu\n",
+		     pcTableKey(&cache->perPC, slots[i]),
+		     counters[CACHE_PC_ACCESSES], counters[CACHE_PC_L1_MISSES],
+		     counters[CACHE_PC_L2_MISSES]);
+  }
+
+  free(slots);
+  return chars;
+}
@@ -0,0 +1,73 @@
+/* This file contains the prototypes and constants needed to use the
+   data cache simulator defined in cache.c
+*/
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "instruction.h"
+#include "pcTable.h"
+
+#define CACHE_MAX_LEVELS 2
+#define CACHE_MAX_WAYS   64
+
+typedef enum replacement_policy {
+  REPL_LRU,  // true least recently used
+  REPL_PLRU  // tree pseudo-LRU, requires a power of two number of ways
+} replacement_policy_t;
+
+typedef struct cache_config {
+  uint64_t             size;     // total capacity in bytes, 0 if disabled
+  unsigned             ways;
+  unsigned             lineSize; // in bytes, a power of two
+  replacement_policy_t policy;
+} cache_config_t;
+
+typedef struct cache_level {
+
+  cache_config_t config;
+
+  uint64_t sets;
+  unsigned lineShift;
+
+  // Tags of set s are tags[s * ways] to tags[s * ways + ways - 1], so a
+  // lookup scans one contiguous run of memory. CACHE_INVALID_TAG marks
+  // empty ways.
+  uint64_t *tags;
+  // LRU: age rank of each way (0 is most recent). PLRU: one tree of
+  // ways - 1 bits per set, stored in the first ways - 1 bits.
+  uint8_t  *ages;
+  uint64_t *plru;
+
+  uint64_t hits;
+  uint64_t misses;
+
+} cache_level_t;
+
+// Per-PC counters kept in cache_sim_t.perPC
+enum { CACHE_PC_ACCESSES, CACHE_PC_L1_MISSES, CACHE_PC_L2_MISSES,
+       NUM_CACHE_PC_COUNTERS };
+
+typedef struct cache_sim {
+
+  int           numLevels;
+  cache_level_t levels[CACHE_MAX_LEVELS];
+  uint64_t      reads;
+  uint64_t      writes;
+  pc_table_t    perPC;
+
+} cache_sim_t;
+
+int  cacheConfigValid(const cache_config_t *config);
+int  cacheInit(cache_sim_t *cache, const cache_config_t *configs, int numLevels);
+void cacheReset(cache_sim_t *cache);
+void cacheFree(cache_sim_t *cache);
+void cacheAccess(cache_sim_t *cache, uint64_t pc, uint64_t address, int isWrite);
+void cacheMemAccessHook(void *data, const y86_instruction_t *instr,
+			uint64_t address, uint64_t value, int isWrite);
+int  cachePrintReport(FILE *file, cache_sim_t *cache, int maxPCs);
+
+#endif /* CACHE */
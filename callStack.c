@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "callStack.h"
+
+#define INITIAL_CAPACITY 64
+
+void callStackInit(call_stack_t *stack) {
+
+  memset(stack, 0, sizeof(*stack));
+}
+
+/* Removes all frames and clears the statistics, keeping the memory
+   allocated for the frames. */
+void callStackClear(call_stack_t *stack) {
+
+  call_frame_t *frames = stack->frames;
+  uint64_t capacity = stack->capacity;
+
+  memset(stack, 0, sizeof(*stack));
+  stack->frames = frames;
+  stack->capacity = capacity;
+}
+
+void callStackFree(call_stack_t *stack) {
+
+  free(stack->frames);
+  callStackInit(stack);
+}
+
+/* Records the frame created by the call instruction just executed. */
+void callStackPush(call_stack_t *stack, const y86_instruction_t *instr,
+		   machine_state_t *state) {
+
+  if (stack->depth == stack->capacity)
+  {
+    uint64_t capacity = stack->capacity ? 2 * stack->capacity : INITIAL_CAPACITY;
+    call_frame_t *frames = realloc(stack->frames, capacity * sizeof(call_frame_t));
+    if (!frames)
+    {
+      stack->droppedFrames++;
+      return;
+    }
+    stack->frames = frames;
+    stack->capacity = capacity;
+  }
+
+  call_frame_t *frame = &stack->frames[stack->depth++];
+  frame->callSite = instr->location;
+  frame->returnAddress = instr->valP;
+  frame->target = instr->valC;
+  frame->entryStack = state->registerFile[R_RSP];
+  frame->minStack = state->registerFile[R_RSP];
+
+  if (stack->depth > stack->maxDepth)
+    stack->maxDepth = stack->depth;
+}
+
+/* Removes the frame left by the ret instruction just executed. A ret
+   that does not go back to the return address of the top frame (with
+   the stack pointer just above it) is counted as mismatched; if it
+   matches a frame further down, as when unwinding several frames at
+   once, all frames above that one are removed as well. */
+void callStackPop(call_stack_t *stack, const y86_instruction_t *instr,
+		  machine_state_t *state) {
+
+  uint64_t pc = state->programCounter;
+  uint64_t rsp = state->registerFile[R_RSP];
+  uint64_t i = stack->depth;
+
+  if (stack->droppedFrames)
+  {
+    stack->droppedFrames--;
+    return;
+  }
+
+  while (i > 0 && !(stack->frames[i - 1].returnAddress == pc &&
+		    stack->frames[i - 1].entryStack + 8 == rsp))
+    i--;
+
+  if (i != stack->depth || i == 0)
+  {
+    stack->mismatchedReturns++;
+    stack->lastMismatchPC = instr->location;
+    if (i == 0)
+      return;
+  }
+
+  // The stack usage of a frame includes that of the frames it called
+  while (stack->depth >= i)
+  {
+    call_frame_t *frame = &stack->frames[--stack->depth];
+    uint64_t usage = frame->entryStack - frame->minStack + 8;
+
+    if (usage > stack->maxStackUsage)
+      stack->maxStackUsage = usage;
+    if (stack->depth && frame->minStack < stack->frames[stack->depth - 1].minStack)
+      stack->frames[stack->depth - 1].minStack = frame->minStack;
+  }
+}
+
+/* Prints the call stack, innermost frame first. Each line shows the
+   PC the frame is executing (or returning to), the function it
+   belongs to, with its label if program has one there, and how much
+   stack the frame has used so far. */
+int callStackPrint(FILE *file, call_stack_t *stack, machine_state_t *state,
+		   const y86_program_t *program) {
+
+  int chars = 0;
+  uint64_t pc = state->programCounter;
+  uint64_t rsp = state->registerFile[R_RSP];
+
+  for (uint64_t i = stack->depth; i > 0; i--)
+  {
+    call_frame_t *frame = &stack->frames[i - 1];
+    uint64_t minStack = frame->minStack < rsp ? frame->minStack : rsp;
+
+    const y86_symbol_t *symbol = symbolAt(program, frame->target);
+
+    chars += fprintf(file, "    # #%-3lu 0x%lx in 0x%lx%s%s%s (sp = 0x%lx, "
+		     "max stack %lu bytes)\n", stack->depth - i, pc,
+		     frame->target, symbol ? " <" : "", symbol ? symbol->name : "",
+		     symbol ? ">" : "", frame->entryStack,
+		     frame->entryStack - minStack + 8);
+    pc = frame->callSite;
+    rsp = minStack;
+  }
+  chars += fprintf(file, "    # #%-3lu 0x%lx in <entry>\n", stack->depth, pc);
+
+  if (stack->droppedFrames)
+    chars += fprintf(file, "    # %lu frames not recorded (out of memory)\n",
+		     stack->droppedFrames);
+  chars += fprintf(file, "    # Max depth %lu, max stack usage %lu bytes, "
+		   "%lu mismatched returns", stack->maxDepth,
+		   stack->maxStackUsage, stack->mismatchedReturns);
+  if (stack->mismatchedReturns)
+    chars += fprintf(file, " (last at PC = 0x%lx)", stack->lastMismatchPC);
+  chars += fprintf(file, "\n");
+  return chars;
+}
@@ -0,0 +1,62 @@
+/* This file contains the prototypes and constants needed to use the
+   shadow call stack defined in callStack.c
+*/
+
+#ifndef _CALLSTACK_H_
+#define _CALLSTACK_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "instruction.h"
+#include "assembler.h"
+
+typedef struct call_frame {
+  uint64_t callSite;      // PC of the call instruction
+  uint64_t returnAddress; // valP of the call instruction
+  uint64_t target;        // address of the called function
+  uint64_t entryStack;    // %rsp on entry, pointing at the return address
+  uint64_t minStack;      // lowest %rsp seen while the frame was active
+} call_frame_t;
+
+/* Shadow call stack, maintained on every call and ret executed. Frames
+   are kept in a growable array, so pushes and pops are O(1). */
+typedef struct call_stack {
+
+  call_frame_t *frames;
+  uint64_t      depth;
+  uint64_t      capacity;
+
+  uint64_t maxDepth;
+  uint64_t maxStackUsage;     // deepest stack usage of any frame, in bytes
+  uint64_t mismatchedReturns; // ret that did not go back to the top call
+  uint64_t lastMismatchPC;
+  uint64_t droppedFrames;     // calls not recorded for lack of memory
+
+} call_stack_t;
+
+void callStackInit(call_stack_t *stack);
+void callStackClear(call_stack_t *stack);
+void callStackFree(call_stack_t *stack);
+void callStackPush(call_stack_t *stack, const y86_instruction_t *instr,
+		   machine_state_t *state);
+void callStackPop(call_stack_t *stack, const y86_instruction_t *instr,
+		  machine_state_t *state);
+int  callStackPrint(FILE *file, call_stack_t *stack, machine_state_t *state,
+		     const y86_program_t *program);
+
+/* Updates the shadow stack after instr was executed successfully. */
+static inline void callStackRecord(call_stack_t *stack,
+				   const y86_instruction_t *instr,
+				   machine_state_t *state) {
+
+  if (instr->icode == I_CALL)
+    callStackPush(stack, instr, state);
+  else if (instr->icode == I_RET)
+    callStackPop(stack, instr, state);
+  else if (stack->depth &&
+	   state->registerFile[R_RSP] < stack->frames[stack->depth - 1].minStack)
+    stack->frames[stack->depth - 1].minStack = state->registerFile[R_RSP];
+}
+
+#endif /* CALLSTACK */
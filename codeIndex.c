@@ -0,0 +1,468 @@
+#define _POSIX_C_SOURCE 200809L // fstat, mmap
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "codeIndex.h"
+
+/* An address where a block starts, found while decoding, with the
+   flags it gets. */
+typedef struct leader {
+  uint64_t address;
+  uint8_t  flags;
+} leader_t;
+
+/* Growing arrays used while building an index. */
+typedef struct index_builder {
+  code_index_record_t *records;
+  uint64_t             numRecords, recordCapacity;
+  leader_t            *leaders;
+  uint64_t             numLeaders, leaderCapacity;
+  uint64_t            *pending;      // addresses left to decode from
+  uint64_t             numPending, pendingCapacity;
+  uint8_t             *decoded;      // one bit per address
+} index_builder_t;
+
+/* Makes room for one more element of size bytes in *array, holding
+   count of capacity. Returns 1 in case of success, or 0 if memory could
+   not be allocated. */
+static int reserve(void **array, uint64_t count, uint64_t *capacity,
+		   size_t size) {
+
+  void *grown;
+
+  if (count < *capacity)
+    return 1;
+  grown = realloc(*array, (*capacity ? 2 * *capacity : 1024) * size);
+  if (!grown)
+    return 0;
+  *array = grown;
+  *capacity = *capacity ? 2 * *capacity : 1024;
+  return 1;
+}
+
+static int addLeader(index_builder_t *b, uint64_t address, uint8_t flags,
+		     int decode) {
+
+  if (!reserve((void **) &b->leaders, b->numLeaders, &b->leaderCapacity,
+	       sizeof(leader_t)))
+    return 0;
+  b->leaders[b->numLeaders].address = address;
+  b->leaders[b->numLeaders++].flags = flags;
+  if (!decode)
+    return 1;
+  if (!reserve((void **) &b->pending, b->numPending, &b->pendingCapacity,
+	       sizeof(uint64_t)))
+    return 0;
+  b->pending[b->numPending++] = address;
+  return 1;
+}
+
+/* Decodes every instruction reachable from the entry point of state,
+   following jumps and calls, but not returns. Returns 1 in case of
+   success, or 0 if memory could not be allocated. */
+static int decodeReachable(index_builder_t *b, machine_state_t *state) {
+
+  uint64_t pc = state->programCounter, size = state->programSize;
+  y86_instruction_t instr;
+  int result = addLeader(b, pc, INDEX_BLOCK | INDEX_FUNCTION, 1);
+
+  while (result && b->numPending > 0)
+  {
+    uint64_t address = b->pending[--b->numPending];
+    int falls = 1;
+
+    while (falls && result && address < size)
+    {
+      if (b->decoded[address >> 3] >> (address & 7) & 1)
+      {
+	// Joins code decoded before, which starts a block there
+	result = addLeader(b, address, INDEX_BLOCK, 0);
+	break;
+      }
+
+      state->programCounter = address;
+      fetchInstruction(state, &instr);
+      if (instr.icode == I_INVALID || instr.icode == I_TOO_SHORT)
+	break;
+      if (!reserve((void **) &b->records, b->numRecords, &b->recordCapacity,
+		   sizeof(code_index_record_t)))
+      {
+	result = 0;
+	break;
+      }
+      b->decoded[address >> 3] |= 1 << (address & 7);
+
+      code_index_record_t *record = &b->records[b->numRecords++];
+      memset(record, 0, sizeof(*record));
+      record->address = address;
+      record->valC = instr.valC;
+      record->icode = instr.icode;
+      record->ifun = instr.ifun;
+      record->rA = instr.rA;
+      record->rB = instr.rB;
+      record->length = instr.valP - address;
+
+      switch (instr.icode)
+      {
+      case I_JXX:
+	result = addLeader(b, instr.valC, INDEX_BLOCK | INDEX_TARGET, 1);
+	falls = instr.ifun != C_NC;
+	if (falls && result)
+	  result = addLeader(b, instr.valP, INDEX_BLOCK, 0);
+	break;
+      case I_CALL:
+	result = addLeader(b, instr.valC, INDEX_BLOCK | INDEX_FUNCTION, 1) &&
+	  addLeader(b, instr.valP, INDEX_BLOCK, 0);
+	break;
+      case I_RET:
+      case I_HALT:
+	falls = 0;
+	break;
+      default:
+	break;
+      }
+      address = instr.valP;
+    }
+  }
+
+  state->programCounter = pc;
+  return result;
+}
+
+static int compareRecords(const void *a, const void *b) {
+
+  uint64_t x = ((const code_index_record_t *) a)->address;
+  uint64_t y = ((const code_index_record_t *) b)->address;
+  return x < y ? -1 : x > y;
+}
+
+static int64_t findRecord(const code_index_record_t *records, uint64_t count,
+			  uint64_t address) {
+
+  uint64_t low = 0, high = count;
+
+  while (low < high)
+  {
+    uint64_t middle = low + (high - low) / 2;
+    if (records[middle].address < address)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low < count && records[low].address == address ? (int64_t) low : -1;
+}
+
+/* Points the fields of index into its memory, laid out as a file. */
+static void layOut(code_index_t *index) {
+
+  index->header = index->memory;
+  index->records = (code_index_record_t *) (index->header + 1);
+  index->blocks = (code_index_block_t *) (index->records +
+					  index->header->numRecords);
+  index->functions = (uint64_t *) (index->blocks + index->header->numBlocks);
+}
+
+/* Builds the index of state's memory into index->memory. Returns 1 in
+   case of success, or 0 if memory could not be allocated. */
+static int build(code_index_t *index, machine_state_t *state, uint64_t hash) {
+
+  index_builder_t b;
+  code_index_header_t header;
+  uint64_t numBlocks = 0, numFunctions = 0;
+  int result;
+
+  memset(&b, 0, sizeof(b));
+  b.decoded = calloc(state->programSize / 8 + 1, 1);
+  result = b.decoded && decodeReachable(&b, state);
+  free(b.decoded);
+  free(b.pending);
+
+  if (result)
+  {
+    qsort(b.records, b.numRecords, sizeof(code_index_record_t), compareRecords);
+    for (uint64_t i = 0; i < b.numLeaders; i++)
+    {
+      int64_t r = findRecord(b.records, b.numRecords, b.leaders[i].address);
+      if (r >= 0)
+	b.records[r].flags |= b.leaders[i].flags;
+    }
+
+    // A block also starts after a gap, or after a jump, call, ret or
+    // halt
+    for (uint64_t i = 0; i < b.numRecords; i++)
+    {
+      code_index_record_t *record = &b.records[i], *previous = record - 1;
+      if (i == 0 || previous->address + previous->length != record->address ||
+	  previous->icode == I_JXX || previous->icode == I_CALL ||
+	  previous->icode == I_RET || previous->icode == I_HALT)
+	record->flags |= INDEX_BLOCK;
+      numBlocks += record->flags & INDEX_BLOCK;
+      numFunctions += (record->flags & INDEX_FUNCTION) != 0;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CODE_INDEX_MAGIC, sizeof(header.magic));
+    header.imageSize = state->programSize;
+    header.imageHash = hash;
+    header.entry = state->programCounter;
+    header.numRecords = b.numRecords;
+    header.numBlocks = numBlocks;
+    header.numFunctions = numFunctions;
+
+    index->size = sizeof(header) + b.numRecords * sizeof(code_index_record_t) +
+      numBlocks * sizeof(code_index_block_t) + numFunctions * sizeof(uint64_t);
+    index->memory = malloc(index->size);
+    result = index->memory != NULL;
+  }
+
+  if (result)
+  {
+    code_index_block_t *block = NULL;
+    uint64_t function = 0;
+
+    memcpy(index->memory, &header, sizeof(header));
+    layOut(index);
+    if (b.numRecords)
+      memcpy(index->records, b.records,
+	     b.numRecords * sizeof(code_index_record_t));
+    for (uint64_t i = 0; i < b.numRecords; i++)
+    {
+      const code_index_record_t *record = &index->records[i];
+      if (record->flags & INDEX_BLOCK)
+      {
+	block = block ? block + 1 : index->blocks;
+	block->start = record->address;
+	block->first = i;
+	block->count = 0;
+      }
+      block->end = record->address + record->length;
+      block->count++;
+      if (record->flags & INDEX_FUNCTION)
+	index->functions[function++] = record->address;
+    }
+  }
+
+  free(b.records);
+  free(b.leaders);
+  return result;
+}
+
+/* Returns 1 if the records, blocks and functions laid out in index are
+   consistent with each other and with an image of imageSize bytes, so
+   that they can be used as indices and addresses, or 0 otherwise. */
+static int checkContents(const code_index_t *index, uint64_t imageSize) {
+
+  const code_index_header_t *header = index->header;
+
+  for (uint64_t i = 0; i < header->numRecords; i++)
+  {
+    const code_index_record_t *record = &index->records[i];
+    if (record->address >= imageSize || record->length == 0 ||
+	record->length > imageSize - record->address ||
+	(i && record->address <= index->records[i - 1].address) ||
+	record->icode > I_POPQ || record->ifun > 0xF ||
+	record->rA > R_NONE || record->rB > R_NONE)
+      return 0;
+  }
+
+  for (uint64_t i = 0; i < header->numBlocks; i++)
+  {
+    const code_index_block_t *block = &index->blocks[i];
+    if (block->count == 0 || block->first >= header->numRecords ||
+	block->count > header->numRecords - block->first ||
+	block->start != index->records[block->first].address ||
+	block->start >= block->end || block->end > imageSize ||
+	(i && block->start <= index->blocks[i - 1].start))
+      return 0;
+  }
+
+  for (uint64_t i = 0; i < header->numFunctions; i++)
+  {
+    if (index->functions[i] >= imageSize ||
+	(i && index->functions[i] <= index->functions[i - 1]))
+      return 0;
+  }
+  return 1;
+}
+
+/* Maps the index in fileName, if it describes the image of the given
+   size and hash with the given entry point. Returns 1 in case of
+   success, or 0 if there is no such index or its contents are not
+   consistent. */
+static int load(code_index_t *index, const char *fileName, uint64_t imageSize,
+		uint64_t hash, uint64_t entry) {
+
+  const code_index_header_t *header;
+  struct stat st;
+  void *memory;
+  int fd = open(fileName, O_RDONLY), valid;
+
+  if (fd < 0)
+    return 0;
+  if (fstat(fd, &st) < 0 || (uint64_t) st.st_size < sizeof(code_index_header_t))
+  {
+    close(fd);
+    return 0;
+  }
+  memory = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED)
+    return 0;
+
+  header = memory;
+  valid = memcmp(header->magic, CODE_INDEX_MAGIC, sizeof(header->magic)) == 0 &&
+    header->imageSize == imageSize && header->imageHash == hash &&
+    header->entry == entry &&
+    header->numRecords <= st.st_size / sizeof(code_index_record_t) &&
+    header->numBlocks <= st.st_size / sizeof(code_index_block_t) &&
+    header->numFunctions <= st.st_size / sizeof(uint64_t) &&
+    sizeof(code_index_header_t) +
+    header->numRecords * sizeof(code_index_record_t) +
+    header->numBlocks * sizeof(code_index_block_t) +
+    header->numFunctions * sizeof(uint64_t) == (uint64_t) st.st_size;
+  if (!valid)
+  {
+    munmap(memory, st.st_size);
+    return 0;
+  }
+
+  index->memory = memory;
+  index->size = st.st_size;
+  index->mapped = 1;
+  layOut(index);
+  if (!checkContents(index, imageSize))
+  {
+    munmap(memory, st.st_size);
+    memset(index, 0, sizeof(*index));
+    return 0;
+  }
+  return 1;
+}
+
+/* Writes the index to a temporary file renamed to fileName, so that a
+   reader never sees a partial index. Returns 1 in case of success, or 0
+   with errno set. */
+static int save(const code_index_t *index, const char *fileName) {
+
+  size_t length = strlen(fileName);
+  char *tempName = malloc(length + 5);
+  FILE *file;
+  int result;
+
+  if (!tempName)
+    return 0;
+  memcpy(tempName, fileName, length);
+  memcpy(tempName + length, ".tmp", 5);
+
+  if (!(file = fopen(tempName, "wb")))
+  {
+    free(tempName);
+    return 0;
+  }
+  result = fwrite(index->memory, 1, index->size, file) == index->size;
+  result = fclose(file) == 0 && result;
+  if (result)
+    result = rename(tempName, fileName) == 0;
+  if (!result)
+    remove(tempName);
+  free(tempName);
+  return result;
+}
+
+/* Opens the index of state's memory, starting at its program counter,
+   kept in fileName: maps it if it is up to date, or builds it and
+   writes it there for later sessions. If it cannot be written, it is
+   still used, and index->error says why. Returns 1 in case of success,
+   or 0 if memory could not be allocated. */
+int codeIndexOpen(code_index_t *index, const char *fileName,
+		  machine_state_t *state) {
+
+  uint64_t hash = state->imageHash;
+
+  memset(index, 0, sizeof(*index));
+  if (load(index, fileName, state->programSize, hash, state->programCounter))
+    return 1;
+
+  if (!build(index, state, hash))
+  {
+    index->header = NULL;
+    return 0;
+  }
+  index->built = 1;
+
+  if (!save(index, fileName))
+  {
+    snprintf(index->error, CODE_INDEX_MAX_ERROR, "Failed to write %s: %s",
+	     fileName, strerror(errno));
+    return 1;
+  }
+
+  // Use the file, as later sessions will, rather than a private copy
+  code_index_t mapped;
+  memset(&mapped, 0, sizeof(mapped));
+  if (load(&mapped, fileName, state->programSize, hash, state->programCounter))
+  {
+    free(index->memory);
+    mapped.built = 1;
+    *index = mapped;
+  }
+  return 1;
+}
+
+void codeIndexFree(code_index_t *index) {
+
+  if (index->mapped)
+    munmap(index->memory, index->size);
+  else
+    free(index->memory);
+  memset(index, 0, sizeof(*index));
+}
+
+/* Returns the position in index->records of the instruction at
+   address, or -1 if none was reached there. */
+int64_t codeIndexFind(const code_index_t *index, uint64_t address) {
+
+  return findRecord(index->records, index->header->numRecords, address);
+}
+
+/* Returns the block holding the instruction at address, or NULL if
+   none was reached there. */
+const code_index_block_t *codeIndexBlock(const code_index_t *index,
+					 uint64_t address) {
+
+  uint64_t low = 0, high = index->header->numBlocks;
+
+  while (low < high)
+  {
+    uint64_t middle = low + (high - low) / 2;
+    if (index->blocks[middle].start <= address)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  if (low == 0 || address >= index->blocks[low - 1].end ||
+      codeIndexFind(index, address) < 0)
+    return NULL;
+  return &index->blocks[low - 1];
+}
+
+/* Fills in instr from record, as fetchInstruction would. */
+void codeIndexInstruction(const code_index_record_t *record,
+			  y86_instruction_t *instr) {
+
+  instr->icode = record->icode;
+  instr->ifun = record->ifun;
+  instr->rA = record->rA;
+  instr->rB = record->rB;
+  instr->valC = record->valC;
+  instr->location = record->address;
+  instr->valP = record->address + record->length;
+}
@@ -0,0 +1,82 @@
+/* This file contains the prototypes and constants needed to use the
+   decode and control flow index defined in codeIndex.c
+*/
+
+#ifndef _CODEINDEX_H_
+#define _CODEINDEX_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "instruction.h"
+
+#define CODE_INDEX_MAGIC     "Y86IDX01"
+#define CODE_INDEX_MAX_ERROR 256
+
+// Flags of an instruction in code_index_record_t
+#define INDEX_BLOCK    0x1 // starts a basic block
+#define INDEX_FUNCTION 0x2 // the entry point, or the target of a call
+#define INDEX_TARGET   0x4 // the target of a jump
+
+/* An instruction reached from the entry point, as decoded. */
+typedef struct code_index_record {
+  uint64_t address;
+  uint64_t valC;
+  uint8_t  icode;
+  uint8_t  ifun;
+  uint8_t  rA;
+  uint8_t  rB;
+  uint8_t  length;
+  uint8_t  flags;
+  uint8_t  unused[2];
+} code_index_record_t;
+
+/* A basic block: the instructions in [start, end), which are
+   count records from first. */
+typedef struct code_index_block {
+  uint64_t start;
+  uint64_t end;
+  uint64_t first;
+  uint64_t count;
+} code_index_block_t;
+
+/* Header of an index file, followed by the records, the blocks and the
+   addresses of the functions, each in increasing order of address.
+   Values are stored in the host's byte order. The index is only used
+   for the image it was built from: the same size, contents (by hash)
+   and entry point. */
+typedef struct code_index_header {
+  char     magic[8];
+  uint64_t imageSize;
+  uint64_t imageHash;
+  uint64_t entry;
+  uint64_t numRecords;
+  uint64_t numBlocks;
+  uint64_t numFunctions;
+} code_index_header_t;
+
+/* An index in memory, laid out as in its file. */
+typedef struct code_index {
+  code_index_header_t *header;      // NULL if there is no index
+  code_index_record_t *records;
+  code_index_block_t  *blocks;
+  uint64_t            *functions;
+  void                *memory;
+  size_t               size;
+  int                  mapped;      // memory is mapped from the file
+  int                  built;       // built during this session, not loaded
+
+  char error[CODE_INDEX_MAX_ERROR]; // why the file could not be written
+
+} code_index_t;
+
+int      codeIndexOpen(code_index_t *index, const char *fileName,
+		       machine_state_t *state);
+void     codeIndexFree(code_index_t *index);
+int64_t  codeIndexFind(const code_index_t *index, uint64_t address);
+const code_index_block_t *codeIndexBlock(const code_index_t *index,
+					 uint64_t address);
+void     codeIndexInstruction(const code_index_record_t *record,
+			      y86_instruction_t *instr);
+
+#endif /* CODEINDEX */
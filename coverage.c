@@ -0,0 +1,260 @@
+#define _POSIX_C_SOURCE 200809L // pread, pwrite
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "coverage.h"
+
+/* Header of a coverage file. Values are stored in the host's byte
+   order. It is followed by the blocks of the map that were written,
+   each as the address of its first flag (a multiple of
+   SPARSE_BLOCK_SIZE) and SPARSE_BLOCK_SIZE flag bytes, or fewer for
+   the block that the image ends in. */
+typedef struct coverage_header {
+  char     magic[8];
+  uint64_t size;
+  uint64_t imageHash;
+} coverage_header_t;
+
+/* Sets up an empty map for an image of size bytes, with execution
+   starting at pc. Returns 1 in case of success, or 0 if memory could
+   not be allocated. */
+int coverageInit(coverage_t *cov, uint64_t size, uint64_t pc) {
+
+  cov->size = size;
+  cov->blockStart = pc;
+  return sparseTableInit(&cov->map, size, 1);
+}
+
+void coverageReset(coverage_t *cov, uint64_t pc) {
+
+  sparseTableClear(&cov->map);
+  cov->blockStart = pc;
+}
+
+void coverageFree(coverage_t *cov) {
+
+  sparseTableFree(&cov->map);
+  cov->size = 0;
+}
+
+/* Marks the instructions from start as executed, up to the end of the
+   block or end, whichever comes first. */
+static void markBlock(coverage_t *cov, machine_state_t *state, uint64_t start,
+		      uint64_t end) {
+
+  y86_instruction_t instr;
+  uint64_t pc = state->programCounter;
+
+  if (end > cov->size)
+    end = cov->size;
+  state->programCounter = start;
+  while (state->programCounter < end)
+  {
+    fetchInstruction(state, &instr);
+    if (instr.icode == I_INVALID || instr.icode == I_TOO_SHORT)
+      break;
+    coverageMark(cov, instr.location, COV_EXECUTED);
+    if (COV_BLOCK_END_MASK >> instr.icode & 1)
+      break;
+    state->programCounter = instr.valP;
+  }
+  state->programCounter = pc;
+}
+
+/* Marks the instructions of every block recorded so far as executed,
+   decoding them from the current image, and those of the block being
+   executed up to the current program counter. A halt there counts as
+   executed, since running stops before it. */
+void coverageExpand(coverage_t *cov, machine_state_t *state) {
+
+  for (uint64_t block = 0; block < cov->map.numBlocks; block++)
+  {
+    const uint8_t *map = cov->map.blocks[block];
+
+    for (uint64_t i = 0; map && i < SPARSE_BLOCK_SIZE; i++)
+      if (map[i] & COV_BLOCK)
+	markBlock(cov, state, (block << SPARSE_BLOCK_SHIFT) + i, cov->size);
+  }
+  if (state->programCounter >= cov->blockStart)
+    markBlock(cov, state, cov->blockStart, state->programCounter +
+	      (state->programCounter < cov->size &&
+	       state->programMap[state->programCounter] == (I_HALT << 4)));
+}
+
+/* Returns the number of flags in the block of the map starting at
+   address. */
+static uint64_t blockLength(const coverage_t *cov, uint64_t address) {
+
+  return cov->size - address < SPARSE_BLOCK_SIZE ? cov->size - address :
+    SPARSE_BLOCK_SIZE;
+}
+
+/* Writes the map to a file, to be merged later into a map of the image
+   with the specified hash, see imageHash(). Returns 1 in case of
+   success, or 0 with errno set. */
+int coverageSave(const char *fileName, coverage_t *cov, uint64_t imageHash) {
+
+  coverage_header_t header;
+  uint64_t offset;
+  int fd, ok;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, COVERAGE_MAGIC, sizeof(header.magic));
+  header.size = cov->size;
+  header.imageHash = imageHash;
+
+  fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return 0;
+  ok = pwrite(fd, &header, sizeof(header), 0) == sizeof(header);
+  offset = sizeof(header);
+  for (uint64_t block = 0; ok && block < cov->map.numBlocks; block++)
+  {
+    uint64_t address = block << SPARSE_BLOCK_SHIFT;
+    uint64_t length = blockLength(cov, address);
+
+    if (!cov->map.blocks[block])
+      continue;
+    ok = pwrite(fd, &address, sizeof(address), offset) == sizeof(address) &&
+      pwrite(fd, cov->map.blocks[block], length, offset + sizeof(address)) ==
+      (ssize_t) length;
+    offset += sizeof(address) + length;
+  }
+  if (close(fd) != 0)
+    ok = 0;
+  return ok;
+}
+
+/* ORs the map saved in a file, for the same image (by size and
+   imageHash), into cov. Returns 1 in case of success, or 0 with errno
+   set, EINVAL if the file is not a coverage map of this image. */
+int coverageMerge(const char *fileName, coverage_t *cov, uint64_t imageHash) {
+
+  coverage_header_t header;
+  uint8_t buffer[SPARSE_BLOCK_SIZE];
+  uint64_t offset = sizeof(header), address;
+  ssize_t got;
+  int fd = open(fileName, O_RDONLY);
+
+  if (fd < 0)
+    return 0;
+  if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+      memcmp(header.magic, COVERAGE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.size != cov->size || header.imageHash != imageHash)
+  {
+    close(fd);
+    errno = EINVAL;
+    return 0;
+  }
+
+  while ((got = pread(fd, &address, sizeof(address), offset)) == sizeof(address))
+  {
+    uint64_t length = address < cov->size ? blockLength(cov, address) : 0;
+
+    if (!length || address % SPARSE_BLOCK_SIZE ||
+	(got = pread(fd, buffer, length, offset + sizeof(address))) != (ssize_t) length)
+      break;
+    for (uint64_t i = 0; i < length; i++)
+      if (buffer[i])
+	coverageMark(cov, address + i, buffer[i]);
+    offset += sizeof(address) + length;
+  }
+
+  // Stops at the end of the file, or at a record that is cut short or
+  // not within the image
+  if (got != 0)
+  {
+    int error = got < 0 ? errno : EINVAL;
+    close(fd);
+    errno = error;
+    return 0;
+  }
+  close(fd);
+  return 1;
+}
+
+/* Prints the number of instructions and blocks executed, the jxx
+   instructions taken in one or both directions and, for an assembled
+   program, the statements executed. coverageExpand must be called
+   first. */
+int coveragePrintReport(FILE *file, coverage_t *cov, const y86_program_t *program) {
+
+  uint64_t executed = 0, blocks = 0, taken = 0, notTaken = 0, both = 0;
+  int chars = 0;
+
+  for (uint64_t block = 0; block < cov->map.numBlocks; block++)
+  {
+    const uint8_t *map = cov->map.blocks[block];
+
+    for (uint64_t i = 0; map && i < SPARSE_BLOCK_SIZE; i++)
+    {
+      uint8_t flags = map[i];
+      executed += (flags & COV_EXECUTED) != 0;
+      blocks += (flags & COV_BLOCK) != 0;
+      taken += (flags & (COV_TAKEN | COV_NOT_TAKEN)) == COV_TAKEN;
+      notTaken += (flags & (COV_TAKEN | COV_NOT_TAKEN)) == COV_NOT_TAKEN;
+      both += (flags & (COV_TAKEN | COV_NOT_TAKEN)) == (COV_TAKEN | COV_NOT_TAKEN);
+    }
+  }
+
+  chars += fprintf(file, "    # Instructions executed: %lu, blocks: %lu\n",
+		   executed, blocks);
+  chars += fprintf(file, "    # Conditional jumps: %lu both ways, %lu only taken, "
+		   "%lu only not taken\n", both, taken, notTaken);
+
+  if (program && program->numLines)
+  {
+    uint64_t covered = 0;
+    for (uint64_t i = 0; i < program->numLines; i++)
+    {
+      uint64_t address = program->lines[i].address;
+      covered += (coverageFlags(cov, address) & COV_EXECUTED) != 0;
+    }
+    chars += fprintf(file, "    # Source statements executed: %lu of %lu\n",
+		     covered, program->numLines);
+  }
+  return chars;
+}
+
+/* Writes the coverage in CSV: one line per statement of an assembled
+   program if program has a line map, otherwise one line per executed
+   address. coverageExpand must be called first. Returns a negative
+   value in case of error. */
+int coverageExport(FILE *file, coverage_t *cov, const y86_program_t *program) {
+
+  if (program && program->numLines)
+  {
+    if (fprintf(file, "line,address,executed,taken,not_taken\n") < 0)
+      return -1;
+    for (uint64_t i = 0; i < program->numLines; i++)
+    {
+      uint64_t address = program->lines[i].address;
+      uint8_t flags = coverageFlags(cov, address);
+      if (fprintf(file, "%lu,0x%lx,%d,%d,%d\n", program->lines[i].line, address,
+		  (flags & COV_EXECUTED) != 0, (flags & COV_TAKEN) != 0,
+		  (flags & COV_NOT_TAKEN) != 0) < 0)
+	return -1;
+    }
+    return 0;
+  }
+
+  if (fprintf(file, "address,executed,taken,not_taken\n") < 0)
+    return -1;
+  for (uint64_t block = 0; block < cov->map.numBlocks; block++)
+  {
+    const uint8_t *map = cov->map.blocks[block];
+
+    for (uint64_t i = 0; map && i < SPARSE_BLOCK_SIZE; i++)
+      if ((map[i] & COV_EXECUTED) &&
+	  fprintf(file, "0x%lx,1,%d,%d\n", (block << SPARSE_BLOCK_SHIFT) + i,
+		  (map[i] & COV_TAKEN) != 0, (map[i] & COV_NOT_TAKEN) != 0) < 0)
+	return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,87 @@
+/* This file contains the prototypes and constants needed to use the
+   code coverage collector defined in coverage.c
+*/
+
+#ifndef _COVERAGE_H_
+#define _COVERAGE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "instruction.h"
+#include "assembler.h"
+#include "sparseTable.h"
+
+#define COVERAGE_MAGIC "Y86COV03"
+
+// Flags kept for each address of the image in coverage_t.map
+#define COV_BLOCK     0x1 // a basic block starting here ran to its end
+#define COV_EXECUTED  0x2 // the instruction here was executed
+#define COV_TAKEN     0x4 // the jxx here was taken
+#define COV_NOT_TAKEN 0x8 // the jxx here was not taken
+
+// Instructions that end a basic block
+#define COV_BLOCK_END_MASK \
+  (1 << I_HALT | 1 << I_JXX | 1 << I_CALL | 1 << I_RET)
+
+/* Coverage flags for every address of the image. While recording, only
+   the start of each block is marked, when the block ends, together
+   with the direction of a jxx that ends it; coverageExpand marks the
+   instructions in the blocks before the flags are reported. Maps of the
+   same image are merged with bitwise OR. The map is sparse, so that it
+   only uses memory where code runs. */
+typedef struct coverage {
+  sparse_table_t map;    // no blocks until coverageInit
+  uint64_t       size;
+  uint64_t       blockStart; // start of the block being executed
+} coverage_t;
+
+int  coverageInit(coverage_t *cov, uint64_t size, uint64_t pc);
+void coverageReset(coverage_t *cov, uint64_t pc);
+void coverageFree(coverage_t *cov);
+void coverageExpand(coverage_t *cov, machine_state_t *state);
+int  coverageSave(const char *fileName, coverage_t *cov, uint64_t imageHash);
+int  coverageMerge(const char *fileName, coverage_t *cov, uint64_t imageHash);
+int  coveragePrintReport(FILE *file, coverage_t *cov, const y86_program_t *program);
+int  coverageExport(FILE *file, coverage_t *cov, const y86_program_t *program);
+
+/* Returns the flags of address, 0 beyond the image. */
+static inline uint8_t coverageFlags(const coverage_t *cov, uint64_t address) {
+
+  const uint8_t *flags = address < cov->size ? sparseTableFind(&cov->map, address) : NULL;
+
+  return flags ? *flags : 0;
+}
+
+/* ORs flags into those of address, in the image. Flags that cannot be
+   stored for lack of memory are dropped. */
+static inline void coverageMark(coverage_t *cov, uint64_t address, uint8_t flags) {
+
+  uint8_t *entry = sparseTableGet(&cov->map, address);
+
+  if (entry)
+    *entry |= flags;
+}
+
+/* Restarts the current block at pc, after the program counter was
+   changed other than by executing an instruction. */
+static inline void coverageResync(coverage_t *cov, uint64_t pc) {
+  cov->blockStart = pc;
+}
+
+/* Updates the coverage after instr was executed successfully, nextPC
+   being the new program counter: marks the block if instr ends it. */
+static inline void coverageRecord(coverage_t *cov, y86_instruction_t *instr,
+				  uint64_t nextPC) {
+
+  if (!(COV_BLOCK_END_MASK >> instr->icode & 1))
+    return;
+
+  if (cov->blockStart < cov->size)
+    coverageMark(cov, cov->blockStart, COV_BLOCK);
+  if (instr->icode == I_JXX)
+    coverageMark(cov, instr->location, nextPC == instr->valC ? COV_TAKEN : COV_NOT_TAKEN);
+  cov->blockStart = nextPC;
+}
+
+#endif /* COVERAGE */
@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 200809L // sigaction, clock_gettime
+
 #include <stdio.h>
 #include <fcntl.h>
 #include <sys/types.h>
@@ -11,19 +13,223 @@
 #include <errno.h>
 #include <string.h>
 #include <strings.h>
+#include <ctype.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <setjmp.h>
 
 #include "instruction.h"
 #include "printRoutines.h"
+#include "pipeline.h"
+#include "cache.h"
+#include "callStack.h"
+#include "memSearch.h"
+#include "snapshot.h"
+#include "gdbServer.h"
+#include "forkServer.h"
+#include "loops.h"
+#include "memStats.h"
+#include "assembler.h"
+#include "coverage.h"
+#include "lanes.h"
+#include "opcodeStats.h"
+#include "guardMemory.h"
+#include "telemetry.h"
+#include "segments.h"
+#include "taint.h"
+#include "codeIndex.h"
+#include "eventStream.h"
 
 #define ERROR_RETURN -1
 #define SUCCESS 0
 
 #define MAX_LINE 256
 
+// Number of instructions between checks for an interrupt in
+// runUntilStop, which also publishes its progress at that rate.
+#define RUN_CHECK_INTERVAL 4096
+
+// Interval between progress updates while running, in milliseconds.
+#define RUN_PROGRESS_INTERVAL 500
+
+// Size of the buffer of stdout when telemetry is written to files, which
+// holds the output of a command until it is done, so that writing it is
+// timed apart from handling it.
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
 static void addBreakpoint(uint64_t address);
 static void deleteBreakpoint(uint64_t address);
 static void deleteAllBreakpoints(void);
 static int  hasBreakpoint(uint64_t address);
+static uint64_t listBreakpoints(uint64_t **addresses);
+static int  stepMachine(machine_state_t *state, y86_instruction_t *instr);
+static int  singleStep(machine_state_t *state, y86_instruction_t *instr);
+static stop_reason_t runUntilStop(machine_state_t *state, y86_instruction_t *instr);
+static stop_reason_t runInBackground(machine_state_t *state,
+				     y86_instruction_t *instr);
+static stop_reason_t gdbStep(machine_state_t *state, y86_instruction_t *instr);
+static stop_reason_t gdbResume(machine_state_t *state, y86_instruction_t *instr,
+			       int (*interrupted)(void *data), void *data);
+static stop_reason_t forkRun(machine_state_t *state, y86_instruction_t *instr,
+			     uint64_t *executed);
+static int  parseSize(const char *string, uint64_t *size);
+static int  parseTelemetryFile(const char *string);
+static int  isAssemblySource(const char *fileName);
+static int  loadImage(const char *fileName, machine_state_t *state, int *fd);
+static int  loadSegments(machine_state_t *state);
+static void openCodeIndex(const char *imageName, machine_state_t *state);
+static int  imageFile(y86_program_t *program);
+static int  hashImage(machine_state_t *state);
+static uint64_t parseAddress(const char *string);
+static uint64_t validLength(machine_state_t *state, uint64_t address,
+			    uint64_t length);
+static void cyclesCommand(char *command, char *parameters);
+static void findCommand(machine_state_t *state, char *command, char *parameters);
+static void cacheCommand(machine_state_t *state, char *command, char *parameters);
+static void loopsCommand(char *command, char *parameters);
+static void coverageCommand(machine_state_t *state, char *command,
+			    char *parameters);
+static void memStatsCommand(machine_state_t *state, char *command,
+			    char *parameters);
+static void sweepCommand(machine_state_t *state, char *command, char *parameters);
+static void statsCommand(machine_state_t *state, char *command, char *parameters);
+static void eventsCommand(char *command, char *parameters);
+static void taintCommand(machine_state_t *state, char *command, char *parameters);
+static void disassembleCommand(machine_state_t *state, char *command,
+			       char *parameters);
+static void indexCommand(char *command, char *parameters);
+static void commandDone(void);
+static int  telemetryCaches(machine_state_t *state, telemetry_cache_t *caches);
+
+// One-shot internal breakpoint planted by next when stepping over a
+// call: the run stops when the program counter reaches address with the
+// stack pointer at or above minStack, i.e., back in the caller's frame.
+static struct {
+  int      active;
+  uint64_t address;
+  uint64_t minStack;
+} stepOut;
+
+// Set by finish: the run stops after a ret that leaves the stack
+// pointer above finishStack, i.e., that returns from the current frame.
+static int      finishActive = 0;
+static uint64_t finishStack;
+
+// Set by the SIGINT handler while a run is in progress; runUntilStop
+// stops at its next check.
+static volatile sig_atomic_t stopRequested = 0;
+
+// Set by the GDB server while it continues: the run also stops when
+// runInterrupted(runInterruptedData) returns 1 at one of its checks.
+static int  (*runInterrupted)(void *data) = NULL;
+static void  *runInterruptedData;
+
+// Progress of the current run, published by runUntilStop every
+// RUN_CHECK_INTERVAL instructions, for the progress display.
+static struct {
+  uint64_t instructions;
+  uint64_t programCounter;
+} runProgress;
+
+// Limits on the length of a single run (0 for no limit), set with
+// --max-instructions and --max-seconds. run N overrides the limit on
+// instructions for one run.
+static struct {
+  uint64_t instructions;
+  double   seconds;
+} runLimits;
+
+// Set by runUntilStop when a data access traps with guard-page memory
+// (--guard-pages), for the report of the run.
+static struct {
+  int      trapped;
+  uint64_t address;
+} memoryTrap;
+
+// Whether memory is set up with guard pages instead of bounds checks.
+static int guardPagesEnabled = 0;
+
+// Files loaded at guest addresses (--segment, --manifest), instead of
+// a single image file whose offset 0 is address 0.
+static segment_map_t segments;
+
+// The single image file, otherwise, kept open to revert written pages
+// and to hash the image when a file saved for it needs the hash.
+static int imageFd = -1;
+static int imageHashed = 0;
+
+// Shadow call stack, maintained by stepMachine.
+static call_stack_t callStack;
+
+// Optional PIPE timing model, fed by stepMachine while enabled.
+static pipeline_model_t pipeline;
+static int pipelineEnabled = 0;
+
+// Optional loop detector, fed by stepMachine while enabled.
+static loop_stats_t loops;
+static int loopsEnabled = 0;
+
+// Optional code coverage, fed by stepMachine while enabled.
+static coverage_t coverage;
+static int coverageEnabled = 0;
+
+// Optional taint tracking, fed by stepMachine while enabled.
+static taint_state_t taint;
+static int taintEnabled = 0;
+
+// Optional data cache simulator, fed through a memory access hook
+// while enabled. Defaults to a 32 KB L1 and a 256 KB L2.
+static cache_sim_t cache;
+static int cacheEnabled = 0;
+static cache_config_t cacheConfigs[CACHE_MAX_LEVELS] = {
+  {32 * 1024, 8, 64, REPL_LRU},
+  {256 * 1024, 8, 64, REPL_LRU}
+};
+static int cacheLevels = 2;
+
+// Optional per-region memory access counters, fed through a memory
+// access hook while enabled.
+static mem_stats_t memStats;
+static int memStatsEnabled = 0;
+
+// Optional counts of opcode pairs and triples, and of the
+// superinstructions executed, reported at exit (--stats opcode-pairs).
+static opcode_stats_t opcodeStats;
+static int opcodeStatsEnabled = 0;
+
+// Files the telemetry is written to at exit, by format (--stats
+// FORMAT:FILE), or NULL.
+static const char *telemetryFiles[TELEMETRY_PROMETHEUS + 1];
+
+// Start of the command being handled, for telemetry, or 0 between
+// commands. Runs started by the command add their time to
+// commandRunSeconds, which does not count as handling the command.
+static double commandStarted = 0;
+static double commandRunSeconds;
+
+// Calls to hasBreakpoint by the current run, added to the thread's
+// telemetry when it stops (counted here as the check is on the
+// run's hot path).
+static __thread uint64_t breakpointChecks;
+
+// Whether runs execute superinstructions (see fetchFused), unless
+// --no-fusion is given.
+static int fusionEnabled = 1;
+
+// Symbols and line map of the program, if it was assembled from a .ys
+// source.
+static y86_program_t program;
+
+// Decoded instructions, blocks and functions of the image, kept in a
+// file next to it, if --index is given.
+static code_index_t codeIndex;
+static int indexEnabled = 0;
+
+// Optional stream of the instructions executed, published by
+// stepMachine to shared memory for other processes, with --events.
+static event_stream_t events;
+static int eventsEnabled = 0;
 
 struct Node *head = NULL;
 
@@ -36,89 +242,217 @@ struct Node
 int main(int argc, char **argv)
 {
 
-  int fd;
-  struct stat st;
 
   machine_state_t state;
   y86_instruction_t nextInstruction;
   memset(&state, 0, sizeof(state));
 
   char line[MAX_LINE + 1], previousLine[MAX_LINE + 1] = "";
-  char *command, *parameters;
-  int c;
+  char *command, *parameters, *end;
+  int c, status = SUCCESS;
 
-  // Verify that the command line has an appropriate number of
-  // arguments
-  if (argc < 2 || argc > 3) {
-    fprintf(stderr, "Usage: %s InputFilename [startingPC]\n", argv[0]);
-    return ERROR_RETURN;
-  }
-
-  // First argument is the file to read, attempt to open it for
-  // reading and verify that the open did occur.
-  fd = open(argv[1], O_RDONLY);
+  int argi = 1;
+  const char *gdbEndpoint = NULL;
+  const char *forkAddress = NULL;
+  const char *eventsName = NULL;
 
-  if (fd < 0) {
-    fprintf(stderr, "Failed to open %s: %s\n", argv[1], strerror(errno));
-    return ERROR_RETURN;
+  // Options come before the input file
+  while (argi < argc && strncmp(argv[argi], "--", 2) == 0) {
+    if (strcmp(argv[argi], "--gdb-server") == 0 && argi + 1 < argc) {
+      gdbEndpoint = argv[argi + 1];
+      argi += 2;
+    }
+    else if (strcmp(argv[argi], "--fork-server") == 0 && argi + 1 < argc) {
+      forkAddress = argv[argi + 1];
+      argi += 2;
+    }
+    else if (strcmp(argv[argi], "--stats") == 0 && argi + 1 < argc &&
+	     strcmp(argv[argi + 1], "opcode-pairs") == 0) {
+      opcodeStatsEnabled = 1;
+      argi += 2;
+    }
+    else if (strcmp(argv[argi], "--stats") == 0 && argi + 1 < argc &&
+	     parseTelemetryFile(argv[argi + 1])) {
+      argi += 2;
+    }
+    else if (strcmp(argv[argi], "--segment") == 0 && argi + 1 < argc) {
+      if (!segmentsAdd(&segments, argv[argi + 1])) {
+	fprintf(stderr, "%s\n", segments.error);
+	return ERROR_RETURN;
+      }
+      argi += 2;
+    }
+    else if (strcmp(argv[argi], "--manifest") == 0 && argi + 1 < argc) {
+      if (!segmentsReadManifest(&segments, argv[argi + 1])) {
+	fprintf(stderr, "%s\n", segments.error);
+	return ERROR_RETURN;
+      }
+      argi += 2;
+    }
+    else if (strcmp(argv[argi], "--no-fusion") == 0) {
+      fusionEnabled = 0;
+      argi++;
+    }
+    else if (strcmp(argv[argi], "--guard-pages") == 0) {
+      guardPagesEnabled = 1;
+      argi++;
+    }
+    else if (strcmp(argv[argi], "--index") == 0) {
+      indexEnabled = 1;
+      argi++;
+    }
+    else if (strcmp(argv[argi], "--events") == 0 && argi + 1 < argc) {
+      eventsName = argv[argi + 1];
+      argi += 2;
+    }
+    else if (strcmp(argv[argi], "--max-instructions") == 0 && argi + 1 < argc &&
+	     parseSize(argv[argi + 1], &runLimits.instructions)) {
+      argi += 2;
+    }
+    else if (strcmp(argv[argi], "--max-seconds") == 0 && argi + 1 < argc &&
+	     (runLimits.seconds = strtod(argv[argi + 1], &end)) >= 0 &&
+	     end != argv[argi + 1] && !*end) {
+      argi += 2;
+    }
+    else {
+      argi = argc;
+    }
   }
 
-  if (fstat(fd, &st) < 0) {
-    fprintf(stderr, "Failed to stat %s: %s\n", argv[1], strerror(errno));
-    close(fd);
+  // Verify that the command line has an appropriate number of
+  // arguments, one less with segments instead of an input file
+  if (argc - argi < !segments.numSegments ||
+      argc - argi > 2 - !!segments.numSegments) {
+    fprintf(stderr, "Usage: %s [--gdb-server PORT|PATH] [--fork-server PC] "
+	    "[--max-instructions N] [--max-seconds S] "
+	    "[--stats opcode-pairs|text:FILE|json:FILE|prometheus:FILE] "
+	    "[--no-fusion] [--guard-pages] [--index] [--events NAME] "
+	    "InputFilename [startingPC]\n"
+	    "       %s [options] {--segment FILE@BASE[:PERMS] | --manifest FILE}... "
+	    "[startingPC]\n", argv[0], argv[0]);
+    segmentsFree(&segments, &state);
     return ERROR_RETURN;
   }
 
-  state.programSize = st.st_size;
+  // Telemetry written to files times the output of each command apart,
+  // so output is then written when each command is done, see commandDone
+  if (telemetryFiles[TELEMETRY_TEXT] || telemetryFiles[TELEMETRY_JSON] ||
+      telemetryFiles[TELEMETRY_PROMETHEUS])
+    setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+
+  // Memory is either the image in the input file, or segments
+  const char *imageName = segments.numSegments ? NULL : argv[argi++];
+  if (imageName ? !loadImage(imageName, &state, &imageFd) : !loadSegments(&state))
+    return ERROR_RETURN;
 
-  // If there is a 2nd argument present it is an offset so convert it
+  // If there is another argument present it is an offset so convert it
   // to a numeric value.
-  if (3 <= argc) {
+  if (argi < argc) {
     errno = 0;
-    state.programCounter = strtoul(argv[2], NULL, 0);
+    state.programCounter = strtoul(argv[argi], NULL, 0);
     if (errno != 0) {
       perror("Invalid program counter on command line");
-      close(fd);
       return ERROR_RETURN;
     }
     if (state.programCounter > state.programSize) {
       fprintf(stderr, "Program counter on command line (%lu) "
 	      "larger than file size (%lu).\n",
 	      state.programCounter, state.programSize);
-      close(fd);
       return ERROR_RETURN;
     }
   }
 
-  // Maps the entire file to memory. This is equivalent to reading the
-  // entire file using functions like fread, but the data is only
-  // retrieved on demand, i.e., when the specific region of the file
-  // is needed.
-  state.programMap = mmap(NULL, state.programSize, PROT_READ | PROT_WRITE,
-			  MAP_PRIVATE, fd, 0);
-  if (state.programMap == MAP_FAILED) {
-    fprintf(stderr, "Failed to map %s: %s\n", argv[1], strerror(errno));
-    close(fd);
-    return ERROR_RETURN;
+  // Track written pages, so that snapshots only need to save those.
+  // Without the bitmap everything else still works.
+  state.dirtyPages = dirtyPagesAlloc(state.programSize);
+
+  // Likewise, runs fall back to one instruction at a time without the
+  // superinstruction cache
+  if (fusionEnabled)
+    fuseCacheInit(&state);
+
+  if (opcodeStatsEnabled && !opcodeStatsInit(&opcodeStats)) {
+    fprintf(stderr, "Not enough memory for opcode statistics\n");
+    opcodeStatsEnabled = 0;
   }
 
   // Move to first non-zero byte
   while (!state.programMap[state.programCounter]) state.programCounter++;
 
-  printf("# Opened %s, starting PC 0x%lX\n", argv[1], state.programCounter);
+  if (segments.numSegments)
+    printf("# Loaded %d segments, starting PC 0x%lX\n", segments.numSegments,
+	   state.programCounter);
+  else
+    printf("# Opened %s, starting PC 0x%lX\n", imageName, state.programCounter);
+
+  if (indexEnabled)
+    openCodeIndex(imageName, &state);
+
+  // Without the stream, the program is debugged as usual
+  if (eventsName) {
+    if (eventStreamCreate(&events, eventsName, EVENT_STREAM_CAPACITY))
+      eventsEnabled = 1;
+    else
+      fprintf(stderr, "Event stream not available: %s\n", events.error);
+  }
 
   fetchInstruction(&state, &nextInstruction);
   printInstruction(stdout, &nextInstruction);
 
-  while(1) {
+  if (gdbEndpoint) {
+    gdb_target_t target = {&state, &nextInstruction, gdbStep, gdbResume,
+			   addBreakpoint, deleteBreakpoint};
+    if (!gdbServe(gdbEndpoint, &target)) {
+      fprintf(stderr, "GDB server on %s failed: %s\n", gdbEndpoint,
+	      strerror(errno));
+      status = ERROR_RETURN;
+    }
+  }
+
+  // The fork server runs the program up to its snapshot, then forks a
+  // copy of the process for each request
+  if (forkAddress) {
+    uint64_t address = parseAddress(forkAddress);
+    stop_reason_t reason = STOP_BREAKPOINT;
+
+    if (state.programCounter != address) {
+      addBreakpoint(address);
+      reason = runUntilStop(&state, &nextInstruction);
+      deleteBreakpoint(address);
+    }
+    if (reason != STOP_BREAKPOINT) {
+      fprintf(stderr, "Program stopped at 0x%lx before reaching 0x%lx\n",
+	      state.programCounter, address);
+      status = ERROR_RETURN;
+    }
+    else {
+      fork_target_t target = {&state, &program, forkRun};
+      // Each child would publish from its own copy of the stream's
+      // position, so only the run up to the snapshot is streamed
+      eventsEnabled = 0;
+      printf("# Fork server at PC 0x%lx\n", state.programCounter);
+      if (!forkServe(stdin, stdout, &target))
+	status = ERROR_RETURN;
+    }
+  }
+
+  // Command loop, unless the debugger is driven through the GDB server
+  // or the fork server
+  while(!gdbEndpoint && !forkAddress) {
+
+    commandDone();
 
     // Show prompt, but only if input comes from a terminal
-    if (isatty(STDIN_FILENO))
+    if (isatty(STDIN_FILENO)) {
       printf("> ");
+      fflush(stdout);
+    }
 
     // Read one line, if EOF break loop
     if (!fgets(line, sizeof(line), stdin))
       break;
+    commandStarted = telemetryNow();
+    commandRunSeconds = 0;
 
     // If line could not be read entirely
     if (!strchr(line, '\n')) {
@@ -158,7 +492,7 @@ int main(int argc, char **argv)
       // If the instruction is halt, the program counter remains unmodified.
       // If the instruction is invalid, an error message must be printed
       //  and the program counter remains unmodified.
-      if (executeInstruction(&state, &nextInstruction) == 0)
+      if (singleStep(&state, &nextInstruction) == 0)
       {
         printInstruction(stdout, &nextInstruction);
       }
@@ -170,65 +504,33 @@ int main(int argc, char **argv)
     }
     else if (strcasecmp(command, "RUN") == 0)
     {
-      int validInstruction;
-      validInstruction = executeInstruction(&state, &nextInstruction);
-      if (validInstruction == 0) // invalid instruction
-      {
-        printInstruction(stdout, &nextInstruction);
-        continue;
-      }
-      else
-      {
-        fetchInstruction(&state, &nextInstruction);
-      }
+      // Optional limit on the number of instructions, for this run only
+      uint64_t limit = runLimits.instructions;
 
-      // keep running rest of the instructions
-      while (1)
+      if (parameters && (!parseSize(parameters, &runLimits.instructions) ||
+			 !runLimits.instructions))
       {
-        if ((nextInstruction.icode == I_HALT && nextInstruction.ifun == 0) ||
-            hasBreakpoint(state.programCounter))
-        {
-          printInstruction(stdout, &nextInstruction);
-          break;
-        }
-
-        validInstruction = executeInstruction(&state, &nextInstruction);
-        if (validInstruction == 0) // invalid instruction
-        {
-          printInstruction(stdout, &nextInstruction);
-          break;
-        }
-        else // valid case
-        {
-          fetchInstruction(&state, &nextInstruction);
-        }
+        runLimits.instructions = limit;
+        printErrorInvalidCommand(stdout, command, parameters);
+        continue;
       }
+      runInBackground(&state, &nextInstruction);
+      runLimits.instructions = limit;
+      printInstruction(stdout, &nextInstruction);
     }
     else if (strcasecmp(command, "NEXT") == 0)
     {
       if (nextInstruction.icode == I_CALL)
       {
-        uint64_t saveRegister = state.registerFile[4];
-
-        // Inside the CALL method
-        while ((nextInstruction.icode != I_HALT) && (!hasBreakpoint(state.programCounter)))
-        {
-          if (executeInstruction(&state, &nextInstruction) == 1)
-          { //if successful execution, continue
-            fetchInstruction(&state, &nextInstruction);
-            if (saveRegister == state.registerFile[4])
-            {
-              printInstruction(stdout, &nextInstruction);
-              break;
-            }
-          }
-          else
-          {
-            //if not successful execution, print error
-            printInstruction(stdout, &nextInstruction);
-            break;
-          }
-        }
+        // Run until the call returns to the instruction after it, in
+        // the caller's frame (recursive calls may reach the same
+        // address in a deeper frame first)
+        stepOut.active = 1;
+        stepOut.address = nextInstruction.valP;
+        stepOut.minStack = state.registerFile[R_RSP];
+        runInBackground(&state, &nextInstruction);
+        stepOut.active = 0;
+        printInstruction(stdout, &nextInstruction);
       }
       else
       {
@@ -241,7 +543,7 @@ int main(int argc, char **argv)
         else
         {
           //if successful execution, go to next instruction
-          if (executeInstruction(&state, &nextInstruction) == 1)
+          if (singleStep(&state, &nextInstruction) == 1)
           {
             fetchInstruction(&state, &nextInstruction);
             printInstruction(stdout, &nextInstruction);
@@ -254,6 +556,15 @@ int main(int argc, char **argv)
         }
       }
     }
+    else if (strcasecmp(command, "FINISH") == 0)
+    {
+      // Run until a ret leaves the current frame
+      finishStack = state.registerFile[R_RSP];
+      finishActive = 1;
+      runInBackground(&state, &nextInstruction);
+      finishActive = 0;
+      printInstruction(stdout, &nextInstruction);
+    }
     else if (strcasecmp(command, "JUMP") == 0)
     {
       // parameter is NULL case:
@@ -262,9 +573,10 @@ int main(int argc, char **argv)
         continue;
       }
 
-      uint64_t address = strtoul(parameters, NULL, 16);
+      uint64_t address = parseAddress(parameters);
 
       state.programCounter = address;
+      coverageResync(&coverage, address);
       fetchInstruction(&state, &nextInstruction);
       printInstruction(stdout, &nextInstruction);
     }
@@ -276,7 +588,7 @@ int main(int argc, char **argv)
         continue;
       }
 
-      uint64_t address = strtoul(parameters, NULL, 16);
+      uint64_t address = parseAddress(parameters);
       addBreakpoint(address);
     }
     else if (strcasecmp(command, "DELETE") == 0)
@@ -286,7 +598,7 @@ int main(int argc, char **argv)
         printErrorInvalidCommand(stdout, command, parameters);
         continue;
       }
-      uint64_t address = strtoul(parameters, NULL, 16);
+      uint64_t address = parseAddress(parameters);
       deleteBreakpoint(address);
     }
     else if (strcasecmp(command, "REGISTERS") == 0)
@@ -295,16 +607,200 @@ int main(int argc, char **argv)
       {
         printRegisterValue(stdout, &state, i);
       }
+      printConditionCodes(stdout, &state);
     }
     else if (strcasecmp(command, "EXAMINE") == 0)
     {
-      if(!parameters){
+      char addressString[32], countString[32], unit[8] = "q";
+      uint64_t count;
+
+      if (!parameters || sscanf(parameters, "%31s %31s %7s", addressString,
+				countString, unit) < 1)
+      {
+        printErrorInvalidCommand(stdout, command, parameters);
+        continue;
+      }
+
+      uint64_t address = strtoul(addressString, NULL, 16);
+
+      if (sscanf(parameters, "%*s %31s", countString) < 1)
+      {
+        printMemoryValueQuad(stdout, &state, address);
+        continue;
+      }
+
+      if (!parseSize(countString, &count) || unit[1] ||
+          (tolower(unit[0]) != 'b' && tolower(unit[0]) != 'q'))
+      {
+        printErrorInvalidCommand(stdout, command, parameters);
+        continue;
+      }
+
+      int quads = tolower(unit[0]) == 'q';
+      uint64_t length = quads ? 8 * count : count;
+      uint64_t valid = validLength(&state, address, length);
+
+      // A quad-word that is only partly within memory is not dumped, so
+      // it is the first one reported as invalid
+      if (quads)
+        valid -= valid % 8;
+
+      printMemoryDump(stdout, &state, address, valid, quads, "    # ");
+      if (valid < length)
+        printErrorInvalidMemoryLocation(stdout, NULL, address + valid);
+    }
+    else if (strcasecmp(command, "XDUMP") == 0)
+    {
+      char addressString[32], lengthString[32], fileName[MAX_LINE + 1], mode[8] = "";
+      uint64_t length;
+      long written;
+      FILE *file;
+
+      if (!parameters || sscanf(parameters, "%31s %31s %256s %7s", addressString,
+				lengthString, fileName, mode) < 3 ||
+          !parseSize(lengthString, &length) ||
+          (*mode && strcasecmp(mode, "RAW") != 0))
+      {
+        printErrorInvalidCommand(stdout, command, parameters);
+        continue;
+      }
+
+      uint64_t address = strtoul(addressString, NULL, 16);
+      uint64_t valid = validLength(&state, address, length);
+
+      file = fopen(fileName, "w");
+      if (!file)
+      {
+        printf("    # Failed to open %s: %s\n", fileName, strerror(errno));
+        continue;
+      }
+
+      // Past the end of memory, address does not point into the image
+      if (*mode)
+        written = !valid ||
+          fwrite(state.programMap + address, 1, valid, file) == valid ?
+          (long) valid : -1;
+      else
+        written = printMemoryDump(file, &state, address, valid, 0, "");
+
+      if (fclose(file) != 0 || written < 0)
+        printf("    # Failed to write %s: %s\n", fileName, strerror(errno));
+      else
+        printf("    # Dumped 0x%lx bytes to %s\n", valid, fileName);
+      if (valid < length)
+        printErrorInvalidMemoryLocation(stdout, NULL, address + valid);
+    }
+    else if (strcasecmp(command, "FIND") == 0)
+    {
+      findCommand(&state, command, parameters);
+    }
+    else if (strcasecmp(command, "SAVE") == 0)
+    {
+      uint64_t *breakpoints;
+      uint64_t numBreakpoints;
+
+      if (!parameters)
+      {
+        printErrorInvalidCommand(stdout, command, parameters);
+        continue;
+      }
+
+      numBreakpoints = listBreakpoints(&breakpoints);
+      if (!hashImage(&state) ||
+	  !snapshotSave(parameters, &state, breakpoints, numBreakpoints))
+        printf("    # Failed to save %s: %s\n", parameters, strerror(errno));
+      free(breakpoints);
+    }
+    else if (strcasecmp(command, "RESTORE") == 0)
+    {
+      uint64_t *breakpoints;
+      uint64_t numBreakpoints;
+
+      if (!parameters)
+      {
         printErrorInvalidCommand(stdout, command, parameters);
         continue;
       }
 
-      uint64_t address = strtoul(parameters, NULL, 16);
-      printMemoryValueQuad(stdout, &state, address);
+      if (!hashImage(&state) || !(segments.numSegments ?
+	    snapshotRestore(parameters, &state, segmentsRevert, &segments,
+			    &breakpoints, &numBreakpoints) :
+	    snapshotRestore(parameters, &state, snapshotRevertFile, &imageFd,
+			    &breakpoints, &numBreakpoints)))
+      {
+        printf("    # Failed to restore %s: %s\n", parameters,
+	       errno == EINVAL ? "not a snapshot of this image" : strerror(errno));
+        // Memory may have been partly restored
+        fuseCacheInvalidate(&state);
+        continue;
+      }
+
+      deleteAllBreakpoints();
+      for (uint64_t i = 0; i < numBreakpoints; i++)
+        addBreakpoint(breakpoints[i]);
+      free(breakpoints);
+
+      // Restored pages were not written through memWriteQuadLE
+      fuseCacheInvalidate(&state);
+
+      // The call history leading to the snapshot is not saved
+      callStackClear(&callStack);
+      coverageResync(&coverage, state.programCounter);
+
+      // The labels no longer describe the restored memory
+      if (taint.pages)
+        taintReset(&taint);
+
+      fetchInstruction(&state, &nextInstruction);
+      printInstruction(stdout, &nextInstruction);
+    }
+    else if (strcasecmp(command, "BACKTRACE") == 0 || strcasecmp(command, "BT") == 0)
+    {
+      callStackPrint(stdout, &callStack, &state, &program);
+    }
+    else if (strcasecmp(command, "CYCLES") == 0)
+    {
+      cyclesCommand(command, parameters);
+    }
+    else if (strcasecmp(command, "LOOPS") == 0)
+    {
+      loopsCommand(command, parameters);
+    }
+    else if (strcasecmp(command, "COVERAGE") == 0)
+    {
+      coverageCommand(&state, command, parameters);
+    }
+    else if (strcasecmp(command, "TAINT") == 0)
+    {
+      taintCommand(&state, command, parameters);
+    }
+    else if (strcasecmp(command, "DISASSEMBLE") == 0 || strcasecmp(command, "DISAS") == 0)
+    {
+      disassembleCommand(&state, command, parameters);
+    }
+    else if (strcasecmp(command, "INDEX") == 0)
+    {
+      indexCommand(command, parameters);
+    }
+    else if (strcasecmp(command, "EVENTS") == 0)
+    {
+      eventsCommand(command, parameters);
+    }
+    else if (strcasecmp(command, "MEMSTATS") == 0)
+    {
+      memStatsCommand(&state, command, parameters);
+    }
+    else if (strcasecmp(command, "CACHE") == 0)
+    {
+      cacheCommand(&state, command, parameters);
+    }
+    else if (strcasecmp(command, "SWEEP") == 0)
+    {
+      sweepCommand(&state, command, parameters);
+    }
+    else if (strcasecmp(command, "STATS") == 0)
+    {
+      statsCommand(&state, command, parameters);
     }
     else
     {
@@ -313,64 +809,1647 @@ int main(int argc, char **argv)
     }
   }
 
+  commandDone();
+  if (opcodeStatsEnabled)
+    opcodeStatsPrintReport(stdout, &opcodeStats, 10);
+
+  for (int format = TELEMETRY_TEXT; format <= TELEMETRY_PROMETHEUS; format++) {
+    telemetry_cache_t caches[1 + CACHE_MAX_LEVELS];
+    int numCaches = telemetryCaches(&state, caches);
+    telemetry_t total;
+
+    if (!telemetryFiles[format])
+      continue;
+    telemetryTotal(&total);
+    if (!telemetryWriteFile(telemetryFiles[format], format, &total, caches,
+			    numCaches)) {
+      fprintf(stderr, "Failed to write %s: %s\n", telemetryFiles[format],
+	      strerror(errno));
+      status = ERROR_RETURN;
+    }
+  }
+
   deleteAllBreakpoints();
-  munmap(state.programMap, state.programSize);
-  close(fd);
-  return SUCCESS;
+  pipelineFree(&pipeline);
+  loopStatsFree(&loops);
+  coverageFree(&coverage);
+  taintFree(&taint);
+  memStatsFree(&memStats);
+  cacheFree(&cache);
+  callStackFree(&callStack);
+  opcodeStatsFree(&opcodeStats);
+  codeIndexFree(&codeIndex);
+  eventStreamClose(&events);
+  programFree(&program);
+  fuseCacheFree(&state);
+  free(state.dirtyPages);
+  if (guardPagesEnabled)
+    guardMemoryFree(&state);
+  if (segments.numSegments)
+    segmentsFree(&segments, &state);
+  else if (!guardPagesEnabled)
+    munmap(state.programMap, state.programSize);
+  if (imageFd >= 0)
+    close(imageFd);
+  return status;
 }
 
-/* Adds an address to the list of breakpoints. If the address is
- * already in the list, it is not added again. */
-static void addBreakpoint(uint64_t address) {
+/* Loads the image in fileName as the memory of state: a .ys source is
+ * assembled first. The file is mapped, or with guard pages copied next
+ * to a guard page. Stores its file descriptor in *fd, for snapshots.
+ * Returns 1 in case of success, or 0 after printing an error. */
+static int loadImage(const char *fileName, machine_state_t *state, int *fd) {
 
-  struct Node *temp = head, *prev;
+  struct stat st;
 
-  // Search for address to be added already in list
-  if (temp != NULL && temp->data == address)
-  {
-    return;
+  // Attempt to open the file for reading and verify that the open did
+  // occur. Y86 sources (.ys) are assembled first, and their image read
+  // from a temporary file.
+  if (isAssemblySource(fileName)) {
+    if (!assembleFile(fileName, &program)) {
+      fprintf(stderr, "%s\n", program.error);
+      programFree(&program);
+      return 0;
+    }
+    *fd = imageFile(&program);
   }
-  while (temp != NULL && temp->data != address)
-  {
-    prev = temp;
-    temp = temp->next;
+  else
+    *fd = open(fileName, O_RDONLY);
+
+  if (*fd < 0) {
+    fprintf(stderr, "Failed to open %s: %s\n", fileName, strerror(errno));
+    return 0;
   }
 
-  // If address is not in the list, add breakpoint to list
-  if (temp == NULL)
-  {
-    struct Node *temp = (struct Node *)malloc(sizeof(struct Node));
-    temp->data = address;
-    temp->next = (head);
-    (head) = temp;
+  if (fstat(*fd, &st) < 0) {
+    fprintf(stderr, "Failed to stat %s: %s\n", fileName, strerror(errno));
+    close(*fd);
+    return 0;
   }
 
-  free(temp);
-}
+  state->programSize = st.st_size;
 
-/* Deletes an address from the list of breakpoints. If the address is
- * not in the list, nothing happens. */
-static void deleteBreakpoint(uint64_t address) {
+  // Maps the entire file to memory. This is equivalent to reading the
+  // entire file using functions like fread, but the data is only
+  // retrieved on demand, i.e., when the specific region of the file
+  // is needed.
+  state->programMap = mmap(NULL, state->programSize, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE, *fd, 0);
+  if (state->programMap == MAP_FAILED) {
+    fprintf(stderr, "Failed to map %s: %s\n", fileName, strerror(errno));
+    close(*fd);
+    return 0;
+  }
 
-  struct Node *temp = head, *prev;
+  // With guard pages, memory is copied next to a guard page instead,
+  // and the file's mapping is not needed any more
+  if (guardPagesEnabled) {
+    uint8_t *image = state->programMap;
+    if (guardMemoryInit(state))
+      munmap(image, state->programSize);
+    else {
+      fprintf(stderr, "Guard pages not available, memory accesses are checked: "
+	      "%s\n", strerror(errno));
+      guardPagesEnabled = 0;
+    }
+  }
+  return 1;
+}
 
-  if (temp != NULL && temp->data == address)
-  {
-    head = temp->next;
-    free(temp);
-    return;
+/* Loads the segments given with --segment and --manifest as the memory
+ * of state, and starts at the lowest executable one. Memory already
+ * ends at an inaccessible page, so guard pages need no copy. Returns 1
+ * in case of success, or 0 after printing an error. */
+static int loadSegments(machine_state_t *state) {
+
+  if (!segmentsLoad(&segments, state)) {
+    fprintf(stderr, "%s\n", segments.error);
+    segmentsFree(&segments, state);
+    return 0;
   }
 
-  // Search for address to be deleted
-  while (temp != NULL && temp->data != address)
-  {
-    prev = temp;
-    temp = temp->next;
+  for (int i = segments.numSegments - 1; i >= 0; i--)
+    if (segments.segments[i].perms & PAGE_EXEC)
+      state->programCounter = segments.segments[i].base;
+
+  // Without host protection, writes to read-only segments and reads of
+  // unreadable ones need the checks
+  if (guardPagesEnabled && !(segments.protected && segments.readable)) {
+    fprintf(stderr, "Guard pages not available with these segment permissions, "
+	    "memory accesses are checked\n");
+    guardPagesEnabled = 0;
+  }
+  else if (guardPagesEnabled &&
+	   !guardMemoryAdopt(state, segments.regionSize - state->programSize)) {
+    fprintf(stderr, "Guard pages not available, memory accesses are checked: "
+	    "%s\n", strerror(errno));
+    guardPagesEnabled = 0;
   }
+  return 1;
+}
 
-  // If address is not in the list, nothing happens
-  if (temp == NULL)
-    return;
+/* Makes sure that state->imageHash holds the hash of the image as
+ * loaded, computing it from the image files the first time: only the
+ * files saved for the image (snapshots, coverage maps and the index)
+ * record it, so plain runs never pay for it. Returns 1 in case of
+ * success, or 0 in case of failure with errno set. */
+static int hashImage(machine_state_t *state) {
+
+  if (!imageHashed)
+    imageHashed = segments.numSegments ?
+      segmentsHash(&segments, &state->imageHash) :
+      imageFileHash(imageFd, state->programSize, &state->imageHash);
+  return imageHashed;
+}
+
+/* Opens the index of the image in imageName, kept next to it in
+ * imageName.idx, for the current entry point: the index is mapped if
+ * it is up to date, and otherwise built and written there. */
+static void openCodeIndex(const char *imageName, machine_state_t *state) {
+
+  size_t length;
+  char *indexName;
+
+  if (!imageName) {
+    fprintf(stderr, "No index for segments, only for an input file\n");
+    return;
+  }
+
+  length = strlen(imageName);
+  if (!(indexName = malloc(length + 5))) {
+    fprintf(stderr, "Not enough memory for the index\n");
+    return;
+  }
+  memcpy(indexName, imageName, length);
+  memcpy(indexName + length, ".idx", 5);
+
+  if (!hashImage(state))
+    fprintf(stderr, "Could not read the image for the index: %s\n",
+	    strerror(errno));
+  else if (!codeIndexOpen(&codeIndex, indexName, state))
+    fprintf(stderr, "Not enough memory for the index\n");
+  else {
+    if (*codeIndex.error)
+      fprintf(stderr, "%s\n", codeIndex.error);
+    printf("# %s %s: %lu instructions, %lu blocks, %lu functions\n",
+	   codeIndex.built ? "Built" : "Loaded", indexName,
+	   codeIndex.header->numRecords, codeIndex.header->numBlocks,
+	   codeIndex.header->numFunctions);
+  }
+  free(indexName);
+}
+
+/* Executes one instruction, and accounts for it in the timing model,
+ * loop detector, coverage and opcode statistics if they are enabled.
+ * Returns the value returned by executeInstruction. */
+static int stepMachine(machine_state_t *state, y86_instruction_t *instr) {
+
+  int result;
+
+  if (taintEnabled)
+    taintPrepare(&taint, state, instr);
+  result = executeInstruction(state, instr);
+  if (eventsEnabled)
+    eventStreamRecord(&events, state, instr, result);
+
+  if (taintEnabled && result)
+    taintCommit(&taint);
+  if (result)
+    callStackRecord(&callStack, instr, state);
+  if (pipelineEnabled && result && instr->icode != I_HALT)
+    pipelineRecord(&pipeline, instr, state->programCounter);
+  if (loopsEnabled && result)
+    loopStatsRecord(&loops, instr, state->programCounter, callStack.depth);
+  if (coverageEnabled && result)
+    coverageRecord(&coverage, instr, state->programCounter);
+  if (opcodeStatsEnabled && result)
+    opcodeStatsRecord(&opcodeStats, instr);
+  return result;
+}
+
+/* Executes one instruction outside of a run (step, next, or a single
+ * step through the GDB server), as stepMachine, and counts it in the
+ * telemetry. Runs count their instructions as a whole. */
+static int singleStep(machine_state_t *state, y86_instruction_t *instr) {
+
+  telemetry_t *t = telemetryThread();
+  uint64_t reads = state->dataReads, writes = state->dataWrites;
+  int result = stepMachine(state, instr);
+
+  t->instructions += result && instr->icode != I_HALT;
+  t->memoryReads += state->dataReads - reads;
+  t->memoryWrites += state->dataWrites - writes;
+  return result;
+}
+
+/* Returns 1 if a run must stop at one of the instructions of a
+ * superinstruction after the first, because of a breakpoint or the
+ * target of next. */
+static int stopsInside(const y86_fused_t *fused) {
+
+  for (int i = 1; i < fused->count; i++)
+    if (hasBreakpoint(fused->instr[i].location) ||
+	(stepOut.active && fused->instr[i].location == stepOut.address))
+      return 1;
+  return 0;
+}
+
+static double elapsedSeconds(const struct timespec *start) {
+
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Executes instructions, starting with the current one, until a halt,
+ * an invalid instruction, a breakpoint, the stop condition of next or
+ * finish, an interrupt request or one of runLimits is reached, and
+ * returns which one it was. instr is left holding the instruction
+ * where execution stopped. Breakpoints are not checked for the first
+ * instruction, so that running from a breakpoint makes progress.
+ *
+ * Interrupts and the time limit are only checked every
+ * RUN_CHECK_INTERVAL instructions, or when the instruction limit is
+ * reached if that comes first, so the loop itself only compares the
+ * instruction count with the next check point.
+ *
+ * Unless the timing model, the loop detector or coverage need to see
+ * every instruction, instructions are executed as superinstructions
+ * where possible, i.e., where none of the stop conditions can happen
+ * inside one. With guard-page memory, data accesses are not bounds
+ * checked during the run; one that traps stops it as invalid.
+ *
+ * The run is counted in the telemetry of the calling thread. For the
+ * split between decoding and executing, the first instruction (or
+ * superinstruction) after each check point is timed. */
+static stop_reason_t runUntilStop(machine_state_t *state, y86_instruction_t *instr) {
+
+  stop_reason_t reason;
+  // Kept in memory, as they are needed after a trap
+  volatile uint64_t executed = 0;
+  const y86_fused_t *volatile fused = NULL; // if set, the next instruction, not instr
+  uint64_t nextCheck = RUN_CHECK_INTERVAL;
+  struct timespec start;
+  int fuse = state->fuseCache && !pipelineEnabled && !loopsEnabled &&
+    !coverageEnabled && !taintEnabled && !eventsEnabled;
+  sigjmp_buf trap;
+  telemetry_t *t = telemetryThread();
+  double runStart = telemetryNow(), sampleStart = 0, sampleExecuted = 0;
+  double clockCost = telemetryClockOverhead();
+  int sampling = 1;
+  uint64_t reads = state->dataReads, writes = state->dataWrites;
+
+  __atomic_store_n(&runProgress.instructions, 0, __ATOMIC_RELAXED);
+  memoryTrap.trapped = 0;
+  if (runLimits.seconds > 0)
+    clock_gettime(CLOCK_MONOTONIC, &start);
+  if (runLimits.instructions && runLimits.instructions < nextCheck)
+    nextCheck = runLimits.instructions;
+
+  // With guard-page memory, a data access that traps comes back here
+  if (sigsetjmp(trap, 1))
+  {
+    // The instruction failed as if its access had been bounds checked.
+    // If it was part of a superinstruction, those before it completed.
+    for (int i = 1; fused && i < fused->count; i++)
+      if (fused->instr[i].location == state->guardPC)
+	executed += i;
+    guardMemoryDisarm(state);
+    state->programCounter = state->guardPC;
+    fetchInstruction(state, instr);
+    if (eventsEnabled)
+      eventStreamRecord(&events, state, instr, 0);
+    instr->icode = I_INVALID;
+    fused = NULL;
+    memoryTrap.trapped = 1;
+    memoryTrap.address = state->guardAddress;
+    reason = STOP_INVALID;
+  }
+  else
+  {
+    guardMemoryArm(state, &trap);
+    while (1)
+    {
+      const y86_instruction_t *last = instr;
+      int done = 0;
+
+      if (sampling)
+	sampleStart = telemetryNow();
+      if (fused && fused->count <= nextCheck - executed && !stopsInside(fused))
+	done = executeFused(state, fused);
+      if (done)
+      {
+	last = &fused->instr[done - 1];
+	callStackRecord(&callStack, last, state);
+	if (opcodeStatsEnabled)
+	  opcodeStatsRecordFused(&opcodeStats, fused, done);
+	executed += done;
+      }
+      else
+      {
+	if (fused)
+	{
+	  fetchInstruction(state, instr);
+	  fused = NULL;
+	}
+	if (!stepMachine(state, instr))
+	{
+	  reason = STOP_INVALID;
+	  break;
+	}
+	executed++;
+      }
+
+      int leftFrame = finishActive && last->icode == I_RET &&
+	state->registerFile[R_RSP] > finishStack;
+
+      if (sampling)
+	sampleExecuted = telemetryNow();
+
+      // Halts and invalid instructions are never fused
+      if (fuse)
+	fused = fetchFused(state);
+      if (!fused)
+	fetchInstruction(state, instr);
+
+      // Each interval timed also holds one clock read, taken out so
+      // that short intervals are not dominated by it
+      if (sampling)
+      {
+	double execute = sampleExecuted - sampleStart - clockCost;
+	double decode = telemetryNow() - sampleExecuted - clockCost;
+
+	t->sampledInstructions += done ? done : 1;
+	t->sampledExecuteSeconds += execute > 0 ? execute : 0;
+	t->sampledDecodeSeconds += decode > 0 ? decode : 0;
+	sampling = 0;
+      }
+
+      if (!fused && instr->icode == I_HALT && instr->ifun == 0)
+	reason = STOP_HALT;
+      else if (leftFrame || (stepOut.active &&
+			     state->programCounter == stepOut.address &&
+			     state->registerFile[R_RSP] >= stepOut.minStack))
+	reason = STOP_STEP_OUT;
+      else if (hasBreakpoint(state->programCounter))
+	reason = STOP_BREAKPOINT;
+      else if (executed == nextCheck)
+      {
+	__atomic_store_n(&runProgress.instructions, executed, __ATOMIC_RELAXED);
+	__atomic_store_n(&runProgress.programCounter, state->programCounter,
+			 __ATOMIC_RELAXED);
+	if (stopRequested ||
+	    (runInterrupted && runInterrupted(runInterruptedData)))
+	  reason = STOP_INTERRUPTED;
+	else if (executed == runLimits.instructions)
+	  reason = STOP_INSTRUCTION_LIMIT;
+	else if (runLimits.seconds > 0 && elapsedSeconds(&start) >= runLimits.seconds)
+	  reason = STOP_TIME_LIMIT;
+	else
+	{
+	  nextCheck += RUN_CHECK_INTERVAL;
+	  if (runLimits.instructions && runLimits.instructions < nextCheck)
+	    nextCheck = runLimits.instructions;
+	  sampling = 1;
+	  continue;
+	}
+      }
+      else
+	continue;
+      break;
+    }
+    guardMemoryDisarm(state);
+  }
+
+  if (fused)
+    fetchInstruction(state, instr);
+  __atomic_store_n(&runProgress.instructions, executed, __ATOMIC_RELAXED);
+  telemetryRecordRun(t, executed, telemetryNow() - runStart);
+  t->breakpointChecks += breakpointChecks;
+  breakpointChecks = 0;
+  t->memoryReads += state->dataReads - reads;
+  t->memoryWrites += state->dataWrites - writes;
+  return reason;
+}
+
+static void interruptHandler(int signum) {
+
+  (void) signum;
+  stopRequested = 1;
+}
+
+// Work done on the worker thread, and its result. done is protected by
+// the mutex, and signalled through the condition variable.
+typedef struct background_run {
+  stop_reason_t    (*body)(void *data);
+  void              *data;
+  stop_reason_t      reason;
+  int                done;
+  pthread_mutex_t    mutex;
+  pthread_cond_t     cond;
+} background_run_t;
+
+// Arguments of runUntilStop, as the body of a background run
+typedef struct run_arguments {
+  machine_state_t   *state;
+  y86_instruction_t *instr;
+} run_arguments_t;
+
+static void *runWorker(void *data) {
+
+  background_run_t *run = data;
+  stop_reason_t reason = run->body(run->data);
+
+  pthread_mutex_lock(&run->mutex);
+  run->reason = reason;
+  run->done = 1;
+  pthread_cond_signal(&run->cond);
+  pthread_mutex_unlock(&run->mutex);
+  return NULL;
+}
+
+/* Calls body(data) on a worker thread, so that it can be interrupted
+ * with Ctrl-C, which sets stopRequested, without losing the machine
+ * state. While it runs, the progress it publishes in runProgress is
+ * shown on stderr if it is a terminal. Returns the result of body, and
+ * the time it took in *seconds. Falls back to calling body on the
+ * calling thread if the worker cannot be created. */
+static stop_reason_t runOnWorker(stop_reason_t (*body)(void *data), void *data,
+				 double *seconds) {
+
+  background_run_t run = {body, data, STOP_STEP, 0,
+			  PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+  struct sigaction action, previous;
+  struct timespec start, deadline;
+  pthread_t worker;
+  int showProgress = isatty(STDERR_FILENO), shown = 0;
+
+  stopRequested = 0;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = interruptHandler;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, &previous);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  if (pthread_create(&worker, NULL, runWorker, &run) != 0)
+  {
+    runWorker(&run);
+  }
+  else
+  {
+    pthread_mutex_lock(&run.mutex);
+    while (!run.done)
+    {
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_nsec += RUN_PROGRESS_INTERVAL * 1000000L;
+      deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+      deadline.tv_nsec %= 1000000000L;
+      if (pthread_cond_timedwait(&run.cond, &run.mutex, &deadline) == 0 ||
+	  run.done || !showProgress)
+	continue;
+
+      uint64_t executed = __atomic_load_n(&runProgress.instructions,
+					  __ATOMIC_RELAXED);
+      fprintf(stderr, "\r# Running: PC = 0x%" PRIx64 ", %" PRIu64
+	      " instructions, %.1f M instructions/s  ",
+	      __atomic_load_n(&runProgress.programCounter, __ATOMIC_RELAXED),
+	      executed, executed / elapsedSeconds(&start) / 1e6);
+      shown = 1;
+    }
+    pthread_mutex_unlock(&run.mutex);
+    pthread_join(worker, NULL);
+  }
+
+  sigaction(SIGINT, &previous, NULL);
+  if (shown)
+    fprintf(stderr, "\n");
+  *seconds = elapsedSeconds(&start);
+  commandRunSeconds += *seconds;
+  pthread_mutex_destroy(&run.mutex);
+  pthread_cond_destroy(&run.cond);
+  return run.reason;
+}
+
+static stop_reason_t runBody(void *data) {
+
+  run_arguments_t *arguments = data;
+  return runUntilStop(arguments->state, arguments->instr);
+}
+
+/* Runs runUntilStop on a worker thread, see runOnWorker. Returns the
+ * reason the run stopped; interrupts, limits and traps are reported
+ * here. */
+static stop_reason_t runInBackground(machine_state_t *state,
+				     y86_instruction_t *instr) {
+
+  run_arguments_t arguments = {state, instr};
+  double seconds;
+  stop_reason_t reason = runOnWorker(runBody, &arguments, &seconds);
+
+  if (reason == STOP_INVALID && memoryTrap.trapped)
+    printErrorInvalidMemoryLocation(stdout, instr, memoryTrap.address);
+  if (reason == STOP_INTERRUPTED || reason == STOP_INSTRUCTION_LIMIT ||
+      reason == STOP_TIME_LIMIT)
+    printf("# %s after %" PRIu64 " instructions (%.3f s)\n",
+	   reason == STOP_INTERRUPTED ? "Interrupted" :
+	   reason == STOP_INSTRUCTION_LIMIT ? "Instruction limit reached" :
+	   "Time limit reached", runProgress.instructions, seconds);
+  return reason;
+}
+
+/* Single step for the GDB server: executes the current instruction and
+ * fetches the next one. */
+static stop_reason_t gdbStep(machine_state_t *state, y86_instruction_t *instr) {
+
+  if (instr->icode == I_HALT && instr->ifun == 0)
+    return STOP_HALT;
+  if (!singleStep(state, instr))
+    return STOP_INVALID;
+
+  fetchInstruction(state, instr);
+  return instr->icode == I_HALT && instr->ifun == 0 ? STOP_HALT : STOP_STEP;
+}
+
+/* Continue for the GDB server: runs until the next stop, checking
+ * interrupted(data) as often as the run limits. */
+static stop_reason_t gdbResume(machine_state_t *state, y86_instruction_t *instr,
+			       int (*interrupted)(void *data), void *data) {
+
+  stop_reason_t reason;
+
+  runInterrupted = interrupted;
+  runInterruptedData = data;
+  reason = runUntilStop(state, instr);
+  runInterrupted = NULL;
+  return reason;
+}
+
+/* Runs a request of the fork server, which also reports how many
+ * instructions were executed. */
+static stop_reason_t forkRun(machine_state_t *state, y86_instruction_t *instr,
+			     uint64_t *executed) {
+
+  stop_reason_t reason = runUntilStop(state, instr);
+
+  *executed = __atomic_load_n(&runProgress.instructions, __ATOMIC_RELAXED);
+  return reason;
+}
+
+/* Returns true (non-zero) if fileName is a Y86 assembly source, i.e.,
+ * ends in .ys. */
+static int isAssemblySource(const char *fileName) {
+
+  size_t length = strlen(fileName);
+
+  return length > 3 && strcmp(fileName + length - 3, ".ys") == 0;
+}
+
+/* Writes the image of an assembled program to an unlinked temporary
+ * file, so it can be mapped like a .mem file, and releases the image.
+ * Returns a file descriptor for it, or -1 with errno set. */
+static int imageFile(y86_program_t *program) {
+
+  FILE *file = tmpfile();
+  int fd;
+
+  if (!file)
+    return -1;
+  if (fwrite(program->image, 1, program->size, file) != program->size ||
+      fflush(file) != 0)
+  {
+    fclose(file);
+    return -1;
+  }
+
+  fd = dup(fileno(file));
+  fclose(file);
+  free(program->image);
+  program->image = NULL;
+  return fd;
+}
+
+/* Parses an address in a command: a label of the assembled program, or
+ * a number in hex. */
+static uint64_t parseAddress(const char *string) {
+
+  char name[MAX_LINE + 1];
+  const y86_symbol_t *symbol = NULL;
+
+  if (sscanf(string, "%256s", name) == 1)
+    symbol = symbolLookup(&program, name);
+  return symbol ? symbol->address : strtoul(string, NULL, 16);
+}
+
+/* Handles the find command:
+ *   find START END VALUE [align=N] [mask=MASK] [max=N]
+ * VALUE is a quad-word in hex, or x: followed by hex bytes in memory
+ * order; MASK has the same form and selects the bits to compare. Prints
+ * the address of every match in [START, END), or of the first N. */
+static void findCommand(machine_state_t *state, char *command, char *parameters) {
+
+  char *tokens[6], *mask = NULL;
+  int numTokens = 0;
+  uint64_t alignment = 1, maxHits = UINT64_MAX, *hits;
+  search_pattern_t pattern;
+
+  for (char *token = parameters ? strtok(parameters, " \t") : NULL;
+       token && numTokens < 6; token = strtok(NULL, " \t"))
+    tokens[numTokens++] = token;
+
+  if (numTokens < 3)
+  {
+    printErrorInvalidCommand(stdout, command, NULL);
+    return;
+  }
+
+  for (int i = 3; i < numTokens; i++)
+  {
+    if ((strncasecmp(tokens[i], "ALIGN=", 6) == 0 &&
+	 parseSize(tokens[i] + 6, &alignment) && alignment) ||
+	(strncasecmp(tokens[i], "MAX=", 4) == 0 &&
+	 parseSize(tokens[i] + 4, &maxHits)))
+      continue;
+    if (strncasecmp(tokens[i], "MASK=", 5) == 0)
+    {
+      mask = tokens[i] + 5;
+      continue;
+    }
+    printErrorInvalidCommand(stdout, command, tokens[i]);
+    return;
+  }
+
+  if (!parseSearchPattern(tokens[2], mask, &pattern))
+  {
+    printErrorInvalidCommand(stdout, command, tokens[2]);
+    return;
+  }
+
+  uint64_t start = strtoul(tokens[0], NULL, 16);
+  uint64_t end = strtoul(tokens[1], NULL, 16);
+  uint64_t numHits = memSearch(state, start, end, &pattern, alignment,
+			       maxHits, &hits);
+
+  for (uint64_t i = 0; i < numHits; i++)
+    printf("    # 0x%lx\n", hits[i]);
+  printf("    # %lu matches\n", numHits);
+  free(hits);
+}
+
+/* Handles the cycles command:
+ *   cycles                  prints the timing model report
+ *   cycles on [predictor]   enables the model (taken, nottaken, btfn
+ *                           or bimodal)
+ *   cycles off              disables the model, keeping its statistics
+ *   cycles reset            clears the statistics */
+static void cyclesCommand(char *command, char *parameters) {
+
+  char action[16] = "", name[16] = "";
+  branch_predictor_t predictor = pipeline.stalls.keys ? pipeline.predictor : P_TAKEN;
+
+  if (parameters)
+    sscanf(parameters, "%15s %15s", action, name);
+
+  if (!*action)
+  {
+    if (pipeline.stalls.keys)
+      pipelinePrintReport(stdout, &pipeline, 10);
+    else
+      printf("    # Cycle model is off, enable it with: cycles on [predictor]\n");
+  }
+  else if (strcasecmp(action, "ON") == 0)
+  {
+    if (*name && !predictorFromName(name, &predictor))
+    {
+      printErrorInvalidCommand(stdout, command, parameters);
+      return;
+    }
+    if (!pipeline.stalls.keys && !pipelineInit(&pipeline, predictor))
+    {
+      printf("    # Not enough memory for the cycle model\n");
+      return;
+    }
+    pipeline.predictor = predictor;
+    pipelineEnabled = 1;
+  }
+  else if (strcasecmp(action, "OFF") == 0)
+  {
+    pipelineEnabled = 0;
+  }
+  else if (strcasecmp(action, "RESET") == 0 && pipeline.stalls.keys)
+  {
+    pipelineReset(&pipeline);
+  }
+  else
+  {
+    printErrorInvalidCommand(stdout, command, parameters);
+  }
+}
+
+/* Handles the loops command:
+ *   loops             prints the loops that executed the most instructions
+ *   loops on|off      enables or disables loop detection
+ *   loops reset       clears the statistics collected so far */
+static void loopsCommand(char *command, char *parameters) {
+
+  char action[16] = "";
+
+  if (parameters)
+    sscanf(parameters, "%15s", action);
+
+  if (!*action)
+  {
+    if (loops.loops.keys)
+      loopStatsPrintReport(stdout, &loops, 10);
+    else
+      printf("    # Loop detection is off, enable it with: loops on\n");
+  }
+  else if (strcasecmp(action, "ON") == 0)
+  {
+    if (!loops.loops.keys && !loopStatsInit(&loops))
+    {
+      printf("    # Not enough memory for loop detection\n");
+      return;
+    }
+    loopsEnabled = 1;
+  }
+  else if (strcasecmp(action, "OFF") == 0)
+  {
+    loopsEnabled = 0;
+  }
+  else if (strcasecmp(action, "RESET") == 0 && loops.loops.keys)
+  {
+    loopStatsReset(&loops);
+  }
+  else
+  {
+    printErrorInvalidCommand(stdout, command, parameters);
+  }
+}
+
+/* Parses a size in bytes, optionally followed by K, M or G. Returns 1
+ * in case of success, or 0 if the string is not a valid size. */
+static int parseSize(const char *string, uint64_t *size) {
+
+  char *end;
+
+  errno = 0;
+  *size = strtoul(string, &end, 0);
+  if (errno || end == string)
+    return 0;
+
+  switch (*end)
+  {
+  case 'k': case 'K': *size <<= 10; end++; break;
+  case 'm': case 'M': *size <<= 20; end++; break;
+  case 'g': case 'G': *size <<= 30; end++; break;
+  }
+  return *end == '\0';
+}
+
+/* Returns how many of the length bytes starting at address are within
+ * the program's memory. */
+static uint64_t validLength(machine_state_t *state, uint64_t address,
+			    uint64_t length) {
+
+  if (address >= state->programSize)
+    return 0;
+  return state->programSize - address < length ? state->programSize - address : length;
+}
+
+/* Handles the cache command:
+ *   cache                                    prints the simulator report
+ *   cache on | off | reset                   enables, disables or clears it
+ *   cache l1|l2 SIZE WAYS LINE [lru|plru]    configures one level
+ *   cache l2 off                             simulates only the L1
+ * Changing the configuration of an enabled simulator restarts it. */
+static void cacheCommand(machine_state_t *state, char *command, char *parameters) {
+
+  char action[16] = "", size[32] = "", policy[16] = "lru";
+  unsigned ways = 0, lineSize = 0;
+  int fields = 0;
+
+  if (parameters)
+    fields = sscanf(parameters, "%15s %31s %u %u %15s", action, size,
+		    &ways, &lineSize, policy);
+
+  if (fields <= 0)
+  {
+    if (cache.numLevels)
+      cachePrintReport(stdout, &cache, 10);
+    else
+      printf("    # Cache simulator is off, enable it with: cache on\n");
+    return;
+  }
+
+  if (strcasecmp(action, "OFF") == 0)
+  {
+    if (cacheEnabled)
+      removeMemAccessHook(state, cacheMemAccessHook, &cache);
+    cacheEnabled = 0;
+    return;
+  }
+  else if (strcasecmp(action, "RESET") == 0)
+  {
+    if (cache.numLevels)
+      cacheReset(&cache);
+    return;
+  }
+  else if (strcasecmp(action, "L2") == 0 && fields == 2 &&
+	   strcasecmp(size, "OFF") == 0)
+  {
+    cacheLevels = 1;
+  }
+  else if ((strcasecmp(action, "L1") == 0 || strcasecmp(action, "L2") == 0) &&
+	   fields >= 4)
+  {
+    cache_config_t config;
+    int level = action[1] - '1';
+
+    config.ways = ways;
+    config.lineSize = lineSize;
+    config.policy = strcasecmp(policy, "PLRU") == 0 ? REPL_PLRU : REPL_LRU;
+    if (!parseSize(size, &config.size) || !cacheConfigValid(&config) ||
+	(strcasecmp(policy, "LRU") != 0 && strcasecmp(policy, "PLRU") != 0))
+    {
+      printErrorInvalidCommand(stdout, command, parameters);
+      return;
+    }
+    cacheConfigs[level] = config;
+    if (level == 1)
+      cacheLevels = 2;
+  }
+  else if (strcasecmp(action, "ON") != 0 || fields != 1)
+  {
+    printErrorInvalidCommand(stdout, command, parameters);
+    return;
+  }
+  else if (cacheEnabled)
+  {
+    return;
+  }
+
+  // (Re)build the simulator with the current configuration, unless it
+  // is only being configured while off
+  if (strcasecmp(action, "ON") != 0 && !cacheEnabled)
+    return;
+
+  if (cacheEnabled)
+    removeMemAccessHook(state, cacheMemAccessHook, &cache);
+  cacheFree(&cache);
+  cacheEnabled = 0;
+
+  if (!cacheInit(&cache, cacheConfigs, cacheLevels))
+  {
+    printf("    # Not enough memory for the cache simulator\n");
+    return;
+  }
+  if (!addMemAccessHook(state, cacheMemAccessHook, &cache))
+  {
+    printf("    # Too many memory observers enabled\n");
+    return;
+  }
+  cacheEnabled = 1;
+}
+
+/* Handles the coverage command:
+ *   coverage                    prints a summary of the code executed
+ *   coverage on|off|reset       enables, disables or clears coverage
+ *   coverage save FILE          saves the coverage map to FILE
+ *   coverage merge FILE         adds a map saved for the same image
+ *   coverage export FILE        writes the coverage per source line of
+ *                               a .ys program, or per address, in CSV */
+static void coverageCommand(machine_state_t *state, char *command,
+			    char *parameters) {
+
+  char action[16] = "", fileName[MAX_LINE + 1] = "";
+  int fields = 0;
+
+  if (parameters)
+    fields = sscanf(parameters, "%15s %256s", action, fileName);
+
+  if (fields == 1 && strcasecmp(action, "ON") == 0)
+  {
+    if (!coverage.map.blocks &&
+	!coverageInit(&coverage, state->programSize, state->programCounter))
+    {
+      printf("    # Not enough memory for coverage\n");
+      return;
+    }
+    if (!coverageEnabled)
+      coverageResync(&coverage, state->programCounter);
+    coverageEnabled = 1;
+    return;
+  }
+  if (fields == 1 && strcasecmp(action, "OFF") == 0)
+  {
+    coverageEnabled = 0;
+    return;
+  }
+
+  if (fields > 0 &&
+      !(fields == 1 && strcasecmp(action, "RESET") == 0) &&
+      !(fields == 2 && (strcasecmp(action, "SAVE") == 0 ||
+			strcasecmp(action, "MERGE") == 0 ||
+			strcasecmp(action, "EXPORT") == 0)))
+  {
+    printErrorInvalidCommand(stdout, command, parameters);
+    return;
+  }
+  if (!coverage.map.blocks)
+  {
+    printf("    # Coverage is off, enable it with: coverage on\n");
+    return;
+  }
+
+  if (fields <= 0)
+  {
+    coverageExpand(&coverage, state);
+    coveragePrintReport(stdout, &coverage, &program);
+  }
+  else if (strcasecmp(action, "RESET") == 0)
+  {
+    coverageReset(&coverage, state->programCounter);
+  }
+  else if (strcasecmp(action, "SAVE") == 0)
+  {
+    coverageExpand(&coverage, state);
+    if (!hashImage(state) || !coverageSave(fileName, &coverage, state->imageHash))
+      printf("    # Could not write %s: %s\n", fileName, strerror(errno));
+  }
+  else if (strcasecmp(action, "MERGE") == 0)
+  {
+    if (!hashImage(state) || !coverageMerge(fileName, &coverage, state->imageHash))
+      printf("    # Could not merge %s: %s\n", fileName,
+	     errno == EINVAL ? "not a coverage file for this image" : strerror(errno));
+  }
+  else
+  {
+    FILE *file = fopen(fileName, "w");
+
+    if (!file)
+    {
+      printf("    # Could not write %s: %s\n", fileName, strerror(errno));
+      return;
+    }
+    coverageExpand(&coverage, state);
+    if ((coverageExport(file, &coverage, &program) < 0) | (fclose(file) != 0))
+      printf("    # Could not write %s: %s\n", fileName, strerror(errno));
+  }
+}
+
+/* Handles the memstats command:
+ *   memstats                          prints the hottest regions, the
+ *                                     working set and the stack depths
+ *   memstats on [REGION [WINDOW]]     enables the counters, with regions
+ *                                     of REGION bytes (a power of two,
+ *                                     default 64) and working set
+ *                                     windows of WINDOW accesses
+ *   memstats off | reset              disables or clears the counters
+ *   memstats export FILE              writes the per-region counts to
+ *                                     FILE in CSV */
+static void memStatsCommand(machine_state_t *state, char *command,
+			    char *parameters) {
+
+  char action[16] = "", region[32] = "", window[32] = "";
+  uint64_t regionSize = MEM_STATS_DEFAULT_REGION;
+  uint64_t windowSize = MEM_STATS_DEFAULT_WINDOW;
+  int fields = 0;
+
+  if (parameters)
+    fields = sscanf(parameters, "%15s %31s %31s", action, region, window);
+
+  if (fields <= 0)
+  {
+    if (memStats.counts.blocks)
+      memStatsPrintReport(stdout, &memStats, 10);
+    else
+      printf("    # Memory statistics are off, enable them with: memstats on\n");
+  }
+  else if (strcasecmp(action, "ON") == 0)
+  {
+    if ((fields >= 2 && (!parseSize(region, &regionSize) || regionSize < 8 ||
+			 regionSize > (1 << 30) || (regionSize & (regionSize - 1)))) ||
+	(fields >= 3 && (!parseSize(window, &windowSize) || !windowSize)))
+    {
+      printErrorInvalidCommand(stdout, command, parameters);
+      return;
+    }
+    if (memStatsEnabled)
+      removeMemAccessHook(state, memStatsMemAccessHook, &memStats);
+    memStatsFree(&memStats);
+    memStatsEnabled = 0;
+
+    if (!memStatsInit(&memStats, state, regionSize, windowSize))
+    {
+      printf("    # Not enough memory for the memory statistics\n");
+      return;
+    }
+    if (!addMemAccessHook(state, memStatsMemAccessHook, &memStats))
+    {
+      printf("    # Too many memory observers enabled\n");
+      return;
+    }
+    memStatsEnabled = 1;
+  }
+  else if (strcasecmp(action, "OFF") == 0 && fields == 1)
+  {
+    if (memStatsEnabled)
+      removeMemAccessHook(state, memStatsMemAccessHook, &memStats);
+    memStatsEnabled = 0;
+  }
+  else if (strcasecmp(action, "RESET") == 0 && fields == 1)
+  {
+    if (memStats.counts.blocks)
+      memStatsReset(&memStats);
+  }
+  else if (strcasecmp(action, "EXPORT") == 0 && fields == 2)
+  {
+    FILE *file;
+
+    if (!memStats.counts.blocks)
+    {
+      printf("    # Memory statistics are off, enable them with: memstats on\n");
+      return;
+    }
+    file = fopen(region, "w");
+    if (!file)
+    {
+      printf("    # Could not write %s: %s\n", region, strerror(errno));
+      return;
+    }
+    if ((memStatsExport(file, &memStats) < 0) | (fclose(file) != 0))
+      printf("    # Could not write %s: %s\n", region, strerror(errno));
+  }
+  else
+  {
+    printErrorInvalidCommand(stdout, command, parameters);
+  }
+}
+
+/* A register or a quad-word in memory, named in a sweep command. */
+typedef struct sweep_location {
+  const char *name;
+  int         reg;      // R_NONE for memory
+  uint64_t    address;
+} sweep_location_t;
+
+#define SWEEP_MAX_LOCATIONS 16
+
+/* Parses a register (%rax) or a memory location (a label or an address
+ * in hex), see parseLocation in assembler.c. Returns 1 in case of
+ * success, or 0 if name is none of those. */
+static int sweepLocation(const char *name, sweep_location_t *location) {
+
+  location->name = name;
+  return parseLocation(&program, name, &location->reg, &location->address);
+}
+
+// A sweep, as the body of a background run
+typedef struct sweep_run {
+  lane_set_t     *set;
+  struct timespec start;
+} sweep_run_t;
+
+/* Publishes the progress of a sweep, and stops it when an interrupt is
+ * requested or the time limit is reached, see lanes_check_t. */
+static lane_status_t sweepCheck(lane_set_t *set, void *data) {
+
+  sweep_run_t *sweep = data;
+
+  __atomic_store_n(&runProgress.instructions, lanesInstructions(set),
+		   __ATOMIC_RELAXED);
+  __atomic_store_n(&runProgress.programCounter, set->stepPc, __ATOMIC_RELAXED);
+  if (stopRequested)
+    return LANE_INTERRUPTED;
+  if (runLimits.seconds > 0 && elapsedSeconds(&sweep->start) >= runLimits.seconds)
+    return LANE_LIMIT;
+  return LANE_RUNNING;
+}
+
+static stop_reason_t sweepBody(void *data) {
+
+  sweep_run_t *sweep = data;
+
+  clock_gettime(CLOCK_MONOTONIC, &sweep->start);
+  lanesRun(sweep->set, runLimits.instructions, RUN_CHECK_INTERVAL, sweepCheck,
+	   sweep);
+  return STOP_HALT;
+}
+
+/* Handles the sweep command:
+ *   sweep N LOC=START[:STEP]... [show LOC...]
+ * Runs N copies of the program from the current state in lockstep, lane
+ * i starting with START + i * STEP (STEP defaults to 1) in each LOC, a
+ * register (%rax) or a quad-word in memory (a label or an address in
+ * hex). Prints how each lane stopped and the final value of each LOC
+ * shown, by default the swept ones and %rax. The state of the program
+ * being debugged is not changed. The lanes run on the worker thread,
+ * like run, so Ctrl-C and the limits on runs stop the lanes still
+ * running, which are then reported as interrupted or at their limit. */
+static void sweepCommand(machine_state_t *state, char *command, char *parameters) {
+
+  sweep_location_t swept[SWEEP_MAX_LOCATIONS], shown[SWEEP_MAX_LOCATIONS + 1];
+  uint64_t start[SWEEP_MAX_LOCATIONS], step[SWEEP_MAX_LOCATIONS];
+  uint64_t numLanes = 0, total = 0;
+  int numSwept = 0, numShown = 0, showing = 0, showsRax = 0;
+  char *token = parameters ? strtok(parameters, " \t") : NULL;
+  lane_set_t set;
+  sweep_run_t sweep = {&set};
+  double elapsed;
+
+  if (!token || !parseSize(token, &numLanes) || !numLanes || numLanes > LANES_MAX)
+  {
+    printErrorInvalidCommand(stdout, command, NULL);
+    return;
+  }
+
+  for (token = strtok(NULL, " \t"); token; token = strtok(NULL, " \t"))
+  {
+    char *equals = strchr(token, '='), *end;
+
+    if (!showing && strcasecmp(token, "SHOW") == 0)
+    {
+      showing = 1;
+    }
+    else if (!showing && equals && numSwept < SWEEP_MAX_LOCATIONS)
+    {
+      *equals = '\0';
+      if (!sweepLocation(token, &swept[numSwept]))
+	break;
+      errno = 0;
+      start[numSwept] = strtoull(equals + 1, &end, 0);
+      step[numSwept] = 1;
+      if (*end == ':')
+	step[numSwept] = strtoull(end + 1, &end, 0);
+      if (errno || end == equals + 1 || *end)
+	break;
+      numSwept++;
+    }
+    else if (showing && !equals && numShown < SWEEP_MAX_LOCATIONS)
+    {
+      if (!sweepLocation(token, &shown[numShown]))
+	break;
+      numShown++;
+    }
+    else
+      break;
+  }
+  if (token || !numSwept)
+  {
+    printErrorInvalidCommand(stdout, command, NULL);
+    return;
+  }
+
+  if (!numShown)
+  {
+    for (int j = 0; j < numSwept; j++)
+    {
+      shown[numShown++] = swept[j];
+      showsRax |= swept[j].reg == R_RAX;
+    }
+    if (!showsRax)
+      sweepLocation("%rax", &shown[numShown++]);
+  }
+
+  // Lanes load the image as it was loaded, and copy only the pages
+  // written since
+  if (!(segments.numSegments ?
+	lanesInit(&set, state, numLanes, segmentsRevert, &segments) :
+	lanesInit(&set, state, numLanes, snapshotRevertFile, &imageFd)))
+  {
+    printf("    # Could not set up %" PRIu64 " lanes: %s\n", numLanes,
+	   strerror(errno));
+    return;
+  }
+  for (uint64_t i = 0; i < numLanes; i++)
+    for (int j = 0; j < numSwept; j++)
+    {
+      uint64_t value = start[j] + i * step[j];
+
+      if (swept[j].reg != R_NONE)
+	set.reg[swept[j].reg][i] = value;
+      else if (!lanesWriteQuad(&set, i, swept[j].address, value))
+      {
+	printf("    # Address 0x%" PRIx64 " is outside the program's memory\n",
+	       swept[j].address);
+	lanesFree(&set);
+	return;
+      }
+    }
+
+  __atomic_store_n(&runProgress.instructions, 0, __ATOMIC_RELAXED);
+  runOnWorker(sweepBody, &sweep, &elapsed);
+
+  for (uint64_t i = 0; i < numLanes; i++)
+  {
+    printf("    # lane %" PRIu64 ": %s after %" PRIu64 " instructions", i,
+	   laneStatusName(set.status[i]), set.instructions[i]);
+    for (int j = 0; j < numShown; j++)
+    {
+      uint64_t value;
+
+      if (shown[j].reg != R_NONE)
+	printf(", %s = 0x%" PRIx64, shown[j].name, set.reg[shown[j].reg][i]);
+      else if (lanesReadQuad(&set, i, shown[j].address, &value))
+	printf(", %s = 0x%" PRIx64, shown[j].name, value);
+      else
+	printf(", %s = ?", shown[j].name);
+    }
+    printf("\n");
+    total += set.instructions[i];
+  }
+  printf("    # %" PRIu64 " instructions in %.3f s (%.1f M instructions/s), "
+	 "%.1f lanes per step\n", total, elapsed, total / elapsed / 1e6,
+	 set.steps ? (double) total / set.steps : 0.0);
+
+  lanesFree(&set);
+}
+
+/* Handles the taint command:
+ *   taint                       prints the labels in use and where they are
+ *   taint on|off|reset          enables, disables or clears taint tracking
+ *   taint mark LOC [LEN]        gives a new label to LOC
+ *   taint clear LOC [LEN]       removes the labels of LOC
+ *   taint LOC [LEN]             prints the labels of LOC
+ * LOC is a register (%rax), or LEN bytes (default 8) at a label or an
+ * address in hex. Labels follow the data as instructions execute. */
+static void taintCommand(machine_state_t *state, char *command, char *parameters) {
+
+  char action[MAX_LINE + 1] = "", name[MAX_LINE + 1] = "", size[MAX_LINE + 1] = "";
+  sweep_location_t location;
+  uint64_t length = 8;
+  int fields = 0, marks, clears, resets;
+
+  if (parameters)
+    fields = sscanf(parameters, "%256s %256s %256s", action, name, size);
+
+  if (fields == 1 && strcasecmp(action, "ON") == 0)
+  {
+    if (!taint.pages && !taintInit(&taint, state->programSize))
+    {
+      printf("    # Not enough memory for taint tracking\n");
+      return;
+    }
+    taintEnabled = 1;
+    return;
+  }
+  if (fields == 1 && strcasecmp(action, "OFF") == 0)
+  {
+    taintEnabled = 0;
+    return;
+  }
+
+  // The location is the first parameter, unless there is an action
+  marks = strcasecmp(action, "MARK") == 0;
+  clears = strcasecmp(action, "CLEAR") == 0;
+  resets = strcasecmp(action, "RESET") == 0;
+  if (!marks && !clears && !resets)
+  {
+    strcpy(size, name);
+    strcpy(name, action);
+    fields = fields > 0 ? fields + 1 : fields;
+  }
+
+  if (fields > 3 || (fields == 1) != resets ||
+      (fields > 1 && !sweepLocation(name, &location)) ||
+      (fields == 3 && (location.reg != R_NONE || !parseSize(size, &length) ||
+		       !length)))
+  {
+    printErrorInvalidCommand(stdout, command, parameters);
+    return;
+  }
+  if (!taint.pages)
+  {
+    printf("    # Taint tracking is off, enable it with: taint on\n");
+    return;
+  }
+
+  if (fields <= 0)
+    taintPrintReport(stdout, &taint, &program);
+  else if (fields == 1)
+    taintReset(&taint);
+  else if (marks || clears)
+  {
+    if (location.reg == R_NONE && !validLength(state, location.address, length))
+      printf("    # Address 0x%lx is outside of memory\n", location.address);
+    else if (clears)
+      taintClear(&taint, location.reg, location.address, length);
+    else
+    {
+      int label = taintMark(&taint, location.reg, location.address, length);
+      if (label < 0)
+	printf("    # All %d labels are in use, clear them with: taint reset\n",
+	       TAINT_MAX_LABELS);
+      else if (location.reg != R_NONE)
+	printf("    # Label %d: %s\n", label, registerName(location.reg));
+      else
+	printf("    # Label %d: 0x%lx+%lu\n", label, location.address, length);
+    }
+  }
+  else if (location.reg != R_NONE)
+  {
+    printf("    # %s: ", registerName(location.reg));
+    taintPrintSet(stdout, &taint, taint.registers[location.reg]);
+    printf("\n");
+  }
+  else
+    taintPrintMemory(stdout, &taint, location.address, length, &program);
+}
+
+/* Prints the label of the instruction at address, if it has one: its
+ * symbol, or for an indexed instruction, a name for a function or a
+ * block. */
+static void printCodeLabel(uint64_t address, uint8_t flags) {
+
+  const y86_symbol_t *symbol = symbolAt(&program, address);
+
+  if (symbol)
+    printf("%s:\n", symbol->name);
+  else if (flags & INDEX_FUNCTION)
+    printf("fn_%lx:\n", address);
+  else if (flags & INDEX_BLOCK)
+    printf(".L%lx:\n", address);
+}
+
+/* Returns 1 if memory at address may differ from the image the index
+ * was built from: one of the pages an instruction there could span was
+ * written, or writes are not tracked. Returns 0 otherwise. */
+static int indexStale(machine_state_t *state, uint64_t address) {
+
+  uint64_t first = address >> DIRTY_PAGE_SHIFT;
+  uint64_t last = (address + 9) >> DIRTY_PAGE_SHIFT;
+
+  if (!state->dirtyPages)
+    return 1;
+  for (uint64_t page = first; page <= last; page++)
+    if (state->dirtyPages[page / 64] >> (page % 64) & 1)
+      return 1;
+  return 0;
+}
+
+/* Handles the disassemble command:
+ *   disassemble [X [N]]
+ * Prints N instructions (default 10) from address X (default the
+ * current PC), with labels for the functions and blocks of the index
+ * if there is one, and the symbols of a .ys program. Instructions are
+ * taken from the index, except where memory was written since. */
+static void disassembleCommand(machine_state_t *state, char *command,
+			       char *parameters) {
+
+  char start[MAX_LINE + 1], count[MAX_LINE + 1];
+  uint64_t address = state->programCounter, pc = state->programCounter;
+  uint64_t numInstructions = 10;
+  y86_instruction_t instr;
+  int fields = 0;
+
+  if (parameters)
+    fields = sscanf(parameters, "%256s %256s", start, count);
+  if (fields == 2 && !parseSize(count, &numInstructions))
+  {
+    printErrorInvalidCommand(stdout, command, parameters);
+    return;
+  }
+  if (fields >= 1)
+    address = parseAddress(start);
+
+  for (uint64_t i = 0; i < numInstructions; i++)
+  {
+    int64_t r = codeIndex.header ? codeIndexFind(&codeIndex, address) : -1;
+
+    if (r >= 0 && !indexStale(state, address))
+      codeIndexInstruction(&codeIndex.records[r], &instr);
+    else
+    {
+      state->programCounter = address;
+      fetchInstruction(state, &instr);
+    }
+    printCodeLabel(address, r >= 0 ? codeIndex.records[r].flags : 0);
+    printInstruction(stdout, &instr);
+    if (instr.icode == I_INVALID || instr.icode == I_TOO_SHORT)
+      break;
+    address = instr.valP;
+  }
+  state->programCounter = pc;
+}
+
+/* Handles the index command:
+ *   index                   prints a summary of the index
+ *   index functions         lists the functions found
+ *   index block X           prints the basic block holding address X
+ * The index is built or loaded with --index. */
+static void indexCommand(char *command, char *parameters) {
+
+  char action[16] = "", address[MAX_LINE + 1] = "";
+  const code_index_header_t *header = codeIndex.header;
+  int fields = 0;
+
+  if (parameters)
+    fields = sscanf(parameters, "%15s %256s", action, address);
+  if (fields > 0 &&
+      !(fields == 1 && strcasecmp(action, "FUNCTIONS") == 0) &&
+      !(fields == 2 && strcasecmp(action, "BLOCK") == 0))
+  {
+    printErrorInvalidCommand(stdout, command, parameters);
+    return;
+  }
+  if (!header)
+  {
+    printf("    # No index, start the debugger with --index\n");
+    return;
+  }
+
+  if (fields <= 0)
+  {
+    printf("    # %lu instructions in %lu blocks and %lu functions reachable "
+	   "from 0x%lx, %s\n", header->numRecords, header->numBlocks,
+	   header->numFunctions, header->entry,
+	   codeIndex.built ? "built for this image" : "loaded from the index file");
+  }
+  else if (strcasecmp(action, "FUNCTIONS") == 0)
+  {
+    for (uint64_t i = 0; i < header->numFunctions; i++)
+    {
+      const y86_symbol_t *symbol = symbolAt(&program, codeIndex.functions[i]);
+      if (symbol)
+	printf("    # 0x%lx <%s>\n", codeIndex.functions[i], symbol->name);
+      else
+	printf("    # 0x%lx <fn_%lx>\n", codeIndex.functions[i],
+	       codeIndex.functions[i]);
+    }
+  }
+  else
+  {
+    const code_index_block_t *block = codeIndexBlock(&codeIndex,
+						     parseAddress(address));
+    y86_instruction_t instr;
+
+    if (!block)
+    {
+      printf("    # No block holds an instruction at 0x%lx\n",
+	     parseAddress(address));
+      return;
+    }
+    printf("    # Block 0x%lx-0x%lx, %lu instructions\n", block->start,
+	   block->end, block->count);
+    for (uint64_t i = 0; i < block->count; i++)
+    {
+      codeIndexInstruction(&codeIndex.records[block->first + i], &instr);
+      printInstruction(stdout, &instr);
+    }
+  }
+}
+
+/* Stores in caches the hit counts of the superinstruction cache and of
+ * the levels of the data cache simulator, those that are in use.
+ * Returns how many there are, at most 1 + CACHE_MAX_LEVELS. */
+static int telemetryCaches(machine_state_t *state, telemetry_cache_t *caches) {
+
+  static const char *levelNames[] = {"L1", "L2", "L3", "L4"};
+  int numCaches = 0;
+
+  if (fuseCacheCounters(state, &caches[0].hits, &caches[0].misses))
+    caches[numCaches++].name = "superinstructions";
+  for (int i = 0; cacheEnabled && i < cache.numLevels &&
+	 i < (int) (sizeof(levelNames) / sizeof(*levelNames)); i++)
+  {
+    caches[numCaches].name = levelNames[i];
+    caches[numCaches].hits = cache.levels[i].hits;
+    caches[numCaches++].misses = cache.levels[i].misses;
+  }
+  return numCaches;
+}
+
+/* Parses FORMAT:FILE, where FORMAT is text, json or prometheus, and
+ * sets FILE as the file the telemetry is written to in that format.
+ * Returns 1 in case of success, or 0 if string is not valid. */
+static int parseTelemetryFile(const char *string) {
+
+  static const char *formats[] = {"text", "json", "prometheus"};
+  const char *colon = strchr(string, ':');
+
+  for (int format = TELEMETRY_TEXT; colon && colon[1] &&
+	 format <= TELEMETRY_PROMETHEUS; format++)
+    if (strlen(formats[format]) == (size_t) (colon - string) &&
+	strncmp(string, formats[format], colon - string) == 0)
+    {
+      telemetryFiles[format] = colon + 1;
+      return 1;
+    }
+  return 0;
+}
+
+/* Handles the stats command, which prints the telemetry collected so
+ * far: instructions executed and rates, where the time went, breakpoint
+ * checks, memory accesses and cache hit rates. The command itself is
+ * counted once it completes. */
+static void statsCommand(machine_state_t *state, char *command, char *parameters) {
+
+  telemetry_cache_t caches[1 + CACHE_MAX_LEVELS];
+  int numCaches = telemetryCaches(state, caches);
+  telemetry_t total;
+
+  if (parameters && strtok(parameters, " \t"))
+  {
+    printErrorInvalidCommand(stdout, command, parameters);
+    return;
+  }
+
+  telemetryTotal(&total);
+  telemetryPrint(stdout, TELEMETRY_TEXT, &total, caches, numCaches);
+}
+
+/* Handles the events command, which prints how many events were
+ * published to the event stream, dropped because the ring was full, and
+ * not read yet. */
+static void eventsCommand(char *command, char *parameters) {
+
+  uint64_t tail;
+
+  if (parameters && strtok(parameters, " \t"))
+  {
+    printErrorInvalidCommand(stdout, command, parameters);
+    return;
+  }
+  if (!events.ring)
+  {
+    printf("    # No event stream, start the debugger with --events NAME\n");
+    return;
+  }
+
+  tail = __atomic_load_n(&events.ring->tail, __ATOMIC_RELAXED);
+  printf("    # %lu events published to %s, %lu dropped, %lu not read yet\n",
+	 events.head, events.name, events.dropped, events.head - tail);
+}
+
+/* Writes the output of the command being handled, if any, and counts
+ * the command in the telemetry, with the time taken by writing its
+ * output apart. Unless telemetry is written to files, stdout is not
+ * fully buffered, and that time only covers what is left to write. */
+static void commandDone(void) {
+
+  telemetry_t *t = telemetryThread();
+  double printStart = telemetryNow();
+
+  fflush(stdout);
+  if (!commandStarted)
+    return;
+  t->commands++;
+  t->commandSeconds += printStart - commandStarted - commandRunSeconds;
+  t->printSeconds += telemetryNow() - printStart;
+  commandStarted = 0;
+}
+
+/* Adds an address to the list of breakpoints. If the address is
+ * already in the list, it is not added again. */
+static void addBreakpoint(uint64_t address) {
+
+  struct Node *temp = head, *prev;
+
+  // Search for address to be added already in list
+  if (temp != NULL && temp->data == address)
+  {
+    return;
+  }
+  while (temp != NULL && temp->data != address)
+  {
+    prev = temp;
+    temp = temp->next;
+  }
+
+  // If address is not in the list, add breakpoint to list
+  if (temp == NULL)
+  {
+    struct Node *temp = (struct Node *)malloc(sizeof(struct Node));
+    temp->data = address;
+    temp->next = (head);
+    (head) = temp;
+  }
+}
+
+/* Deletes an address from the list of breakpoints. If the address is
+ * not in the list, nothing happens. */
+static void deleteBreakpoint(uint64_t address) {
+
+  struct Node *temp = head, *prev;
+
+  if (temp != NULL && temp->data == address)
+  {
+    head = temp->next;
+    free(temp);
+    return;
+  }
+
+  // Search for address to be deleted
+  while (temp != NULL && temp->data != address)
+  {
+    prev = temp;
+    temp = temp->next;
+  }
+
+  // If address is not in the list, nothing happens
+  if (temp == NULL)
+    return;
 
   // temp != NULL, address to be deleted is found
   prev->next = temp->next;
@@ -391,12 +2470,34 @@ static void deleteAllBreakpoints(void) {
   }
 }
 
+/* Stores in *addresses a newly allocated array with the addresses of
+ * all breakpoints, and returns their number. The caller must free
+ * *addresses. */
+static uint64_t listBreakpoints(uint64_t **addresses) {
+
+  uint64_t count = 0;
+
+  for (struct Node *current = head; current != NULL; current = current->next)
+    count++;
+
+  *addresses = malloc((count + 1) * sizeof(uint64_t));
+  if (!*addresses)
+    return 0;
+
+  count = 0;
+  for (struct Node *current = head; current != NULL; current = current->next)
+    (*addresses)[count++] = current->data;
+  return count;
+}
+
 /* Returns true (non-zero) if the address corresponds to a breakpoint
  * in the list of breakpoints, or false (zero) otherwise. */
 static int hasBreakpoint(uint64_t address) {
 
   struct Node *current = head, *prev;
 
+  breakpointChecks++;
+
   while (current != NULL)
   {
     if (current->data == address)
@@ -0,0 +1,86 @@
+/* Decoder microbenchmark. Fills a buffer with a random mix of valid
+   Y86-64 instructions and measures how long fetchInstruction() takes
+   to decode it, repeatedly, from start to end.
+
+   Usage: decodeBench [megabytes] [passes]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "instruction.h"
+
+static double now(void) {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Writes one random valid instruction at *p and returns its length. */
+static int emitInstruction(uint8_t *p) {
+
+  static const uint8_t lengths[12] = {1, 1, 2, 10, 10, 10, 2, 9, 9, 1, 2, 2};
+  int icode = 1 + rand() % 11; // anything but halt
+  int ifun = 0;
+  int rA = rand() % 15, rB = rand() % 15;
+
+  if (icode == I_RRMVXX || icode == I_JXX) ifun = rand() % (C_G + 1);
+  if (icode == I_OPQ) ifun = rand() % (A_MODQ + 1);
+  if (icode == I_IRMOVQ) rA = R_NONE;
+  if (icode == I_PUSHQ || icode == I_POPQ) rB = R_NONE;
+
+  p[0] = icode << 4 | ifun;
+  switch (icode) {
+  case I_JXX:
+  case I_CALL:
+    for (int i = 1; i < 9; i++) p[i] = rand();
+    break;
+  default:
+    if (lengths[icode] > 1) p[1] = rA << 4 | rB;
+    for (int i = 2; i < lengths[icode]; i++) p[i] = rand();
+    break;
+  }
+  return lengths[icode];
+}
+
+int main(int argc, char **argv) {
+
+  uint64_t size = (argc > 1 ? strtoul(argv[1], NULL, 0) : 16) << 20;
+  int passes = argc > 2 ? atoi(argv[2]) : 10;
+  machine_state_t state;
+  y86_instruction_t instr;
+  uint64_t decoded = 0, checksum = 0;
+
+  memset(&state, 0, sizeof(state));
+  state.programMap = calloc(size, 1);
+  if (!state.programMap) {
+    fprintf(stderr, "Failed to allocate %lu bytes\n", size);
+    return 1;
+  }
+
+  srand(1);
+  for (uint64_t pos = 0; pos + 10 < size; )
+    pos += emitInstruction(state.programMap + pos);
+  state.programSize = size;
+
+  double start = now();
+  for (int pass = 0; pass < passes; pass++) {
+    state.programCounter = 0;
+    while (fetchInstruction(&state, &instr)) {
+      checksum += instr.valC ^ instr.rA;
+      state.programCounter = instr.valP;
+      decoded++;
+    }
+  }
+  double elapsed = now() - start;
+
+  printf("decoded %lu instructions in %.3f s: %.2f ns/instr "
+	 "(checksum %lx)\n", decoded, elapsed, elapsed * 1e9 / decoded,
+	 checksum);
+  free(state.programMap);
+  return 0;
+}
@@ -0,0 +1,82 @@
+/* Event stream consumer. Attaches to the shared-memory event stream of
+   a debugger started with --events NAME, and prints one line per
+   instruction executed until the debugger exits, and how many events
+   were dropped because this reader fell behind.
+
+   Usage: eventDump NAME
+*/
+
+#define _POSIX_C_SOURCE 200809L // nanosleep
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "eventStream.h"
+#include "printRoutines.h"
+
+#define BATCH 256
+
+int main(int argc, char **argv) {
+
+  event_stream_t stream;
+  y86_event_t events[BATCH];
+  uint64_t count, expected = 0, received = 0;
+  struct timespec pause = {0, 1000000};
+
+  if (argc != 2)
+  {
+    fprintf(stderr, "Usage: %s NAME\n", argv[0]);
+    return 1;
+  }
+  if (!eventStreamAttach(&stream, argv[1]))
+  {
+    fprintf(stderr, "%s\n", stream.error);
+    return 1;
+  }
+
+  for (;;)
+  {
+    // Read closed before the events, so that none published before it
+    // was set are missed
+    int closed = __atomic_load_n(&stream.ring->closed, __ATOMIC_ACQUIRE);
+
+    count = eventStreamRead(&stream, events, BATCH);
+    if (!count)
+    {
+      if (closed)
+	break;
+      nanosleep(&pause, NULL);
+      continue;
+    }
+
+    for (uint64_t i = 0; i < count; i++)
+    {
+      const y86_event_t *event = &events[i];
+
+      if (event->sequence != expected)
+	printf("# %lu events dropped\n", event->sequence - expected);
+      expected = event->sequence + 1;
+
+      if (event->flags & EVENT_FAILED)
+	printf("%lu 0x%lx failed\n", event->sequence, event->pc);
+      else
+      {
+	printf("%lu 0x%lx %s", event->sequence, event->pc,
+	       instructionName(event->icode, event->ifun));
+	if (event->flags & EVENT_REGISTER)
+	  printf(" %s=0x%lx", registerName(event->reg), event->regValue);
+	if (event->flags & EVENT_MEMORY)
+	  printf(" [0x%lx]=0x%lx", event->memAddress, event->memValue);
+	printf("\n");
+      }
+    }
+    received += count;
+  }
+
+  printf("# %lu events received, %lu dropped\n", received,
+	 __atomic_load_n(&stream.ring->dropped, __ATOMIC_RELAXED));
+  eventStreamClose(&stream);
+  return 0;
+}
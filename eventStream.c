@@ -0,0 +1,230 @@
+#define _POSIX_C_SOURCE 200809L // shm_open, ftruncate, strdup
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "eventStream.h"
+
+/* Creates the shared memory object name (e.g. /y86-events), holding a
+   ring of capacity events, a power of two, and maps it to publish
+   events. An object that already has that name, used by another
+   debugger or left by one that crashed, is never replaced: creating
+   the stream then fails. Returns 1 in case of success, or 0 with
+   stream->error set. */
+int eventStreamCreate(event_stream_t *stream, const char *name,
+		      uint64_t capacity) {
+
+  int fd;
+
+  memset(stream, 0, sizeof(*stream));
+  stream->size = sizeof(event_ring_t) + capacity * sizeof(y86_event_t);
+
+  fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0 && errno == EEXIST)
+  {
+    snprintf(stream->error, EVENT_STREAM_MAX_ERROR,
+	     "Shared memory %s already exists; if no debugger is using it, "
+	     "remove it (/dev/shm%s on Linux)", name, name);
+    return 0;
+  }
+  if (fd < 0 || ftruncate(fd, stream->size) < 0)
+  {
+    snprintf(stream->error, EVENT_STREAM_MAX_ERROR,
+	     "Failed to create shared memory %s: %s", name, strerror(errno));
+    if (fd >= 0)
+    {
+      close(fd);
+      shm_unlink(name);
+    }
+    return 0;
+  }
+  stream->ring = mmap(NULL, stream->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		      fd, 0);
+  close(fd);
+  if (stream->ring == MAP_FAILED || !(stream->name = strdup(name)))
+  {
+    snprintf(stream->error, EVENT_STREAM_MAX_ERROR,
+	     "Failed to map shared memory %s: %s", name, strerror(errno));
+    if (stream->ring != MAP_FAILED)
+      munmap(stream->ring, stream->size);
+    stream->ring = NULL;
+    shm_unlink(name);
+    return 0;
+  }
+
+  // The object starts out zeroed, so only the layout needs writing
+  stream->events = (y86_event_t *) (stream->ring + 1);
+  stream->ring->eventSize = sizeof(y86_event_t);
+  stream->ring->headerSize = sizeof(event_ring_t);
+  stream->ring->capacity = capacity;
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(stream->ring->magic, EVENT_STREAM_MAGIC, sizeof(stream->ring->magic));
+  return 1;
+}
+
+/* Publishes instr, which state has just executed, or failed to execute
+   if executed is 0. Never waits for the consumer: if the ring is full,
+   the event is dropped and counted. */
+void eventStreamRecord(event_stream_t *stream, machine_state_t *state,
+		       const y86_instruction_t *instr, int executed) {
+
+  event_ring_t *ring = stream->ring;
+  const uint64_t *regs = state->registerFile;
+  uint64_t head = stream->head;
+  y86_event_t *event;
+
+  // The consumer's position is only read again once the ring looks
+  // full, so that its cache line is not pulled in for every event
+  if (head - stream->tail >= ring->capacity)
+  {
+    stream->tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head - stream->tail >= ring->capacity)
+    {
+      __atomic_store_n(&ring->dropped, ++stream->dropped, __ATOMIC_RELAXED);
+      return;
+    }
+  }
+
+  event = &stream->events[head & (ring->capacity - 1)];
+  event->sequence = head + stream->dropped;
+  event->pc = instr->location;
+  event->icode = instr->icode;
+  event->ifun = instr->ifun;
+  event->reg = R_NONE;
+  event->flags = executed ? 0 : EVENT_FAILED;
+  event->regValue = event->memAddress = event->memValue = 0;
+
+  if (executed)
+  {
+    switch (instr->icode)
+    {
+    case I_RRMVXX:
+      // A cmovXX whose condition does not hold writes nothing; the
+      // condition codes are still those it was executed with
+      if (conditionHolds(state, instr->ifun))
+	event->reg = instr->rB;
+      break;
+    case I_IRMOVQ:
+    case I_OPQ:
+      event->reg = instr->rB;
+      break;
+    case I_MRMOVQ:
+    case I_POPQ:
+      event->reg = instr->rA;
+      break;
+    case I_RMMOVQ:
+      event->flags |= EVENT_MEMORY;
+      event->memAddress = regs[instr->rB] + instr->valC;
+      event->memValue = regs[instr->rA];
+      break;
+    case I_PUSHQ:
+      // pushq %rsp pushes the value before the push
+      event->flags |= EVENT_MEMORY;
+      event->memAddress = regs[R_RSP];
+      event->memValue = instr->rA == R_RSP ? regs[R_RSP] + 8 : regs[instr->rA];
+      break;
+    case I_CALL:
+      event->flags |= EVENT_MEMORY;
+      event->memAddress = regs[R_RSP];
+      event->memValue = instr->valP;
+      break;
+    default:
+      break;
+    }
+    if (event->reg != R_NONE)
+    {
+      event->flags |= EVENT_REGISTER;
+      event->regValue = regs[event->reg];
+    }
+  }
+
+  stream->head = head + 1;
+  __atomic_store_n(&ring->head, stream->head, __ATOMIC_RELEASE);
+}
+
+/* Maps the stream published as name, to read its events. Returns 1 in
+   case of success, or 0 with stream->error set. */
+int eventStreamAttach(event_stream_t *stream, const char *name) {
+
+  struct stat st;
+  int fd;
+
+  memset(stream, 0, sizeof(*stream));
+  fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0 || fstat(fd, &st) < 0)
+  {
+    snprintf(stream->error, EVENT_STREAM_MAX_ERROR,
+	     "Failed to open shared memory %s: %s", name, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return 0;
+  }
+  stream->size = st.st_size;
+  stream->ring = stream->size >= sizeof(event_ring_t) ?
+    mmap(NULL, stream->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) :
+    MAP_FAILED;
+  close(fd);
+  if (stream->ring == MAP_FAILED)
+  {
+    snprintf(stream->error, EVENT_STREAM_MAX_ERROR,
+	     "%s is not an event stream", name);
+    stream->ring = NULL;
+    return 0;
+  }
+
+  if (memcmp(stream->ring->magic, EVENT_STREAM_MAGIC,
+	     sizeof(stream->ring->magic)) != 0 ||
+      stream->ring->eventSize != sizeof(y86_event_t) ||
+      stream->ring->headerSize != sizeof(event_ring_t) ||
+      stream->ring->capacity & (stream->ring->capacity - 1) ||
+      stream->ring->capacity > (stream->size - sizeof(event_ring_t)) /
+      sizeof(y86_event_t))
+  {
+    snprintf(stream->error, EVENT_STREAM_MAX_ERROR,
+	     "%s is not an event stream", name);
+    munmap(stream->ring, stream->size);
+    stream->ring = NULL;
+    return 0;
+  }
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  stream->events = (y86_event_t *) (stream->ring + 1);
+  return 1;
+}
+
+/* Copies up to maxEvents events not read yet to events, and frees
+   their slots for the producer. Returns the number of events copied. */
+uint64_t eventStreamRead(event_stream_t *stream, y86_event_t *events,
+			 uint64_t maxEvents) {
+
+  event_ring_t *ring = stream->ring;
+  uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+  uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  uint64_t count = head - tail < maxEvents ? head - tail : maxEvents;
+
+  for (uint64_t i = 0; i < count; i++)
+    events[i] = stream->events[(tail + i) & (ring->capacity - 1)];
+  __atomic_store_n(&ring->tail, tail + count, __ATOMIC_RELEASE);
+  return count;
+}
+
+/* Unmaps the stream. The producer also marks it as closed, for the
+   consumer, and removes its name. */
+void eventStreamClose(event_stream_t *stream) {
+
+  if (stream->ring && stream->name)
+  {
+    __atomic_store_n(&stream->ring->closed, 1, __ATOMIC_RELEASE);
+    shm_unlink(stream->name);
+  }
+  if (stream->ring)
+    munmap(stream->ring, stream->size);
+  free(stream->name);
+  memset(stream, 0, sizeof(*stream));
+}
@@ -0,0 +1,82 @@
+/* This file contains the prototypes and constants needed to use the
+   shared-memory event stream defined in eventStream.c
+*/
+
+#ifndef _EVENTSTREAM_H_
+#define _EVENTSTREAM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "instruction.h"
+
+#define EVENT_STREAM_MAGIC     "Y86EVT01"
+#define EVENT_STREAM_CAPACITY  (1 << 16) // events, a power of two
+#define EVENT_STREAM_MAX_ERROR 256
+
+// Flags of an event
+#define EVENT_REGISTER 0x1 // reg was written with regValue
+#define EVENT_MEMORY   0x2 // the quad-word at memAddress was written
+#define EVENT_FAILED   0x4 // the instruction could not be executed
+
+/* An instruction executed by the debugger. A ret, call, pushq or popq
+   also changes %rsp, which is not reported. */
+typedef struct y86_event {
+  uint64_t sequence;   // events before this one, including dropped ones
+  uint64_t pc;
+  uint64_t regValue;
+  uint64_t memAddress;
+  uint64_t memValue;
+  uint8_t  icode;
+  uint8_t  ifun;
+  uint8_t  reg;        // R_NONE if no register is written
+  uint8_t  flags;
+  uint8_t  unused[4];
+} y86_event_t;
+
+/* Start of the shared memory, followed by capacity events at offset
+   headerSize. The producer and the consumer each write their own
+   cache line: head is the number of events published, tail the number
+   consumed, and the events in [tail, head) are at index & (capacity -
+   1). The producer never waits: when the ring is full, it counts the
+   event as dropped instead. */
+typedef struct event_ring {
+  char     magic[8];      // written last, once the ring is ready
+  uint32_t eventSize;
+  uint32_t headerSize;
+  uint64_t capacity;
+  uint8_t  unused0[40];
+
+  uint64_t head;          // written by the producer
+  uint64_t dropped;
+  uint64_t closed;        // set when the producer is done
+  uint8_t  unused1[40];
+
+  uint64_t tail;          // written by the consumer
+  uint8_t  unused2[56];
+} event_ring_t;
+
+/* One end of a stream. */
+typedef struct event_stream {
+  event_ring_t *ring;
+  y86_event_t  *events;
+  size_t        size;          // of the shared memory
+  char         *name;          // set by the producer, to remove it
+  uint64_t      head;          // producer's copy of ring->head
+  uint64_t      dropped;       // producer's copy of ring->dropped
+  uint64_t      tail;          // last value of ring->tail read by the producer
+
+  char error[EVENT_STREAM_MAX_ERROR];
+
+} event_stream_t;
+
+int      eventStreamCreate(event_stream_t *stream, const char *name,
+			   uint64_t capacity);
+void     eventStreamRecord(event_stream_t *stream, machine_state_t *state,
+			   const y86_instruction_t *instr, int executed);
+int      eventStreamAttach(event_stream_t *stream, const char *name);
+uint64_t eventStreamRead(event_stream_t *stream, y86_event_t *events,
+			 uint64_t maxEvents);
+void     eventStreamClose(event_stream_t *stream);
+
+#endif /* EVENTSTREAM */
@@ -0,0 +1,70 @@
+/* Execution microbenchmark. Builds a small flag-heavy Y86-64 loop in
+   memory (a mix of OPq instructions, a conditional move and a
+   conditional jump) and measures how long the fetch/execute loop
+   takes to run it to completion.
+
+   Usage: execBench [iterations]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "instruction.h"
+
+static double now(void) {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint8_t *emitQuad(uint8_t *p, uint64_t value) {
+
+  for (int i = 0; i < 8; i++)
+    *p++ = value >> (8 * i);
+  return p;
+}
+
+int main(int argc, char **argv) {
+
+  uint64_t iterations = argc > 1 ? strtoul(argv[1], NULL, 0) : 20000000;
+  uint8_t image[0x100];
+  uint8_t *p = image;
+  uint64_t loop;
+  machine_state_t state;
+  y86_instruction_t instr;
+  uint64_t executed = 0;
+
+  memset(image, 0, sizeof(image));
+
+  // irmovq $iterations, %rcx ; irmovq $1, %rdx ; irmovq $3, %rdi
+  *p++ = 0x30; *p++ = 0xF0 | R_RCX; p = emitQuad(p, iterations);
+  *p++ = 0x30; *p++ = 0xF0 | R_RDX; p = emitQuad(p, 1);
+  *p++ = 0x30; *p++ = 0xF0 | R_RDI; p = emitQuad(p, 3);
+  loop = p - image;
+  *p++ = 0x60; *p++ = R_RDX << 4 | R_RAX; // addq %rdx, %rax
+  *p++ = 0x63; *p++ = R_RAX << 4 | R_RBX; // xorq %rax, %rbx
+  *p++ = 0x62; *p++ = R_RDI << 4 | R_RBX; // andq %rdi, %rbx
+  *p++ = 0x60; *p++ = R_RBX << 4 | R_RSI; // addq %rbx, %rsi
+  *p++ = 0x24; *p++ = R_RAX << 4 | R_R8;  // cmovne %rax, %r8
+  *p++ = 0x61; *p++ = R_RDX << 4 | R_RCX; // subq %rdx, %rcx
+  *p++ = 0x74; p = emitQuad(p, loop);     // jne loop
+  *p++ = 0x00;                            // halt
+
+  memset(&state, 0, sizeof(state));
+  state.programMap = image;
+  state.programSize = sizeof(image);
+
+  double start = now();
+  while (fetchInstruction(&state, &instr) && executeInstruction(&state, &instr))
+    executed++;
+  double elapsed = now() - start;
+
+  printf("executed %lu instructions in %.3f s: %.2f ns/instr "
+	 "(rsi = %lx)\n", executed, elapsed, elapsed * 1e9 / executed,
+	 state.registerFile[R_RSI]);
+  return 0;
+}
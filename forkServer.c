@@ -0,0 +1,275 @@
+#define _POSIX_C_SOURCE 200809L // getline, fork
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "forkServer.h"
+#include "printRoutines.h"
+
+/* A register or a span of memory named in a request. */
+typedef struct fork_location {
+  const char *name;
+  int         reg;      // R_NONE for memory
+  uint64_t    address;
+  uint64_t    value;    // registers only
+  size_t      offset;   // memory only, of the bytes in fork_request_t
+  size_t      length;
+} fork_location_t;
+
+/* A parsed request, reused from one request to the next. */
+typedef struct fork_request {
+  fork_location_t *patches;
+  size_t           numPatches;
+  fork_location_t *reports;
+  size_t           numReports;
+  size_t           capacity;   // of both patches and reports
+  uint8_t         *bytes;      // written by memory patches
+  size_t           numBytes;
+  size_t           byteCapacity;
+} fork_request_t;
+
+static const char *stopName(stop_reason_t reason) {
+
+  switch (reason)
+  {
+  case STOP_HALT:              return "halt";
+  case STOP_INVALID:           return "invalid";
+  case STOP_BREAKPOINT:        return "breakpoint";
+  case STOP_INTERRUPTED:       return "interrupted";
+  case STOP_INSTRUCTION_LIMIT: return "instruction-limit";
+  case STOP_TIME_LIMIT:        return "time-limit";
+  default:                     return "stopped";
+  }
+}
+
+static int hexValue(char c) {
+
+  return isdigit((unsigned char) c) ? c - '0' : tolower((unsigned char) c) - 'a' + 10;
+}
+
+/* Stores the value of a patch: a number, or x: and bytes in hex for
+   memory. Returns 1 in case of success, or 0 if value is invalid. */
+static int parseValue(fork_request_t *request, const char *value,
+		      fork_location_t *patch) {
+
+  size_t length = strlen(value);
+  char *end;
+
+  if (patch->reg == R_NONE && strncasecmp(value, "x:", 2) == 0)
+  {
+    value += 2;
+    length -= 2;
+    if (!length || length % 2)
+      return 0;
+    for (size_t i = 0; i < length; i++)
+      if (!isxdigit((unsigned char) value[i]))
+	return 0;
+    length /= 2;
+  }
+  else
+  {
+    errno = 0;
+    patch->value = strtoull(value, &end, 0);
+    if (errno || end == value || *end)
+      return 0;
+    value = NULL;
+    length = patch->reg == R_NONE ? 8 : 0;
+  }
+
+  if (request->numBytes + length > request->byteCapacity)
+  {
+    size_t capacity = 2 * (request->numBytes + length);
+    uint8_t *bytes = realloc(request->bytes, capacity);
+    if (!bytes)
+      return 0;
+    request->bytes = bytes;
+    request->byteCapacity = capacity;
+  }
+
+  patch->offset = request->numBytes;
+  patch->length = length;
+  for (size_t i = 0; i < length; i++)
+    request->bytes[request->numBytes++] = value ?
+      hexValue(value[2 * i]) << 4 | hexValue(value[2 * i + 1]) :
+      patch->value >> (8 * i);
+  return 1;
+}
+
+/* Parses a request line in place. Returns NULL in case of success, or
+   the offending token. */
+static const char *parseRequest(fork_target_t *target, char *line,
+				fork_request_t *request) {
+
+  request->numPatches = request->numReports = request->numBytes = 0;
+
+  for (char *token = strtok(line, " \t\r\n"); token;
+       token = strtok(NULL, " \t\r\n"))
+  {
+    char *equals = strchr(token, '=');
+    fork_location_t location;
+
+    if (request->numPatches == request->capacity ||
+	request->numReports == request->capacity)
+    {
+      size_t capacity = request->capacity ? 2 * request->capacity : 16;
+      fork_location_t *patches = realloc(request->patches,
+					 capacity * sizeof(fork_location_t));
+      if (patches)
+	request->patches = patches;
+      fork_location_t *reports = realloc(request->reports,
+					 capacity * sizeof(fork_location_t));
+      if (reports)
+	request->reports = reports;
+      if (!patches || !reports)
+	return token;
+      request->capacity = capacity;
+    }
+
+    if (equals)
+      *equals = '\0';
+    memset(&location, 0, sizeof(location));
+    location.name = token;
+    if (!parseLocation(target->program, token, &location.reg,
+		       &location.address))
+    {
+      if (equals)
+	*equals = '=';
+      return token;
+    }
+
+    if (!equals)
+    {
+      request->reports[request->numReports++] = location;
+      continue;
+    }
+    if (!parseValue(request, equals + 1, &location) ||
+	(location.reg == R_NONE &&
+	 !memAccessible(target->state, location.address, location.length,
+			PAGE_WRITE)))
+    {
+      *equals = '=';
+      return token;
+    }
+    request->patches[request->numPatches++] = location;
+  }
+
+  return NULL;
+}
+
+/* Runs in the child: applies the patches to its copy of the snapshot,
+   runs the program and writes the reply. */
+static void runRequest(FILE *out, fork_target_t *target,
+		       const fork_request_t *request) {
+
+  machine_state_t *state = target->state;
+  y86_instruction_t instr;
+  uint64_t executed = 0, value;
+  stop_reason_t reason;
+
+  for (size_t i = 0; i < request->numPatches; i++)
+  {
+    const fork_location_t *patch = &request->patches[i];
+    if (patch->reg != R_NONE)
+      state->registerFile[patch->reg] = patch->value;
+    else
+    {
+      memcpy(state->programMap + patch->address, request->bytes + patch->offset,
+	     patch->length);
+      fuseCacheInvalidate(state);
+    }
+  }
+
+  fetchInstruction(state, &instr);
+  if (instr.icode == I_HALT && instr.ifun == 0)
+    reason = STOP_HALT;
+  else
+    reason = target->run(state, &instr, &executed);
+
+  fprintf(out, "%s %" PRIu64 " pc=0x%" PRIx64 " cc=0x%x", stopName(reason),
+	  executed, state->programCounter, getConditionCodes(state));
+  for (int r = R_RAX; r < R_NONE; r++)
+    fprintf(out, " %s=0x%" PRIx64, registerName(r), state->registerFile[r]);
+  for (size_t i = 0; i < request->numReports; i++)
+  {
+    const fork_location_t *report = &request->reports[i];
+    if (report->reg != R_NONE)
+      fprintf(out, " %s=0x%" PRIx64, report->name, state->registerFile[report->reg]);
+    else if (memReadQuadLE(state, report->address, &value))
+      fprintf(out, " %s=0x%" PRIx64, report->name, value);
+    else
+      fprintf(out, " %s=?", report->name);
+  }
+  fprintf(out, "\n");
+}
+
+/* Answers requests read from in, one line each, until the end of the
+   input. Each request runs in a child process forked from this one,
+   so that it starts from a copy-on-write copy of the snapshot in
+   target->state, which stays untouched. Returns 1 at the end of the
+   input, or 0 if a reply could not be written. */
+int forkServe(FILE *in, FILE *out, fork_target_t *target) {
+
+  fork_request_t request;
+  char *line = NULL;
+  size_t lineSize = 0;
+  int result = 1;
+
+  memset(&request, 0, sizeof(request));
+
+  // The client may be waiting for what was written before the first
+  // request, e.g. a greeting
+  if (fflush(out) == EOF)
+    return 0;
+
+  while (getline(&line, &lineSize, in) >= 0)
+  {
+    const char *invalid = parseRequest(target, line, &request);
+    pid_t child;
+    int status;
+
+    if (invalid)
+    {
+      fprintf(out, "error invalid %s\n", invalid);
+    }
+    else if (fflush(out), (child = fork()) < 0)
+    {
+      fprintf(out, "error fork: %s\n", strerror(errno));
+    }
+    else if (child == 0)
+    {
+      runRequest(out, target, &request);
+      fflush(out);
+      _exit(0);
+    }
+    else if (waitpid(child, &status, 0) < 0)
+    {
+      fprintf(out, "error wait: %s\n", strerror(errno));
+    }
+    else if (WIFSIGNALED(status))
+    {
+      // e.g., SIGFPE for a division by zero
+      fprintf(out, "error run killed by signal %d\n", WTERMSIG(status));
+    }
+
+    if (fflush(out) == EOF)
+    {
+      result = 0;
+      break;
+    }
+  }
+
+  free(line);
+  free(request.patches);
+  free(request.reports);
+  free(request.bytes);
+  return result;
+}
@@ -0,0 +1,36 @@
+/* This file contains the prototypes and constants needed to use the
+   fork server defined in forkServer.c
+*/
+
+#ifndef _FORKSERVER_H_
+#define _FORKSERVER_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "instruction.h"
+#include "assembler.h"
+
+/* Execution machinery provided by the debugger. state is the snapshot
+   every run starts from. run executes from the current program
+   counter until the program stops, and stores the number of
+   instructions executed in *executed. */
+typedef struct fork_target {
+  machine_state_t     *state;
+  const y86_program_t *program;   // for labels, may have no symbols
+  stop_reason_t      (*run)(machine_state_t *state, y86_instruction_t *instr,
+			    uint64_t *executed);
+} fork_target_t;
+
+/* Requests and replies are one line each. A request is a list of
+   space-separated tokens:
+     LOC=VALUE     before running, sets LOC to VALUE
+     LOC           after running, reports the value of LOC
+   LOC is a register (%rax), or a quad-word in memory at a label or an
+   address in hex. VALUE is a number (decimal, or hex with 0x), or, for
+   memory, x: followed by bytes in hex, in memory order. The reply is
+     STATUS INSTRUCTIONS pc=PC cc=CC %rax=VALUE ... %r14=VALUE [LOC=VALUE...]
+   or "error MESSAGE" if the request is invalid or the run crashed. */
+int forkServe(FILE *in, FILE *out, fork_target_t *target);
+
+#endif /* FORKSERVER */
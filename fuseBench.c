@@ -0,0 +1,112 @@
+/* Superinstruction microbenchmark. Builds an array-summing Y86-64 loop
+   in the style of compiled code (load and add, add a constant,
+   decrement and branch) and runs it twice: one instruction at a time
+   with fetchInstruction/executeInstruction, and as superinstructions
+   with fetchFused/executeFused. Reports both times and checks that the
+   results are the same.
+
+   Usage: fuseBench [passes]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "instruction.h"
+
+#define ELEMENTS 64
+
+static double now(void) {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint8_t *emitQuad(uint8_t *p, uint64_t value) {
+
+  for (int i = 0; i < 8; i++)
+    *p++ = value >> (8 * i);
+  return p;
+}
+
+static uint8_t *emitIrmovq(uint8_t *p, uint64_t value, y86_register_t reg) {
+
+  *p++ = 0x30;
+  *p++ = 0xF0 | reg;
+  return emitQuad(p, value);
+}
+
+int main(int argc, char **argv) {
+
+  uint64_t passes = argc > 1 ? strtoul(argv[1], NULL, 0) : 300000;
+  uint8_t image[0x400];
+  uint8_t *p = image;
+  uint64_t outer, inner, array = 0x200, executed[2] = {0, 0};
+  uint64_t results[2];
+  double elapsed[2];
+  machine_state_t state;
+  y86_instruction_t instr;
+  const y86_fused_t *fused;
+
+  memset(image, 0, sizeof(image));
+
+  p = emitIrmovq(p, passes, R_RBX);
+  outer = p - image;
+  p = emitIrmovq(p, array, R_RDI);
+  p = emitIrmovq(p, ELEMENTS, R_RSI);
+  inner = p - image;
+  *p++ = 0x50; *p++ = R_R10 << 4 | R_RDI; p = emitQuad(p, 0); // mrmovq (%rdi), %r10
+  *p++ = 0x60; *p++ = R_R10 << 4 | R_RAX;                     // addq %r10, %rax
+  p = emitIrmovq(p, 8, R_R8);                                 // irmovq $8, %r8
+  *p++ = 0x60; *p++ = R_R8 << 4 | R_RDI;                      // addq %r8, %rdi
+  p = emitIrmovq(p, 1, R_R8);                                 // irmovq $1, %r8
+  *p++ = 0x61; *p++ = R_R8 << 4 | R_RSI;                      // subq %r8, %rsi
+  *p++ = 0x74; p = emitQuad(p, inner);                        // jne inner
+  p = emitIrmovq(p, 1, R_R8);                                 // irmovq $1, %r8
+  *p++ = 0x61; *p++ = R_R8 << 4 | R_RBX;                      // subq %r8, %rbx
+  *p++ = 0x74; p = emitQuad(p, outer);                        // jne outer
+  *p++ = 0x00;                                                // halt
+
+  for (int i = 0; i < ELEMENTS; i++)
+    emitQuad(image + array + 8 * i, i * 0x9e3779b97f4a7c15ull);
+
+  for (int mode = 0; mode < 2; mode++)
+  {
+    memset(&state, 0, sizeof(state));
+    state.programMap = image;
+    state.programSize = sizeof(image);
+
+    double start = now();
+    if (mode == 0)
+      while (fetchInstruction(&state, &instr) && executeInstruction(&state, &instr))
+	executed[mode]++;
+    else
+    {
+      if (!fuseCacheInit(&state))
+      {
+	fprintf(stderr, "fuseBench: out of memory\n");
+	return 1;
+      }
+      while ((fused = fetchFused(&state)) &&
+	     executeFused(&state, fused) == fused->count)
+	executed[mode] += fused->count;
+    }
+    elapsed[mode] = now() - start;
+    results[mode] = state.registerFile[R_RAX];
+    fuseCacheFree(&state);
+  }
+
+  printf("executed %lu instructions: %.2f ns/instr one at a time, "
+	 "%.2f ns/instr fused, %.2fx\n", executed[0],
+	 elapsed[0] * 1e9 / executed[0], elapsed[1] * 1e9 / executed[1],
+	 elapsed[0] / elapsed[1]);
+  if (executed[0] != executed[1] || results[0] != results[1])
+  {
+    fprintf(stderr, "fuseBench: fused execution gave a different result\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,582 @@
+#define _POSIX_C_SOURCE 200809L // sockets
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "gdbServer.h"
+
+static const char targetXML[] =
+  "<?xml version=\"1.0\"?>"
+  "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+  "<target><feature name=\"org.y86.core\">"
+  "<reg name=\"rax\" bitsize=\"64\"/><reg name=\"rcx\" bitsize=\"64\"/>"
+  "<reg name=\"rdx\" bitsize=\"64\"/><reg name=\"rbx\" bitsize=\"64\"/>"
+  "<reg name=\"rsp\" bitsize=\"64\" type=\"data_ptr\"/>"
+  "<reg name=\"rbp\" bitsize=\"64\" type=\"data_ptr\"/>"
+  "<reg name=\"rsi\" bitsize=\"64\"/><reg name=\"rdi\" bitsize=\"64\"/>"
+  "<reg name=\"r8\" bitsize=\"64\"/><reg name=\"r9\" bitsize=\"64\"/>"
+  "<reg name=\"r10\" bitsize=\"64\"/><reg name=\"r11\" bitsize=\"64\"/>"
+  "<reg name=\"r12\" bitsize=\"64\"/><reg name=\"r13\" bitsize=\"64\"/>"
+  "<reg name=\"r14\" bitsize=\"64\"/>"
+  "<reg name=\"pc\" bitsize=\"64\" type=\"code_ptr\"/>"
+  "<reg name=\"cc\" bitsize=\"64\"/>"
+  "</feature></target>";
+
+#define XFER_TARGET "qXfer:features:read:target.xml:"
+
+static const char hexDigits[] = "0123456789abcdef";
+
+typedef struct gdb_connection {
+  int      fd;
+  int      noAck;
+  uint8_t  input[4096];
+  size_t   inputStart;
+  size_t   inputEnd;
+} gdb_connection_t;
+
+/* Opens a listening socket: a TCP port on the loopback interface if
+   endpoint is a number, or a Unix domain socket otherwise. Returns the
+   socket, or -1 with errno set. */
+static int openEndpoint(const char *endpoint) {
+
+  char *end;
+  long port = strtol(endpoint, &end, 10);
+  int fd, one = 1;
+
+  if (*endpoint && !*end)
+  {
+    struct sockaddr_in address;
+
+    if (port <= 0 || port > 65535)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+      return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *) &address, sizeof(address)) < 0)
+    {
+      close(fd);
+      return -1;
+    }
+  }
+  else
+  {
+    struct sockaddr_un address;
+
+    if (strlen(endpoint) >= sizeof(address.sun_path))
+    {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+      return -1;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, endpoint);
+    unlink(endpoint);
+    if (bind(fd, (struct sockaddr *) &address, sizeof(address)) < 0)
+    {
+      close(fd);
+      return -1;
+    }
+  }
+
+  if (listen(fd, 1) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* Returns the next byte received, or -1 if the connection is closed. */
+static int readByte(gdb_connection_t *conn) {
+
+  if (conn->inputStart == conn->inputEnd)
+  {
+    ssize_t received;
+    do
+      received = read(conn->fd, conn->input, sizeof(conn->input));
+    while (received < 0 && errno == EINTR);
+    if (received <= 0)
+      return -1;
+    conn->inputStart = 0;
+    conn->inputEnd = received;
+  }
+  return conn->input[conn->inputStart++];
+}
+
+/* Returns 1 if the client sent an interrupt (0x03) or disconnected, or
+   0 otherwise, without waiting. Called while the target runs, when the
+   client only sends acks besides interrupts; the start of a packet is
+   left for receivePacket. */
+static int clientInterrupted(void *data) {
+
+  gdb_connection_t *conn = data;
+  struct pollfd pending = {conn->fd, POLLIN, 0};
+
+  if (conn->inputStart == conn->inputEnd)
+  {
+    ssize_t received;
+    if (poll(&pending, 1, 0) <= 0)
+      return 0;
+    received = read(conn->fd, conn->input, sizeof(conn->input));
+    if (received <= 0)
+      return received == 0 || errno != EINTR;
+    conn->inputStart = 0;
+    conn->inputEnd = received;
+  }
+
+  while (conn->inputStart < conn->inputEnd &&
+	 conn->input[conn->inputStart] != '$')
+  {
+    if (conn->input[conn->inputStart++] == 0x03)
+      return 1;
+  }
+  return 0;
+}
+
+static int writeAll(int fd, const char *data, size_t length) {
+
+  while (length)
+  {
+    ssize_t written = write(fd, data, length);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return 0;
+    data += written;
+    length -= written;
+  }
+  return 1;
+}
+
+static int hexValue(int c) {
+
+  if (isdigit(c))
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+/* Receives one packet into buffer (NUL-terminated, without the framing
+   and checksum), acknowledging it unless acks are disabled. Returns its
+   length, or -1 if the connection is closed. */
+static long receivePacket(gdb_connection_t *conn, char *buffer, size_t size) {
+
+  while (1)
+  {
+    int c;
+    size_t length = 0;
+    uint8_t checksum = 0;
+
+    // skip acks, interrupts and garbage up to the start of a packet
+    while ((c = readByte(conn)) != '$')
+    {
+      if (c < 0)
+	return -1;
+    }
+
+    while ((c = readByte(conn)) != '#')
+    {
+      if (c < 0)
+	return -1;
+      checksum += c;
+      if (length < size - 1)
+	buffer[length++] = c;
+    }
+    buffer[length] = '\0';
+
+    int high = hexValue(readByte(conn));
+    int low = hexValue(readByte(conn));
+
+    if (conn->noAck)
+      return length;
+    if (high >= 0 && low >= 0 && (high << 4 | low) == checksum)
+    {
+      if (!writeAll(conn->fd, "+", 1))
+	return -1;
+      return length;
+    }
+    if (!writeAll(conn->fd, "-", 1))
+      return -1;
+  }
+}
+
+/* Sends one packet, retransmitting it until it is acknowledged (unless
+   acks are disabled). Returns 1 in case of success, or 0 if the
+   connection is closed. */
+static int sendPacket(gdb_connection_t *conn, const char *data, size_t length) {
+
+  char *packet = malloc(length + 4);
+  uint8_t checksum = 0;
+  int ok = 0, c;
+
+  if (!packet)
+    return 0;
+
+  packet[0] = '$';
+  for (size_t i = 0; i < length; i++)
+    checksum += (uint8_t) data[i];
+  memcpy(packet + 1, data, length);
+  packet[length + 1] = '#';
+  packet[length + 2] = hexDigits[checksum >> 4];
+  packet[length + 3] = hexDigits[checksum & 0xF];
+
+  do
+  {
+    if (!writeAll(conn->fd, packet, length + 4))
+      break;
+    if (conn->noAck)
+    {
+      ok = 1;
+      break;
+    }
+    while ((c = readByte(conn)) != '+' && c != '-' && c >= 0);
+    ok = c == '+';
+  } while (c == '-');
+
+  free(packet);
+  return ok;
+}
+
+static int sendString(gdb_connection_t *conn, const char *string) {
+
+  return sendPacket(conn, string, strlen(string));
+}
+
+/* Appends value as 8 little-endian bytes in hex. */
+static char *formatRegister(char *out, uint64_t value) {
+
+  for (int i = 0; i < 8; i++, value >>= 8)
+  {
+    *out++ = hexDigits[(value >> 4) & 0xF];
+    *out++ = hexDigits[value & 0xF];
+  }
+  return out;
+}
+
+/* Parses 8 little-endian bytes in hex. Returns 1 in case of success. */
+static int parseRegister(const char *in, uint64_t *value) {
+
+  *value = 0;
+  for (int i = 0; i < 8; i++)
+  {
+    int high = hexValue(in[2 * i]), low = hexValue(in[2 * i + 1]);
+    if (high < 0 || low < 0)
+      return 0;
+    *value |= (uint64_t) (high << 4 | low) << (8 * i);
+  }
+  return 1;
+}
+
+static uint64_t *registerSlot(gdb_target_t *target, int reg) {
+
+  if (reg < GDB_REG_PC)
+    return &target->state->registerFile[reg];
+  return &target->state->programCounter;
+}
+
+static uint64_t readRegister(gdb_target_t *target, int reg) {
+
+  if (reg == GDB_REG_CC)
+    return getConditionCodes(target->state);
+  return *registerSlot(target, reg);
+}
+
+static void writeRegister(gdb_target_t *target, int reg, uint64_t value) {
+
+  if (reg == GDB_REG_CC)
+  {
+    getConditionCodes(target->state);
+    target->state->conditionCodes = value;
+  }
+  else
+    *registerSlot(target, reg) = value;
+
+  if (reg == GDB_REG_PC)
+    fetchInstruction(target->state, target->instr);
+}
+
+/* Parses "ADDR,LENGTH" followed by terminator. Returns a pointer past
+   the terminator, or NULL if the syntax is invalid. */
+static char *parseRange(char *in, uint64_t *address, uint64_t *length,
+			char terminator) {
+
+  char *end;
+
+  *address = strtoul(in, &end, 16);
+  if (end == in || *end != ',')
+    return NULL;
+  in = end + 1;
+  *length = strtoul(in, &end, 16);
+  if (end == in || *end != terminator)
+    return NULL;
+  return end + (terminator != '\0');
+}
+
+static int rangeValid(machine_state_t *state, uint64_t address, uint64_t length) {
+
+  return address <= state->programSize && length <= state->programSize - address;
+}
+
+static const char *stopReply(stop_reason_t reason) {
+
+  switch (reason)
+  {
+  case STOP_HALT:
+    return "W00";
+  case STOP_INVALID:
+    return "S04";
+  case STOP_INTERRUPTED:
+    return "S02";
+  default:
+    return "S05";
+  }
+}
+
+/* Handles one packet and sends its reply. Returns 1 to keep serving, or
+   0 if the connection is finished (detach, kill or error). */
+static int handlePacket(gdb_connection_t *conn, gdb_target_t *target,
+			char *packet, long length, char *reply) {
+
+  machine_state_t *state = target->state;
+  uint64_t address, size, value;
+  char *out = reply, *data;
+
+  switch (packet[0])
+  {
+  case '?':
+    return sendString(conn, "S05");
+
+  case 'g':
+    for (int reg = 0; reg < GDB_NUM_REGISTERS; reg++)
+      out = formatRegister(out, readRegister(target, reg));
+    return sendPacket(conn, reply, out - reply);
+
+  case 'G':
+    if (length - 1 < 16 * GDB_NUM_REGISTERS)
+      return sendString(conn, "E16");
+    for (int reg = 0; reg < GDB_NUM_REGISTERS; reg++)
+    {
+      if (!parseRegister(packet + 1 + 16 * reg, &value))
+	return sendString(conn, "E16");
+      writeRegister(target, reg, value);
+    }
+    return sendString(conn, "OK");
+
+  case 'p':
+    value = strtoul(packet + 1, NULL, 16);
+    if (value >= GDB_NUM_REGISTERS)
+      return sendString(conn, "E16");
+    out = formatRegister(out, readRegister(target, value));
+    return sendPacket(conn, reply, out - reply);
+
+  case 'P':
+    value = strtoul(packet + 1, &data, 16);
+    if (value >= GDB_NUM_REGISTERS || *data != '=' ||
+	strlen(data + 1) < 16 || !parseRegister(data + 1, &size))
+      return sendString(conn, "E16");
+    writeRegister(target, value, size);
+    return sendString(conn, "OK");
+
+  case 'm':
+    if (!parseRange(packet + 1, &address, &size, '\0') ||
+	size > GDB_PACKET_SIZE / 2)
+      return sendString(conn, "E16");
+    if (!rangeValid(state, address, 1))
+      return sendString(conn, "E0e");
+    if (!rangeValid(state, address, size))
+      size = state->programSize - address;
+    for (uint64_t i = 0; i < size; i++)
+    {
+      uint8_t byte = state->programMap[address + i];
+      *out++ = hexDigits[byte >> 4];
+      *out++ = hexDigits[byte & 0xF];
+    }
+    return sendPacket(conn, reply, out - reply);
+
+  case 'M':
+    data = parseRange(packet + 1, &address, &size, ':');
+    if (!data || (uint64_t) (packet + length - data) < 2 * size)
+      return sendString(conn, "E16");
+    if (!rangeValid(state, address, size))
+      return sendString(conn, "E0e");
+    for (uint64_t i = 0; i < size; i++)
+    {
+      int high = hexValue(data[2 * i]), low = hexValue(data[2 * i + 1]);
+      if (high < 0 || low < 0)
+	return sendString(conn, "E16");
+      memWriteByte(state, address + i, high << 4 | low);
+    }
+    fetchInstruction(state, target->instr);
+    return sendString(conn, "OK");
+
+  case 'X':
+    // binary data, with '}' escaping the next byte (xor 0x20)
+    data = parseRange(packet + 1, &address, &size, ':');
+    if (!data)
+      return sendString(conn, "E16");
+    if (!rangeValid(state, address, size))
+      return sendString(conn, "E0e");
+    for (uint64_t i = 0; i < size; i++)
+    {
+      if (data >= packet + length)
+	return sendString(conn, "E16");
+      uint8_t byte = *data++;
+      if (byte == '}' && data < packet + length)
+	byte = *data++ ^ 0x20;
+      memWriteByte(state, address + i, byte);
+    }
+    fetchInstruction(state, target->instr);
+    return sendString(conn, "OK");
+
+  case 's':
+  case 'c':
+    // an optional resume address
+    if (packet[1])
+    {
+      state->programCounter = strtoul(packet + 1, NULL, 16);
+      fetchInstruction(state, target->instr);
+    }
+    if (target->instr->icode == I_HALT && target->instr->ifun == 0)
+      return sendString(conn, stopReply(STOP_HALT));
+    return sendString(conn, stopReply(packet[0] == 's' ?
+				      target->step(state, target->instr) :
+				      target->resume(state, target->instr,
+						     clientInterrupted, conn)));
+
+  case 'Z':
+  case 'z':
+    // only software breakpoints (type 0) are supported
+    if (packet[1] != '0' || packet[2] != ',')
+      return sendString(conn, "");
+    address = strtoul(packet + 3, NULL, 16);
+    if (packet[0] == 'Z')
+      target->addBreakpoint(address);
+    else
+      target->deleteBreakpoint(address);
+    return sendString(conn, "OK");
+
+  case 'H':
+    return sendString(conn, "OK");
+
+  case 'D':
+    sendString(conn, "OK");
+    return 0;
+
+  case 'k':
+    return 0;
+
+  case 'q':
+    if (strncmp(packet, "qSupported", 10) == 0)
+    {
+      sprintf(reply, "PacketSize=%x;qXfer:features:read+;QStartNoAckMode+",
+	      GDB_PACKET_SIZE);
+      return sendString(conn, reply);
+    }
+    if (strcmp(packet, "qAttached") == 0)
+      return sendString(conn, "1");
+    if (strncmp(packet, XFER_TARGET, sizeof(XFER_TARGET) - 1) == 0)
+    {
+      uint64_t offset;
+      if (!parseRange(packet + sizeof(XFER_TARGET) - 1, &offset, &size, '\0'))
+	return sendString(conn, "E16");
+      if (offset >= sizeof(targetXML) - 1)
+	return sendString(conn, "l");
+      if (size > sizeof(targetXML) - 1 - offset)
+	size = sizeof(targetXML) - 1 - offset;
+      if (size > GDB_PACKET_SIZE - 1)
+	size = GDB_PACKET_SIZE - 1;
+      reply[0] = offset + size == sizeof(targetXML) - 1 ? 'l' : 'm';
+      memcpy(reply + 1, targetXML + offset, size);
+      return sendPacket(conn, reply, size + 1);
+    }
+    return sendString(conn, "");
+
+  case 'Q':
+    if (strcmp(packet, "QStartNoAckMode") == 0)
+    {
+      int ok = sendString(conn, "OK");
+      conn->noAck = 1;
+      return ok;
+    }
+    return sendString(conn, "");
+
+  default:
+    // unsupported packets get an empty reply
+    return sendString(conn, "");
+  }
+}
+
+/* Serves the GDB remote serial protocol on endpoint (a TCP port on the
+   loopback interface, or the path of a Unix domain socket), for a
+   single client, until it detaches, kills the target or disconnects.
+   Returns 1 in case of success, or 0 if the endpoint could not be set
+   up, with errno set. */
+int gdbServe(const char *endpoint, gdb_target_t *target) {
+
+  gdb_connection_t conn;
+  int listener = openEndpoint(endpoint), one = 1;
+  char *packet, *reply;
+  long length;
+
+  if (listener < 0)
+    return 0;
+
+  printf("# Waiting for a GDB connection on %s\n", endpoint);
+  fflush(stdout);
+
+  memset(&conn, 0, sizeof(conn));
+  do
+    conn.fd = accept(listener, NULL, NULL);
+  while (conn.fd < 0 && errno == EINTR);
+  close(listener);
+  if (conn.fd < 0)
+    return 0;
+  setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  packet = malloc(GDB_PACKET_SIZE + 1);
+  reply = malloc(2 * GDB_PACKET_SIZE + 1);
+  if (!packet || !reply)
+  {
+    free(packet);
+    free(reply);
+    close(conn.fd);
+    errno = ENOMEM;
+    return 0;
+  }
+
+  while ((length = receivePacket(&conn, packet, GDB_PACKET_SIZE + 1)) >= 0 &&
+	 handlePacket(&conn, target, packet, length, reply));
+
+  free(packet);
+  free(reply);
+  close(conn.fd);
+  if (strspn(endpoint, "0123456789") != strlen(endpoint))
+    unlink(endpoint);
+  return 1;
+}
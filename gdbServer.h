@@ -0,0 +1,37 @@
+/* This file contains the prototypes and constants needed to use the
+   GDB remote serial protocol server defined in gdbServer.c
+*/
+
+#ifndef _GDBSERVER_H_
+#define _GDBSERVER_H_
+
+#include <stdint.h>
+
+#include "instruction.h"
+
+/* Register numbers used by the g, G, p and P packets: the fifteen
+   general purpose registers in y86_register_t order, then the program
+   counter and the condition codes. All registers are 64 bits wide. */
+#define GDB_REG_PC        15
+#define GDB_REG_CC        16
+#define GDB_NUM_REGISTERS 17
+
+#define GDB_PACKET_SIZE 0x10000
+
+/* Execution machinery provided by the debugger. instr always holds
+   the instruction at the current program counter, and step and resume
+   leave it that way. resume calls interrupted(data) every so many
+   instructions, and stops with STOP_INTERRUPTED once it returns 1. */
+typedef struct gdb_target {
+  machine_state_t   *state;
+  y86_instruction_t *instr;
+  stop_reason_t    (*step)(machine_state_t *state, y86_instruction_t *instr);
+  stop_reason_t    (*resume)(machine_state_t *state, y86_instruction_t *instr,
+			     int (*interrupted)(void *data), void *data);
+  void             (*addBreakpoint)(uint64_t address);
+  void             (*deleteBreakpoint)(uint64_t address);
+} gdb_target_t;
+
+int gdbServe(const char *endpoint, gdb_target_t *target);
+
+#endif /* GDBSERVER */
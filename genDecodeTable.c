@@ -0,0 +1,78 @@
+/* Build-time generator for the instruction decode table used by
+   fetchInstruction(). The generated table is indexed by the first
+   byte of an instruction and describes the icode, ifun, length,
+   operand layout and valid register encodings of every possible
+   opcode. Since the description below is written in terms of the
+   enums in instruction.h, regenerating the table as part of the build
+   keeps the decoder in sync with those enums.
+
+   Usage: genDecodeTable > decodeTable.c
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "instruction.h"
+
+#define ANY_REG   0xFFFF                  // any value in the nibble
+#define REG_ONLY  (0xFFFF & ~(1 << R_NONE)) // a real register (not F)
+#define NONE_ONLY (1 << R_NONE)           // must be F
+
+typedef struct icode_spec {
+  const char *name;
+  uint8_t     maxIfun;
+  uint8_t     length;
+  uint8_t     hasRegs;
+  uint8_t     valCOffset;
+  uint16_t    rAMask;
+  uint16_t    rBMask;
+  uint8_t     status;
+} icode_spec_t;
+
+/* Layout of every defined icode, as described in the Y86-64
+   specification. Entries not listed here are invalid opcodes. */
+static const icode_spec_t spec[16] = {
+  [I_HALT]   = {"I_HALT",   0,    1, 0, 0, ANY_REG,   ANY_REG,   0},
+  [I_NOP]    = {"I_NOP",    0,    1, 0, 0, ANY_REG,   ANY_REG,   1},
+  [I_RRMVXX] = {"I_RRMVXX", C_G,  2, 1, 0, REG_ONLY,  REG_ONLY,  1},
+  [I_IRMOVQ] = {"I_IRMOVQ", 0,   10, 1, 2, NONE_ONLY, REG_ONLY,  1},
+  [I_RMMOVQ] = {"I_RMMOVQ", 0,   10, 1, 2, REG_ONLY,  REG_ONLY,  1},
+  [I_MRMOVQ] = {"I_MRMOVQ", 0,   10, 1, 2, REG_ONLY,  REG_ONLY,  1},
+  [I_OPQ]    = {"I_OPQ",    A_MODQ, 2, 1, 0, REG_ONLY, REG_ONLY, 1},
+  [I_JXX]    = {"I_JXX",    C_G,  9, 0, 1, ANY_REG,   ANY_REG,   1},
+  [I_CALL]   = {"I_CALL",   0,    9, 0, 1, ANY_REG,   ANY_REG,   1},
+  [I_RET]    = {"I_RET",    0,    1, 0, 0, ANY_REG,   ANY_REG,   1},
+  [I_PUSHQ]  = {"I_PUSHQ",  0,    2, 1, 0, REG_ONLY,  NONE_ONLY, 1},
+  [I_POPQ]   = {"I_POPQ",   0,    2, 1, 0, REG_ONLY,  NONE_ONLY, 1},
+};
+
+int main(void) {
+
+  printf("/* Generated by genDecodeTable from instruction.h. "
+	 "Do not edit. */\n\n");
+  printf("#include \"instruction.h\"\n\n");
+  printf("const y86_decode_entry_t decodeTable[256] = {\n");
+
+  for (int byte = 0; byte < 256; byte++) {
+    int icode = byte >> 4;
+    int ifun = byte & 0x0F;
+    const icode_spec_t *s = &spec[icode];
+
+    if (s->name && ifun <= s->maxIfun) {
+      printf("  /* 0x%02X */ {%-8s, 0x%X, %2d, %d, %d, %d, 0x%04X, 0x%04X, %d},\n",
+	     byte, s->name, ifun, s->length, s->hasRegs ? 2 : 1, s->hasRegs,
+	     s->valCOffset, s->rAMask, s->rBMask, s->status);
+    }
+    else {
+      // Invalid opcodes never match a register byte. Anything other
+      // than a halt or nop encoding still needs its second byte to be
+      // present, otherwise it is reported as incomplete.
+      int needed = (icode == I_HALT || icode == I_NOP) ? 1 : 2;
+      printf("  /* 0x%02X */ {%-8s, 0x%X, %2d, %d, %d, %d, 0x%04X, 0x%04X, %d},\n",
+	     byte, "I_INVALID", ifun, needed, needed, 0, 0, 0, 0, 0);
+    }
+  }
+
+  printf("};\n");
+  return 0;
+}
@@ -0,0 +1,159 @@
+/* Guard-page memory benchmark. Runs a memory-bound Y86-64 loop (copy
+   an array, then sum it) with fetchFused/executeFused, as runs of the
+   debugger do, first with bounds-checked data accesses, then with
+   guard-page memory, and compares the results and the times. The loop
+   ends with a load beyond the end of memory, which must fail the same
+   way in both.
+
+   Usage: guardBench [passes]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <setjmp.h>
+#include <time.h>
+
+#include "instruction.h"
+#include "guardMemory.h"
+
+#define ELEMENTS 256
+#define MEMORY_SIZE 0x2000
+
+static double now(void) {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint8_t *emitQuad(uint8_t *p, uint64_t value) {
+
+  for (int i = 0; i < 8; i++)
+    *p++ = value >> (8 * i);
+  return p;
+}
+
+static uint8_t *emitIrmovq(uint8_t *p, uint64_t value, y86_register_t reg) {
+
+  *p++ = 0x30;
+  *p++ = 0xF0 | reg;
+  return emitQuad(p, value);
+}
+
+static uint8_t *emitMemory(uint8_t *p, int icode, y86_register_t rA,
+			   y86_register_t rB, uint64_t offset) {
+
+  *p++ = icode << 4;
+  *p++ = rA << 4 | rB;
+  return emitQuad(p, offset);
+}
+
+/* Runs until an instruction fails or halts, and leaves the instruction
+   where it stopped in *instr. Returns the number of instructions
+   executed. */
+static uint64_t run(machine_state_t *state, y86_instruction_t *instr) {
+
+  uint64_t executed = 0;
+  const y86_fused_t *fused;
+  int done;
+
+  while ((fused = fetchFused(state)) &&
+	 (done = executeFused(state, fused)) == fused->count)
+    executed += done;
+  if (fused)
+    executed += done;
+  fetchInstruction(state, instr);
+  if (fused)
+    instr->icode = I_INVALID;
+  return executed;
+}
+
+int main(int argc, char **argv) {
+
+  uint64_t passes = argc > 1 ? strtoul(argv[1], NULL, 0) : 100000;
+  uint8_t *image = calloc(1, MEMORY_SIZE), *p = image;
+  uint64_t outer, inner, source = 0x800, target = 0x1000;
+  volatile uint64_t executed[2] = {0, 0};
+  uint64_t results[2];
+  double elapsed[2];
+  machine_state_t state;
+  y86_instruction_t instr;
+  sigjmp_buf trap;
+
+  p = emitIrmovq(p, passes, R_RBX);
+  p = emitIrmovq(p, 8, R_R8);
+  p = emitIrmovq(p, 1, R_R9);
+  outer = p - image;
+  p = emitIrmovq(p, source, R_RSI);
+  p = emitIrmovq(p, target, R_RDI);
+  p = emitIrmovq(p, ELEMENTS, R_RCX);
+  inner = p - image;
+  p = emitMemory(p, 5, R_R10, R_RSI, 0);       // mrmovq (%rsi), %r10
+  p = emitMemory(p, 4, R_R10, R_RDI, 0);       // rmmovq %r10, (%rdi)
+  p = emitMemory(p, 5, R_R11, R_RDI, 0);       // mrmovq (%rdi), %r11
+  *p++ = 0x60; *p++ = R_R11 << 4 | R_RAX;      // addq %r11, %rax
+  *p++ = 0x60; *p++ = R_R8 << 4 | R_RSI;       // addq %r8, %rsi
+  *p++ = 0x60; *p++ = R_R8 << 4 | R_RDI;       // addq %r8, %rdi
+  *p++ = 0x61; *p++ = R_R9 << 4 | R_RCX;       // subq %r9, %rcx
+  *p++ = 0x74; p = emitQuad(p, inner);         // jne inner
+  *p++ = 0x61; *p++ = R_R9 << 4 | R_RBX;       // subq %r9, %rbx
+  *p++ = 0x74; p = emitQuad(p, outer);         // jne outer
+  p = emitMemory(p, 5, R_R12, R_RBX, MEMORY_SIZE - 4); // beyond the end
+
+  for (int i = 0; i < ELEMENTS; i++)
+    emitQuad(image + source + 8 * i, i * 0x9e3779b97f4a7c15ull);
+
+  for (int mode = 0; mode < 2; mode++)
+  {
+    memset(&state, 0, sizeof(state));
+    state.programMap = image;
+    state.programSize = MEMORY_SIZE;
+    if (!fuseCacheInit(&state) || (mode == 1 && !guardMemoryInit(&state)))
+    {
+      perror("guardBench");
+      return 1;
+    }
+
+    double start = now();
+    if (mode == 0)
+      executed[mode] = run(&state, &instr);
+    else if (!sigsetjmp(trap, 1))
+    {
+      guardMemoryArm(&state, &trap);
+      executed[mode] = run(&state, &instr);
+    }
+    else
+    {
+      // The load beyond the end trapped: in the checked run it failed
+      // after the same number of instructions
+      executed[mode] = executed[0];
+      instr.icode = I_INVALID;
+    }
+    guardMemoryDisarm(&state);
+    elapsed[mode] = now() - start;
+    results[mode] = state.registerFile[R_RAX];
+
+    if (instr.icode != I_INVALID || state.programCounter != (uint64_t) (p - image) - 10)
+    {
+      fprintf(stderr, "guardBench: the last load did not fail\n");
+      return 1;
+    }
+    fuseCacheFree(&state);
+    if (mode == 1)
+      guardMemoryFree(&state);
+  }
+
+  printf("executed %lu instructions: %.2f ns/instr bounds checked, "
+	 "%.2f ns/instr with guard pages, %.2fx\n", executed[0],
+	 elapsed[0] * 1e9 / executed[0], elapsed[1] * 1e9 / executed[1],
+	 elapsed[0] / elapsed[1]);
+  if (results[0] != results[1])
+  {
+    fprintf(stderr, "guardBench: guard-page memory gave a different result\n");
+    return 1;
+  }
+  free(image);
+  return 0;
+}
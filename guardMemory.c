@@ -0,0 +1,164 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS, MAP_NORESERVE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "guardMemory.h"
+
+/* Guard-page memory: the program's memory is copied into a reserved
+   region, so that it ends right where an inaccessible guard page
+   starts. Data accesses then skip the bounds check: addresses beyond
+   the end are clamped to the end and the access traps. The SIGSEGV
+   handler sends traps back to the run that armed it, which reports
+   the access as failed, like a bounds check would have. */
+
+// The reserved region (one per process) and the run traps go back to
+static struct {
+  uint8_t    *region;
+  size_t      size;
+  int         owned;    // released by guardMemoryFree
+  sigjmp_buf *jump;
+} guard;
+
+static void faultHandler(int signum, siginfo_t *info, void *context) {
+
+  uintptr_t address = (uintptr_t) info->si_addr;
+
+  (void) context;
+  if (guard.jump && address >= (uintptr_t) guard.region &&
+      address < (uintptr_t) guard.region + guard.size)
+    siglongjmp(*guard.jump, 1);
+
+  // Not a guest access: the fault happens again on return, and kills
+  // the process as usual
+  signal(signum, SIG_DFL);
+}
+
+static int installHandler(void) {
+
+  struct sigaction action;
+
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = faultHandler;
+  action.sa_flags = SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+  return sigaction(SIGSEGV, &action, NULL) == 0;
+}
+
+/* Moves the program's memory into a newly reserved region, with a
+   guard page after it, and installs the handler for the traps. The
+   previous state->programMap is left for the caller to release.
+   Returns 1 in case of success, or 0 in case of failure with errno
+   set; the state is then unchanged. */
+int guardMemoryInit(machine_state_t *state) {
+
+  long page = sysconf(_SC_PAGESIZE);
+  size_t span;
+  uint8_t *region;
+
+  if (guard.region)
+  {
+    errno = EBUSY;
+    return 0;
+  }
+  if (page <= 0)
+    page = 4096;
+
+  // A clamped access starts at most at the end of memory, so one guard
+  // page is enough
+  span = (state->programSize + page - 1) / page * page;
+  region = mmap(NULL, span + page, PROT_NONE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (region == MAP_FAILED)
+    return 0;
+  if (span && mprotect(region, span, PROT_READ | PROT_WRITE) < 0)
+  {
+    int error = errno;
+    munmap(region, span + page);
+    errno = error;
+    return 0;
+  }
+
+  if (!installHandler())
+  {
+    int error = errno;
+    munmap(region, span + page);
+    errno = error;
+    return 0;
+  }
+
+  guard.region = region;
+  guard.size = span + page;
+  guard.owned = 1;
+  memcpy(region + span - state->programSize, state->programMap,
+	 state->programSize);
+  state->programMap = region + span - state->programSize;
+  return 1;
+}
+
+/* Same as guardMemoryInit, for memory that already ends where
+   guardSize inaccessible bytes start, e.g. loaded by segmentsLoad():
+   it is used in place, and not released by guardMemoryFree. */
+int guardMemoryAdopt(machine_state_t *state, size_t guardSize) {
+
+  if (guard.region)
+  {
+    errno = EBUSY;
+    return 0;
+  }
+  if (!installHandler())
+    return 0;
+
+  guard.region = state->programMap;
+  guard.size = state->programSize + guardSize;
+  guard.owned = 0;
+  return 1;
+}
+
+/* Releases the memory set up by guardMemoryInit, and restores the
+   default handling of SIGSEGV. */
+void guardMemoryFree(machine_state_t *state) {
+
+  if (!guard.region)
+    return;
+  signal(SIGSEGV, SIG_DFL);
+  if (guard.owned)
+  {
+    munmap(guard.region, guard.size);
+    state->programMap = NULL;
+  }
+  guard.region = NULL;
+  guard.jump = NULL;
+  state->guardedMemory = 0;
+}
+
+/* Turns off the bounds checks of the data accesses made by
+   executeInstruction() until guardMemoryDisarm() is called, if the
+   state's memory was set up by guardMemoryInit(). An access that traps
+   returns through siglongjmp(*jump, 1), after which state->guardPC and
+   state->guardAddress tell which instruction and address it was.
+   Returns 1 if the checks are off, or 0 if they are still needed. */
+int guardMemoryArm(machine_state_t *state, sigjmp_buf *jump) {
+
+  uintptr_t map = (uintptr_t) state->programMap;
+
+  if (!guard.region || map < (uintptr_t) guard.region ||
+      map >= (uintptr_t) guard.region + guard.size)
+    return 0;
+  guard.jump = jump;
+  state->guardedMemory = 1;
+  return 1;
+}
+
+void guardMemoryDisarm(machine_state_t *state) {
+
+  state->guardedMemory = 0;
+  guard.jump = NULL;
+}
@@ -0,0 +1,19 @@
+/* This file contains the prototypes and constants needed to use the
+   guard-page memory defined in guardMemory.c
+*/
+
+#ifndef _GUARDMEMORY_H_
+#define _GUARDMEMORY_H_
+
+#include <stddef.h>
+#include <setjmp.h>
+
+#include "instruction.h"
+
+int  guardMemoryInit(machine_state_t *state);
+int  guardMemoryAdopt(machine_state_t *state, size_t guardSize);
+void guardMemoryFree(machine_state_t *state);
+int  guardMemoryArm(machine_state_t *state, sigjmp_buf *jump);
+void guardMemoryDisarm(machine_state_t *state);
+
+#endif /* GUARDMEMORY */
@@ -1,602 +1,890 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <stdint.h>
-#include <inttypes.h>
-#include <unistd.h>
-
-#include "instruction.h"
-#include "printRoutines.h"
-
-/* Reads one byte from memory, at the specified address. Stores the
-   read value into *value. Returns 1 in case of success, or 0 in case
-   of failure (e.g., if the address is beyond the limit of the memory
-   size). */
-int memReadByte(machine_state_t *state,	uint64_t address, uint8_t *value) {
-  if (address >= state->programSize)
-  {
-    return 0;
-  }
-  else
-  {
-    *value = state->programMap[address];
-    return 1;
-  }
-}
-
-/* Reads one quad-word (64-bit number) from memory in little-endian
-   format, at the specified starting address. Stores the read value
-   into *value. Returns 1 in case of success, or 0 in case of failure
-   (e.g., if the address is beyond the limit of the memory size). */
-int memReadQuadLE(machine_state_t *state, uint64_t address, uint64_t *value) {
-  if ((address + 7) >= state->programSize) // address byte and 7 more bytes for one quad-word value
-  {
-    return 0;
-  }
-  else
-  {
-    uint64_t secondByte = state->programMap[address + 1];
-    uint64_t thirdByte = state->programMap[address + 2];
-    uint64_t fourthByte = state->programMap[address + 3];
-    uint64_t fifthByte = state->programMap[address + 4];
-    uint64_t sixthByte = state->programMap[address + 5];
-    uint64_t seventhByte = state->programMap[address + 6];
-    uint64_t eighthByte = state->programMap[address + 7];
-    uint64_t newValue = state->programMap[address];
-
-    newValue = secondByte << 8 | newValue;
-    newValue = thirdByte << 16 | newValue;
-    newValue = fourthByte << 24 | newValue;
-    newValue = fifthByte << 32 | newValue;
-    newValue = sixthByte << 40 | newValue;
-    newValue = seventhByte << 48 | newValue;
-    newValue = eighthByte << 56 | newValue;
-
-    *value = newValue;
-    return 1;
-  }
-}
-
-/* Stores the specified one-byte value into memory, at the specified
-   address. Returns 1 in case of success, or 0 in case of failure
-   (e.g., if the address is beyond the limit of the memory size). */
-int memWriteByte(machine_state_t *state,  uint64_t address, uint8_t value) {
-  if (address >= state->programSize)
-  {
-    return 0;
-  }
-  else
-  {
-    state->programMap[address] = value;
-    return 1;
-  }
-}
-
-/* Stores the specified quad-word (64-bit) value into memory, at the
-   specified start address, using little-endian format. Returns 1 in
-   case of success, or 0 in case of failure (e.g., if the address is
-   beyond the limit of the memory size). */
-int memWriteQuadLE(machine_state_t *state, uint64_t address, uint64_t value) {
-  if ((address + 7) >= state->programSize) // address byte and 7 more bytes for one quad-word value
-  {
-    return 0;
-  }
-  else
-  {
-    state->programMap[address] = (value)&0xFF; // little endian
-    state->programMap[address + 1] = (value >> 8) & 0xFF;
-    state->programMap[address + 2] = (value >> 16) & 0xFF;
-    state->programMap[address + 3] = (value >> 24) & 0xFF;
-    state->programMap[address + 4] = (value >> 32) & 0xFF;
-    state->programMap[address + 5] = (value >> 40) & 0xFF;
-    state->programMap[address + 6] = (value >> 48) & 0xFF;
-    state->programMap[address + 7] = (value >> 56) & 0xFF;
-    return 1;
-  }
-
-}
-
-/*  return 0 if invalid instruction
-    return 1 if correct instruction
-    check for ifun
-    check for proper register values (e.g. rB of pushq must be F, rA of pushq is not F)
-    check icode and corresponding ifun */
-int isValidInstruction(machine_state_t *state, y86_instruction_t *instr)
-{
-  // invalid ifun and out of bound registers
-  if (instr->ifun > C_G || instr->ifun < C_NC)
-  {
-    return 0;
-  }
-  // I_HALT and I_NOP does not need rA, rB, can skip check
-  if (instr->icode != I_HALT && instr->icode != I_NOP)
-  {
-    if (instr->rA > R_NONE || instr->rA < R_RAX)
-    {
-      return 0;
-    }
-    if (instr->rB > R_NONE || instr->rB < R_RAX)
-    {
-      return 0;
-    }
-  }
-  if (instr->rA > R_NONE || instr->rA < R_RAX)
-  {
-    return 0;
-  }
-  if (instr->rB > R_NONE || instr->rB < R_RAX)
-  {
-    return 0;
-  }
-
-  // invalid icode, ifun, register cases
-  switch (instr->icode)
-  {
-  case I_HALT:
-    if (instr->ifun != 0)
-    {
-      return 0;
-    }
-    break;
-  case I_NOP:
-    if (instr->ifun != 0)
-    {
-      return 0;
-    }
-    break;
-  case I_RRMVXX:
-    if (instr->rA == R_NONE || instr->rB == R_NONE)
-    {
-      return 0;
-    }
-    break;
-  case I_IRMOVQ:
-    if ((instr->ifun != 0) || (instr->rA != R_NONE) || instr->rB == R_NONE)
-    {
-      return 0;
-    }
-    break;
-  case I_RMMOVQ:
-    if (instr->ifun != 0 || instr->rA == R_NONE || instr->rB == R_NONE)
-    {
-      return 0;
-    }
-    break;
-  case I_MRMOVQ:
-    if (instr->ifun != 0 || instr->rA == R_NONE || instr->rB == R_NONE)
-    {
-      return 0;
-    }
-    break;
-  case I_OPQ:
-    if (instr->rA == R_NONE || instr->rB == R_NONE)
-    {
-      return 0;
-    }
-    break;
-  case I_JXX:
-    break; //do nothing
-  case I_CALL:
-    if (instr->ifun != 0)
-    {
-      return 0;
-    }
-    break;
-  case I_RET:
-    if (instr->ifun != 0)
-    {
-      return 0;
-    }
-    break;
-  case I_PUSHQ:
-    if ((instr->ifun != 0) || (instr->rA == R_NONE) || (instr->rB != R_NONE))
-    {
-      return 0;
-    }
-    break;
-  case I_POPQ:
-    if ((instr->ifun != 0) || (instr->rA == R_NONE) || (instr->rB != R_NONE))
-    {
-      return 0;
-    }
-    break;
-  case I_INVALID:
-    return 0;
-    break;
-  case I_TOO_SHORT:
-    return 0;
-    break;
-  }
-
-  // valid case
-  return 1;
-}
-
-/* Fetches one instruction from memory, at the address specified by
-   the program counter. Does not modify the machine's state. The
-   resulting instruction is stored in *instr. Returns 1 if the
-   instruction is a valid non-halt instruction, or 0 (zero)
-   otherwise. */
-int fetchInstruction(machine_state_t *state, y86_instruction_t *instr) {
-  instr->location = state->programCounter;
-
-  uint8_t firstByte;
-  uint8_t secondByte;
-  int checkInstrTooShort;
-
-  if (!memReadByte(state, state->programCounter, &firstByte))
-  {
-    instr->icode = I_TOO_SHORT;
-    return 0;
-  }
-
-  instr->icode = firstByte >> 4;
-  instr->ifun = firstByte & 0x0F;
-
-  if(instr->icode != I_HALT && instr->icode != I_NOP){
-    if (!memReadByte(state, state->programCounter + 1, &secondByte))
-    {
-      instr->icode = I_TOO_SHORT;
-      return 0;
-    }
-    instr->rA = secondByte >> 4;
-    instr->rB = secondByte & 0x0F;
-  }
-
-  if (!isValidInstruction(state, instr)){
-    instr->icode = I_INVALID;
-  }
-
-  // valid non-halt instructions
-  switch (instr->icode)
-  {
-  case I_HALT:
-    instr->valP = state->programCounter + 1;
-    return 0;
-    break;
-  case I_NOP:
-    instr->valP = state->programCounter + 1;
-    return 1;
-    break;
-  case I_RRMVXX:
-    instr->valP = state->programCounter + 2;
-    return 1;
-    break;
-  case I_IRMOVQ:
-    checkInstrTooShort = memReadQuadLE(state, state->programCounter + 2, &instr->valC);
-    if (checkInstrTooShort == 0)
-    {
-      instr->icode = I_TOO_SHORT;
-      return 0;
-    }
-    instr->valP = state->programCounter + 10;
-    return 1;
-    break;
-  case I_RMMOVQ:
-    checkInstrTooShort = memReadQuadLE(state, state->programCounter + 2, &instr->valC);
-    if (checkInstrTooShort == 0)
-    {
-      instr->icode = I_TOO_SHORT;
-      return 0;
-    }
-    instr->valP = state->programCounter + 10;
-    return 1;
-    break;
-  case I_MRMOVQ:
-    checkInstrTooShort = memReadQuadLE(state, state->programCounter + 2, &instr->valC);
-    if (checkInstrTooShort == 0)
-    {
-      instr->icode = I_TOO_SHORT;
-      return 0;
-    }
-    instr->valP = state->programCounter + 10;
-    return 1;
-    break;
-  case I_OPQ:
-    instr->valP = state->programCounter + 2;
-    return 1;
-    break;
-  case I_JXX:
-    checkInstrTooShort = memReadQuadLE(state, state->programCounter + 1, &instr->valC);
-    if (checkInstrTooShort == 0)
-    {
-      instr->icode = I_TOO_SHORT;
-      return 0;
-    }
-    instr->valP = state->programCounter + 9;
-    return 1;
-    break;
-  case I_CALL:
-    checkInstrTooShort = memReadQuadLE(state, state->programCounter + 1, &instr->valC);
-    if (checkInstrTooShort == 0)
-    {
-      instr->icode = I_TOO_SHORT;
-      return 0;
-    }
-    instr->valP = state->programCounter + 9;
-    return 1;
-    break;
-  case I_RET:
-    instr->valP = state->programCounter + 1;
-    return 1;
-    break;
-  case I_PUSHQ:
-    instr->valP = state->programCounter + 2;
-    return 1;
-    break;
-  case I_POPQ:
-    instr->valP = state->programCounter + 2;
-    return 1;
-    break;
-  case I_INVALID:
-    return 0;
-    break;
-  case I_TOO_SHORT:
-    return 0;
-    break;
-  default:
-    instr->icode = I_INVALID;
-    return 0;
-    break;
-  }
-}
-
-/* Executes the instruction specified by *instr, modifying the
-   machine's state (memory, registers, condition codes, program
-   counter) in the process. Returns 1 if the instruction was executed
-   successfully, or 0 if there was an error. Typical errors include an
-   invalid instruction or a memory access to an invalid address. */
-int executeInstruction(machine_state_t *state, y86_instruction_t *instr) {
-  switch (instr->icode)
-  {
-  case I_HALT:
-    return 1;
-    break;
-  case I_NOP:
-    state->programCounter = instr->valP;
-    return 1;
-    break;
-  case I_RRMVXX:
-    switch (instr->ifun)
-    {
-    case C_NC:
-      // no condition case or simply the RRMVXX case
-      state->registerFile[instr->rB] = state->registerFile[instr->rA];
-      state->programCounter = instr->valP;
-      break;
-    case C_LE:
-      if ((state->conditionCodes & CC_ZERO_MASK) != 0 ||
-          (state->conditionCodes & CC_SIGN_MASK) != 0)
-      {
-        state->registerFile[instr->rB] = state->registerFile[instr->rA];
-      }
-      state->programCounter = instr->valP;
-      break;
-    case C_L:
-      if ((state->conditionCodes & CC_SIGN_MASK) != 0)
-      {
-        state->registerFile[instr->rB] = state->registerFile[instr->rA];
-      };
-      state->programCounter = instr->valP;
-      break;
-    case C_E:
-      if ((state->conditionCodes & CC_ZERO_MASK) != 0)
-      {
-        state->registerFile[instr->rB] = state->registerFile[instr->rA];
-      };
-      state->programCounter = instr->valP;
-      break;
-    case C_NE:
-      if ((state->conditionCodes & CC_ZERO_MASK) == 0)
-      {
-        state->registerFile[instr->rB] = state->registerFile[instr->rA];
-      };
-      state->programCounter = instr->valP;
-      break;
-    case C_GE:
-      if ((state->conditionCodes & CC_SIGN_MASK) == 0)
-      {
-        state->registerFile[instr->rB] = state->registerFile[instr->rA];
-      };
-      state->programCounter = instr->valP;
-      break;
-    case C_G:
-      if (((state->conditionCodes & CC_ZERO_MASK) == 0) && ((state->conditionCodes & CC_SIGN_MASK) == 0))
-      {
-        state->registerFile[instr->rB] = state->registerFile[instr->rA];
-      };
-      state->programCounter = instr->valP;
-      break;
-    }
-    return 1;
-    break;
-  case I_IRMOVQ:
-    state->registerFile[instr->rB] = instr->valC;
-    state->programCounter = instr->valP;
-    return 1;
-    break;
-  case I_RMMOVQ:
-    if(memWriteQuadLE(state, state->registerFile[instr->rB] + instr->valC, state->registerFile[instr->rA]) == 0){
-      instr->icode = I_INVALID;
-      return 0;
-    }
-    state->programCounter = instr->valP;
-    return 1;
-    break;
-  case I_MRMOVQ:
-    if(memReadQuadLE(state, state->registerFile[instr->rB] + instr->valC, &state->registerFile[instr->rA]) == 0) {
-      instr->icode = I_INVALID;
-      return 0;
-    }
-    state->programCounter = instr->valP;
-    return 1;
-    break;
-  case I_OPQ:
-    switch (instr->ifun)
-    {
-    case A_ADDQ:
-      state->registerFile[instr->rB] = state->registerFile[instr->rB] + state->registerFile[instr->rA];
-      break;
-    case A_SUBQ:
-      state->registerFile[instr->rB] = state->registerFile[instr->rB] - state->registerFile[instr->rA];
-      break;
-    case A_ANDQ:
-      state->registerFile[instr->rB] = state->registerFile[instr->rB] & state->registerFile[instr->rA];
-      break;
-    case A_XORQ:
-      state->registerFile[instr->rB] = state->registerFile[instr->rB] ^ state->registerFile[instr->rA];
-      break;
-    case A_MULQ:
-      state->registerFile[instr->rB] = state->registerFile[instr->rB] * state->registerFile[instr->rA];
-      break;
-    case A_DIVQ:
-      state->registerFile[instr->rB] = state->registerFile[instr->rB] / state->registerFile[instr->rA];
-      break;
-    case A_MODQ:
-      state->registerFile[instr->rB] = state->registerFile[instr->rB] % state->registerFile[instr->rA];
-      break;
-    }
-
-    // check condition code
-    if (!((~state->registerFile[instr->rB] + 1) & 0x8000000000000000))
-    { //if <=0
-      if ((state->registerFile[instr->rB] & 0x8000000000000000) != 0)
-      {
-        state->conditionCodes = CC_SIGN_MASK; //if < 0
-      }
-      else
-      { //if == 0
-        state->conditionCodes = CC_ZERO_MASK;
-      }
-    }
-    else if (state->registerFile[instr->rB] > 0)
-    {
-      state->conditionCodes = CC_SIGN_MASK & CC_ZERO_MASK;
-    }
-    else
-    { //if !=0
-      state->conditionCodes = CC_SIGN_MASK & CC_ZERO_MASK;
-    }
-
-    // update PC
-    state->programCounter = instr->valP;
-    return 1;
-    break;
-  case I_JXX:
-    switch (instr->ifun)
-    {
-    case C_NC: //no condition
-      state->programCounter = instr->valC;
-      break;
-    case C_LE: //<=0
-      if (((state->conditionCodes & CC_ZERO_MASK) != 0) ||
-          ((state->conditionCodes & CC_SIGN_MASK) != 0))
-      {
-        state->programCounter = instr->valC;
-      }
-      else
-      {
-        state->programCounter = instr->valP;
-      }
-      break;
-    case C_L: //<0
-      if ((state->conditionCodes & CC_SIGN_MASK) != 0)
-      {
-        state->programCounter = instr->valC;
-      }
-      else
-      {
-        state->programCounter = instr->valP;
-      }
-      break;
-    case C_E: //==0
-      if ((state->conditionCodes & CC_ZERO_MASK) != 0)
-      {
-        state->programCounter = instr->valC;
-      }
-      else
-      {
-        state->programCounter = instr->valP;
-      }
-      break;
-    case C_NE: //!=0
-      if ((state->conditionCodes & CC_ZERO_MASK) == 0)
-      {
-        state->programCounter = instr->valC;
-      }
-      else
-      {
-        state->programCounter = instr->valP;
-      }
-      break;
-    case C_GE: //>=0
-      if ((state->conditionCodes & CC_SIGN_MASK) == 0)
-      {
-        state->programCounter = instr->valC;
-      }
-      else
-      {
-        state->programCounter = instr->valP;
-      }
-      break;
-    case C_G: //>0
-      if (((state->conditionCodes & CC_ZERO_MASK) == 0) && ((state->conditionCodes & CC_SIGN_MASK) == 0))
-      {
-        state->programCounter = instr->valC;
-      }
-      else
-      {
-        state->programCounter = instr->valP;
-      }
-      break;
-    }
-    return 1;
-    break;
-  case I_CALL:
-    state->registerFile[4] = state->registerFile[4] - 8;
-    if(memWriteQuadLE(state, state->registerFile[4], instr->valP) == 0){
-      instr->icode = I_INVALID;
-      return 0;
-    }
-    state->programCounter = instr->valC;
-    return 1;
-    break;
-  case I_RET:
-    if(memReadQuadLE(state, state->registerFile[4], &state->programCounter) == 0){
-      instr->icode = I_INVALID;
-      return 0;
-    }
-    state->registerFile[4] = state->registerFile[4] + 8;
-    return 1;
-    break;
-  case I_PUSHQ:
-    if(memWriteQuadLE(state, state->registerFile[4] - 8, state->registerFile[instr->rA]) == 0){
-      instr->icode = I_INVALID;
-      return 0;
-    }
-    state->registerFile[4] = state->registerFile[4] - 8;
-    state->programCounter = instr->valP;
-    return 1;
-    break;
-  case I_POPQ: ;
-    uint64_t poppedValue;
-    if(memReadQuadLE(state, state->registerFile[4], &poppedValue) == 0)
-    {
-      instr->icode = I_INVALID;
-      return 0;
-    }
-    state->registerFile[4] = state->registerFile[4] + 8;
-    state->registerFile[instr->rA] = poppedValue;
-    state->programCounter = instr->valP;
-    return 1;
-    break;
-  case I_INVALID:
-    return 0;
-    break;
-  case I_TOO_SHORT:
-    return 0;
-    break;
-  default:
-    return 0;
-    break;
-  }
-}
+#define _POSIX_C_SOURCE 200809L // mmap
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "instruction.h"
+#include "printRoutines.h"
+#include "sparseTable.h"
+
+/* One entry of the superinstruction cache. It is valid if its
+   generation is the cache's, so invalidating the whole cache only
+   takes a new generation. */
+typedef struct y86_fuse_entry {
+  uint64_t    pc;
+  uint64_t    generation;
+  y86_fused_t fused;
+} y86_fuse_entry_t;
+
+struct y86_fuse_cache {
+  uint64_t         generation;
+  sparse_table_t   lines;      // one bit per line decoded into some entry
+  uint64_t         numLines;
+  uint64_t         lookups;
+  uint64_t         misses;
+  y86_fuse_entry_t entries[FUSE_CACHE_SIZE];
+};
+
+/* Returns the permissions that the page at index page denies. */
+static inline int pageDenies(const machine_state_t *state, uint64_t page) {
+
+  const uint8_t *denied = sparseTableFind(state->pageDenied, page);
+
+  return denied ? *denied : 0;
+}
+
+/* Returns 1 if the pages holding the bytes from first to last (at most
+   one page apart) allow perms, or 0 otherwise. Callers test
+   state->pageDenied first, so that memory without permissions costs
+   no more than a test. */
+static inline int pagesAllow(const machine_state_t *state, uint64_t first,
+			     uint64_t last, int perms) {
+
+  return !((pageDenies(state, first >> DIRTY_PAGE_SHIFT) |
+	    pageDenies(state, last >> DIRTY_PAGE_SHIFT)) & perms);
+}
+
+/* Returns 1 if the length bytes of memory starting at address are all
+   within memory and allow perms (PAGE_READ, PAGE_WRITE and/or
+   PAGE_EXEC), or 0 otherwise. */
+int memAccessible(const machine_state_t *state, uint64_t address,
+		  uint64_t length, int perms) {
+
+  if (address > state->programSize || length > state->programSize - address)
+    return 0;
+  for (uint64_t page = address >> DIRTY_PAGE_SHIFT;
+       state->pageDenied && length && page <= (address + length - 1) >> DIRTY_PAGE_SHIFT;
+       page++)
+    if (pageDenies(state, page) & perms)
+      return 0;
+  return 1;
+}
+
+/* Reads one byte from memory, at the specified address. Stores the
+   read value into *value. Returns 1 in case of success, or 0 in case
+   of failure (e.g., if the address is beyond the limit of the memory
+   size). */
+int memReadByte(machine_state_t *state,	uint64_t address, uint8_t *value) {
+  if (address >= state->programSize ||
+      (state->pageDenied && !pagesAllow(state, address, address, PAGE_READ)))
+  {
+    return 0;
+  }
+  else
+  {
+    *value = state->programMap[address];
+    return 1;
+  }
+}
+
+/* Reads one quad-word (64-bit number) from memory in little-endian
+   format, at the specified starting address. Stores the read value
+   into *value. Returns 1 in case of success, or 0 in case of failure
+   (e.g., if the address is beyond the limit of the memory size). */
+int memReadQuadLE(machine_state_t *state, uint64_t address, uint64_t *value) {
+  if (address >= state->programSize || state->programSize - address < 8 || // address byte and 7 more bytes, without wrapping around
+      (state->pageDenied && !pagesAllow(state, address, address + 7, PAGE_READ)))
+  {
+    return 0;
+  }
+  else
+  {
+    uint64_t secondByte = state->programMap[address + 1];
+    uint64_t thirdByte = state->programMap[address + 2];
+    uint64_t fourthByte = state->programMap[address + 3];
+    uint64_t fifthByte = state->programMap[address + 4];
+    uint64_t sixthByte = state->programMap[address + 5];
+    uint64_t seventhByte = state->programMap[address + 6];
+    uint64_t eighthByte = state->programMap[address + 7];
+    uint64_t newValue = state->programMap[address];
+
+    newValue = secondByte << 8 | newValue;
+    newValue = thirdByte << 16 | newValue;
+    newValue = fourthByte << 24 | newValue;
+    newValue = fifthByte << 32 | newValue;
+    newValue = sixthByte << 40 | newValue;
+    newValue = seventhByte << 48 | newValue;
+    newValue = eighthByte << 56 | newValue;
+
+    *value = newValue;
+    return 1;
+  }
+}
+
+/* Records that the page containing address has been written to. */
+static inline void markDirty(machine_state_t *state, uint64_t address) {
+
+  uint64_t page = address >> DIRTY_PAGE_SHIFT;
+  state->dirtyPages[page / 64] |= 1ull << (page % 64);
+}
+
+/* Invalidates the superinstruction cache if any of the bytes from
+   first to last were decoded into it. */
+static inline void fuseCacheWrite(machine_state_t *state, uint64_t first,
+				  uint64_t last) {
+
+  const sparse_table_t *lines = &state->fuseCache->lines;
+
+  for (uint64_t line = first >> FUSE_LINE_SHIFT; line <= last >> FUSE_LINE_SHIFT; line++)
+    if (sparseTableTestBit(lines, line))
+    {
+      fuseCacheInvalidate(state);
+      return;
+    }
+}
+
+/* Accounts for a write to the bytes from first to last in the dirty
+   pages and the superinstruction cache. */
+static inline void trackWrite(machine_state_t *state, uint64_t first,
+			      uint64_t last) {
+
+  if (state->dirtyPages)
+  {
+    markDirty(state, first);
+    markDirty(state, last);
+  }
+  if (state->fuseCache)
+    fuseCacheWrite(state, first, last);
+}
+
+/* Stores the specified one-byte value into memory, at the specified
+   address. Returns 1 in case of success, or 0 in case of failure
+   (e.g., if the address is beyond the limit of the memory size). */
+int memWriteByte(machine_state_t *state,  uint64_t address, uint8_t value) {
+  if (address >= state->programSize ||
+      (state->pageDenied && !pagesAllow(state, address, address, PAGE_WRITE)))
+  {
+    return 0;
+  }
+  else
+  {
+    state->programMap[address] = value;
+    trackWrite(state, address, address);
+    return 1;
+  }
+}
+
+/* Stores the specified quad-word (64-bit) value into memory, at the
+   specified start address, using little-endian format. Returns 1 in
+   case of success, or 0 in case of failure (e.g., if the address is
+   beyond the limit of the memory size). */
+int memWriteQuadLE(machine_state_t *state, uint64_t address, uint64_t value) {
+  if (address >= state->programSize || state->programSize - address < 8 || // address byte and 7 more bytes, without wrapping around
+      (state->pageDenied && !pagesAllow(state, address, address + 7, PAGE_WRITE)))
+  {
+    return 0;
+  }
+  else
+  {
+    state->programMap[address] = (value)&0xFF; // little endian
+    state->programMap[address + 1] = (value >> 8) & 0xFF;
+    state->programMap[address + 2] = (value >> 16) & 0xFF;
+    state->programMap[address + 3] = (value >> 24) & 0xFF;
+    state->programMap[address + 4] = (value >> 32) & 0xFF;
+    state->programMap[address + 5] = (value >> 40) & 0xFF;
+    state->programMap[address + 6] = (value >> 48) & 0xFF;
+    state->programMap[address + 7] = (value >> 56) & 0xFF;
+    trackWrite(state, address, address + 7);
+    return 1;
+  }
+
+}
+
+/* Hashes size bytes of image, a quad-word at a time. */
+uint64_t imageHash(const uint8_t *image, uint64_t size) {
+
+  uint64_t hash = size, quad;
+
+  for (uint64_t i = 0; i < size; i += 8)
+  {
+    quad = 0;
+    memcpy(&quad, image + i, size - i < 8 ? size - i : 8);
+    hash = (hash ^ quad) * 0x9e3779b97f4a7c15ull;
+    hash ^= hash >> 29;
+  }
+  return hash;
+}
+
+/* Hashes the first size bytes of the file open as fd, which imageHash
+   would give for them once loaded, and stores the hash in *hash.
+   Returns 1 in case of success, or 0 in case of failure with errno
+   set. */
+int imageFileHash(int fd, uint64_t size, uint64_t *hash) {
+
+  uint8_t *image;
+
+  if (!size)
+  {
+    *hash = imageHash(NULL, 0);
+    return 1;
+  }
+  image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (image == MAP_FAILED)
+    return 0;
+  *hash = imageHash(image, size);
+  munmap(image, size);
+  return 1;
+}
+
+/* Registers a function to be called for every data memory access
+   made by executeInstruction(). Returns 1 in case of success, or 0 if
+   too many hooks are already registered. */
+int addMemAccessHook(machine_state_t *state, mem_access_hook_t hook, void *data) {
+
+  if (state->numMemAccessHooks >= MAX_MEM_ACCESS_HOOKS)
+    return 0;
+
+  state->memAccessHooks[state->numMemAccessHooks] = hook;
+  state->memAccessHookData[state->numMemAccessHooks] = data;
+  state->numMemAccessHooks++;
+  return 1;
+}
+
+/* Removes a hook previously registered with addMemAccessHook. Nothing
+   happens if it is not registered. */
+void removeMemAccessHook(machine_state_t *state, mem_access_hook_t hook, void *data) {
+
+  for (int i = 0; i < state->numMemAccessHooks; i++)
+  {
+    if (state->memAccessHooks[i] == hook && state->memAccessHookData[i] == data)
+    {
+      state->numMemAccessHooks--;
+      for (int j = i; j < state->numMemAccessHooks; j++)
+      {
+	state->memAccessHooks[j] = state->memAccessHooks[j + 1];
+	state->memAccessHookData[j] = state->memAccessHookData[j + 1];
+      }
+      return;
+    }
+  }
+}
+
+static void notifyMemAccess(machine_state_t *state, const y86_instruction_t *instr,
+			    uint64_t address, uint64_t value, int isWrite) {
+
+  for (int i = 0; i < state->numMemAccessHooks; i++)
+    state->memAccessHooks[i](state->memAccessHookData[i], instr, address,
+			     value, isWrite);
+}
+
+/* Reads a little-endian quad-word starting at the specified host
+   pointer. The caller is responsible for checking that all eight
+   bytes are within the program image. */
+static inline uint64_t loadQuadLE(const uint8_t *p) {
+  return (uint64_t) p[0]       | (uint64_t) p[1] << 8  |
+         (uint64_t) p[2] << 16 | (uint64_t) p[3] << 24 |
+         (uint64_t) p[4] << 32 | (uint64_t) p[5] << 40 |
+         (uint64_t) p[6] << 48 | (uint64_t) p[7] << 56;
+}
+
+/* Stores a little-endian quad-word starting at the specified host
+   pointer. The last byte is written first, so that if the quad-word
+   runs into a guard page nothing is written. A quad-word that starts
+   on a page that may be read-only (a segment without w) and ends on a
+   writable one first stores its first byte back, which traps before
+   anything is written. */
+static inline void storeQuadLE(uint8_t *p, uint64_t value) {
+  if (((uintptr_t) p & (DIRTY_PAGE_SIZE - 1)) > DIRTY_PAGE_SIZE - 8)
+    *(volatile uint8_t *) p = *p;
+  for (int i = 7; i >= 0; i--)
+    p[i] = value >> (8 * i);
+}
+
+/* Host address of a data access with guard-page memory. Addresses
+   beyond the end of memory are clamped to the end, without a branch,
+   so that the guard page that follows makes the access trap. */
+static inline uint8_t *guardedAddress(machine_state_t *state,
+				      const y86_instruction_t *instr,
+				      uint64_t address) {
+
+  state->guardPC = instr->location;
+  state->guardAddress = address;
+  return state->programMap +
+    (address < state->programSize ? address : state->programSize);
+}
+
+/* Data memory accesses made on behalf of an instruction. Same as
+   memReadQuadLE and memWriteQuadLE, but the access is also reported to
+   any registered memory access hooks. */
+static inline int dataReadQuad(machine_state_t *state, const y86_instruction_t *instr,
+			       uint64_t address, uint64_t *value) {
+
+  if (state->guardedMemory)
+    *value = loadQuadLE(guardedAddress(state, instr, address));
+  else if (!memReadQuadLE(state, address, value))
+    return 0;
+  state->dataReads++;
+  if (state->numMemAccessHooks)
+    notifyMemAccess(state, instr, address, *value, 0);
+  return 1;
+}
+
+static inline int dataWriteQuad(machine_state_t *state, const y86_instruction_t *instr,
+				uint64_t address, uint64_t value) {
+
+  if (state->guardedMemory)
+  {
+    storeQuadLE(guardedAddress(state, instr, address), value);
+    trackWrite(state, address, address + 7);
+  }
+  else if (!memWriteQuadLE(state, address, value))
+    return 0;
+  state->dataWrites++;
+  if (state->numMemAccessHooks)
+    notifyMemAccess(state, instr, address, value, 1);
+  return 1;
+}
+
+/* Decodes the instruction at pc, as described for fetchInstruction
+   below. */
+static inline int decodeAt(machine_state_t *state, uint64_t pc,
+			   y86_instruction_t *instr) {
+
+  instr->location = pc;
+
+  if (pc >= state->programSize)
+  {
+    instr->icode = I_TOO_SHORT;
+    return 0;
+  }
+
+  const uint8_t *bytes = state->programMap + pc;
+  const y86_decode_entry_t *entry = &decodeTable[bytes[0]];
+  uint64_t available = state->programSize - pc;
+
+  if (available < entry->minLength)
+  {
+    instr->icode = I_TOO_SHORT;
+    return 0;
+  }
+
+  // Instructions without a register byte read their own first byte
+  // here, and regOffset - 1 (all ones) turns both nibbles into R_NONE.
+  uint8_t regByte = bytes[entry->regOffset] | (uint8_t) (entry->regOffset - 1);
+
+  instr->icode = entry->icode;
+  instr->ifun = entry->ifun;
+  instr->rA = regByte >> 4;
+  instr->rB = regByte & 0x0F;
+  instr->valP = pc + entry->length;
+
+  if (!((entry->rAMask >> instr->rA) & (entry->rBMask >> instr->rB) & 1))
+  {
+    instr->icode = I_INVALID;
+    return 0;
+  }
+
+  if (available < entry->length)
+  {
+    instr->icode = I_TOO_SHORT;
+    return 0;
+  }
+
+  if (state->pageDenied && !pagesAllow(state, pc, instr->valP - 1, PAGE_EXEC))
+  {
+    instr->icode = I_INVALID;
+    return 0;
+  }
+
+  // Always load eight bytes so that no branch depends on the opcode.
+  // Instructions without valC read their own bytes (or zeros, close to
+  // the end of the image) and the result is masked out.
+  static const uint8_t noValC[8];
+  const uint8_t *valCBytes = available >= 8u + entry->valCOffset ?
+    bytes + entry->valCOffset : noValC;
+  instr->valC = loadQuadLE(valCBytes) & -(uint64_t) (entry->valCOffset != 0);
+
+  return entry->status;
+}
+
+/* Fetches one instruction from memory, at the address specified by
+   the program counter. Does not modify the machine's state. The
+   resulting instruction is stored in *instr. Returns 1 if the
+   instruction is a valid non-halt instruction, or 0 (zero)
+   otherwise.
+
+   Decoding is driven by decodeTable (see genDecodeTable.c): the first
+   byte selects an entry that gives the instruction's layout and the
+   set of valid register encodings, so no per-icode logic is needed
+   here. */
+int fetchInstruction(machine_state_t *state, y86_instruction_t *instr) {
+
+  return decodeAt(state, state->programCounter, instr);
+}
+
+/* Returns the machine's condition codes (a combination of the CC_*
+   masks). The codes are not computed when an arithmetic operation is
+   executed; instead, the operation and its operands are recorded and
+   the flags are derived from them here, the first time they are
+   needed afterwards. */
+uint8_t getConditionCodes(machine_state_t *state) {
+
+  if (state->ccPending)
+  {
+    uint64_t valA = state->ccValA;
+    uint64_t valB = state->ccValB;
+    uint64_t valE = state->ccResult;
+    uint8_t cc = 0;
+
+    if (valE == 0)
+      cc |= CC_ZERO_MASK;
+    if (valE >> 63)
+      cc |= CC_SIGN_MASK;
+
+    switch (state->ccOperation)
+    {
+    case A_ADDQ:
+      // overflow if both operands have the same sign, and the result
+      // does not
+      if ((~(valA ^ valB) & (valA ^ valE)) >> 63)
+        cc |= CC_OVERFLOW_MASK;
+      if (valE < valA)
+        cc |= CC_CARRY_MASK;
+      break;
+    case A_SUBQ:
+      // valE = valB - valA: overflow if the operands have different
+      // signs, and the result does not have the sign of valB
+      if (((valA ^ valB) & (valB ^ valE)) >> 63)
+        cc |= CC_OVERFLOW_MASK;
+      if (valB < valA)
+        cc |= CC_CARRY_MASK;
+      break;
+    default:
+      // logical operations, and the mulq/divq/modq extensions, clear
+      // overflow and carry
+      break;
+    }
+
+    state->conditionCodes = cc;
+    state->ccPending = 0;
+  }
+
+  return state->conditionCodes;
+}
+
+/* Returns 1 if the condition specified by ifun (one of the
+   y86_condition_t values) holds for the current condition codes, or 0
+   otherwise. */
+int conditionHolds(machine_state_t *state, uint8_t ifun) {
+
+  int zero, less;
+
+  if (ifun == C_NC)
+    return 1;
+
+  if (state->ccPending && state->ccOperation == A_SUBQ)
+  {
+    // the common compare-and-branch case needs no flags at all: SF ^ OF
+    // is a signed comparison of the operands
+    zero = state->ccValB == state->ccValA;
+    less = (int64_t) state->ccValB < (int64_t) state->ccValA;
+  }
+  else
+  {
+    uint8_t cc = getConditionCodes(state);
+    zero = (cc & CC_ZERO_MASK) != 0;
+    less = ((cc & CC_SIGN_MASK) != 0) != ((cc & CC_OVERFLOW_MASK) != 0);
+  }
+
+  switch (ifun)
+  {
+  case C_LE:
+    return less || zero;
+  case C_L:
+    return less;
+  case C_E:
+    return zero;
+  case C_NE:
+    return !zero;
+  case C_GE:
+    return !less;
+  case C_G:
+    return !less && !zero;
+  default:
+    return 0;
+  }
+}
+
+/* Executes the OPq instruction in *instr, without updating the program
+   counter. */
+static inline void executeOpq(machine_state_t *state, const y86_instruction_t *instr) {
+
+  uint64_t valA = state->registerFile[instr->rA];
+  uint64_t valB = state->registerFile[instr->rB];
+  uint64_t valE = 0;
+  switch (instr->ifun)
+  {
+  case A_ADDQ:
+    valE = valB + valA;
+    break;
+  case A_SUBQ:
+    valE = valB - valA;
+    break;
+  case A_ANDQ:
+    valE = valB & valA;
+    break;
+  case A_XORQ:
+    valE = valB ^ valA;
+    break;
+  case A_MULQ:
+    valE = valB * valA;
+    break;
+  case A_DIVQ:
+    valE = valB / valA;
+    break;
+  case A_MODQ:
+    valE = valB % valA;
+    break;
+  }
+  state->registerFile[instr->rB] = valE;
+
+  // condition codes are only computed if something reads them
+  state->ccPending = 1;
+  state->ccOperation = instr->ifun;
+  state->ccValA = valA;
+  state->ccValB = valB;
+  state->ccResult = valE;
+}
+
+/* Executes the instruction specified by *instr, modifying the
+   machine's state (memory, registers, condition codes, program
+   counter) in the process. Returns 1 if the instruction was executed
+   successfully, or 0 if there was an error. Typical errors include an
+   invalid instruction or a memory access to an invalid address. */
+int executeInstruction(machine_state_t *state, y86_instruction_t *instr) {
+  switch (instr->icode)
+  {
+  case I_HALT:
+    return 1;
+    break;
+  case I_NOP:
+    state->programCounter = instr->valP;
+    return 1;
+    break;
+  case I_RRMVXX:
+    if (conditionHolds(state, instr->ifun))
+    {
+      state->registerFile[instr->rB] = state->registerFile[instr->rA];
+    }
+    state->programCounter = instr->valP;
+    return 1;
+    break;
+  case I_IRMOVQ:
+    state->registerFile[instr->rB] = instr->valC;
+    state->programCounter = instr->valP;
+    return 1;
+    break;
+  case I_RMMOVQ:
+    if(dataWriteQuad(state, instr, state->registerFile[instr->rB] + instr->valC, state->registerFile[instr->rA]) == 0){
+      instr->icode = I_INVALID;
+      return 0;
+    }
+    state->programCounter = instr->valP;
+    return 1;
+    break;
+  case I_MRMOVQ:
+    if(dataReadQuad(state, instr, state->registerFile[instr->rB] + instr->valC, &state->registerFile[instr->rA]) == 0) {
+      instr->icode = I_INVALID;
+      return 0;
+    }
+    state->programCounter = instr->valP;
+    return 1;
+    break;
+  case I_OPQ:
+    executeOpq(state, instr);
+    state->programCounter = instr->valP;
+    return 1;
+    break;
+  case I_JXX:
+    if (conditionHolds(state, instr->ifun))
+    {
+      state->programCounter = instr->valC;
+    }
+    else
+    {
+      state->programCounter = instr->valP;
+    }
+    return 1;
+    break;
+  case I_CALL:
+    state->registerFile[4] = state->registerFile[4] - 8;
+    if(dataWriteQuad(state, instr, state->registerFile[4], instr->valP) == 0){
+      instr->icode = I_INVALID;
+      return 0;
+    }
+    state->programCounter = instr->valC;
+    return 1;
+    break;
+  case I_RET:
+    if(dataReadQuad(state, instr, state->registerFile[4], &state->programCounter) == 0){
+      instr->icode = I_INVALID;
+      return 0;
+    }
+    state->registerFile[4] = state->registerFile[4] + 8;
+    return 1;
+    break;
+  case I_PUSHQ:
+    if(dataWriteQuad(state, instr, state->registerFile[4] - 8, state->registerFile[instr->rA]) == 0){
+      instr->icode = I_INVALID;
+      return 0;
+    }
+    state->registerFile[4] = state->registerFile[4] - 8;
+    state->programCounter = instr->valP;
+    return 1;
+    break;
+  case I_POPQ: ;
+    uint64_t poppedValue;
+    if(dataReadQuad(state, instr, state->registerFile[4], &poppedValue) == 0)
+    {
+      instr->icode = I_INVALID;
+      return 0;
+    }
+    state->registerFile[4] = state->registerFile[4] + 8;
+    state->registerFile[instr->rA] = poppedValue;
+    state->programCounter = instr->valP;
+    return 1;
+    break;
+  case I_INVALID:
+    return 0;
+    break;
+  case I_TOO_SHORT:
+    return 0;
+    break;
+  default:
+    return 0;
+    break;
+  }
+}
+
+/* The sequences of instructions executed as superinstructions. */
+static const struct {
+  y86_fusion_t kind;
+  int          count;
+  y86_icode_t  icodes[FUSE_MAX_LENGTH];
+} fusionPatterns[] = {
+  {FUSE_OPQ_JXX,        2, {I_OPQ, I_JXX}},
+  {FUSE_IRMOVQ_OPQ,     2, {I_IRMOVQ, I_OPQ}},
+  {FUSE_IRMOVQ_OPQ_JXX, 3, {I_IRMOVQ, I_OPQ, I_JXX}},
+  {FUSE_MRMOVQ_OPQ,     2, {I_MRMOVQ, I_OPQ}},
+  {FUSE_PUSHQ_PUSHQ,    2, {I_PUSHQ, I_PUSHQ}},
+  {FUSE_POPQ_POPQ,      2, {I_POPQ, I_POPQ}}
+};
+
+/* Returns the kind of superinstruction made of count instructions with
+   the given icodes, or FUSE_NONE if they are not one. */
+y86_fusion_t fusionOf(const y86_icode_t *icodes, int count) {
+
+  for (size_t i = 0; i < sizeof(fusionPatterns) / sizeof(fusionPatterns[0]); i++)
+    if (fusionPatterns[i].count == count &&
+	memcmp(fusionPatterns[i].icodes, icodes, count * sizeof(y86_icode_t)) == 0)
+      return fusionPatterns[i].kind;
+  return FUSE_NONE;
+}
+
+/* Allocates the superinstruction cache used by fetchFused(), for the
+   current size of memory. Returns 1 in case of success, or 0 if there
+   is not enough memory. */
+int fuseCacheInit(machine_state_t *state) {
+
+  y86_fuse_cache_t *cache = calloc(1, sizeof(y86_fuse_cache_t));
+
+  if (!cache)
+    return 0;
+  cache->generation = 1;
+  cache->numLines = (state->programSize >> FUSE_LINE_SHIFT) + 1;
+  if (!sparseTableInit(&cache->lines, (cache->numLines + 63) / 64, sizeof(uint64_t)))
+  {
+    free(cache);
+    return 0;
+  }
+  state->fuseCache = cache;
+  return 1;
+}
+
+/* Discards all the decoded superinstructions. Writes made with
+   memWriteByte() and memWriteQuadLE() do this when needed; this must be
+   called after memory is modified by any other means. */
+void fuseCacheInvalidate(machine_state_t *state) {
+
+  y86_fuse_cache_t *cache = state->fuseCache;
+
+  if (!cache)
+    return;
+  cache->generation++;
+  sparseTableClear(&cache->lines);
+}
+
+void fuseCacheFree(machine_state_t *state) {
+
+  if (state->fuseCache)
+    sparseTableFree(&state->fuseCache->lines);
+  free(state->fuseCache);
+  state->fuseCache = NULL;
+}
+
+/* Stores the number of fetchFused() calls that found their instructions
+   already decoded, and the number that had to decode them. Returns 1,
+   or 0 if there is no superinstruction cache. */
+int fuseCacheCounters(const machine_state_t *state, uint64_t *hits,
+		      uint64_t *misses) {
+
+  const y86_fuse_cache_t *cache = state->fuseCache;
+
+  if (!cache)
+    return 0;
+  *hits = cache->lookups - cache->misses;
+  *misses = cache->misses;
+  return 1;
+}
+
+/* Decodes the superinstruction at pc into entry, see fetchFused(). */
+static const y86_fused_t *decodeFused(machine_state_t *state, uint64_t pc,
+				      y86_fuse_entry_t *entry) {
+
+  y86_fuse_cache_t *cache = state->fuseCache;
+  y86_fused_t *fused = &entry->fused;
+  y86_icode_t icodes[FUSE_MAX_LENGTH];
+  uint64_t next = pc, end;
+  int decoded = 0;
+
+  entry->generation = 0;
+  cache->misses++;
+
+  // As many instructions as the longest sequence could use, up to the
+  // first change of control flow
+  while (decoded < FUSE_MAX_LENGTH &&
+	 decodeAt(state, next, &fused->instr[decoded]))
+  {
+    icodes[decoded] = fused->instr[decoded].icode;
+    next = fused->instr[decoded++].valP;
+    if (icodes[decoded - 1] == I_JXX || icodes[decoded - 1] == I_CALL ||
+	icodes[decoded - 1] == I_RET)
+      break;
+  }
+  if (!decoded)
+    return NULL;
+
+  fused->kind = FUSE_NONE;
+  fused->count = 1;
+  for (int count = decoded; count > 1; count--)
+  {
+    y86_fusion_t kind = fusionOf(icodes, count);
+    if (kind != FUSE_NONE)
+    {
+      fused->kind = kind;
+      fused->count = count;
+      break;
+    }
+  }
+
+  // Without memory to track writes to its lines, the entry is not kept
+  end = fused->instr[fused->count - 1].valP - 1;
+  for (uint64_t line = pc >> FUSE_LINE_SHIFT; line <= end >> FUSE_LINE_SHIFT; line++)
+    if (!sparseTableSetBit(&cache->lines, line))
+      return fused;
+  entry->pc = pc;
+  entry->generation = cache->generation;
+  return fused;
+}
+
+/* Fetches the instruction at the program counter, along with the
+   instructions that follow it if they form one of the sequences in
+   fusionPatterns, so that executeFused() can run them with a single
+   handler. Decoded instructions are kept in state->fuseCache, which
+   must have been allocated with fuseCacheInit(), so instructions are
+   only decoded again after their memory is written. Returns NULL if
+   the instruction is a halt or is invalid, in which case
+   fetchInstruction() tells which. */
+const y86_fused_t *fetchFused(machine_state_t *state) {
+
+  y86_fuse_cache_t *cache = state->fuseCache;
+  uint64_t pc = state->programCounter;
+  y86_fuse_entry_t *entry = &cache->entries[pc % FUSE_CACHE_SIZE];
+
+  cache->lookups++;
+  if (entry->pc == pc && entry->generation == cache->generation)
+    return &entry->fused;
+  return decodeFused(state, pc, entry);
+}
+
+/* Executes the superinstruction returned by fetchFused(). The effect is
+   the same as executing its instructions one by one with
+   executeInstruction(). Returns the number of instructions executed
+   successfully: if one of them fails, the program counter is left at
+   its address, and executeInstruction() reports the failure if it is
+   executed again. */
+int executeFused(machine_state_t *state, const y86_fused_t *fused) {
+
+  const y86_instruction_t *instr = fused->instr;
+  uint64_t *registers = state->registerFile;
+
+  switch (fused->kind)
+  {
+  case FUSE_OPQ_JXX:
+    executeOpq(state, &instr[0]);
+    state->programCounter = conditionHolds(state, instr[1].ifun) ?
+      instr[1].valC : instr[1].valP;
+    return 2;
+  case FUSE_IRMOVQ_OPQ:
+    registers[instr[0].rB] = instr[0].valC;
+    executeOpq(state, &instr[1]);
+    state->programCounter = instr[1].valP;
+    return 2;
+  case FUSE_IRMOVQ_OPQ_JXX:
+    registers[instr[0].rB] = instr[0].valC;
+    executeOpq(state, &instr[1]);
+    state->programCounter = conditionHolds(state, instr[2].ifun) ?
+      instr[2].valC : instr[2].valP;
+    return 3;
+  case FUSE_MRMOVQ_OPQ:
+    if (!dataReadQuad(state, &instr[0], registers[instr[0].rB] + instr[0].valC,
+		      &registers[instr[0].rA]))
+      return 0;
+    executeOpq(state, &instr[1]);
+    state->programCounter = instr[1].valP;
+    return 2;
+  case FUSE_PUSHQ_PUSHQ: ;
+    uint64_t generation = state->fuseCache->generation;
+    for (int i = 0; i < 2; i++)
+    {
+      if (!dataWriteQuad(state, &instr[i], registers[R_RSP] - 8,
+			 registers[instr[i].rA]))
+      {
+	state->programCounter = instr[i].location;
+	return i;
+      }
+      registers[R_RSP] -= 8;
+      // The first push may have overwritten the second one
+      if (state->fuseCache->generation != generation)
+      {
+	state->programCounter = instr[i].valP;
+	return i + 1;
+      }
+    }
+    state->programCounter = instr[1].valP;
+    return 2;
+  case FUSE_POPQ_POPQ:
+    for (int i = 0; i < 2; i++)
+    {
+      uint64_t value;
+      if (!dataReadQuad(state, &instr[i], registers[R_RSP], &value))
+      {
+	state->programCounter = instr[i].location;
+	return i;
+      }
+      registers[R_RSP] += 8;
+      registers[instr[i].rA] = value;
+    }
+    state->programCounter = instr[1].valP;
+    return 2;
+  default: ;
+    // executeInstruction() marks instructions that fail as invalid
+    y86_instruction_t copy = instr[0];
+    return executeInstruction(state, &copy);
+  }
+}
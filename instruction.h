@@ -76,11 +76,89 @@ typedef struct instruction {
   uint64_t       valP;
 } y86_instruction_t;
 
+/* Why a run of instructions stopped. */
+typedef enum stop_reason {
+  STOP_STEP,              // a single step completed normally
+  STOP_HALT,              // the next instruction is a halt
+  STOP_BREAKPOINT,        // the next instruction has a breakpoint
+  STOP_INVALID,           // invalid or incomplete instruction, or memory access
+  STOP_STEP_OUT,          // the target of next or finish was reached
+  STOP_INTERRUPTED,       // the run was interrupted (SIGINT)
+  STOP_INSTRUCTION_LIMIT, // the run executed its maximum number of instructions
+  STOP_TIME_LIMIT         // the run exceeded its maximum time
+} stop_reason_t;
+
+/* One entry of the decode table, indexed by the first byte of an
+   instruction. The table itself is generated at build time by
+   genDecodeTable from the enums above. */
+typedef struct y86_decode_entry {
+
+  uint8_t  icode;      // I_INVALID for undefined opcodes
+  uint8_t  ifun;
+  uint8_t  length;     // total length of the instruction in bytes
+  uint8_t  minLength;  // bytes needed to decide whether it is valid
+  uint8_t  regOffset;  // offset of the register byte, 0 if none
+  uint8_t  valCOffset; // offset of valC, 0 if none
+  uint16_t rAMask;     // bit N set if rA == N is valid
+  uint16_t rBMask;     // bit N set if rB == N is valid
+  uint8_t  status;     // value returned by fetchInstruction if valid
+} y86_decode_entry_t;
+
+extern const y86_decode_entry_t decodeTable[256];
+
 #define CC_ZERO_MASK     0x1
 #define CC_SIGN_MASK     0x2
 #define CC_CARRY_MASK    0x4
 #define CC_OVERFLOW_MASK 0x8
 
+/* Superinstructions: sequences of instructions that are common in
+   compiled code, executed by a single handler. */
+typedef enum y86_fusion {
+  FUSE_NONE,
+  FUSE_OPQ_JXX,        // opq; jxx (compare and branch)
+  FUSE_IRMOVQ_OPQ,     // irmovq; opq (operation with a constant)
+  FUSE_IRMOVQ_OPQ_JXX, // irmovq; opq; jxx
+  FUSE_MRMOVQ_OPQ,     // mrmovq; opq (load and operate)
+  FUSE_PUSHQ_PUSHQ,    // pushq; pushq
+  FUSE_POPQ_POPQ,      // popq; popq
+  FUSE_KINDS
+} y86_fusion_t;
+
+#define FUSE_MAX_LENGTH 3
+
+/* A superinstruction, or a single instruction (kind FUSE_NONE), as
+   decoded and cached by fetchFused(). */
+typedef struct y86_fused {
+  y86_fusion_t      kind;
+  int               count;   // number of instructions in instr
+  y86_instruction_t instr[FUSE_MAX_LENGTH];
+} y86_fused_t;
+
+/* Cache of decoded superinstructions, indexed by address */
+#define FUSE_CACHE_SIZE 1024 // entries, a power of two
+#define FUSE_LINE_SHIFT 6    // writes are tracked in lines of 64 bytes
+
+typedef struct y86_fuse_cache y86_fuse_cache_t;
+
+/* Observer for data memory accesses. It is called for every quad-word
+   read or written by executeInstruction() (but not for instruction
+   fetches or accesses made by the debugger itself), after the access
+   succeeds. instr is the instruction making the access, as decoded. */
+typedef void (*mem_access_hook_t)(void *data, const y86_instruction_t *instr,
+				  uint64_t address, uint64_t value, int isWrite);
+
+#define MAX_MEM_ACCESS_HOOKS 8
+
+// Granularity of dirty page tracking
+#define DIRTY_PAGE_SHIFT 12
+#define DIRTY_PAGE_SIZE  (1 << DIRTY_PAGE_SHIFT)
+
+// Access permissions of a page of memory, see machine_state.pageDenied
+#define PAGE_READ  4
+#define PAGE_WRITE 2
+#define PAGE_EXEC  1
+#define PAGE_ALL   (PAGE_READ | PAGE_WRITE | PAGE_EXEC)
+
 typedef struct machine_state {
 
   uint8_t *programMap;
@@ -92,14 +170,74 @@ typedef struct machine_state {
 
   uint8_t conditionCodes;
 
+  // Condition codes are evaluated lazily: executing an OPq only
+  // records the operation, its operands and its result, and
+  // conditionCodes is brought up to date by getConditionCodes().
+  uint8_t  ccPending;
+  uint8_t  ccOperation;
+  uint64_t ccValA;
+  uint64_t ccValB;
+  uint64_t ccResult;
+
+  // One bit per DIRTY_PAGE_SIZE page of memory, set when the page is
+  // written. NULL if writes are not tracked.
+  uint64_t *dirtyPages;
+
+  // PAGE_READ, PAGE_WRITE and PAGE_EXEC denied for each DIRTY_PAGE_SIZE
+  // page of memory by the segments it was loaded from, in a sparse
+  // table: pages outside segments deny nothing, and use no memory.
+  // NULL if everything is allowed everywhere.
+  struct sparse_table *pageDenied;
+
+  // Hash of the image as loaded, recorded in the files saved for it to
+  // recognize them later. The debugger only computes it for those files.
+  uint64_t imageHash;
+
+  int               numMemAccessHooks;
+  mem_access_hook_t memAccessHooks[MAX_MEM_ACCESS_HOOKS];
+  void             *memAccessHookData[MAX_MEM_ACCESS_HOOKS];
+
+  // Instructions decoded by fetchFused(), NULL if they are not cached.
+  // Writes to memory covered by the cache invalidate it.
+  y86_fuse_cache_t *fuseCache;
+
+  // Set while data accesses made by executeInstruction() are not
+  // bounds checked, but trap beyond programSize instead (see
+  // guardMemory.c). The access in progress is recorded for the report.
+  int      guardedMemory;
+  uint64_t guardPC;
+  uint64_t guardAddress;
+
+  // Data memory accesses made by executed instructions, for telemetry
+  uint64_t dataReads;
+  uint64_t dataWrites;
+
 } machine_state_t;
 
 int fetchInstruction(machine_state_t *state, y86_instruction_t *instr);
 int executeInstruction(machine_state_t *state, y86_instruction_t *instr);
+uint8_t getConditionCodes(machine_state_t *state);
+int conditionHolds(machine_state_t *state, uint8_t ifun);
+
+int  fuseCacheInit(machine_state_t *state);
+void fuseCacheInvalidate(machine_state_t *state);
+void fuseCacheFree(machine_state_t *state);
+int  fuseCacheCounters(const machine_state_t *state, uint64_t *hits,
+		       uint64_t *misses);
+const y86_fused_t *fetchFused(machine_state_t *state);
+int  executeFused(machine_state_t *state, const y86_fused_t *fused);
+y86_fusion_t fusionOf(const y86_icode_t *icodes, int count);
 
 int memReadByte(machine_state_t *state,	uint64_t address, uint8_t *value);
 int memReadQuadLE(machine_state_t *state, uint64_t address, uint64_t *value);
 int memWriteByte(machine_state_t *state,  uint64_t address, uint8_t value);
 int memWriteQuadLE(machine_state_t *state, uint64_t address, uint64_t value);
+int memAccessible(const machine_state_t *state, uint64_t address,
+		  uint64_t length, int perms);
+uint64_t imageHash(const uint8_t *image, uint64_t size);
+int imageFileHash(int fd, uint64_t size, uint64_t *hash);
+
+int addMemAccessHook(machine_state_t *state, mem_access_hook_t hook, void *data);
+void removeMemAccessHook(machine_state_t *state, mem_access_hook_t hook, void *data);
 
 #endif /* INSTRUCTION */
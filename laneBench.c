@@ -0,0 +1,116 @@
+/* Lockstep execution benchmark. Runs the same register-only Y86-64
+   loop for a number of inputs (each with a different trip count),
+   first one instance after another with fetchInstruction and
+   executeInstruction, then all at once in lanes, and compares the
+   results and the throughput.
+
+   Usage: laneBench [lanes [iterations]]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "instruction.h"
+#include "lanes.h"
+
+static double now(void) {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint8_t *emitQuad(uint8_t *p, uint64_t value) {
+
+  for (int i = 0; i < 8; i++)
+    *p++ = value >> (8 * i);
+  return p;
+}
+
+int main(int argc, char **argv) {
+
+  int numLanes = argc > 1 ? atoi(argv[1]) : 256;
+  uint64_t iterations = argc > 2 ? strtoul(argv[2], NULL, 0) : 20000;
+  uint8_t image[0x100], copy[0x100];
+  uint8_t *p = image;
+  uint64_t loop, sequential = 0, lockstep = 0, *results;
+  machine_state_t state;
+  y86_instruction_t instr;
+  lane_set_t set;
+
+  if (numLanes <= 0 || numLanes > LANES_MAX)
+  {
+    fprintf(stderr, "laneBench: 1 to %d lanes\n", LANES_MAX);
+    return 1;
+  }
+  results = malloc(numLanes * sizeof(uint64_t));
+  memset(image, 0, sizeof(image));
+
+  // %rcx holds the input: the number of iterations
+  *p++ = 0x30; *p++ = 0xF0 | R_RDX; p = emitQuad(p, 1); // irmovq $1, %rdx
+  *p++ = 0x30; *p++ = 0xF0 | R_RDI; p = emitQuad(p, 3); // irmovq $3, %rdi
+  loop = p - image;
+  *p++ = 0x60; *p++ = R_RDX << 4 | R_RAX;               // addq %rdx, %rax
+  *p++ = 0x63; *p++ = R_RAX << 4 | R_RBX;               // xorq %rax, %rbx
+  *p++ = 0x62; *p++ = R_RDI << 4 | R_RBX;               // andq %rdi, %rbx
+  *p++ = 0x60; *p++ = R_RBX << 4 | R_RSI;               // addq %rbx, %rsi
+  *p++ = 0x24; *p++ = R_RAX << 4 | R_R8;                // cmovne %rax, %r8
+  *p++ = 0x30; *p++ = 0xF0 | R_R9; p = emitQuad(p, 5);  // irmovq $5, %r9
+  *p++ = 0x60; *p++ = R_R9 << 4 | R_R10;                // addq %r9, %r10
+  *p++ = 0x61; *p++ = R_RDX << 4 | R_RCX;               // subq %rdx, %rcx
+  *p++ = 0x74; p = emitQuad(p, loop);                   // jne loop
+  *p++ = 0x00;                                          // halt
+
+  double start = now();
+  for (int i = 0; i < numLanes; i++)
+  {
+    memcpy(copy, image, sizeof(image));
+    memset(&state, 0, sizeof(state));
+    state.programMap = copy;
+    state.programSize = sizeof(copy);
+    state.registerFile[R_RCX] = iterations + i;
+    while (fetchInstruction(&state, &instr) && executeInstruction(&state, &instr))
+      sequential++;
+    results[i] = state.registerFile[R_RSI] ^ state.registerFile[R_R8] ^
+      state.registerFile[R_R10];
+  }
+  double sequentialTime = now() - start;
+
+  memset(&state, 0, sizeof(state));
+  state.programMap = image;
+  state.programSize = sizeof(image);
+  if (!lanesInit(&set, &state, numLanes, NULL, NULL))
+  {
+    fprintf(stderr, "laneBench: out of memory\n");
+    return 1;
+  }
+  for (int i = 0; i < numLanes; i++)
+    set.reg[R_RCX][i] = iterations + i;
+
+  start = now();
+  lanesRun(&set, 0, 0, NULL, NULL);
+  double lockstepTime = now() - start;
+
+  for (int i = 0; i < numLanes; i++)
+  {
+    lockstep += set.instructions[i];
+    if (set.status[i] != LANE_HALTED ||
+	(set.reg[R_RSI][i] ^ set.reg[R_R8][i] ^ set.reg[R_R10][i]) != results[i])
+    {
+      fprintf(stderr, "laneBench: lane %d does not match\n", i);
+      return 1;
+    }
+  }
+
+  printf("%d inputs, %lu instructions: sequential %.3f s (%.2f ns/instr), "
+	 "lanes %.3f s (%.2f ns/instr), %.1fx\n", numLanes, sequential,
+	 sequentialTime, sequentialTime * 1e9 / sequential, lockstepTime,
+	 lockstepTime * 1e9 / lockstep, sequentialTime / lockstepTime);
+
+  lanesFree(&set);
+  free(results);
+  return sequential != lockstep;
+}
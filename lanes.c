@@ -0,0 +1,631 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS, MAP_NORESERVE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "lanes.h"
+
+/* Selects new where mask is all ones, and old where it is zero. */
+static inline uint64_t blend(uint64_t new, uint64_t old, uint64_t mask) {
+
+  return (new & mask) | (old & ~mask);
+}
+
+static inline uint64_t maskOf(int condition) {
+
+  return -(uint64_t) (condition != 0);
+}
+
+/* Length of the mapping holding the memory of a lane, whole host
+   pages. */
+static uint64_t mappedLength(uint64_t size) {
+
+  uint64_t hostPage = sysconf(_SC_PAGESIZE);
+
+  return size ? (size + hostPage - 1) / hostPage * hostPage : hostPage;
+}
+
+/* Sets up memory as a copy of the memory of state. With load, memory is
+   loaded as the image was, sharing the pages the lane never writes
+   with the image's files, and only the pages state->dirtyPages marks
+   as written since are copied from state. Returns 1 in case of success,
+   or 0 in case of failure with errno set. */
+static int copyMemory(machine_state_t *memory, machine_state_t *state,
+		      snapshot_revert_t load, void *loadData) {
+
+  uint64_t size = state->programSize, hostPage = sysconf(_SC_PAGESIZE);
+  uint8_t *map = mmap(NULL, mappedLength(size), PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+  if (map == MAP_FAILED)
+    return 0;
+  memory->programMap = map;
+  memory->programSize = size;
+  memory->pageDenied = state->pageDenied;
+
+  if (!load || !state->dirtyPages)
+  {
+    memcpy(map, state->programMap, size);
+    return 1;
+  }
+  if (!load(memory, 0, size, loadData))
+    return 0;
+
+  for (uint64_t word = 0; word << 6 << DIRTY_PAGE_SHIFT < size; word++)
+    for (uint64_t bits = state->dirtyPages[word]; bits; bits &= bits - 1)
+    {
+      uint64_t address = (word * 64 + __builtin_ctzll(bits)) << DIRTY_PAGE_SHIFT;
+      uint64_t length = size - address < DIRTY_PAGE_SIZE ? size - address : DIRTY_PAGE_SIZE;
+      uint64_t first = address / hostPage * hostPage;
+
+      // The page may be mapped read-only from a segment without w
+      if (mprotect(map + first, address + length - first, PROT_READ | PROT_WRITE) < 0)
+	return 0;
+      memcpy(map + address, state->programMap + address, length);
+    }
+  return 1;
+}
+
+/* Initializes a set of numLanes lanes, each starting from a copy of
+   the registers, condition codes and memory of state. The memory of
+   the lanes is loaded by load, called with loadData like the
+   snapshot_revert_t given to snapshotRestore, so that each lane only
+   uses memory for the pages it writes; without load, it is copied
+   whole. Lanes are bound by the page permissions of state. Returns 1
+   in case of success, or 0 in case of failure with errno set. */
+int lanesInit(lane_set_t *set, machine_state_t *state, int numLanes,
+	      snapshot_revert_t load, void *loadData) {
+
+  uint8_t cc = getConditionCodes(state);
+  int r, ok = 1;
+
+  memset(set, 0, sizeof(*set));
+  set->numLanes = numLanes;
+  set->numRunning = numLanes;
+
+  for (r = 0; r < R_NONE; r++)
+    ok &= (set->reg[r] = malloc(numLanes * sizeof(uint64_t))) != NULL;
+  ok &= (set->pc = malloc(numLanes * sizeof(uint64_t))) != NULL;
+  ok &= (set->zero = malloc(numLanes * sizeof(uint64_t))) != NULL;
+  ok &= (set->less = malloc(numLanes * sizeof(uint64_t))) != NULL;
+  ok &= (set->running = malloc(numLanes * sizeof(uint64_t))) != NULL;
+  ok &= (set->active = malloc(numLanes * sizeof(uint64_t))) != NULL;
+  ok &= (set->taken = malloc(numLanes * sizeof(uint64_t))) != NULL;
+  ok &= (set->instructions = calloc(numLanes, sizeof(uint64_t))) != NULL;
+  ok &= (set->status = calloc(numLanes, 1)) != NULL;
+  ok &= (set->memory = calloc(numLanes, sizeof(machine_state_t))) != NULL;
+  ok &= sparseTableInit(&set->written, ((state->programSize >> LANE_LINE_SHIFT) + 64) / 64,
+			sizeof(uint64_t));
+  if (!ok)
+  {
+    lanesFree(set);
+    return 0;
+  }
+
+  for (int i = 0; i < numLanes; i++)
+  {
+    for (r = 0; r < R_NONE; r++)
+      set->reg[r][i] = state->registerFile[r];
+    set->pc[i] = state->programCounter;
+    set->zero[i] = maskOf(cc & CC_ZERO_MASK);
+    set->less[i] = maskOf(!(cc & CC_SIGN_MASK) != !(cc & CC_OVERFLOW_MASK));
+    set->running[i] = ~0ull;
+
+    if (!copyMemory(&set->memory[i], state, load, loadData))
+    {
+      int error = errno;
+      lanesFree(set);
+      errno = error;
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+void lanesFree(lane_set_t *set) {
+
+  for (int r = 0; r < R_NONE; r++)
+    free(set->reg[r]);
+  free(set->pc);
+  free(set->zero);
+  free(set->less);
+  free(set->running);
+  free(set->active);
+  free(set->taken);
+  free(set->instructions);
+  free(set->status);
+  if (set->memory)
+    for (int i = 0; i < set->numLanes; i++)
+      if (set->memory[i].programMap)
+	munmap(set->memory[i].programMap, mappedLength(set->memory[i].programSize));
+  free(set->memory);
+  sparseTableFree(&set->written);
+  memset(set, 0, sizeof(*set));
+}
+
+/* Records that some lane wrote the quad-word at address, so that the
+   lanes' copies of the code there may differ. */
+static inline void markWritten(lane_set_t *set, uint64_t address) {
+
+  uint64_t first = address >> LANE_LINE_SHIFT, last = (address + 7) >> LANE_LINE_SHIFT;
+
+  if (!sparseTableSetBit(&set->written, first) ||
+      !sparseTableSetBit(&set->written, last))
+    set->writtenLost = 1;
+}
+
+static inline int isWritten(const lane_set_t *set, uint64_t address) {
+
+  return set->writtenLost || sparseTableTestBit(&set->written, address >> LANE_LINE_SHIFT);
+}
+
+int lanesReadQuad(lane_set_t *set, int lane, uint64_t address, uint64_t *value) {
+
+  return memReadQuadLE(&set->memory[lane], address, value);
+}
+
+int lanesWriteQuad(lane_set_t *set, int lane, uint64_t address, uint64_t value) {
+
+  if (!memWriteQuadLE(&set->memory[lane], address, value))
+    return 0;
+  markWritten(set, address);
+  return 1;
+}
+
+/* Brings the program counter and instruction count of every running
+   lane up to date, and leaves the converged state. */
+static void leaveGroup(lane_set_t *set) {
+
+  const uint64_t *running = set->running;
+  uint64_t *pc = set->pc, *instructions = set->instructions;
+  uint64_t groupPc = set->groupPc, pending = set->groupSteps;
+  int n = set->numLanes;
+
+  if (!set->converged)
+    return;
+  for (int i = 0; i < n; i++)
+  {
+    pc[i] = blend(groupPc, pc[i], running[i]);
+    instructions[i] += pending & running[i];
+  }
+  set->converged = 0;
+  set->groupSteps = 0;
+}
+
+static void stopLane(lane_set_t *set, int lane, lane_status_t status) {
+
+  leaveGroup(set);
+  set->status[lane] = status;
+  set->running[lane] = 0;
+  set->active[lane] = 0;
+  set->numRunning--;
+}
+
+/* Stores in set->taken the lanes that take part in the current step
+   and for which condition ifun holds. */
+static void conditionMasks(lane_set_t *set, uint8_t ifun) {
+
+  uint64_t *taken = set->taken;
+  const uint64_t *active = set->active, *zero = set->zero, *less = set->less;
+  int n = set->numLanes;
+
+  switch (ifun)
+  {
+  case C_NC:
+    memcpy(taken, active, n * sizeof(uint64_t));
+    break;
+  case C_LE:
+    for (int i = 0; i < n; i++)
+      taken[i] = active[i] & (less[i] | zero[i]);
+    break;
+  case C_L:
+    for (int i = 0; i < n; i++)
+      taken[i] = active[i] & less[i];
+    break;
+  case C_E:
+    for (int i = 0; i < n; i++)
+      taken[i] = active[i] & zero[i];
+    break;
+  case C_NE:
+    for (int i = 0; i < n; i++)
+      taken[i] = active[i] & ~zero[i];
+    break;
+  case C_GE:
+    for (int i = 0; i < n; i++)
+      taken[i] = active[i] & ~less[i];
+    break;
+  case C_G:
+    for (int i = 0; i < n; i++)
+      taken[i] = active[i] & ~less[i] & ~zero[i];
+    break;
+  default:
+    memset(taken, 0, n * sizeof(uint64_t));
+    break;
+  }
+}
+
+/* Executes OPq on every active lane. The flags are those set by
+   getConditionCodes(): overflow only for addq and subq, so for the
+   other operations "less" is just the sign of the result. */
+static void executeOpq(lane_set_t *set, y86_instruction_t *instr) {
+
+  const uint64_t *a = set->reg[instr->rA], *active = set->active;
+  uint64_t *b = set->reg[instr->rB], *zero = set->zero, *less = set->less;
+  int n = set->numLanes;
+
+  switch (instr->ifun)
+  {
+  case A_ADDQ:
+    for (int i = 0; i < n; i++)
+    {
+      uint64_t m = active[i], e = b[i] + a[i];
+      uint64_t overflow = ~(a[i] ^ b[i]) & (a[i] ^ e);
+      zero[i] = blend(maskOf(e == 0), zero[i], m);
+      less[i] = blend(-((e ^ overflow) >> 63), less[i], m);
+      b[i] = blend(e, b[i], m);
+    }
+    break;
+  case A_SUBQ:
+    for (int i = 0; i < n; i++)
+    {
+      uint64_t m = active[i], e = b[i] - a[i];
+      zero[i] = blend(maskOf(e == 0), zero[i], m);
+      less[i] = blend(maskOf((int64_t) b[i] < (int64_t) a[i]), less[i], m);
+      b[i] = blend(e, b[i], m);
+    }
+    break;
+  case A_ANDQ:
+    for (int i = 0; i < n; i++)
+    {
+      uint64_t m = active[i], e = b[i] & a[i];
+      zero[i] = blend(maskOf(e == 0), zero[i], m);
+      less[i] = blend(-(e >> 63), less[i], m);
+      b[i] = blend(e, b[i], m);
+    }
+    break;
+  case A_XORQ:
+    for (int i = 0; i < n; i++)
+    {
+      uint64_t m = active[i], e = b[i] ^ a[i];
+      zero[i] = blend(maskOf(e == 0), zero[i], m);
+      less[i] = blend(-(e >> 63), less[i], m);
+      b[i] = blend(e, b[i], m);
+    }
+    break;
+  case A_MULQ:
+    for (int i = 0; i < n; i++)
+    {
+      uint64_t m = active[i], e = b[i] * a[i];
+      zero[i] = blend(maskOf(e == 0), zero[i], m);
+      less[i] = blend(-(e >> 63), less[i], m);
+      b[i] = blend(e, b[i], m);
+    }
+    break;
+  case A_DIVQ:
+  case A_MODQ:
+    // no vector division; a zero divisor stops the lane instead of
+    // the whole process
+    for (int i = 0; i < n; i++)
+    {
+      if (!active[i])
+	continue;
+      if (a[i] == 0)
+      {
+	stopLane(set, i, LANE_INVALID);
+	continue;
+      }
+      uint64_t e = instr->ifun == A_DIVQ ? b[i] / a[i] : b[i] % a[i];
+      zero[i] = maskOf(e == 0);
+      less[i] = -(e >> 63);
+      b[i] = e;
+    }
+    break;
+  }
+}
+
+/* Executes the instructions that access memory, one active lane at a
+   time. Lanes whose access fails are stopped. */
+static void executeMemory(lane_set_t *set, y86_instruction_t *instr) {
+
+  uint64_t *rsp = set->reg[R_RSP];
+  int n = set->numLanes;
+  int isWrite = instr->icode == I_RMMOVQ || instr->icode == I_CALL ||
+    instr->icode == I_PUSHQ;
+
+  for (int i = 0; i < n; i++)
+  {
+    machine_state_t *memory = &set->memory[i];
+    uint64_t value, address = 0;
+    int ok = 1;
+
+    if (!set->active[i])
+      continue;
+
+    switch (instr->icode)
+    {
+    case I_RMMOVQ:
+      address = set->reg[instr->rB][i] + instr->valC;
+      ok = memWriteQuadLE(memory, address, set->reg[instr->rA][i]);
+      break;
+    case I_MRMOVQ:
+      ok = memReadQuadLE(memory, set->reg[instr->rB][i] + instr->valC, &value);
+      if (ok)
+	set->reg[instr->rA][i] = value;
+      break;
+    case I_CALL:
+      address = rsp[i] -= 8;
+      ok = memWriteQuadLE(memory, address, instr->valP);
+      break;
+    case I_RET:
+      ok = memReadQuadLE(memory, rsp[i], &value);
+      if (ok)
+      {
+	rsp[i] += 8;
+	set->pc[i] = value;
+      }
+      break;
+    case I_PUSHQ:
+      address = rsp[i] - 8;
+      ok = memWriteQuadLE(memory, address, set->reg[instr->rA][i]);
+      if (ok)
+	rsp[i] -= 8;
+      break;
+    case I_POPQ:
+      ok = memReadQuadLE(memory, rsp[i], &value);
+      if (ok)
+      {
+	rsp[i] += 8;
+	set->reg[instr->rA][i] = value;
+      }
+      break;
+    default:
+      break;
+    }
+
+    if (!ok)
+      stopLane(set, i, LANE_INVALID);
+    else if (isWrite)
+      markWritten(set, address);
+  }
+}
+
+/* Executes one instruction for every running lane whose program
+   counter is the lowest among running lanes. Picking the lowest
+   program counter lets lanes that took different branches meet again
+   at the join point before going on. Lanes that executed
+   maxInstructions instructions (if not 0) are stopped. Returns the
+   number of lanes that took part in the step, or 0 if no lane is
+   running.
+
+   While every running lane takes part in each step, the lanes are
+   converged: they share groupPc, and their own program counters and
+   instruction counts are only brought up to date by leaveGroup(),
+   when they go separate ways or one of them stops. */
+static int lanesStep(lane_set_t *set, uint64_t maxInstructions) {
+
+  int n = set->numLanes, leader, count = 0;
+  uint64_t pc = UINT64_MAX, length, next;
+  const uint64_t *running = set->running, *taken = set->taken;
+  uint64_t *lanePc = set->pc, *active = set->active, *instructions = set->instructions;
+  y86_instruction_t instr;
+
+  // A lane executes at most one instruction per step, so none can
+  // reach the limit before nextLimitCheck
+  if (maxInstructions && set->steps >= set->nextLimitCheck)
+  {
+    uint64_t most = 0;
+    leaveGroup(set);
+    for (int i = 0; i < n; i++)
+      if (running[i] && instructions[i] >= maxInstructions)
+	stopLane(set, i, LANE_LIMIT);
+      else if (running[i] && instructions[i] > most)
+	most = instructions[i];
+    set->nextLimitCheck = set->steps + (maxInstructions - most);
+  }
+
+  if (set->converged)
+  {
+    pc = set->groupPc;
+    leader = set->leader;
+    count = set->numRunning;
+  }
+  else
+  {
+    // Running lanes get their program counter, stopped ones all ones,
+    // which no valid program counter can match
+    for (int i = 0; i < n; i++)
+    {
+      uint64_t key = lanePc[i] | ~running[i];
+      pc = key < pc ? key : pc;
+    }
+    for (int i = 0; i < n; i++)
+    {
+      active[i] = running[i] & maskOf(lanePc[i] == pc);
+      count += active[i] & 1;
+    }
+    if (!count)
+      return 0;
+    for (leader = 0; !active[leader]; leader++)
+      ;
+  }
+
+  // The instruction is decoded once, from the leader's memory. If any
+  // lane wrote over it, lanes that now have different bytes there are
+  // left for a later step, where one of them will lead.
+  set->memory[leader].programCounter = pc;
+  fetchInstruction(&set->memory[leader], &instr);
+  length = instr.icode < I_INVALID ? instr.valP - pc : 10;
+  if (pc < set->memory[leader].programSize &&
+      (isWritten(set, pc) || isWritten(set, pc + length - 1)))
+  {
+    const uint8_t *code = set->memory[leader].programMap + pc;
+    if (pc + length > set->memory[leader].programSize)
+      length = set->memory[leader].programSize - pc;
+    for (int i = leader + 1; i < n; i++)
+      if (active[i] && memcmp(set->memory[i].programMap + pc, code, length))
+      {
+	leaveGroup(set);
+	active[i] = 0;
+	count--;
+      }
+  }
+
+  set->steps++;
+  set->stepPc = pc;
+  next = instr.valP;
+
+  switch (instr.icode)
+  {
+  case I_HALT:
+  case I_INVALID:
+  case I_TOO_SHORT:
+    for (int i = 0; i < n; i++)
+      if (active[i])
+	stopLane(set, i, instr.icode == I_HALT ? LANE_HALTED : LANE_INVALID);
+    return count;
+  case I_IRMOVQ:
+    {
+      uint64_t *rB = set->reg[instr.rB];
+      for (int i = 0; i < n; i++)
+	rB[i] = blend(instr.valC, rB[i], active[i]);
+    }
+    break;
+  case I_RRMVXX:
+    {
+      const uint64_t *rA = set->reg[instr.rA];
+      uint64_t *rB = set->reg[instr.rB];
+      conditionMasks(set, instr.ifun);
+      for (int i = 0; i < n; i++)
+	rB[i] = blend(rA[i], rB[i], taken[i]);
+    }
+    break;
+  case I_OPQ:
+    executeOpq(set, &instr);
+    break;
+  case I_JXX:
+    {
+      int numTaken = 0;
+      conditionMasks(set, instr.ifun);
+      for (int i = 0; i < n; i++)
+	numTaken += taken[i] & 1;
+      if (numTaken == count)
+	next = instr.valC;
+      else if (numTaken)
+      {
+	// the lanes go separate ways
+	leaveGroup(set);
+	for (int i = 0; i < n; i++)
+	{
+	  lanePc[i] = blend(blend(instr.valC, instr.valP, taken[i]), lanePc[i],
+			    active[i]);
+	  instructions[i] += active[i] & 1;
+	}
+	return count;
+      }
+    }
+    break;
+  case I_RET:
+    // the return addresses may differ
+    leaveGroup(set);
+    executeMemory(set, &instr);
+    for (int i = 0; i < n; i++)
+      instructions[i] += active[i] & 1;
+    return count;
+  case I_CALL:
+    executeMemory(set, &instr);
+    next = instr.valC;
+    break;
+  case I_RMMOVQ:
+  case I_MRMOVQ:
+  case I_PUSHQ:
+  case I_POPQ:
+    executeMemory(set, &instr);
+    break;
+  default:
+    break;
+  }
+
+  // All the active lanes go on to next
+  if (set->converged)
+  {
+    set->groupPc = next;
+    set->groupSteps++;
+  }
+  else if (count == set->numRunning)
+  {
+    set->converged = 1;
+    set->groupPc = next;
+    set->groupSteps = 1;
+    set->leader = leader;
+  }
+  else
+  {
+    for (int i = 0; i < n; i++)
+    {
+      lanePc[i] = blend(next, lanePc[i], active[i]);
+      instructions[i] += active[i] & 1;
+    }
+  }
+  return count;
+}
+
+/* Runs every lane until it halts, fails, or executes maxInstructions
+   instructions (if not 0), or until check (if not NULL), called with
+   data every checkInterval steps, stops the run. */
+void lanesRun(lane_set_t *set, uint64_t maxInstructions, uint64_t checkInterval,
+	      lanes_check_t check, void *data) {
+
+  uint64_t nextCheck = set->steps + checkInterval;
+
+  while (lanesStep(set, maxInstructions))
+  {
+    if (!check || set->steps < nextCheck)
+      continue;
+
+    lane_status_t status = check(set, data);
+    if (status != LANE_RUNNING)
+    {
+      for (int i = 0; i < set->numLanes; i++)
+	if (set->running[i])
+	  stopLane(set, i, status);
+      return;
+    }
+    nextCheck = set->steps + checkInterval;
+  }
+}
+
+/* Returns the number of instructions executed so far by all the
+   lanes. */
+uint64_t lanesInstructions(const lane_set_t *set) {
+
+  uint64_t total = 0;
+
+  for (int i = 0; i < set->numLanes; i++)
+    total += set->instructions[i];
+  return set->converged ? total + set->groupSteps * set->numRunning : total;
+}
+
+const char *laneStatusName(lane_status_t status) {
+
+  switch (status)
+  {
+  case LANE_RUNNING:
+    return "running";
+  case LANE_HALTED:
+    return "halted";
+  case LANE_INVALID:
+    return "invalid";
+  case LANE_LIMIT:
+    return "limit";
+  case LANE_INTERRUPTED:
+    return "interrupted";
+  default:
+    return "?";
+  }
+}
@@ -0,0 +1,99 @@
+/* This file contains the prototypes and constants needed to run one
+   program over many inputs in lockstep, using the routines defined in
+   lanes.c
+*/
+
+#ifndef _LANES_H_
+#define _LANES_H_
+
+#include <stdint.h>
+
+#include "instruction.h"
+#include "snapshot.h"
+#include "sparseTable.h"
+
+#define LANES_MAX 4096
+
+// Granularity at which writes to memory are tracked, to find code
+// that may differ between lanes
+#define LANE_LINE_SHIFT 6
+
+typedef enum lane_status {
+  LANE_RUNNING,
+  LANE_HALTED,     // reached a halt instruction
+  LANE_INVALID,    // invalid instruction or memory access
+  LANE_LIMIT,      // executed its maximum number of instructions, or the
+		   // run reached its time limit
+  LANE_INTERRUPTED // still running when the run was interrupted
+} lane_status_t;
+
+/* A set of lanes, each running the same program on its own copy of
+   the machine state. Registers, flags and program counters are kept
+   in structure-of-arrays form (reg[r][lane]) so that register-only
+   instructions are executed for all the lanes that share a program
+   counter with a single loop the compiler can vectorize. */
+typedef struct lane_set {
+
+  int numLanes;
+
+  uint64_t *reg[R_NONE];
+  uint64_t *pc;
+  // Condition codes, as all-ones/all-zeros masks: the result was zero,
+  // and the result was less than zero (SF ^ OF)
+  uint64_t *zero;
+  uint64_t *less;
+
+  // All ones for the lanes still running, and for those taking part in
+  // the current step
+  uint64_t *running;
+  uint64_t *active;
+  // Scratch: the active lanes for which a condition holds
+  uint64_t *taken;
+
+  uint64_t *instructions;
+  uint8_t  *status;
+
+  // Memory of each lane, a private copy of the initial memory
+  machine_state_t *memory;
+  // One bit per 1 << LANE_LINE_SHIFT bytes of memory, set when any lane
+  // writes there. If a write could not be recorded for lack of memory,
+  // code anywhere may differ.
+  sparse_table_t written;
+  int            writtenLost;
+
+  // Total number of steps, i.e. of decoded instructions
+  uint64_t steps;
+
+  int numRunning;
+  // Set while all the running lanes are at groupPc, and active holds
+  // them all. Their pc and instructions are then groupSteps behind.
+  int      converged;
+  uint64_t groupPc;
+  uint64_t groupSteps;
+  int      leader;
+  // No lane can reach the instruction limit before this step
+  uint64_t nextLimitCheck;
+  // Program counter of the latest step, for progress reports
+  uint64_t stepPc;
+
+} lane_set_t;
+
+/* Called by lanesRun between steps, every checkInterval steps. Returns
+   LANE_RUNNING to go on, or the status to give the lanes still running
+   to stop the run there. */
+typedef lane_status_t (*lanes_check_t)(lane_set_t *set, void *data);
+
+int  lanesInit(lane_set_t *set, machine_state_t *state, int numLanes,
+		snapshot_revert_t load, void *loadData);
+void lanesFree(lane_set_t *set);
+
+int  lanesReadQuad(lane_set_t *set, int lane, uint64_t address, uint64_t *value);
+int  lanesWriteQuad(lane_set_t *set, int lane, uint64_t address, uint64_t value);
+
+void lanesRun(lane_set_t *set, uint64_t maxInstructions, uint64_t checkInterval,
+	      lanes_check_t check, void *data);
+uint64_t lanesInstructions(const lane_set_t *set);
+
+const char *laneStatusName(lane_status_t status);
+
+#endif /* LANES */
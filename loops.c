@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "loops.h"
+
+int loopStatsInit(loop_stats_t *stats) {
+
+  memset(stats, 0, sizeof(*stats));
+  if (!pcTableInit(&stats->loops, NUM_LOOP_COUNTERS))
+    return 0;
+  if (!pcTableInit(&stats->edges, NUM_EDGE_COUNTERS))
+  {
+    pcTableFree(&stats->loops);
+    return 0;
+  }
+  return 1;
+}
+
+/* Clears all statistics collected so far, including the loops
+   currently executing. */
+void loopStatsReset(loop_stats_t *stats) {
+
+  stats->instructions = 0;
+  stats->numActive = 0;
+  stats->droppedActivations = 0;
+  stats->lastExitValid = 0;
+  pcTableClear(&stats->loops);
+  pcTableClear(&stats->edges);
+}
+
+void loopStatsFree(loop_stats_t *stats) {
+
+  pcTableFree(&stats->loops);
+  pcTableFree(&stats->edges);
+}
+
+/* Adds the counts of the innermost active loop to its counters, and
+   removes it from the active loops. */
+static void leaveLoop(loop_stats_t *stats) {
+
+  loop_activation_t *loop = &stats->active[--stats->numActive];
+  uint64_t *counters = pcTableLookup(&stats->loops, loop->header);
+
+  if (counters)
+  {
+    counters[LOOP_ENTRIES]++;
+    counters[LOOP_BACK_EDGES] += loop->backEdges;
+    counters[LOOP_INSTRUCTIONS] += stats->instructions - loop->startInstruction;
+    if (loop->backEdges + 1 > counters[LOOP_MAX_TRIPS])
+      counters[LOOP_MAX_TRIPS] = loop->backEdges + 1;
+  }
+
+  stats->lastExit = *loop;
+  stats->lastExitInstruction = stats->instructions;
+  stats->lastExitValid = 1;
+}
+
+/* Takes back the counts added when the last loop was left, and makes
+   it active again. */
+static void resumeLastExit(loop_stats_t *stats) {
+
+  loop_activation_t *loop = &stats->lastExit;
+  uint64_t *counters = pcTableLookup(&stats->loops, loop->header);
+
+  if (counters)
+  {
+    counters[LOOP_ENTRIES]--;
+    counters[LOOP_BACK_EDGES] -= loop->backEdges;
+    counters[LOOP_INSTRUCTIONS] -=
+      stats->lastExitInstruction - loop->startInstruction;
+  }
+  stats->active[stats->numActive++] = *loop;
+  stats->lastExitValid = 0;
+}
+
+/* Records a taken backward jump from latch to header, made in the
+   frame at the specified call stack depth. */
+void loopStatsBackEdge(loop_stats_t *stats, uint64_t latch, uint64_t header,
+		       uint64_t depth) {
+
+  uint64_t *edge = pcTableLookup(&stats->edges, latch);
+  uint64_t *counters = pcTableLookup(&stats->loops, header);
+  loop_activation_t *top = NULL;
+  uint64_t end = latch;
+
+  if (edge)
+  {
+    edge[EDGE_HEADER] = header;
+    edge[EDGE_TAKEN]++;
+  }
+  if (counters)
+  {
+    if (latch > counters[LOOP_END])
+      counters[LOOP_END] = latch;
+    end = counters[LOOP_END];
+  }
+  // Leaving loops below may add a key to stats->loops, which moves the
+  // counters, so they are not used past this point
+
+  // Jumping back to the header of an enclosing loop leaves the inner
+  // ones; frames that returned without being noticed are left too.
+  while (stats->numActive)
+  {
+    top = &stats->active[stats->numActive - 1];
+    if (top->depth < depth ||
+	(top->depth == depth && header >= top->header && header <= top->end))
+      break;
+    leaveLoop(stats);
+  }
+
+  if (stats->numActive && top->header == header && top->depth == depth)
+  {
+    top->backEdges++;
+    if (latch > top->end)
+      top->end = latch;
+    return;
+  }
+
+  if (stats->lastExitValid && stats->lastExit.header == header &&
+      stats->lastExit.depth == depth && latch > stats->lastExit.end &&
+      stats->numActive < LOOP_MAX_ACTIVE)
+  {
+    resumeLastExit(stats);
+    top = &stats->active[stats->numActive - 1];
+    top->backEdges++;
+    top->end = latch;
+    return;
+  }
+
+  if (stats->numActive == LOOP_MAX_ACTIVE)
+  {
+    stats->droppedActivations++;
+    return;
+  }
+
+  top = &stats->active[stats->numActive++];
+  top->header = header;
+  top->end = end;
+  top->depth = depth;
+  top->startInstruction = stats->instructions;
+  top->backEdges = 1;
+  stats->lastExitValid = 0;
+}
+
+/* Leaves all the active loops that nextPC, at the specified call stack
+   depth, is outside of. */
+void loopStatsExit(loop_stats_t *stats, uint64_t nextPC, uint64_t depth) {
+
+  while (stats->numActive)
+  {
+    loop_activation_t *top = &stats->active[stats->numActive - 1];
+    if (top->depth < depth ||
+	(top->depth == depth && nextPC >= top->header && nextPC <= top->end))
+      break;
+    leaveLoop(stats);
+  }
+}
+
+static uint64_t loopInstructions(const uint64_t *counters) {
+
+  return counters[LOOP_INSTRUCTIONS];
+}
+
+/* Prints the maxLoops loops that executed the most instructions, with
+   their entries, iterations and instructions per iteration, and the
+   jumps that close them. Iterations count the pass through the body
+   before the first back edge; instructions are counted from the first
+   back edge on, i.e., over one iteration less. Loops still executing
+   are not included until they are left. */
+int loopStatsPrintReport(FILE *file, loop_stats_t *stats, int maxLoops) {
+
+  int chars = 0;
+  uint64_t *slots;
+  uint64_t n = pcTableSort(&stats->loops, loopInstructions, &slots);
+
+  chars += fprintf(file, "    # Loops: %lu, instructions: %lu\n",
+		   stats->loops.used, stats->instructions);
+  if (stats->numActive)
+    chars += fprintf(file, "    # Loops still executing: %d\n", stats->numActive);
+  if (stats->droppedActivations)
+    chars += fprintf(file, "    # Loop entries not tracked (nested too deep): %lu\n",
+		     stats->droppedActivations);
+  if (!n || maxLoops <= 0)
+  {
+    free(slots);
+    return chars;
+  }
+
+  chars += fprintf(file, "    # %-18s %10s %12s %10s %10s %10s %14s\n", "Loop",
+		   "entries", "iterations", "avg iter", "max iter",
+		   "instr/iter", "instructions");
+  for (uint64_t i = 0; i < n && i < (uint64_t) maxLoops; i++)
+  {
+    uint64_t header = pcTableKey(&stats->loops, slots[i]);
+    uint64_t *counters = pcTableCounters(&stats->loops, slots[i]);
+    uint64_t entries = counters[LOOP_ENTRIES];
+    uint64_t iterations = counters[LOOP_BACK_EDGES] + entries;
+
+    if (!entries)
+      continue;
+    chars += fprintf(file, "    # 0x%-16lx %10lu %12lu %10.1f %10lu %10.1f %14lu\n",
+		     header, entries, iterations, (double) iterations / entries,
+		     counters[LOOP_MAX_TRIPS],
+		     (double) counters[LOOP_INSTRUCTIONS] / counters[LOOP_BACK_EDGES],
+		     counters[LOOP_INSTRUCTIONS]);
+
+    for (uint64_t slot = 0; slot < stats->edges.capacity; slot++)
+    {
+      uint64_t *edge = pcTableCounters(&stats->edges, slot);
+      if (pcTableKey(&stats->edges, slot) != PC_TABLE_EMPTY &&
+	  edge[EDGE_HEADER] == header)
+	chars += fprintf(file, "    #   back edge from 0x%lx taken %lu times\n",
+			 pcTableKey(&stats->edges, slot), edge[EDGE_TAKEN]);
+    }
+  }
+
+  free(slots);
+  return chars;
+}
@@ -0,0 +1,87 @@
+/* This file contains the prototypes and constants needed to use the
+   dynamic loop detector defined in loops.c
+*/
+
+#ifndef _LOOPS_H_
+#define _LOOPS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "instruction.h"
+#include "pcTable.h"
+
+#define LOOP_MAX_ACTIVE 64 // maximum nesting of loops being tracked
+
+// Per-loop counters kept in loop_stats_t.loops, keyed by the header
+enum { LOOP_END, LOOP_ENTRIES, LOOP_BACK_EDGES, LOOP_INSTRUCTIONS,
+       LOOP_MAX_TRIPS, NUM_LOOP_COUNTERS };
+
+// Per-edge counters kept in loop_stats_t.edges, keyed by the jump
+enum { EDGE_HEADER, EDGE_TAKEN, NUM_EDGE_COUNTERS };
+
+/* A loop currently executing: entered when its first back edge was
+   taken, left when the program counter leaves [header, end] in the
+   same call frame, or the frame returns. */
+typedef struct loop_activation {
+  uint64_t header;
+  uint64_t end;              // highest back edge seen for the loop
+  uint64_t depth;            // call stack depth of the loop's frame
+  uint64_t startInstruction; // instruction count at the first back edge
+  uint64_t backEdges;
+} loop_activation_t;
+
+/* Natural loops detected from taken backward jumps. Counters are only
+   updated when a back edge is taken or a loop is left; other
+   instructions cost an increment and a range check. */
+typedef struct loop_stats {
+
+  uint64_t instructions;
+
+  int               numActive;
+  loop_activation_t active[LOOP_MAX_ACTIVE];
+  uint64_t          droppedActivations; // loops nested too deep to track
+
+  // Last loop left, and the instruction count at that point. If one of
+  // its back edges beyond end is taken right after, the exit was only
+  // a branch to a part of the body not seen before, and it resumes.
+  int               lastExitValid;
+  loop_activation_t lastExit;
+  uint64_t          lastExitInstruction;
+
+  pc_table_t loops;
+  pc_table_t edges;
+
+} loop_stats_t;
+
+int  loopStatsInit(loop_stats_t *stats);
+void loopStatsReset(loop_stats_t *stats);
+void loopStatsFree(loop_stats_t *stats);
+void loopStatsBackEdge(loop_stats_t *stats, uint64_t latch, uint64_t header,
+		       uint64_t depth);
+void loopStatsExit(loop_stats_t *stats, uint64_t nextPC, uint64_t depth);
+int  loopStatsPrintReport(FILE *file, loop_stats_t *stats, int maxLoops);
+
+/* Updates the loop statistics after instr was executed successfully.
+   nextPC is the new program counter, and depth the call stack depth
+   after the instruction. */
+static inline void loopStatsRecord(loop_stats_t *stats, y86_instruction_t *instr,
+				   uint64_t nextPC, uint64_t depth) {
+
+  stats->instructions++;
+
+  if (instr->icode == I_JXX && nextPC == instr->valC &&
+      instr->valC <= instr->location)
+  {
+    loopStatsBackEdge(stats, instr->location, instr->valC, depth);
+  }
+  else if (stats->numActive)
+  {
+    loop_activation_t *top = &stats->active[stats->numActive - 1];
+    if (depth < top->depth ||
+	(depth == top->depth && (nextPC < top->header || nextPC > top->end)))
+      loopStatsExit(stats, nextPC, depth);
+  }
+}
+
+#endif /* LOOPS */
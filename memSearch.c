@@ -0,0 +1,284 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "memSearch.h"
+
+// Ranges at least this large are split among several threads
+#define PARALLEL_CHUNK (16 << 20)
+#define MAX_THREADS 64
+
+typedef struct search_job {
+
+  const uint8_t          *map;
+  uint64_t                from;  // first candidate address
+  uint64_t                to;    // last candidate address + 1
+  const search_pattern_t *pattern;
+  uint64_t                alignment;
+  uint64_t                maxHits;
+
+  uint64_t *hits;
+  uint64_t  numHits;
+  uint64_t  capacity;
+  int       failed;              // out of memory
+
+} search_job_t;
+
+static int hexDigit(char c) {
+
+  return isdigit((unsigned char) c) ? c - '0' : tolower((unsigned char) c) - 'a' + 10;
+}
+
+/* Parses a string of hex digits, two per byte, in memory order. */
+static int parseHexBytes(const char *string, uint8_t *bytes, unsigned *length) {
+
+  size_t digits = strlen(string);
+
+  if (!digits || digits % 2 || digits / 2 > SEARCH_MAX_PATTERN)
+    return 0;
+  for (size_t i = 0; i < digits; i++)
+  {
+    if (!isxdigit((unsigned char) string[i]))
+      return 0;
+  }
+
+  for (size_t i = 0; i < digits / 2; i++)
+    bytes[i] = hexDigit(string[2 * i]) << 4 | hexDigit(string[2 * i + 1]);
+  *length = digits / 2;
+  return 1;
+}
+
+/* Parses a quad-word in hex and stores it as 8 little-endian bytes. */
+static int parseHexQuad(const char *string, uint8_t *bytes) {
+
+  char *end;
+  uint64_t value = strtoul(string, &end, 16);
+
+  if (!*string || *end)
+    return 0;
+  for (int i = 0; i < 8; i++)
+    bytes[i] = value >> (8 * i);
+  return 1;
+}
+
+/* Builds a search pattern from its textual form. value is either a
+   quad-word in hex, searched for in little-endian order, or "x:"
+   followed by a sequence of hex bytes in memory order. mask, if not
+   NULL, has the same form and selects the bits that must match.
+   Returns 1 in case of success, or 0 if the strings are invalid. */
+int parseSearchPattern(const char *value, const char *mask,
+		       search_pattern_t *pattern) {
+
+  unsigned maskLength;
+  int bytes = strncasecmp(value, "x:", 2) == 0;
+
+  if (bytes ? !parseHexBytes(value + 2, pattern->bytes, &pattern->length) :
+      !parseHexQuad(value, pattern->bytes))
+    return 0;
+  if (!bytes)
+    pattern->length = 8;
+
+  memset(pattern->mask, 0xFF, sizeof(pattern->mask));
+  if (mask)
+  {
+    if (bytes != (strncasecmp(mask, "x:", 2) == 0))
+      return 0;
+    if (bytes ? !parseHexBytes(mask + 2, pattern->mask, &maskLength) ||
+	maskLength != pattern->length : !parseHexQuad(mask, pattern->mask))
+      return 0;
+  }
+
+  for (unsigned i = 0; i < pattern->length; i++)
+    pattern->bytes[i] &= pattern->mask[i];
+  return 1;
+}
+
+static void addHit(search_job_t *job, uint64_t address) {
+
+  if (job->numHits == job->capacity)
+  {
+    uint64_t capacity = job->capacity ? 2 * job->capacity : 64;
+    uint64_t *hits = realloc(job->hits, capacity * sizeof(uint64_t));
+    if (!hits)
+    {
+      job->failed = 1;
+      return;
+    }
+    job->hits = hits;
+    job->capacity = capacity;
+  }
+  job->hits[job->numHits++] = address;
+}
+
+static inline int matches(const uint8_t *bytes, const search_pattern_t *pattern) {
+
+  for (unsigned i = 0; i < pattern->length; i++)
+  {
+    if ((bytes[i] & pattern->mask[i]) != pattern->bytes[i])
+      return 0;
+  }
+  return 1;
+}
+
+/* Aligned quad-word search: one masked 64-bit compare per candidate,
+   in a loop simple enough for the compiler to vectorize. */
+static void searchAlignedQuads(search_job_t *job) {
+
+  const search_pattern_t *pattern = job->pattern;
+  uint64_t value, mask, word;
+  uint64_t step = job->alignment;
+  uint64_t first = (job->from + step - 1) / step * step;
+
+  memcpy(&value, pattern->bytes, 8);
+  memcpy(&mask, pattern->mask, 8);
+
+  for (uint64_t address = first; address < job->to; address += step)
+  {
+    memcpy(&word, job->map + address, 8);
+    if (((word & mask) ^ value) == 0)
+    {
+      addHit(job, address);
+      if (job->numHits >= job->maxHits || job->failed)
+	return;
+    }
+  }
+}
+
+/* General search. If some byte of the pattern is fully significant,
+   candidates are found by looking for that byte with memchr, which the
+   C library implements with SIMD instructions; every candidate is then
+   checked against the whole pattern and the alignment. */
+static void searchBytes(search_job_t *job) {
+
+  const search_pattern_t *pattern = job->pattern;
+  int anchor = -1;
+
+  for (unsigned i = 0; i < pattern->length && anchor < 0; i++)
+  {
+    if (pattern->mask[i] == 0xFF)
+      anchor = i;
+  }
+
+  if (anchor < 0)
+  {
+    for (uint64_t address = job->from; address < job->to; address++)
+    {
+      if (address % job->alignment == 0 &&
+	  matches(job->map + address, pattern))
+      {
+	addHit(job, address);
+	if (job->numHits >= job->maxHits || job->failed)
+	  return;
+      }
+    }
+    return;
+  }
+
+  uint64_t address = job->from;
+  while (address < job->to)
+  {
+    const uint8_t *found = memchr(job->map + address + anchor,
+				  pattern->bytes[anchor], job->to - address);
+    if (!found)
+      return;
+
+    address = found - job->map - anchor;
+    if (address % job->alignment == 0 && matches(job->map + address, pattern))
+    {
+      addHit(job, address);
+      if (job->numHits >= job->maxHits || job->failed)
+	return;
+    }
+    address++;
+  }
+}
+
+static void *runJob(void *data) {
+
+  search_job_t *job = data;
+
+  if (job->pattern->length == 8 && job->alignment % 8 == 0)
+    searchAlignedQuads(job);
+  else
+    searchBytes(job);
+  return NULL;
+}
+
+/* Searches memory in [start, end) for pattern, only considering
+   addresses that are a multiple of alignment. Stores in *hits a newly
+   allocated array with the address of the first maxHits matches, in
+   increasing order, and returns their number (the caller must free
+   *hits). Large ranges are split among as many threads as there are
+   processors. Returns 0 with *hits set to NULL if memory could not be
+   allocated. */
+uint64_t memSearch(machine_state_t *state, uint64_t start, uint64_t end,
+		   const search_pattern_t *pattern, uint64_t alignment,
+		   uint64_t maxHits, uint64_t **hits) {
+
+  search_job_t jobs[MAX_THREADS];
+  pthread_t threads[MAX_THREADS];
+  int started[MAX_THREADS];
+  uint64_t numHits = 0;
+  int failed = 0;
+
+  *hits = NULL;
+  if (end > state->programSize)
+    end = state->programSize;
+  if (start >= end || end - start < pattern->length || !maxHits)
+    return 0;
+
+  // candidates are start .. last - 1
+  uint64_t last = end - pattern->length + 1;
+  long processors = sysconf(_SC_NPROCESSORS_ONLN);
+  int numJobs = (last - start) / PARALLEL_CHUNK + 1;
+
+  if (numJobs > processors)
+    numJobs = processors > 0 ? processors : 1;
+  if (numJobs > MAX_THREADS)
+    numJobs = MAX_THREADS;
+
+  for (int i = 0; i < numJobs; i++)
+  {
+    memset(&jobs[i], 0, sizeof(search_job_t));
+    jobs[i].map = state->programMap;
+    jobs[i].from = start + (last - start) / numJobs * i;
+    jobs[i].to = i == numJobs - 1 ? last : start + (last - start) / numJobs * (i + 1);
+    jobs[i].pattern = pattern;
+    jobs[i].alignment = alignment ? alignment : 1;
+    jobs[i].maxHits = maxHits;
+
+    // run the first job on this thread, or all of them if threads
+    // cannot be created
+    started[i] = i > 0 && pthread_create(&threads[i], NULL, runJob, &jobs[i]) == 0;
+    if (i > 0 && !started[i])
+      runJob(&jobs[i]);
+  }
+  runJob(&jobs[0]);
+
+  for (int i = 0; i < numJobs; i++)
+  {
+    if (started[i])
+      pthread_join(threads[i], NULL);
+    failed |= jobs[i].failed;
+    numHits += jobs[i].numHits;
+  }
+
+  if (numHits > maxHits)
+    numHits = maxHits;
+  if (!failed && numHits)
+    *hits = malloc(numHits * sizeof(uint64_t));
+
+  uint64_t n = 0;
+  for (int i = 0; i < numJobs; i++)
+  {
+    for (uint64_t j = 0; *hits && j < jobs[i].numHits && n < numHits; j++)
+      (*hits)[n++] = jobs[i].hits[j];
+    free(jobs[i].hits);
+  }
+
+  return *hits ? numHits : 0;
+}
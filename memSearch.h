@@ -0,0 +1,26 @@
+/* This file contains the prototypes and constants needed to use the
+   memory search routines defined in memSearch.c
+*/
+
+#ifndef _MEMSEARCH_H_
+#define _MEMSEARCH_H_
+
+#include <stdint.h>
+
+#include "instruction.h"
+
+#define SEARCH_MAX_PATTERN 64
+
+typedef struct search_pattern {
+  uint8_t  bytes[SEARCH_MAX_PATTERN];
+  uint8_t  mask[SEARCH_MAX_PATTERN]; // bits that must match
+  unsigned length;
+} search_pattern_t;
+
+int      parseSearchPattern(const char *value, const char *mask,
+			    search_pattern_t *pattern);
+uint64_t memSearch(machine_state_t *state, uint64_t start, uint64_t end,
+		   const search_pattern_t *pattern, uint64_t alignment,
+		   uint64_t maxHits, uint64_t **hits);
+
+#endif /* MEMSEARCH */
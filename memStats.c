@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "memStats.h"
+
+// Regions counted in each block of the sparse table of counts
+#define BLOCK_REGIONS (SPARSE_BLOCK_SIZE / sizeof(mem_stats_count_t))
+
+/* Sets up statistics for the image of state, with regions of
+   regionSize bytes (a power of two) and working set windows of
+   windowSize accesses. Returns 1 in case of success, or 0 if memory
+   could not be allocated. */
+int memStatsInit(mem_stats_t *stats, machine_state_t *state,
+		 uint64_t regionSize, uint64_t windowSize) {
+
+  memset(stats, 0, sizeof(*stats));
+  while ((1ull << stats->regionShift) < regionSize)
+    stats->regionShift++;
+  stats->numRegions = (state->programSize >> stats->regionShift) + 1;
+  stats->windowSize = windowSize;
+
+  stats->windowRegions = malloc((windowSize < stats->numRegions ?
+				 windowSize : stats->numRegions) *
+				sizeof(uint64_t));
+  if (!sparseTableInit(&stats->counts, stats->numRegions, sizeof(mem_stats_count_t)) ||
+      !sparseTableInit(&stats->windowBits, (stats->numRegions + 63) / 64,
+		       sizeof(uint64_t)) ||
+      !stats->windowRegions)
+  {
+    memStatsFree(stats);
+    return 0;
+  }
+
+  memStatsReset(stats);
+  return 1;
+}
+
+/* Clears all statistics collected so far, keeping the configuration. */
+void memStatsReset(mem_stats_t *stats) {
+
+  sparseTableClear(&stats->counts);
+  sparseTableClear(&stats->windowBits);
+  stats->totalReads = 0;
+  stats->totalWrites = 0;
+  stats->windowAccesses = 0;
+  stats->windowTouched = 0;
+  stats->numWindows = 0;
+  stats->sumWorkingSet = 0;
+  stats->minWorkingSet = UINT64_MAX;
+  stats->maxWorkingSet = 0;
+  stats->stackBase = 0;
+  memset(stats->stackDepths, 0, sizeof(stats->stackDepths));
+}
+
+void memStatsFree(mem_stats_t *stats) {
+
+  sparseTableFree(&stats->counts);
+  sparseTableFree(&stats->windowBits);
+  free(stats->windowRegions);
+  stats->windowRegions = NULL;
+  stats->numRegions = 0;
+}
+
+/* Returns the histogram bucket of a stack depth: 0 for no depth, k for
+   depths in [2^(k-1), 2^k). */
+static inline int depthBucket(uint64_t depth) {
+
+  int bucket = 0;
+
+  while (depth && bucket < MEM_STATS_STACK_BUCKETS - 1)
+  {
+    depth >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+void memStatsMemAccessHook(void *data, const y86_instruction_t *instr,
+			   uint64_t address, uint64_t value, int isWrite) {
+
+  mem_stats_t *stats = data;
+  uint64_t region = address >> stats->regionShift;
+  mem_stats_count_t *count = sparseTableGet(&stats->counts, region);
+
+  // Without memory for the counts, the access is only in the totals
+  if (count && isWrite)
+    count->writes += count->writes != UINT32_MAX;
+  else if (count)
+    count->reads += count->reads != UINT32_MAX;
+  if (isWrite)
+    stats->totalWrites++;
+  else
+    stats->totalReads++;
+
+  if (!sparseTableTestBit(&stats->windowBits, region) &&
+      sparseTableSetBit(&stats->windowBits, region))
+    stats->windowRegions[stats->windowTouched++] = region;
+  if (++stats->windowAccesses == stats->windowSize)
+  {
+    stats->numWindows++;
+    stats->sumWorkingSet += stats->windowTouched;
+    if (stats->windowTouched < stats->minWorkingSet)
+      stats->minWorkingSet = stats->windowTouched;
+    if (stats->windowTouched > stats->maxWorkingSet)
+      stats->maxWorkingSet = stats->windowTouched;
+    for (uint64_t i = 0; i < stats->windowTouched; i++)
+    {
+      uint64_t *word = sparseTableFind(&stats->windowBits, stats->windowRegions[i] / 64);
+      *word = 0;
+    }
+    stats->windowAccesses = 0;
+    stats->windowTouched = 0;
+  }
+
+  // Stack accesses are those made by push, pop, call and ret
+  if (instr->icode == I_PUSHQ || instr->icode == I_POPQ ||
+      instr->icode == I_CALL || instr->icode == I_RET)
+  {
+    if (address + 8 > stats->stackBase)
+      stats->stackBase = address + 8;
+    stats->stackDepths[depthBucket(stats->stackBase - address)]++;
+  }
+}
+
+typedef struct region_count {
+  uint64_t region;
+  uint64_t accesses;
+} region_count_t;
+
+static int compareRegionCounts(const void *a, const void *b) {
+
+  const region_count_t *ra = a, *rb = b;
+
+  if (ra->accesses != rb->accesses)
+    return ra->accesses < rb->accesses ? 1 : -1;
+  return ra->region < rb->region ? -1 : ra->region > rb->region;
+}
+
+/* Prints the totals, the (at most) maxRegions regions with the most
+   accesses, the working set per window and the distribution of the
+   stack depth. */
+int memStatsPrintReport(FILE *file, mem_stats_t *stats, int maxRegions) {
+
+  int chars = 0;
+  uint64_t regionSize = 1ull << stats->regionShift, touched = 0;
+  region_count_t *sorted;
+
+  chars += fprintf(file, "    # Accesses: %lu reads, %lu writes, %lu-byte regions\n",
+		   stats->totalReads, stats->totalWrites, regionSize);
+
+  sorted = malloc((stats->counts.numAllocated * BLOCK_REGIONS + 1) *
+		  sizeof(region_count_t));
+  if (sorted)
+  {
+    for (uint64_t block = 0; block < stats->counts.numBlocks; block++)
+    {
+      const mem_stats_count_t *counts = (mem_stats_count_t *) stats->counts.blocks[block];
+
+      for (uint64_t i = 0; counts && i < BLOCK_REGIONS; i++)
+	if (counts[i].reads || counts[i].writes)
+	{
+	  sorted[touched].region = block * BLOCK_REGIONS + i;
+	  sorted[touched].accesses = (uint64_t) counts[i].reads + counts[i].writes;
+	  touched++;
+	}
+    }
+    qsort(sorted, touched, sizeof(region_count_t), compareRegionCounts);
+
+    chars += fprintf(file, "    # Regions touched: %lu (%lu bytes)\n",
+		     touched, touched * regionSize);
+    if (touched && maxRegions > 0)
+      chars += fprintf(file, "    # %-37s %12s %12s\n", "Region", "reads", "writes");
+    for (uint64_t i = 0; i < touched && i < (uint64_t) maxRegions; i++)
+    {
+      uint64_t region = sorted[i].region;
+      const mem_stats_count_t *count = sparseTableFind(&stats->counts, region);
+      chars += fprintf(file, "    # 0x%016lx-0x%016lx %12u %12u\n",
+		       region << stats->regionShift,
+		       ((region + 1) << stats->regionShift) - 1,
+		       count->reads, count->writes);
+    }
+    free(sorted);
+  }
+
+  if (stats->numWindows)
+    chars += fprintf(file, "    # Working set over %lu windows of %lu accesses: "
+		     "min %lu, avg %.1f, max %lu regions\n",
+		     stats->numWindows, stats->windowSize, stats->minWorkingSet,
+		     (double) stats->sumWorkingSet / stats->numWindows,
+		     stats->maxWorkingSet);
+  chars += fprintf(file, "    # Working set of the current window: %lu regions "
+		   "in %lu accesses\n", stats->windowTouched, stats->windowAccesses);
+
+  if (stats->stackBase)
+    chars += fprintf(file, "    # Stack depth in bytes below 0x%lx at each stack access:\n",
+		     stats->stackBase);
+  for (int i = 0; i < MEM_STATS_STACK_BUCKETS; i++)
+  {
+    if (!stats->stackDepths[i])
+      continue;
+    if (i == 0)
+      chars += fprintf(file, "    #   %21s %12lu\n", "0", stats->stackDepths[i]);
+    else
+      chars += fprintf(file, "    #   %10lu-%10lu %12lu\n", 1ul << (i - 1),
+		       (1ul << i) - 1, stats->stackDepths[i]);
+  }
+
+  return chars;
+}
+
+/* Writes the heatmap: one line per region accessed, with its start
+   address and read and write counts, in CSV. Returns a negative value
+   in case of error. */
+int memStatsExport(FILE *file, mem_stats_t *stats) {
+
+  if (fprintf(file, "address,reads,writes\n") < 0)
+    return -1;
+  for (uint64_t block = 0; block < stats->counts.numBlocks; block++)
+  {
+    const mem_stats_count_t *counts = (mem_stats_count_t *) stats->counts.blocks[block];
+
+    for (uint64_t i = 0; counts && i < BLOCK_REGIONS; i++)
+      if ((counts[i].reads || counts[i].writes) &&
+	  fprintf(file, "0x%lx,%u,%u\n",
+		  (block * BLOCK_REGIONS + i) << stats->regionShift,
+		  counts[i].reads, counts[i].writes) < 0)
+	return -1;
+  }
+  return 0;
+}
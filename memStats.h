@@ -0,0 +1,67 @@
+/* This file contains the prototypes and constants needed to use the
+   memory access statistics defined in memStats.c
+*/
+
+#ifndef _MEMSTATS_H_
+#define _MEMSTATS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "instruction.h"
+#include "sparseTable.h"
+
+#define MEM_STATS_DEFAULT_REGION 64   // bytes, one cache line
+#define MEM_STATS_DEFAULT_WINDOW 1000 // accesses
+#define MEM_STATS_STACK_BUCKETS  33   // depth 0, then 1 B up to 4 GB in powers of 2
+
+/* Read and write counts of a region. Counters are 32 bits and
+   saturate. */
+typedef struct mem_stats_count {
+  uint32_t reads;
+  uint32_t writes;
+} mem_stats_count_t;
+
+/* Read and write counts per fixed-size region of the program image,
+   fed through a memory access hook. Each access is counted in the
+   region of its first byte. The counts are kept in a sparse table, so
+   that they only use memory for the parts of memory accessed. */
+typedef struct mem_stats {
+
+  unsigned  regionShift;
+  uint64_t  numRegions;
+  sparse_table_t counts;  // of mem_stats_count_t, no blocks until memStatsInit
+  uint64_t  totalReads;
+  uint64_t  totalWrites;
+
+  // Working set: number of distinct regions touched in each window of
+  // windowSize accesses, tracked with one bit per region. The regions
+  // touched are also listed, so that only their bits are cleared when
+  // the next window starts.
+  uint64_t  windowSize;
+  uint64_t  windowAccesses;
+  sparse_table_t windowBits;
+  uint64_t *windowRegions;
+  uint64_t  windowTouched;
+  uint64_t  numWindows;
+  uint64_t  sumWorkingSet;
+  uint64_t  minWorkingSet;
+  uint64_t  maxWorkingSet;
+
+  // Depth of each push, pop, call and ret access, in bytes below the
+  // end of the highest stack slot accessed so far
+  uint64_t  stackBase;
+  uint64_t  stackDepths[MEM_STATS_STACK_BUCKETS];
+
+} mem_stats_t;
+
+int  memStatsInit(mem_stats_t *stats, machine_state_t *state,
+		  uint64_t regionSize, uint64_t windowSize);
+void memStatsReset(mem_stats_t *stats);
+void memStatsFree(mem_stats_t *stats);
+void memStatsMemAccessHook(void *data, const y86_instruction_t *instr,
+			   uint64_t address, uint64_t value, int isWrite);
+int  memStatsPrintReport(FILE *file, mem_stats_t *stats, int maxRegions);
+int  memStatsExport(FILE *file, mem_stats_t *stats);
+
+#endif /* MEMSTATS */
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "opcodeStats.h"
+#include "printRoutines.h"
+
+int opcodeStatsInit(opcode_stats_t *stats) {
+
+  memset(stats, 0, sizeof(*stats));
+  if (!pcTableInit(&stats->pairs, 1))
+    return 0;
+  if (!pcTableInit(&stats->triples, 1))
+  {
+    pcTableFree(&stats->pairs);
+    return 0;
+  }
+  return 1;
+}
+
+/* Clears all statistics collected so far. */
+void opcodeStatsReset(opcode_stats_t *stats) {
+
+  stats->instructions = 0;
+  stats->numPrevious = 0;
+  stats->fusedInstructions = 0;
+  memset(stats->fused, 0, sizeof(stats->fused));
+  pcTableClear(&stats->pairs);
+  pcTableClear(&stats->triples);
+}
+
+void opcodeStatsFree(opcode_stats_t *stats) {
+
+  pcTableFree(&stats->pairs);
+  pcTableFree(&stats->triples);
+}
+
+static uint64_t sequenceCount(const uint64_t *counters) {
+  return counters[0];
+}
+
+/* Prints the maxSequences most frequent sequences of length instructions
+   in table, with the superinstruction they make, if any. */
+static int printSequences(FILE *file, opcode_stats_t *stats, pc_table_t *table,
+			  int length, int maxSequences) {
+
+  int chars = 0;
+  uint64_t *slots;
+  uint64_t n = pcTableSort(table, sequenceCount, &slots);
+
+  if (!n || maxSequences <= 0)
+  {
+    free(slots);
+    return chars;
+  }
+
+  chars += fprintf(file, "    # %-26s %14s %7s  %s\n",
+		   length == 2 ? "Pair" : "Triple", "count", "%", "superinstruction");
+  for (uint64_t i = 0; i < n && i < (uint64_t) maxSequences; i++)
+  {
+    uint64_t key = pcTableKey(table, slots[i]);
+    uint64_t count = *pcTableCounters(table, slots[i]);
+    y86_icode_t icodes[FUSE_MAX_LENGTH];
+    y86_fusion_t kind;
+    char names[32] = "";
+
+    for (int j = 0; j < length; j++)
+    {
+      uint8_t opcode = key >> (8 * (length - 1 - j));
+      icodes[j] = opcode >> 4;
+      snprintf(names + strlen(names), sizeof(names) - strlen(names), "%s%s",
+	       j ? " " : "", instructionName(opcode >> 4, opcode & 0xF));
+    }
+    kind = fusionOf(icodes, length);
+    chars += fprintf(file, "    # %-26s %14lu %6.2f%%  %s\n", names, count,
+		     100.0 * count / stats->instructions,
+		     kind != FUSE_NONE ? fusionName(kind) : "-");
+  }
+
+  free(slots);
+  return chars;
+}
+
+/* Prints the superinstructions executed, then the most frequent pairs
+   and triples of instructions. */
+int opcodeStatsPrintReport(FILE *file, opcode_stats_t *stats, int maxSequences) {
+
+  int chars = 0;
+
+  chars += fprintf(file, "    # Instructions: %lu, in superinstructions: %lu (%.1f%%)\n",
+		   stats->instructions, stats->fusedInstructions,
+		   stats->instructions ?
+		   100.0 * stats->fusedInstructions / stats->instructions : 0.0);
+  for (int kind = FUSE_NONE + 1; kind < FUSE_KINDS; kind++)
+    chars += fprintf(file, "    #   %-24s %14lu\n", fusionName(kind),
+		     stats->fused[kind]);
+
+  chars += printSequences(file, stats, &stats->pairs, 2, maxSequences);
+  chars += printSequences(file, stats, &stats->triples, 3, maxSequences);
+  return chars;
+}
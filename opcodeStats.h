@@ -0,0 +1,79 @@
+/* This file contains the prototypes and constants needed to use the
+   opcode pair statistics defined in opcodeStats.c
+*/
+
+#ifndef _OPCODESTATS_H_
+#define _OPCODESTATS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "instruction.h"
+#include "pcTable.h"
+
+/* Sequences of two and three instructions executed one after the
+   other in memory order (a taken jump, call or ret ends a sequence),
+   keyed by their opcode bytes: the candidates for superinstructions.
+   Also counts the superinstructions actually executed. */
+typedef struct opcode_stats {
+
+  uint64_t instructions;
+
+  uint64_t nextPC;       // address after the last instruction recorded
+  int      numPrevious;  // instructions in the current sequence, up to 2
+  uint8_t  previous[2];  // their opcodes, the last one first
+
+  pc_table_t pairs;
+  pc_table_t triples;
+
+  uint64_t fused[FUSE_KINDS];  // superinstructions executed, by kind
+  uint64_t fusedInstructions;  // instructions executed in them
+
+} opcode_stats_t;
+
+int  opcodeStatsInit(opcode_stats_t *stats);
+void opcodeStatsReset(opcode_stats_t *stats);
+void opcodeStatsFree(opcode_stats_t *stats);
+int  opcodeStatsPrintReport(FILE *file, opcode_stats_t *stats, int maxSequences);
+
+/* Updates the statistics after instr was executed successfully. */
+static inline void opcodeStatsRecord(opcode_stats_t *stats,
+				     const y86_instruction_t *instr) {
+
+  uint8_t opcode = instr->icode << 4 | instr->ifun;
+  uint64_t *counter;
+
+  stats->instructions++;
+  if (instr->location != stats->nextPC)
+    stats->numPrevious = 0;
+
+  if (stats->numPrevious >= 1 &&
+      (counter = pcTableLookup(&stats->pairs, stats->previous[0] << 8 | opcode)))
+    (*counter)++;
+  if (stats->numPrevious == 2 &&
+      (counter = pcTableLookup(&stats->triples, stats->previous[1] << 16 |
+			       stats->previous[0] << 8 | opcode)))
+    (*counter)++;
+
+  stats->previous[1] = stats->previous[0];
+  stats->previous[0] = opcode;
+  if (stats->numPrevious < 2)
+    stats->numPrevious++;
+  stats->nextPC = instr->valP;
+}
+
+/* Updates the statistics after the first done instructions of a
+   superinstruction were executed by executeFused(). */
+static inline void opcodeStatsRecordFused(opcode_stats_t *stats,
+					  const y86_fused_t *fused, int done) {
+
+  for (int i = 0; i < done; i++)
+    opcodeStatsRecord(stats, &fused->instr[i]);
+  if (fused->kind != FUSE_NONE && done == fused->count)
+  {
+    stats->fused[fused->kind]++;
+    stats->fusedInstructions += done;
+  }
+}
+
+#endif /* OPCODESTATS */
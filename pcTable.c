@@ -0,0 +1,176 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "pcTable.h"
+
+#define INITIAL_CAPACITY 1024
+
+/* Initializes an empty table with numCounters counters per entry.
+   Returns 1 in case of success, or 0 if memory could not be
+   allocated. */
+int pcTableInit(pc_table_t *table, int numCounters) {
+
+  table->numCounters = numCounters;
+  table->capacity = INITIAL_CAPACITY;
+  table->keys = malloc(table->capacity * sizeof(uint64_t));
+  table->counters = malloc(table->capacity * numCounters * sizeof(uint64_t));
+  if (!table->keys || !table->counters)
+  {
+    pcTableFree(table);
+    return 0;
+  }
+
+  pcTableClear(table);
+  return 1;
+}
+
+/* Removes all entries from the table. */
+void pcTableClear(pc_table_t *table) {
+
+  for (uint64_t i = 0; i < table->capacity; i++)
+    table->keys[i] = PC_TABLE_EMPTY;
+  table->used = 0;
+}
+
+void pcTableFree(pc_table_t *table) {
+
+  free(table->keys);
+  free(table->counters);
+  table->keys = NULL;
+  table->counters = NULL;
+  table->capacity = 0;
+  table->used = 0;
+}
+
+static inline uint64_t slotFor(pc_table_t *table, uint64_t key) {
+
+  return (key * 0x9E3779B97F4A7C15ull >> 32) & (table->capacity - 1);
+}
+
+/* Doubles the capacity of the table. If memory cannot be allocated
+   the table is left as is, and keeps working while there is room in
+   it. */
+static void grow(pc_table_t *table) {
+
+  pc_table_t bigger = *table;
+
+  bigger.capacity = 2 * table->capacity;
+  bigger.keys = malloc(bigger.capacity * sizeof(uint64_t));
+  bigger.counters = malloc(bigger.capacity * table->numCounters * sizeof(uint64_t));
+  if (!bigger.keys || !bigger.counters)
+  {
+    free(bigger.keys);
+    free(bigger.counters);
+    return;
+  }
+  pcTableClear(&bigger);
+
+  for (uint64_t i = 0; i < table->capacity; i++)
+  {
+    if (table->keys[i] != PC_TABLE_EMPTY)
+      memcpy(pcTableLookup(&bigger, table->keys[i]), pcTableCounters(table, i),
+	     table->numCounters * sizeof(uint64_t));
+  }
+
+  free(table->keys);
+  free(table->counters);
+  *table = bigger;
+}
+
+/* Adds key, which is not in the table, with all counters set to zero,
+   growing the table first if it is half full. Returns the counters, or
+   NULL if the table is full and cannot grow. */
+static uint64_t *insert(pc_table_t *table, uint64_t key) {
+
+  if (2 * (table->used + 1) > table->capacity)
+    grow(table);
+  if (table->used + 1 >= table->capacity)
+    return NULL;
+
+  uint64_t mask = table->capacity - 1;
+  uint64_t i = slotFor(table, key);
+
+  while (table->keys[i] != PC_TABLE_EMPTY)
+    i = (i + 1) & mask;
+  table->keys[i] = key;
+  memset(pcTableCounters(table, i), 0, table->numCounters * sizeof(uint64_t));
+  table->used++;
+  return pcTableCounters(table, i);
+}
+
+/* Returns the counters associated with the specified key, adding a
+   new entry with all counters set to zero if there is none yet.
+   Returns NULL only if the table is full and cannot grow. Only adding
+   a key moves the entries, so the counters returned stay valid until
+   the next lookup of a key that is not in the table. */
+uint64_t *pcTableLookup(pc_table_t *table, uint64_t key) {
+
+  uint64_t mask = table->capacity - 1;
+  uint64_t i = slotFor(table, key);
+
+  while (table->keys[i] != key)
+  {
+    if (table->keys[i] == PC_TABLE_EMPTY)
+      return insert(table, key);
+    i = (i + 1) & mask;
+  }
+  return pcTableCounters(table, i);
+}
+
+typedef struct weighted_slot {
+  uint64_t weight;
+  uint64_t key;
+  uint64_t slot;
+} weighted_slot_t;
+
+static int compareWeightedSlots(const void *a, const void *b) {
+
+  const weighted_slot_t *wa = a, *wb = b;
+
+  if (wa->weight != wb->weight)
+    return wa->weight < wb->weight ? 1 : -1;
+  return wa->key < wb->key ? -1 : wa->key > wb->key;
+}
+
+/* Stores in *slots a newly allocated array with the slots of all
+   entries in the table, ordered by decreasing weight (and increasing
+   key for equal weights). Returns the number of entries, or 0 if
+   there are none or memory could not be allocated. The caller must
+   free *slots. */
+uint64_t pcTableSort(pc_table_t *table, pc_weight_t weight, uint64_t **slots) {
+
+  uint64_t n = 0;
+  weighted_slot_t *sorted;
+
+  *slots = NULL;
+  if (!table->used)
+    return 0;
+
+  sorted = malloc(table->used * sizeof(weighted_slot_t));
+  *slots = malloc(table->used * sizeof(uint64_t));
+  if (!sorted || !*slots)
+  {
+    free(sorted);
+    free(*slots);
+    *slots = NULL;
+    return 0;
+  }
+
+  for (uint64_t i = 0; i < table->capacity; i++)
+  {
+    if (table->keys[i] != PC_TABLE_EMPTY)
+    {
+      sorted[n].weight = weight(pcTableCounters(table, i));
+      sorted[n].key = table->keys[i];
+      sorted[n].slot = i;
+      n++;
+    }
+  }
+  qsort(sorted, n, sizeof(weighted_slot_t), compareWeightedSlots);
+
+  for (uint64_t i = 0; i < n; i++)
+    (*slots)[i] = sorted[i].slot;
+  free(sorted);
+  return n;
+}
@@ -0,0 +1,42 @@
+/* This file contains the prototypes and constants needed to use the
+   per-PC counter tables defined in pcTable.c
+*/
+
+#ifndef _PCTABLE_H_
+#define _PCTABLE_H_
+
+#include <stdint.h>
+
+#define PC_TABLE_EMPTY UINT64_MAX
+
+/* Open-addressing hash table mapping a guest address (usually a PC) to
+   a fixed number of 64-bit counters. Counters of all entries are kept
+   in one flat array, numCounters per slot. Adding a key may move all
+   of them, which invalidates the pointers returned by earlier lookups. */
+typedef struct pc_table {
+
+  int       numCounters;
+  uint64_t  capacity;
+  uint64_t  used;
+  uint64_t *keys;
+  uint64_t *counters;
+
+} pc_table_t;
+
+typedef uint64_t (*pc_weight_t)(const uint64_t *counters);
+
+int       pcTableInit(pc_table_t *table, int numCounters);
+void      pcTableClear(pc_table_t *table);
+void      pcTableFree(pc_table_t *table);
+uint64_t *pcTableLookup(pc_table_t *table, uint64_t key);
+uint64_t  pcTableSort(pc_table_t *table, pc_weight_t weight, uint64_t **slots);
+
+static inline uint64_t pcTableKey(pc_table_t *table, uint64_t slot) {
+  return table->keys[slot];
+}
+
+static inline uint64_t *pcTableCounters(pc_table_t *table, uint64_t slot) {
+  return table->counters + slot * table->numCounters;
+}
+
+#endif /* PCTABLE */
@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#include "pipeline.h"
+
+static const char *predictorNames[] = {
+  [P_TAKEN]     = "taken",
+  [P_NOT_TAKEN] = "nottaken",
+  [P_BTFN]      = "btfn",
+  [P_BIMODAL]   = "bimodal"
+};
+
+const char *predictorName(branch_predictor_t predictor) {
+
+  return predictorNames[predictor];
+}
+
+/* Converts a predictor name (as accepted by the cycles command) into
+   its branch_predictor_t value. Returns 1 in case of success, or 0 if
+   the name is unknown. */
+int predictorFromName(const char *name, branch_predictor_t *predictor) {
+
+  for (int i = P_TAKEN; i <= P_BIMODAL; i++)
+  {
+    if (strcasecmp(name, predictorNames[i]) == 0)
+    {
+      *predictor = i;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Initializes an empty timing model using the specified branch
+   predictor. Returns 1 in case of success, or 0 if memory could not
+   be allocated. */
+int pipelineInit(pipeline_model_t *model, branch_predictor_t predictor) {
+
+  memset(model, 0, sizeof(*model));
+  model->predictor = predictor;
+  if (!pcTableInit(&model->stalls, NUM_STALL_COUNTERS))
+    return 0;
+
+  pipelineReset(model);
+  return 1;
+}
+
+/* Clears all statistics collected so far, keeping the predictor. */
+void pipelineReset(pipeline_model_t *model) {
+
+  model->instructions = 0;
+  model->cycles = 0;
+  model->branches = 0;
+  model->mispredicts = 0;
+  model->loadUseStalls = 0;
+  model->retBubbles = 0;
+  model->pendingLoad = R_NONE;
+
+  // weakly taken
+  memset(model->bimodal, 2, sizeof(model->bimodal));
+
+  pcTableClear(&model->stalls);
+}
+
+void pipelineFree(pipeline_model_t *model) {
+
+  pcTableFree(&model->stalls);
+}
+
+/* Adds one occurrence of the specified kind of stall to the counters
+   of the instruction at pc. */
+static void countStall(pipeline_model_t *model, uint64_t pc, int kind) {
+
+  uint64_t *counters = pcTableLookup(&model->stalls, pc);
+
+  if (counters)
+    counters[kind]++;
+}
+
+/* Returns true (non-zero) if the instruction reads the specified
+   register in its decode stage. */
+static inline int readsRegister(y86_instruction_t *instr, y86_register_t reg) {
+
+  switch (instr->icode)
+  {
+  case I_RRMVXX:
+    return instr->rA == reg;
+  case I_OPQ:
+  case I_RMMOVQ:
+    return instr->rA == reg || instr->rB == reg;
+  case I_MRMOVQ:
+    return instr->rB == reg;
+  case I_PUSHQ:
+    return instr->rA == reg || reg == R_RSP;
+  case I_POPQ:
+  case I_CALL:
+  case I_RET:
+    return reg == R_RSP;
+  default:
+    return 0;
+  }
+}
+
+static inline int predictTaken(pipeline_model_t *model, y86_instruction_t *instr) {
+
+  switch (model->predictor)
+  {
+  case P_NOT_TAKEN:
+    return 0;
+  case P_BTFN:
+    return instr->valC <= instr->location;
+  case P_BIMODAL:
+    return model->bimodal[instr->location % PIPE_BIMODAL_ENTRIES] >= 2;
+  case P_TAKEN:
+  default:
+    return 1;
+  }
+}
+
+/* Accounts for one instruction that was just executed successfully;
+   nextPC is the program counter after its execution. Computes the
+   cycles it costs in a PIPE-style five stage pipeline, including
+   load/use stalls, branch mispredictions and ret bubbles. */
+void pipelineRecord(pipeline_model_t *model, y86_instruction_t *instr,
+		    uint64_t nextPC) {
+
+  model->instructions++;
+  model->cycles += model->instructions == 1 ? 1 + PIPE_FILL_CYCLES : 1;
+
+  if (model->pendingLoad != R_NONE && readsRegister(instr, model->pendingLoad))
+  {
+    model->cycles += PIPE_LOAD_USE_PENALTY;
+    model->loadUseStalls++;
+    countStall(model, instr->location, STALL_LOAD_USE);
+  }
+
+  model->pendingLoad =
+    (instr->icode == I_MRMOVQ || instr->icode == I_POPQ) ? instr->rA : R_NONE;
+
+  if (instr->icode == I_JXX && instr->ifun != C_NC)
+  {
+    int taken = nextPC == instr->valC;
+    model->branches++;
+
+    if (predictTaken(model, instr) != taken && instr->valC != instr->valP)
+    {
+      model->cycles += PIPE_MISPREDICT_PENALTY;
+      model->mispredicts++;
+      countStall(model, instr->location, STALL_MISPREDICT);
+    }
+
+    if (model->predictor == P_BIMODAL)
+    {
+      uint8_t *counter = &model->bimodal[instr->location % PIPE_BIMODAL_ENTRIES];
+      if (taken && *counter < 3)
+	(*counter)++;
+      else if (!taken && *counter > 0)
+	(*counter)--;
+    }
+  }
+  else if (instr->icode == I_RET)
+  {
+    model->cycles += PIPE_RET_PENALTY;
+    model->retBubbles++;
+    countStall(model, instr->location, STALL_RET);
+  }
+}
+
+/* Number of cycles lost by an instruction, used to rank the report. */
+static uint64_t stallCycles(const uint64_t *counters) {
+
+  return counters[STALL_LOAD_USE] * PIPE_LOAD_USE_PENALTY +
+    counters[STALL_MISPREDICT] * PIPE_MISPREDICT_PENALTY +
+    counters[STALL_RET] * PIPE_RET_PENALTY;
+}
+
+/* Prints total cycles, CPI and the breakdown of stall cycles, followed
+   by the (at most) maxPCs instructions that stalled the most. */
+int pipelinePrintReport(FILE *file, pipeline_model_t *model, int maxPCs) {
+
+  int chars = 0;
+  double cpi = model->instructions ?
+    (double) model->cycles / model->instructions : 0;
+
+  chars += fprintf(file, "    # Predictor: %s\n", predictorName(model->predictor));
+  chars += fprintf(file, "    # Instructions: %lu, cycles: %lu, CPI: %.3f\n",
+		   model->instructions, model->cycles, cpi);
+  chars += fprintf(file, "    # Load/use stalls: %lu (%lu cycles)\n",
+		   model->loadUseStalls,
+		   model->loadUseStalls * PIPE_LOAD_USE_PENALTY);
+  chars += fprintf(file, "    # Mispredicted branches: %lu of %lu (%lu cycles)\n",
+		   model->mispredicts, model->branches,
+		   model->mispredicts * PIPE_MISPREDICT_PENALTY);
+  chars += fprintf(file, "    # Return bubbles: %lu (%lu cycles)\n",
+		   model->retBubbles, model->retBubbles * PIPE_RET_PENALTY);
+
+  uint64_t *slots;
+  uint64_t n = pcTableSort(&model->stalls, stallCycles, &slots);
+  if (!n || maxPCs <= 0)
+  {
+    free(slots);
+    return chars;
+  }
+
+  chars += fprintf(file, "    # %-18s %12s %12s %12s\n",
+		   "PC", "load/use", "mispredict", "ret");
+  for (uint64_t i = 0; i < n && i < (uint64_t) maxPCs; i++)
+  {
+    uint64_t *counters = pcTableCounters(&model->stalls, slots[i]);
+    chars += fprintf(file, "    # 0x%-16lx %12lu %12lu %12lu\n",
+		     pcTableKey(&model->stalls, slots[i]),
+		     counters[STALL_LOAD_USE], counters[STALL_MISPREDICT],
+		     counters[STALL_RET]);
+  }
+
+  free(slots);
+  return chars;
+}
@@ -0,0 +1,64 @@
+/* This file contains the prototypes and constants needed to use the
+   PIPE timing model defined in pipeline.c
+*/
+
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "instruction.h"
+#include "pcTable.h"
+
+#define PIPE_FILL_CYCLES        4 // cycles before the first instruction retires
+#define PIPE_LOAD_USE_PENALTY   1
+#define PIPE_MISPREDICT_PENALTY 2
+#define PIPE_RET_PENALTY        3
+
+#define PIPE_BIMODAL_ENTRIES 4096
+
+typedef enum branch_predictor {
+  P_TAKEN,     // always predict taken (the PIPE default)
+  P_NOT_TAKEN, // always predict not taken
+  P_BTFN,      // backward taken, forward not taken
+  P_BIMODAL    // per-PC 2-bit saturating counters
+} branch_predictor_t;
+
+// Per-PC stall counters kept in pipeline_model_t.stalls
+enum { STALL_LOAD_USE, STALL_MISPREDICT, STALL_RET, NUM_STALL_COUNTERS };
+
+typedef struct pipeline_model {
+
+  branch_predictor_t predictor;
+
+  uint64_t instructions;
+  uint64_t cycles;
+  uint64_t branches;
+  uint64_t mispredicts;
+  uint64_t loadUseStalls;
+  uint64_t retBubbles;
+
+  // Register loaded from memory by the previous instruction, R_NONE
+  // if the previous instruction was not a load.
+  y86_register_t pendingLoad;
+
+  uint8_t bimodal[PIPE_BIMODAL_ENTRIES];
+
+  // Per-PC stall counts, only touched when an instruction actually
+  // stalls.
+  pc_table_t stalls;
+
+} pipeline_model_t;
+
+int  pipelineInit(pipeline_model_t *model, branch_predictor_t predictor);
+void pipelineReset(pipeline_model_t *model);
+void pipelineFree(pipeline_model_t *model);
+void pipelineRecord(pipeline_model_t *model, y86_instruction_t *instr,
+		    uint64_t nextPC);
+int  pipelinePrintReport(FILE *file, pipeline_model_t *model, int maxPCs);
+
+const char *predictorName(branch_predictor_t predictor);
+int predictorFromName(const char *name, branch_predictor_t *predictor);
+
+#endif /* PIPELINE */
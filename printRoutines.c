@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdarg.h>
 #include <assert.h>
@@ -60,6 +62,39 @@ static const char *regName[R_NONE] = {
   [R_R14] = "%r14"
 };
 
+static const char *fuseName[FUSE_KINDS] = {
+  [FUSE_NONE]           = "none",
+  [FUSE_OPQ_JXX]        = "opq+jxx",
+  [FUSE_IRMOVQ_OPQ]     = "irmovq+opq",
+  [FUSE_IRMOVQ_OPQ_JXX] = "irmovq+opq+jxx",
+  [FUSE_MRMOVQ_OPQ]     = "mrmovq+opq",
+  [FUSE_PUSHQ_PUSHQ]    = "pushq+pushq",
+  [FUSE_POPQ_POPQ]      = "popq+popq"
+};
+
+/* Returns the mnemonic of the instruction with the specified icode and
+   ifun, or NULL if there is no such instruction. */
+const char *instructionName(int icode, int ifun) {
+
+  if (icode < 0 || icode > 0xF || ifun < 0 || ifun > 0xF ||
+      !instrName[icode][ifun])
+    return NULL;
+  return instrName[icode][ifun];
+}
+
+/* Returns the name of a kind of superinstruction, e.g., "opq+jxx". */
+const char *fusionName(y86_fusion_t kind) {
+
+  return kind < FUSE_KINDS ? fuseName[kind] : NULL;
+}
+
+/* Returns the name of a register, including the %, or NULL if reg is
+   not a valid register. */
+const char *registerName(y86_register_t reg) {
+
+  return reg < R_NONE ? regName[reg] : NULL;
+}
+
 static inline int printRegister(FILE *file, y86_register_t reg) {
 
   assert(reg < R_NONE);
@@ -170,6 +205,14 @@ int printRegisterValue(FILE *file, machine_state_t *state,
 		 state->registerFile[reg]);
 }
 
+int printConditionCodes(FILE *file, machine_state_t *state) {
+
+  uint8_t cc = getConditionCodes(state);
+  return fprintf(file, "    # CC: ZF = %d, SF = %d, OF = %d\n",
+		 (cc & CC_ZERO_MASK) != 0, (cc & CC_SIGN_MASK) != 0,
+		 (cc & CC_OVERFLOW_MASK) != 0);
+}
+
 int printMemoryValueByte(FILE *file, machine_state_t *state, uint64_t addr) {
 
   uint8_t value;
@@ -187,3 +230,141 @@ int printMemoryValueQuad(FILE *file, machine_state_t *state, uint64_t addr) {
   else
     return printErrorInvalidMemoryLocation(file, NULL, addr);
 }
+
+#define DUMP_BUFFER_SIZE (1 << 20)
+#define DUMP_BYTES_PER_LINE 16
+
+// "000102...feff": the two hex digits of every byte value
+static char hexPairs[2 * 256 + 1];
+
+static void initHexPairs(void) {
+
+  static const char digits[] = "0123456789abcdef";
+
+  if (hexPairs[0])
+    return;
+  for (int i = 0; i < 256; i++)
+  {
+    hexPairs[2 * i] = digits[i >> 4];
+    hexPairs[2 * i + 1] = digits[i & 0xF];
+  }
+}
+
+static inline char *formatHexByte(char *out, uint8_t byte) {
+
+  memcpy(out, &hexPairs[2 * byte], 2);
+  return out + 2;
+}
+
+static inline char *formatHexQuad(char *out, uint64_t value) {
+
+  for (int shift = 56; shift >= 0; shift -= 8)
+    out = formatHexByte(out, value >> shift);
+  return out;
+}
+
+/* Formats one dump line with up to 16 bytes starting at addr into out,
+   and returns a pointer past the end of the line. In byte mode lines
+   look like the canonical hexdump -C format; in quad mode each group
+   of eight bytes is shown as one little-endian quad-word. */
+static char *formatDumpLine(char *out, const char *prefix, uint64_t addr,
+			    const uint8_t *bytes, unsigned count, int quads) {
+
+  size_t prefixLength = strlen(prefix);
+
+  memcpy(out, prefix, prefixLength);
+  out = formatHexQuad(out + prefixLength, addr);
+  *out++ = ' ';
+
+  if (quads)
+  {
+    for (unsigned i = 0; i + 8 <= count; i += 8)
+    {
+      uint64_t value = 0;
+      for (int j = 7; j >= 0; j--)
+	value = value << 8 | bytes[i + j];
+      *out++ = ' ';
+      out = formatHexQuad(out, value);
+    }
+  }
+  else
+  {
+    for (unsigned i = 0; i < DUMP_BYTES_PER_LINE; i++)
+    {
+      if (i % 8 == 0)
+	*out++ = ' ';
+      if (i < count)
+	out = formatHexByte(out, bytes[i]);
+      else
+      {
+	memcpy(out, "  ", 2);
+	out += 2;
+      }
+      *out++ = ' ';
+    }
+    *out++ = ' ';
+    *out++ = '|';
+    for (unsigned i = 0; i < count; i++)
+      *out++ = bytes[i] >= 0x20 && bytes[i] < 0x7F ? bytes[i] : '.';
+    *out++ = '|';
+  }
+
+  *out++ = '\n';
+  return out;
+}
+
+/* Prints length bytes of memory starting at addr as a hex dump, each
+   line starting with prefix. quads selects quad-word rather than byte
+   groups (length should then be a multiple of 8). Lines are formatted
+   into a large buffer that is written out as it fills up, so that big
+   ranges are limited by the speed of the output. Only the part of the
+   range that is within memory is dumped; it is up to the caller to
+   report the rest as invalid. Returns the number of characters
+   printed, or -1 if there was a write error. */
+long printMemoryDump(FILE *file, machine_state_t *state, uint64_t addr,
+		     uint64_t length, int quads, const char *prefix) {
+
+  uint64_t valid = 0;
+  long chars = 0;
+  size_t lineMax = strlen(prefix) + 16 + 4 * DUMP_BYTES_PER_LINE + 8;
+  char *buffer, *out;
+
+  if (addr < state->programSize)
+    valid = state->programSize - addr < length ? state->programSize - addr : length;
+
+  if (quads)
+    valid -= valid % 8;
+
+  buffer = malloc(DUMP_BUFFER_SIZE);
+  if (!buffer)
+    return -1;
+  initHexPairs();
+
+  out = buffer;
+  for (uint64_t offset = 0; offset < valid; offset += DUMP_BYTES_PER_LINE)
+  {
+    unsigned count = valid - offset < DUMP_BYTES_PER_LINE ?
+      valid - offset : DUMP_BYTES_PER_LINE;
+
+    out = formatDumpLine(out, prefix, addr + offset,
+			 state->programMap + addr + offset, count, quads);
+
+    if (out + lineMax > buffer + DUMP_BUFFER_SIZE)
+    {
+      if (fwrite(buffer, 1, out - buffer, file) != (size_t) (out - buffer))
+      {
+	free(buffer);
+	return -1;
+      }
+      chars += out - buffer;
+      out = buffer;
+    }
+  }
+
+  if (fwrite(buffer, 1, out - buffer, file) != (size_t) (out - buffer))
+    chars = -1;
+  else
+    chars += out - buffer;
+  free(buffer);
+  return chars;
+}
@@ -9,12 +9,19 @@
 
 #include "instruction.h"
 
+const char *instructionName(int icode, int ifun);
+const char *registerName(y86_register_t reg);
+const char *fusionName(y86_fusion_t kind);
+
 int printInstruction(FILE *file, y86_instruction_t *instr);
 
 int printRegisterValue(FILE *file, machine_state_t *state,
 		       y86_register_t reg);
+int printConditionCodes(FILE *file, machine_state_t *state);
 int printMemoryValueByte(FILE *file, machine_state_t *state, uint64_t addr);
 int printMemoryValueQuad(FILE *file, machine_state_t *state, uint64_t addr);
+long printMemoryDump(FILE *file, machine_state_t *state, uint64_t addr,
+		     uint64_t length, int quads, const char *prefix);
 
 int printErrorCommandTooLong(FILE *file);
 int printErrorInvalidCommand(FILE *file, char *command, char *parameters);
@@ -0,0 +1,515 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS, MAP_NORESERVE, getline, pread
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "segments.h"
+#include "sparseTable.h"
+
+/* Parses permissions such as rwx, r-x or rw. Returns them, or -1 if
+   string is not valid. */
+static int parsePerms(const char *string, size_t length) {
+
+  int perms = 0;
+
+  if (!length)
+    return -1;
+  for (size_t i = 0; i < length; i++)
+    switch (string[i])
+    {
+    case 'r': perms |= PAGE_READ; break;
+    case 'w': perms |= PAGE_WRITE; break;
+    case 'x': perms |= PAGE_EXEC; break;
+    case '-': break;
+    default:  return -1;
+    }
+  return perms;
+}
+
+/* Adds a segment for the first nameLength bytes of fileName. */
+static int addSegment(segment_map_t *map, const char *fileName, size_t nameLength,
+		      uint64_t base, int perms) {
+
+  segment_t *segment;
+
+  if (map->numSegments == SEGMENTS_MAX)
+  {
+    snprintf(map->error, SEGMENTS_MAX_ERROR, "More than %d segments", SEGMENTS_MAX);
+    return 0;
+  }
+  segment = &map->segments[map->numSegments];
+  memset(segment, 0, sizeof(*segment));
+  segment->fileName = malloc(nameLength + 1);
+  if (!segment->fileName)
+  {
+    snprintf(map->error, SEGMENTS_MAX_ERROR, "Not enough memory");
+    return 0;
+  }
+  memcpy(segment->fileName, fileName, nameLength);
+  segment->fileName[nameLength] = '\0';
+  segment->base = base;
+  segment->perms = perms;
+  segment->fd = -1;
+  map->numSegments++;
+  return 1;
+}
+
+/* Adds a segment given as FILE@BASE[:PERMS], where BASE is a number
+   (hex with 0x) and PERMS is made of r, w, x and - (rwx by default).
+   Returns 1 in case of success, or 0 with a message in map->error. */
+int segmentsAdd(segment_map_t *map, const char *spec) {
+
+  const char *at = strrchr(spec, '@'), *colon;
+  uint64_t base;
+  int perms = PAGE_ALL;
+  char *end;
+
+  if (!at || at == spec)
+  {
+    snprintf(map->error, SEGMENTS_MAX_ERROR, "Invalid segment %s, expected "
+	     "FILE@BASE[:PERMS]", spec);
+    return 0;
+  }
+
+  errno = 0;
+  base = strtoull(at + 1, &end, 0);
+  colon = *end == ':' ? end : NULL;
+  if (errno || end == at + 1 || (*end && !colon) ||
+      (colon && (perms = parsePerms(colon + 1, strlen(colon + 1))) < 0))
+  {
+    snprintf(map->error, SEGMENTS_MAX_ERROR, "Invalid segment %s, expected "
+	     "FILE@BASE[:PERMS]", spec);
+    return 0;
+  }
+  return addSegment(map, spec, at - spec, base, perms);
+}
+
+/* Adds the segments listed in a manifest: one per line, as
+     FILE BASE [PERMS]
+   with the same BASE and PERMS as segmentsAdd. Relative file names are
+   relative to the manifest's directory. Blank lines and lines starting
+   with # are ignored. Returns 1 in case of success, or 0 with a
+   message in map->error. */
+int segmentsReadManifest(segment_map_t *map, const char *fileName) {
+
+  FILE *file = fopen(fileName, "r");
+  const char *slash = strrchr(fileName, '/');
+  size_t dirLength = slash ? slash - fileName + 1 : 0;
+  char *line = NULL, *path = NULL;
+  size_t lineSize = 0;
+  int lineNumber = 0, ok = 1;
+
+  if (!file)
+  {
+    snprintf(map->error, SEGMENTS_MAX_ERROR, "%s: %s", fileName, strerror(errno));
+    return 0;
+  }
+
+  while (ok && getline(&line, &lineSize, file) >= 0)
+  {
+    char *name = strtok(line, " \t\r\n");
+    char *baseString = name ? strtok(NULL, " \t\r\n") : NULL;
+    char *permString = baseString ? strtok(NULL, " \t\r\n") : NULL;
+    uint64_t base;
+    int perms = PAGE_ALL;
+    char *end;
+
+    lineNumber++;
+    if (!name || *name == '#')
+      continue;
+
+    errno = 0;
+    base = baseString ? strtoull(baseString, &end, 0) : 0;
+    if (!baseString || errno || end == baseString || *end ||
+	(permString && (perms = parsePerms(permString, strlen(permString))) < 0) ||
+	strtok(NULL, " \t\r\n"))
+    {
+      snprintf(map->error, SEGMENTS_MAX_ERROR, "%s:%d: expected FILE BASE [PERMS]",
+	       fileName, lineNumber);
+      ok = 0;
+      break;
+    }
+
+    if (*name == '/' || !dirLength)
+      ok = addSegment(map, name, strlen(name), base, perms);
+    else
+    {
+      free(path);
+      path = malloc(dirLength + strlen(name) + 1);
+      if (!path)
+      {
+	snprintf(map->error, SEGMENTS_MAX_ERROR, "Not enough memory");
+	ok = 0;
+	break;
+      }
+      memcpy(path, fileName, dirLength);
+      strcpy(path + dirLength, name);
+      ok = addSegment(map, path, strlen(path), base, perms);
+    }
+  }
+
+  if (ok && ferror(file))
+  {
+    snprintf(map->error, SEGMENTS_MAX_ERROR, "%s: %s", fileName, strerror(errno));
+    ok = 0;
+  }
+  free(line);
+  free(path);
+  fclose(file);
+  return ok;
+}
+
+static int readAll(int fd, uint8_t *data, uint64_t length, uint64_t offset) {
+
+  while (length)
+  {
+    ssize_t nread = pread(fd, data, length, offset);
+    if (nread < 0 && errno == EINTR)
+      continue;
+    if (nread <= 0)
+    {
+      if (!nread)
+	errno = EIO; // the file shrank
+      return 0;
+    }
+    data += nread;
+    offset += nread;
+    length -= nread;
+  }
+  return 1;
+}
+
+static uint64_t roundUp(uint64_t value, uint64_t page) {
+
+  return (value + page - 1) / page * page;
+}
+
+/* End of the memory a segment is loaded into: the end of its last page
+   if it is mapped from its file. */
+static uint64_t segmentEnd(const segment_map_t *map, const segment_t *segment) {
+
+  return segment->mapped ? roundUp(segment->base + segment->size, map->hostPage) :
+    segment->base + segment->size;
+}
+
+static int hostProtection(int perms) {
+
+  // Instructions are decoded from memory, so it stays readable
+  return PROT_READ | (perms & PAGE_WRITE ? PROT_WRITE : 0);
+}
+
+/* Opens the segments' files, and sorts the segments by base address.
+   Returns 1 in case of success, or 0 with a message in map->error. */
+static int openSegments(segment_map_t *map) {
+
+  for (int i = 0; i < map->numSegments; i++)
+  {
+    segment_t *segment = &map->segments[i];
+    struct stat st;
+
+    segment->fd = open(segment->fileName, O_RDONLY);
+    if (segment->fd < 0 || fstat(segment->fd, &st) < 0)
+    {
+      snprintf(map->error, SEGMENTS_MAX_ERROR, "%s: %s", segment->fileName,
+	       strerror(errno));
+      return 0;
+    }
+    segment->size = st.st_size;
+    if (segment->base + segment->size < segment->base)
+    {
+      snprintf(map->error, SEGMENTS_MAX_ERROR, "%s: beyond the end of memory",
+	       segment->fileName);
+      return 0;
+    }
+  }
+
+  for (int i = 1; i < map->numSegments; i++)
+  {
+    segment_t segment = map->segments[i];
+    int j;
+    for (j = i; j > 0 && map->segments[j - 1].base > segment.base; j--)
+      map->segments[j] = map->segments[j - 1];
+    map->segments[j] = segment;
+  }
+
+  for (int i = 1; i < map->numSegments; i++)
+  {
+    const segment_t *previous = &map->segments[i - 1];
+    if (previous->base + previous->size > map->segments[i].base)
+    {
+      snprintf(map->error, SEGMENTS_MAX_ERROR, "%s and %s overlap",
+	       previous->fileName, map->segments[i].fileName);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Sets the permissions denied by each page of the segments in
+   state->pageDenied, if any segment does not allow everything, and
+   makes the pages without PAGE_WRITE read-only for the host if its
+   pages are small enough. */
+static int setPermissions(segment_map_t *map, machine_state_t *state) {
+
+  uint64_t numPages = (state->programSize >> DIRTY_PAGE_SHIFT) + 1;
+  int restricted = 0;
+
+  map->protected = 1;
+  map->readable = 1;
+  for (int i = 0; i < map->numSegments; i++)
+    restricted |= map->segments[i].perms != PAGE_ALL;
+  if (!restricted)
+    return 1;
+
+  state->pageDenied = malloc(sizeof(sparse_table_t));
+  if (!state->pageDenied || !sparseTableInit(state->pageDenied, numPages, 1))
+  {
+    free(state->pageDenied);
+    state->pageDenied = NULL;
+    snprintf(map->error, SEGMENTS_MAX_ERROR, "Not enough memory");
+    return 0;
+  }
+
+  // Memory between segments allows everything, as the padding of a
+  // single image would, and is left out of the table. A page shared by
+  // segments gets all their permissions.
+  for (int i = 0; i < map->numSegments; i++)
+  {
+    const segment_t *segment = &map->segments[i];
+    for (uint64_t page = segment->base >> DIRTY_PAGE_SHIFT;
+	 segment->size && page <= (segment->base + segment->size - 1) >> DIRTY_PAGE_SHIFT;
+	 page++)
+    {
+      uint8_t *denied = sparseTableGet(state->pageDenied, page);
+      if (!denied)
+      {
+	snprintf(map->error, SEGMENTS_MAX_ERROR, "Not enough memory");
+	return 0;
+      }
+      *denied = PAGE_ALL;
+    }
+  }
+  for (int i = 0; i < map->numSegments; i++)
+  {
+    const segment_t *segment = &map->segments[i];
+    for (uint64_t page = segment->base >> DIRTY_PAGE_SHIFT;
+	 segment->size && page <= (segment->base + segment->size - 1) >> DIRTY_PAGE_SHIFT;
+	 page++)
+      *(uint8_t *) sparseTableFind(state->pageDenied, page) &= ~segment->perms;
+  }
+
+  map->protected = DIRTY_PAGE_SIZE % map->hostPage == 0;
+  for (int i = 0; i < map->numSegments; i++)
+  {
+    const segment_t *segment = &map->segments[i];
+    for (uint64_t page = segment->base >> DIRTY_PAGE_SHIFT;
+	 segment->size && page <= (segment->base + segment->size - 1) >> DIRTY_PAGE_SHIFT;
+	 page++)
+    {
+      uint8_t denied = *(uint8_t *) sparseTableFind(state->pageDenied, page);
+
+      map->readable &= !(denied & PAGE_READ);
+      if (map->protected && (denied & PAGE_WRITE) &&
+	  mprotect(map->region + (page << DIRTY_PAGE_SHIFT), DIRTY_PAGE_SIZE,
+		   PROT_READ) < 0)
+	map->protected = 0;
+    }
+  }
+  return 1;
+}
+
+/* Loads the segments added to map as the memory of state. Memory is
+   reserved for the whole address space, without using any until it is
+   written. A segment whose base address is page aligned, and which
+   does not share a page with another one, is mapped from its file in
+   place (copy on write), so that it is read on demand and never
+   copied; others are read into memory. Returns 1 in case of success,
+   or 0 with a message in map->error; segmentsFree must be called in
+   both cases. */
+int segmentsLoad(segment_map_t *map, machine_state_t *state) {
+
+  long page = sysconf(_SC_PAGESIZE);
+  uint64_t end = 0, span;
+
+  map->hostPage = page > 0 ? page : 4096;
+  if (!map->numSegments)
+  {
+    snprintf(map->error, SEGMENTS_MAX_ERROR, "No segments");
+    return 0;
+  }
+  if (!openSegments(map))
+    return 0;
+
+  for (int i = 0; i < map->numSegments; i++)
+    if (map->segments[i].base + map->segments[i].size > end)
+      end = map->segments[i].base + map->segments[i].size;
+  span = roundUp(end ? end : 1, map->hostPage);
+  if (span < end || span + map->hostPage < span || span + map->hostPage > SIZE_MAX)
+  {
+    snprintf(map->error, SEGMENTS_MAX_ERROR, "Memory too large");
+    return 0;
+  }
+
+  // The page after memory stays inaccessible, for guard-page memory
+  map->regionSize = span + map->hostPage;
+  map->region = mmap(NULL, map->regionSize, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (map->region == MAP_FAILED ||
+      mprotect(map->region + span, map->hostPage, PROT_NONE) < 0)
+  {
+    snprintf(map->error, SEGMENTS_MAX_ERROR, "Cannot reserve 0x%llx bytes: %s",
+	     (unsigned long long) span, strerror(errno));
+    if (map->region != MAP_FAILED)
+      munmap(map->region, map->regionSize);
+    map->region = NULL;
+    return 0;
+  }
+
+  for (int i = 0; i < map->numSegments; i++)
+  {
+    segment_t *segment = &map->segments[i];
+    uint64_t lastPage = roundUp(segment->base + segment->size, map->hostPage);
+
+    segment->mapped = segment->size && segment->base % map->hostPage == 0 &&
+      (i + 1 == map->numSegments || map->segments[i + 1].base >= lastPage);
+    if (segment->mapped &&
+	mmap(map->region + segment->base, lastPage - segment->base,
+	     hostProtection(segment->perms), MAP_PRIVATE | MAP_FIXED, segment->fd,
+	     0) == MAP_FAILED)
+      segment->mapped = 0;
+    if (!segment->mapped &&
+	!readAll(segment->fd, map->region + segment->base, segment->size, 0))
+    {
+      snprintf(map->error, SEGMENTS_MAX_ERROR, "%s: %s", segment->fileName,
+	       strerror(errno));
+      return 0;
+    }
+  }
+
+  state->programMap = map->region;
+  state->programSize = span;
+  return setPermissions(map, state);
+}
+
+/* Clears memory from address first to last. Whole host pages are
+   replaced by fresh anonymous pages, which use no memory until they
+   are written again. Returns 1 in case of success, or 0 in case of
+   failure with errno set. */
+static int clearMemory(machine_state_t *state, const segment_map_t *map,
+		       uint64_t first, uint64_t last) {
+
+  uint64_t head = roundUp(first, map->hostPage), tail = last / map->hostPage * map->hostPage;
+
+  if ((uintptr_t) state->programMap % map->hostPage || head >= tail)
+  {
+    memset(state->programMap + first, 0, last - first);
+    return 1;
+  }
+  memset(state->programMap + first, 0, head - first);
+  memset(state->programMap + tail, 0, last - tail);
+  return mmap(state->programMap + head, tail - head, PROT_READ | PROT_WRITE,
+	      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) != MAP_FAILED;
+}
+
+/* Reverts length bytes of memory at address (page aligned) to their
+   contents when they were loaded by segmentsLoad: segments are mapped
+   or read again, and the rest is cleared. A snapshot_revert_t for
+   snapshotRestore, map being the segment_map_t. Returns 1 in case of
+   success, or 0 in case of failure with errno set. */
+int segmentsRevert(machine_state_t *state, uint64_t address, uint64_t length,
+		   void *data) {
+
+  segment_map_t *map = data;
+  uint64_t end = address + length < state->programSize ?
+    address + length : state->programSize;
+  uint64_t cursor = address;
+
+  for (int i = 0; i < map->numSegments && cursor < end; i++)
+  {
+    const segment_t *segment = &map->segments[i];
+    uint64_t first = segment->base > cursor ? segment->base : cursor;
+    uint64_t last = segmentEnd(map, segment) < end ? segmentEnd(map, segment) : end;
+    uint64_t fileEnd = segment->base + segment->size;
+
+    if (first >= last)
+      continue;
+    if (!clearMemory(state, map, cursor, first))
+      return 0;
+
+    if (segment->mapped && first % map->hostPage == 0 && last % map->hostPage == 0)
+    {
+      if (mmap(state->programMap + first, last - first,
+	       hostProtection(segment->perms), MAP_PRIVATE | MAP_FIXED,
+	       segment->fd, first - segment->base) == MAP_FAILED)
+	return 0;
+    }
+    else
+    {
+      uint64_t inFile = (fileEnd < last ? fileEnd : last) - first;
+      if (!readAll(segment->fd, state->programMap + first, inFile,
+		   first - segment->base))
+	return 0;
+      memset(state->programMap + first + inFile, 0, last - first - inFile);
+    }
+    cursor = last;
+  }
+
+  return cursor < end ? clearMemory(state, map, cursor, end) : 1;
+}
+
+/* Hashes the segments as loaded by segmentsLoad, reading their files:
+   the address, permissions and contents of each, but not the zeros
+   between them, so that the cost depends on the size of the files
+   rather than on the span of addresses. Stores the hash in *hash.
+   Returns 1 in case of success, or 0 in case of failure with errno
+   set. */
+int segmentsHash(const segment_map_t *map, uint64_t *hash) {
+
+  uint64_t result = map->numSegments, contents;
+
+  for (int i = 0; i < map->numSegments; i++)
+  {
+    const segment_t *segment = &map->segments[i];
+
+    if (!imageFileHash(segment->fd, segment->size, &contents))
+      return 0;
+    result = (result ^ segment->base) * 0x9e3779b97f4a7c15ull;
+    result = (result ^ segment->perms) * 0x9e3779b97f4a7c15ull;
+    result = (result ^ contents) * 0x9e3779b97f4a7c15ull;
+  }
+  *hash = result;
+  return 1;
+}
+
+/* Releases the memory and files of the segments, and of state if they
+   were loaded into it. */
+void segmentsFree(segment_map_t *map, machine_state_t *state) {
+
+  if (map->region && state->programMap == map->region)
+  {
+    if (state->pageDenied)
+      sparseTableFree(state->pageDenied);
+    free(state->pageDenied);
+    state->pageDenied = NULL;
+    state->programMap = NULL;
+    state->programSize = 0;
+  }
+  if (map->region)
+    munmap(map->region, map->regionSize);
+  map->region = NULL;
+
+  for (int i = 0; i < map->numSegments; i++)
+  {
+    if (map->segments[i].fd >= 0)
+      close(map->segments[i].fd);
+    free(map->segments[i].fileName);
+  }
+  map->numSegments = 0;
+}
@@ -0,0 +1,53 @@
+/* This file contains the prototypes and constants needed to use the
+   multi-segment loader defined in segments.c
+*/
+
+#ifndef _SEGMENTS_H_
+#define _SEGMENTS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "instruction.h"
+
+#define SEGMENTS_MAX       64
+#define SEGMENTS_MAX_ERROR 256
+
+/* A file loaded at a guest address. */
+typedef struct segment {
+  char    *fileName;
+  uint64_t base;
+  uint64_t size;     // of the file
+  int      perms;    // PAGE_READ, PAGE_WRITE and PAGE_EXEC
+  int      fd;       // kept open to revert written pages
+  int      mapped;   // mapped from the file, rather than read into memory
+} segment_t;
+
+/* The segments making up the memory of a machine, in increasing order
+   of base address once loaded. Memory is a region reserved for the
+   whole address space, from 0 to the end of the last segment rounded
+   up to a page, followed by an inaccessible page; addresses outside of
+   the segments read as zeros, and only use memory once written. */
+typedef struct segment_map {
+  segment_t segments[SEGMENTS_MAX];
+  int       numSegments;
+  uint8_t  *region;
+  size_t    regionSize;   // including the inaccessible page
+  size_t    hostPage;
+  int       protected;    // whether pages without PAGE_WRITE are read-only
+			  // for the host too, so writes to them trap
+  int       readable;     // whether all pages allow PAGE_READ
+
+  char error[SEGMENTS_MAX_ERROR];
+
+} segment_map_t;
+
+int  segmentsAdd(segment_map_t *map, const char *spec);
+int  segmentsReadManifest(segment_map_t *map, const char *fileName);
+int  segmentsLoad(segment_map_t *map, machine_state_t *state);
+int  segmentsRevert(machine_state_t *state, uint64_t address, uint64_t length,
+		    void *map);
+int  segmentsHash(const segment_map_t *map, uint64_t *hash);
+void segmentsFree(segment_map_t *map, machine_state_t *state);
+
+#endif /* SEGMENTS */
@@ -0,0 +1,327 @@
+#define _POSIX_C_SOURCE 200809L // pread, pwrite
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+
+/* Allocates a dirty page bitmap, with all pages clean, for a memory of
+   the specified size. Returns NULL if memory could not be allocated. */
+uint64_t *dirtyPagesAlloc(uint64_t programSize) {
+
+  uint64_t pages = (programSize + DIRTY_PAGE_SIZE - 1) >> DIRTY_PAGE_SHIFT;
+  return calloc((pages + 63) / 64 + 1, sizeof(uint64_t));
+}
+
+static inline int isDirty(const uint64_t *dirtyPages, uint64_t page) {
+
+  return (dirtyPages[page / 64] >> (page % 64)) & 1;
+}
+
+/* Returns the number of bytes of memory in the specified page: all of
+   DIRTY_PAGE_SIZE, except in a last page that memory ends in. */
+static inline uint64_t pageLength(const machine_state_t *state, uint64_t page) {
+
+  uint64_t start = page << DIRTY_PAGE_SHIFT;
+  return state->programSize - start < DIRTY_PAGE_SIZE ?
+    state->programSize - start : DIRTY_PAGE_SIZE;
+}
+
+static int writeAll(int fd, const void *data, uint64_t length, uint64_t offset) {
+
+  const char *bytes = data;
+
+  while (length)
+  {
+    ssize_t written = pwrite(fd, bytes, length, offset);
+    if (written < 0)
+    {
+      if (errno == EINTR)
+	continue;
+      return 0;
+    }
+    bytes += written;
+    offset += written;
+    length -= written;
+  }
+  return 1;
+}
+
+static int readAll(int fd, void *data, uint64_t length, uint64_t offset) {
+
+  char *bytes = data;
+
+  while (length)
+  {
+    ssize_t nread = pread(fd, bytes, length, offset);
+    if (nread < 0 && errno == EINTR)
+      continue;
+    if (nread <= 0)
+    {
+      if (nread == 0)
+	errno = EINVAL; // truncated file
+      return 0;
+    }
+    bytes += nread;
+    offset += nread;
+    length -= nread;
+  }
+  return 1;
+}
+
+/* Saves registers, condition codes, program counter, breakpoints and
+   the pages of memory written since the image was loaded into a
+   snapshot file. Returns 1 in case of success, or 0 in case of failure
+   with errno set. */
+int snapshotSave(const char *fileName, machine_state_t *state,
+		 const uint64_t *breakpoints, uint64_t numBreakpoints) {
+
+  snapshot_header_t header;
+  uint64_t numPages = 0, totalPages, *pages, offset;
+  size_t length;
+  char *tempName;
+  int fd, ok = 1;
+
+  if (!state->dirtyPages)
+  {
+    errno = ENOTSUP;
+    return 0;
+  }
+
+  totalPages = (state->programSize + DIRTY_PAGE_SIZE - 1) >> DIRTY_PAGE_SHIFT;
+  for (uint64_t page = 0; page < totalPages; page++)
+    numPages += isDirty(state->dirtyPages, page);
+
+  pages = malloc((numPages + 1) * sizeof(uint64_t));
+  if (!pages)
+    return 0;
+  numPages = 0;
+  for (uint64_t page = 0; page < totalPages; page++)
+  {
+    if (isDirty(state->dirtyPages, page))
+      pages[numPages++] = page;
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.programSize = state->programSize;
+  header.imageHash = state->imageHash;
+  header.programCounter = state->programCounter;
+  memcpy(header.registerFile, state->registerFile, sizeof(header.registerFile));
+  header.conditionCodes = getConditionCodes(state);
+  header.numBreakpoints = numBreakpoints;
+  header.numPages = numPages;
+  offset = sizeof(header) + (numBreakpoints + numPages) * sizeof(uint64_t);
+  header.dataOffset = (offset + DIRTY_PAGE_SIZE - 1) & ~(uint64_t) (DIRTY_PAGE_SIZE - 1);
+
+  // Write to a temporary file renamed to fileName, so that a reader
+  // never sees a partial snapshot and a snapshot being restored from
+  // is not truncated
+  length = strlen(fileName);
+  tempName = malloc(length + 5);
+  if (!tempName)
+  {
+    free(pages);
+    return 0;
+  }
+  memcpy(tempName, fileName, length);
+  memcpy(tempName + length, ".tmp", 5);
+
+  fd = open(tempName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+  {
+    free(tempName);
+    free(pages);
+    return 0;
+  }
+
+  ok = writeAll(fd, &header, sizeof(header), 0) &&
+    writeAll(fd, breakpoints, numBreakpoints * sizeof(uint64_t), sizeof(header)) &&
+    writeAll(fd, pages, numPages * sizeof(uint64_t),
+	     sizeof(header) + numBreakpoints * sizeof(uint64_t));
+
+  for (uint64_t i = 0; ok && i < numPages; i++)
+    ok = writeAll(fd, state->programMap + (pages[i] << DIRTY_PAGE_SHIFT),
+		  pageLength(state, pages[i]), header.dataOffset + i * DIRTY_PAGE_SIZE);
+
+  free(pages);
+  if (close(fd) != 0)
+    ok = 0;
+  if (ok)
+    ok = rename(tempName, fileName) == 0;
+  if (!ok)
+  {
+    int error = errno;
+    remove(tempName);
+    errno = error;
+  }
+  free(tempName);
+  return ok;
+}
+
+/* Reverts memory from an image file whose offset 0 is address 0, see
+   snapshot_revert_t. imageFd points to its file descriptor. If the host
+   page size allows it, and memory is page aligned (it is not with guard
+   pages), the image is mapped back in place, as it was when loaded;
+   otherwise it is read. */
+int snapshotRevertFile(machine_state_t *state, uint64_t address,
+		       uint64_t length, void *imageFd) {
+
+  int fd = *(int *) imageFd;
+  long hostPage = sysconf(_SC_PAGESIZE);
+
+  if (hostPage > 0 && DIRTY_PAGE_SIZE % hostPage == 0 &&
+      (uintptr_t) state->programMap % hostPage == 0)
+    return mmap(state->programMap + address, length, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_FIXED, fd, address) != MAP_FAILED;
+
+  if (address + length > state->programSize)
+    length = state->programSize - address;
+  return readAll(fd, state->programMap + address, length, address);
+}
+
+/* Restores a snapshot saved by snapshotSave for the same image, as
+   recognized by its size and hash; any other file, or one whose pages
+   do not all lie within it, fails with EINVAL. Pages written since the
+   image was loaded are first reverted to the contents of the image by
+   revert, called with revertData, then the pages saved in the snapshot
+   are read over them. Stores the snapshot's breakpoints in a newly
+   allocated array *breakpoints, which the caller must free. Returns 1
+   in case of success, or 0 in case of failure with errno set.
+
+   The whole snapshot is checked before the machine state is modified,
+   and registers, program counter and condition codes only change on
+   success. If reverting or reading fails after that, memory is partly
+   restored, but every page that may differ from the image is still
+   marked as written. */
+int snapshotRestore(const char *fileName, machine_state_t *state,
+		    snapshot_revert_t revert, void *revertData,
+		    uint64_t **breakpoints, uint64_t *numBreakpoints) {
+
+  snapshot_header_t header;
+  uint64_t *pages = NULL, totalPages, bitmapWords, run;
+  struct stat st;
+  int fd, ok;
+
+  *breakpoints = NULL;
+  if (!state->dirtyPages)
+  {
+    errno = ENOTSUP;
+    return 0;
+  }
+
+  fd = open(fileName, O_RDONLY);
+  if (fd < 0)
+    return 0;
+
+  totalPages = (state->programSize + DIRTY_PAGE_SIZE - 1) >> DIRTY_PAGE_SHIFT;
+  bitmapWords = (totalPages + 63) / 64;
+  ok = readAll(fd, &header, sizeof(header), 0) && fstat(fd, &st) == 0;
+  if (ok && (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+	     header.programSize != state->programSize ||
+	     header.imageHash != state->imageHash ||
+	     header.numPages > totalPages ||
+	     header.numBreakpoints > (1 << 24)))
+  {
+    errno = EINVAL;
+    ok = 0;
+  }
+
+  if (ok)
+  {
+    *breakpoints = malloc((header.numBreakpoints + 1) * sizeof(uint64_t));
+    pages = malloc((header.numPages + 1) * sizeof(uint64_t));
+    ok = *breakpoints && pages &&
+      readAll(fd, *breakpoints, header.numBreakpoints * sizeof(uint64_t),
+	      sizeof(header)) &&
+      readAll(fd, pages, header.numPages * sizeof(uint64_t),
+	      sizeof(header) + header.numBreakpoints * sizeof(uint64_t));
+  }
+
+  for (uint64_t i = 0; ok && i < header.numPages; i++)
+  {
+    if (pages[i] >= totalPages || (i && pages[i] <= pages[i - 1]))
+    {
+      errno = EINVAL;
+      ok = 0;
+    }
+  }
+
+  // The saved pages, if any, lie between the end of the index and the
+  // end of the file, the last one no longer than memory
+  if (ok)
+  {
+    uint64_t indexEnd = sizeof(header) +
+      (header.numBreakpoints + header.numPages) * sizeof(uint64_t);
+    uint64_t dataLength = header.numPages ?
+      (header.numPages - 1) * DIRTY_PAGE_SIZE +
+      pageLength(state, pages[header.numPages - 1]) : 0;
+
+    if (header.dataOffset < indexEnd ||
+	(dataLength && (header.dataOffset > (uint64_t) st.st_size ||
+			(uint64_t) st.st_size - header.dataOffset < dataLength)))
+    {
+      errno = EINVAL;
+      ok = 0;
+    }
+  }
+
+  // Revert every modified page, in runs of consecutive pages
+  for (uint64_t page = 0; ok && page < totalPages; page += run)
+  {
+    for (run = 0; page + run < totalPages &&
+	   isDirty(state->dirtyPages, page + run); run++);
+    if (run)
+      ok = revert(state, page << DIRTY_PAGE_SHIFT, run << DIRTY_PAGE_SHIFT,
+		  revertData);
+    else
+      run = 1;
+  }
+
+  // Read the saved pages, again in runs of consecutive pages. Until
+  // they are all in, they are marked as written along with the pages
+  // reverted above.
+  for (uint64_t i = 0; ok && i < header.numPages; i++)
+    state->dirtyPages[pages[i] / 64] |= 1ull << (pages[i] % 64);
+  for (uint64_t i = 0; ok && i < header.numPages; i += run)
+  {
+    uint64_t start = pages[i] << DIRTY_PAGE_SHIFT;
+
+    for (run = 1; i + run < header.numPages && pages[i + run] == pages[i] + run; run++);
+    ok = readAll(fd, state->programMap + start,
+		 (run - 1) * DIRTY_PAGE_SIZE + pageLength(state, pages[i] + run - 1),
+		 header.dataOffset + i * DIRTY_PAGE_SIZE);
+  }
+
+  if (!ok)
+  {
+    int error = errno;
+    free(pages);
+    free(*breakpoints);
+    *breakpoints = NULL;
+    close(fd);
+    errno = error;
+    return 0;
+  }
+
+  memset(state->dirtyPages, 0, bitmapWords * sizeof(uint64_t));
+  for (uint64_t i = 0; i < header.numPages; i++)
+    state->dirtyPages[pages[i] / 64] |= 1ull << (pages[i] % 64);
+
+  state->programCounter = header.programCounter;
+  memcpy(state->registerFile, header.registerFile, sizeof(state->registerFile));
+  state->conditionCodes = header.conditionCodes;
+  state->ccPending = 0;
+  *numBreakpoints = header.numBreakpoints;
+
+  free(pages);
+  close(fd);
+  return 1;
+}
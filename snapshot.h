@@ -0,0 +1,48 @@
+/* This file contains the prototypes and constants needed to use the
+   machine state snapshots defined in snapshot.c
+*/
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <stdint.h>
+
+#include "instruction.h"
+
+#define SNAPSHOT_MAGIC "Y86SNAP2"
+
+/* Header of a snapshot file. It is followed by the breakpoint
+   addresses and the numbers of the saved pages (all uint64_t), then,
+   starting at dataOffset, by the contents of the saved pages, each
+   DIRTY_PAGE_SIZE bytes long and in increasing page order. Values are
+   stored in the host's byte order. */
+typedef struct snapshot_header {
+  char     magic[8];
+  uint64_t programSize;
+  uint64_t imageHash;      // of the image as loaded, see imageHash()
+  uint64_t programCounter;
+  uint64_t registerFile[16];
+  uint64_t conditionCodes;
+  uint64_t numBreakpoints;
+  uint64_t numPages;
+  uint64_t dataOffset;
+} snapshot_header_t;
+
+/* Reverts length bytes of memory starting at address (both multiples
+   of DIRTY_PAGE_SIZE, but possibly beyond the end of memory) to their
+   contents when the image was loaded. data is the argument given to
+   snapshotRestore. Returns 1 in case of success, or 0 in case of
+   failure with errno set. */
+typedef int (*snapshot_revert_t)(machine_state_t *state, uint64_t address,
+				 uint64_t length, void *data);
+
+uint64_t *dirtyPagesAlloc(uint64_t programSize);
+int snapshotSave(const char *fileName, machine_state_t *state,
+		 const uint64_t *breakpoints, uint64_t numBreakpoints);
+int snapshotRevertFile(machine_state_t *state, uint64_t address,
+		       uint64_t length, void *imageFd);
+int snapshotRestore(const char *fileName, machine_state_t *state,
+		    snapshot_revert_t revert, void *revertData,
+		    uint64_t **breakpoints, uint64_t *numBreakpoints);
+
+#endif /* SNAPSHOT */
@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sparseTable.h"
+
+/* Sets up an empty table of numEntries entries of entrySize bytes (a
+   power of two, at most SPARSE_BLOCK_SIZE). Returns 1 in case of
+   success, or 0 if memory could not be allocated. */
+int sparseTableInit(sparse_table_t *t, uint64_t numEntries, unsigned entrySize) {
+
+  memset(t, 0, sizeof(*t));
+  while ((1u << t->entryShift) < entrySize)
+    t->entryShift++;
+  t->blockShift = SPARSE_BLOCK_SHIFT - t->entryShift;
+  t->numEntries = numEntries;
+  t->numBlocks = (numEntries >> t->blockShift) + 1;
+  t->blocks = calloc(t->numBlocks, sizeof(uint8_t *));
+  return t->blocks != NULL;
+}
+
+/* Sets every entry back to zero, releasing the blocks. */
+void sparseTableClear(sparse_table_t *t) {
+
+  for (uint64_t i = 0; i < t->numBlocks && t->numAllocated; i++)
+    if (t->blocks[i])
+    {
+      free(t->blocks[i]);
+      t->blocks[i] = NULL;
+      t->numAllocated--;
+    }
+}
+
+void sparseTableFree(sparse_table_t *t) {
+
+  if (t->blocks)
+    sparseTableClear(t);
+  free(t->blocks);
+  memset(t, 0, sizeof(*t));
+}
+
+/* Allocates the block of entries at index block, see sparseTableGet().
+   Returns it, or NULL if memory could not be allocated. */
+uint8_t *sparseTableAllocBlock(sparse_table_t *t, uint64_t block) {
+
+  uint8_t *entries = calloc(SPARSE_BLOCK_SIZE, 1);
+
+  if (entries)
+  {
+    t->blocks[block] = entries;
+    t->numAllocated++;
+  }
+  return entries;
+}
@@ -0,0 +1,74 @@
+/* This file contains the prototypes and constants needed to use the
+   sparse tables defined in sparseTable.c
+*/
+
+#ifndef _SPARSETABLE_H_
+#define _SPARSETABLE_H_
+
+#include <stdint.h>
+
+// Size of the blocks of entries allocated together
+#define SPARSE_BLOCK_SHIFT 12
+#define SPARSE_BLOCK_SIZE  (1 << SPARSE_BLOCK_SHIFT)
+
+/* A table with an entry for each address, line, region or page of
+   memory, all zero at first. Entries are allocated in blocks of
+   SPARSE_BLOCK_SIZE bytes when one of them is first written, so that
+   the parts of memory never used (e.g. between segments far apart)
+   only cost a pointer per block. */
+typedef struct sparse_table {
+  uint8_t **blocks;       // NULL for blocks never written
+  uint64_t  numEntries;
+  uint64_t  numBlocks;
+  unsigned  entryShift;   // entries are 1 << entryShift bytes long
+  unsigned  blockShift;   // and blocks hold 1 << blockShift of them
+  uint64_t  numAllocated;
+} sparse_table_t;
+
+int      sparseTableInit(sparse_table_t *t, uint64_t numEntries, unsigned entrySize);
+void     sparseTableClear(sparse_table_t *t);
+void     sparseTableFree(sparse_table_t *t);
+uint8_t *sparseTableAllocBlock(sparse_table_t *t, uint64_t block);
+
+/* Returns the entry at index (below numEntries), or NULL if its block
+   was never written, the entry then being zero. */
+static inline void *sparseTableFind(const sparse_table_t *t, uint64_t index) {
+
+  uint8_t *block = t->blocks[index >> t->blockShift];
+
+  return block ? block + ((index & ((1ull << t->blockShift) - 1)) << t->entryShift) :
+    NULL;
+}
+
+/* Returns the entry at index (below numEntries) to be written,
+   allocating its block if needed. Returns NULL if memory could not be
+   allocated. */
+static inline void *sparseTableGet(sparse_table_t *t, uint64_t index) {
+
+  uint8_t *block = t->blocks[index >> t->blockShift];
+
+  if (!block && !(block = sparseTableAllocBlock(t, index >> t->blockShift)))
+    return NULL;
+  return block + ((index & ((1ull << t->blockShift) - 1)) << t->entryShift);
+}
+
+/* Bitmaps, kept as tables of 64-bit words: returns bit, and sets it.
+   Setting a bit returns 0 if memory could not be allocated. */
+static inline int sparseTableTestBit(const sparse_table_t *t, uint64_t bit) {
+
+  const uint64_t *word = sparseTableFind(t, bit / 64);
+
+  return word && (*word >> (bit % 64) & 1);
+}
+
+static inline int sparseTableSetBit(sparse_table_t *t, uint64_t bit) {
+
+  uint64_t *word = sparseTableGet(t, bit / 64);
+
+  if (!word)
+    return 0;
+  *word |= 1ull << (bit % 64);
+  return 1;
+}
+
+#endif /* SPARSETABLE */
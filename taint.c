@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "taint.h"
+#include "printRoutines.h"
+
+// Tainted spans of memory listed by a report before the rest are only
+// counted
+#define TAINT_MAX_RANGES 32
+
+/* Sets up a clean shadow state for size bytes of memory. Returns 1 in
+   case of success, or 0 if memory could not be allocated. */
+int taintInit(taint_state_t *t, uint64_t size) {
+
+  memset(t, 0, sizeof(*t));
+  t->size = size;
+  t->numPages = (size + DIRTY_PAGE_SIZE - 1) >> DIRTY_PAGE_SHIFT;
+  t->pages = calloc(t->numPages ? t->numPages : 1, sizeof(taint_t *));
+  t->pendingReg = R_NONE;
+  return t->pages != NULL;
+}
+
+/* Removes every label, and releases the shadow pages. */
+void taintReset(taint_state_t *t) {
+
+  for (uint64_t i = 0; i < t->numPages; i++)
+  {
+    free(t->pages[i]);
+    t->pages[i] = NULL;
+  }
+  t->numAllocated = 0;
+  t->lost = 0;
+  memset(t->registers, 0, sizeof(t->registers));
+  t->numLabels = 0;
+  t->pendingReg = R_NONE;
+  t->pendingMem = 0;
+}
+
+void taintFree(taint_state_t *t) {
+
+  if (t->pages)
+    taintReset(t);
+  free(t->pages);
+  t->pages = NULL;
+}
+
+/* Writes taint to length bytes at address, or ORs it in if merge is
+   set. Pages are only allocated to hold labels, not to clear them. */
+static void writeMemory(taint_state_t *t, uint64_t address, uint64_t length,
+			taint_t taint, int merge) {
+
+  if (address >= t->size)
+    return;
+  if (length > t->size - address)
+    length = t->size - address;
+
+  while (length > 0)
+  {
+    uint64_t offset = address & (DIRTY_PAGE_SIZE - 1);
+    uint64_t chunk = DIRTY_PAGE_SIZE - offset;
+    taint_t **page = &t->pages[address >> DIRTY_PAGE_SHIFT];
+
+    if (chunk > length)
+      chunk = length;
+    if (!*page && taint)
+    {
+      if ((*page = calloc(DIRTY_PAGE_SIZE, 1)))
+	t->numAllocated++;
+      else
+	t->lost = 1;
+    }
+    if (*page)
+    {
+      if (merge)
+	for (uint64_t i = 0; i < chunk; i++)
+	  (*page)[offset + i] |= taint;
+      else
+	memset(*page + offset, taint, chunk);
+    }
+    address += chunk;
+    length -= chunk;
+  }
+}
+
+/* Returns the union of the labels of length bytes at address. Bytes
+   outside of memory have none. */
+taint_t taintRead(const taint_state_t *t, uint64_t address, uint64_t length) {
+
+  taint_t taint = 0;
+
+  if (address >= t->size)
+    return 0;
+  if (length > t->size - address)
+    length = t->size - address;
+
+  while (length > 0)
+  {
+    uint64_t offset = address & (DIRTY_PAGE_SIZE - 1);
+    uint64_t chunk = DIRTY_PAGE_SIZE - offset;
+    const taint_t *page = t->pages[address >> DIRTY_PAGE_SHIFT];
+
+    if (chunk > length)
+      chunk = length;
+    if (page)
+      for (uint64_t i = 0; i < chunk; i++)
+	taint |= page[offset + i];
+    address += chunk;
+    length -= chunk;
+  }
+  return taint;
+}
+
+/* Gives a new label to register reg, or, if reg is R_NONE, to length
+   bytes at address. Returns the label, or -1 if all of them are in
+   use. */
+int taintMark(taint_state_t *t, int reg, uint64_t address, uint64_t length) {
+
+  int label = t->numLabels;
+
+  if (label == TAINT_MAX_LABELS)
+    return -1;
+  t->labels[label].reg = reg;
+  t->labels[label].address = address;
+  t->labels[label].length = length;
+  t->numLabels++;
+
+  if (reg != R_NONE)
+    t->registers[reg] |= 1 << label;
+  else
+    writeMemory(t, address, length, 1 << label, 1);
+  return label;
+}
+
+/* Removes the labels of register reg, or, if reg is R_NONE, of length
+   bytes at address. */
+void taintClear(taint_state_t *t, int reg, uint64_t address, uint64_t length) {
+
+  if (reg != R_NONE)
+    t->registers[reg] = 0;
+  else
+    writeMemory(t, address, length, 0, 0);
+}
+
+static inline void pendRegister(taint_state_t *t, int reg, taint_t taint) {
+
+  t->pendingReg = reg;
+  t->pendingRegTaint = taint;
+}
+
+static inline void pendMemory(taint_state_t *t, uint64_t address, taint_t taint) {
+
+  t->pendingMem = 1;
+  t->pendingAddress = address;
+  t->pendingMemTaint = taint;
+}
+
+/* Works out how instr, about to be executed on state, moves labels.
+   The effect is only applied by taintCommit, once the instruction was
+   executed successfully, since executing it changes the registers the
+   addresses are computed from. */
+void taintPrepare(taint_state_t *t, machine_state_t *state,
+		  const y86_instruction_t *instr) {
+
+  const uint64_t *regs = state->registerFile;
+  const taint_t *shadow = t->registers;
+
+  t->pendingReg = R_NONE;
+  t->pendingMem = 0;
+
+  switch (instr->icode)
+  {
+  case I_RRMVXX:
+    if (conditionHolds(state, instr->ifun))
+      pendRegister(t, instr->rB, shadow[instr->rA]);
+    break;
+  case I_IRMOVQ:
+    pendRegister(t, instr->rB, 0);
+    break;
+  case I_OPQ:
+    // xorq and subq of a register with itself give 0 whatever it held
+    if (instr->rA == instr->rB &&
+	(instr->ifun == A_XORQ || instr->ifun == A_SUBQ))
+      pendRegister(t, instr->rB, 0);
+    else
+      pendRegister(t, instr->rB, shadow[instr->rA] | shadow[instr->rB]);
+    break;
+  case I_RMMOVQ:
+    pendMemory(t, regs[instr->rB] + instr->valC, shadow[instr->rA]);
+    break;
+  case I_MRMOVQ:
+    pendRegister(t, instr->rA, taintRead(t, regs[instr->rB] + instr->valC, 8));
+    break;
+  case I_PUSHQ:
+    pendMemory(t, regs[R_RSP] - 8, shadow[instr->rA]);
+    break;
+  case I_CALL:
+    // the return address is a constant
+    pendMemory(t, regs[R_RSP] - 8, 0);
+    break;
+  case I_POPQ:
+    pendRegister(t, instr->rA, taintRead(t, regs[R_RSP], 8));
+    break;
+  default:
+    break;
+  }
+}
+
+/* Applies the effect worked out by the last taintPrepare. */
+void taintCommit(taint_state_t *t) {
+
+  if (t->pendingReg != R_NONE)
+    t->registers[t->pendingReg] = t->pendingRegTaint;
+  if (t->pendingMem)
+    writeMemory(t, t->pendingAddress, 8, t->pendingMemTaint, 0);
+}
+
+/* Prints the labels in taint, and what each was given to. */
+void taintPrintSet(FILE *file, const taint_state_t *t, taint_t taint) {
+
+  const char *separator = "";
+
+  if (!taint)
+  {
+    fprintf(file, "clean");
+    return;
+  }
+  for (int label = 0; label < TAINT_MAX_LABELS; label++)
+  {
+    const taint_label_t *l = &t->labels[label];
+
+    if (!(taint >> label & 1))
+      continue;
+    if (l->reg != R_NONE)
+      fprintf(file, "%s%d (%s)", separator, label, registerName(l->reg));
+    else
+      fprintf(file, "%s%d (0x%lx+%lu)", separator, label, l->address, l->length);
+    separator = ", ";
+  }
+}
+
+/* Prints the tainted spans of length bytes at address, one per line,
+   up to TAINT_MAX_RANGES. Returns the number of spans. */
+static uint64_t printRanges(FILE *file, const taint_state_t *t, uint64_t address,
+			    uint64_t length, const y86_program_t *program) {
+
+  uint64_t numRanges = 0, start = 0, end;
+  taint_t current = 0;
+
+  if (address >= t->size)
+    return 0;
+  if (length > t->size - address)
+    length = t->size - address;
+  end = address + length;
+
+  // One more iteration at end closes the last span
+  for (uint64_t a = address; a <= end; a++)
+  {
+    const taint_t *page = a < end ? t->pages[a >> DIRTY_PAGE_SHIFT] : NULL;
+    taint_t taint = page ? page[a & (DIRTY_PAGE_SIZE - 1)] : 0;
+
+    if (taint == current)
+    {
+      // Skip the rest of a page without labels
+      if (!page && !current && a < end)
+	a = (a | (DIRTY_PAGE_SIZE - 1)) < end ? (a | (DIRTY_PAGE_SIZE - 1)) : end - 1;
+      continue;
+    }
+    if (current && numRanges++ < TAINT_MAX_RANGES)
+    {
+      const y86_symbol_t *symbol = program ? symbolAt(program, start) : NULL;
+      fprintf(file, "    #   0x%lx%s%s%s+%lu: ", start, symbol ? " <" : "",
+	      symbol ? symbol->name : "", symbol ? ">" : "", a - start);
+      taintPrintSet(file, t, current);
+      fprintf(file, "\n");
+    }
+    current = taint;
+    start = a;
+  }
+  if (numRanges > TAINT_MAX_RANGES)
+    fprintf(file, "    #   ... and %lu more\n", numRanges - TAINT_MAX_RANGES);
+  return numRanges;
+}
+
+/* Prints the labels of length bytes at address, and the spans that
+   carry them if they differ from byte to byte. */
+void taintPrintMemory(FILE *file, const taint_state_t *t, uint64_t address,
+		      uint64_t length, const y86_program_t *program) {
+
+  fprintf(file, "    # 0x%lx+%lu: ", address, length);
+  taintPrintSet(file, t, taintRead(t, address, length));
+  fprintf(file, "\n");
+  if (length > 8)
+    printRanges(file, t, address, length, program);
+}
+
+void taintPrintReport(FILE *file, const taint_state_t *t,
+		      const y86_program_t *program) {
+
+  int numRegisters = 0;
+
+  fprintf(file, "    # %d of %d labels used, %lu shadow pages of %d bytes\n",
+	  t->numLabels, TAINT_MAX_LABELS, t->numAllocated, DIRTY_PAGE_SIZE);
+  if (t->lost)
+    fprintf(file, "    # Some labels were dropped for lack of memory\n");
+
+  for (int r = R_RAX; r < R_NONE; r++)
+  {
+    if (!t->registers[r])
+      continue;
+    if (!numRegisters++)
+      fprintf(file, "    # Tainted registers:\n");
+    fprintf(file, "    #   %s: ", registerName(r));
+    taintPrintSet(file, t, t->registers[r]);
+    fprintf(file, "\n");
+  }
+
+  fprintf(file, "    # Tainted memory:\n");
+  if (!printRanges(file, t, 0, t->size, program))
+    fprintf(file, "    #   none\n");
+}
@@ -0,0 +1,66 @@
+/* This file contains the prototypes and constants needed to use the
+   taint tracker defined in taint.c
+*/
+
+#ifndef _TAINT_H_
+#define _TAINT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "instruction.h"
+#include "assembler.h"
+
+#define TAINT_MAX_LABELS 8
+
+/* Labels carried by a byte of memory or a register, one bit each. */
+typedef uint8_t taint_t;
+
+/* What a label was first given to: a register, or a span of memory. */
+typedef struct taint_label {
+  int      reg;      // R_NONE for memory
+  uint64_t address;
+  uint64_t length;
+} taint_label_t;
+
+/* Shadow state of a machine: the labels of every register, and of
+   every byte of memory, kept per DIRTY_PAGE_SIZE page. A page is only
+   allocated once a label is written to it, so that untainted memory
+   costs a pointer per page. Labels flow along data moves and
+   arithmetic, but not through addresses or condition codes. */
+typedef struct taint_state {
+  taint_t      **pages;      // NULL for pages without labels
+  uint64_t       numPages;
+  uint64_t       size;       // of memory
+  uint64_t       numAllocated;
+  int            lost;       // labels were dropped for lack of memory
+
+  taint_t        registers[16];
+
+  taint_label_t  labels[TAINT_MAX_LABELS];
+  int            numLabels;
+
+  // Effect of the instruction about to be executed, see taintPrepare
+  int            pendingReg;       // R_NONE if none
+  taint_t        pendingRegTaint;
+  int            pendingMem;
+  uint64_t       pendingAddress;   // of a quad-word
+  taint_t        pendingMemTaint;
+} taint_state_t;
+
+int     taintInit(taint_state_t *t, uint64_t size);
+void    taintReset(taint_state_t *t);
+void    taintFree(taint_state_t *t);
+int     taintMark(taint_state_t *t, int reg, uint64_t address, uint64_t length);
+void    taintClear(taint_state_t *t, int reg, uint64_t address, uint64_t length);
+taint_t taintRead(const taint_state_t *t, uint64_t address, uint64_t length);
+void    taintPrepare(taint_state_t *t, machine_state_t *state,
+		     const y86_instruction_t *instr);
+void    taintCommit(taint_state_t *t);
+void    taintPrintSet(FILE *file, const taint_state_t *t, taint_t taint);
+void    taintPrintMemory(FILE *file, const taint_state_t *t, uint64_t address,
+			 uint64_t length, const y86_program_t *program);
+void    taintPrintReport(FILE *file, const taint_state_t *t,
+			 const y86_program_t *program);
+
+#endif /* TAINT */
@@ -0,0 +1,350 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "telemetry.h"
+
+__thread telemetry_t *threadTelemetry;
+
+static pthread_mutex_t telemetryLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t telemetryOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t telemetryKey;
+static telemetry_t *threads;    // counters of the running threads
+static telemetry_t retired;     // sum of the counters of finished threads
+static telemetry_t fallback;    // shared by threads that could not get their own
+
+/* Adds the counters of from to those of to. */
+static void telemetryAdd(telemetry_t *to, const telemetry_t *from) {
+
+  to->instructions += from->instructions;
+  to->runInstructions += from->runInstructions;
+  to->runs += from->runs;
+  to->runSeconds += from->runSeconds;
+  if (from->runs && from->lastRunEnd >= to->lastRunEnd)
+  {
+    to->lastRunInstructions = from->lastRunInstructions;
+    to->lastRunSeconds = from->lastRunSeconds;
+    to->lastRunEnd = from->lastRunEnd;
+  }
+  if (from->maxRunRate > to->maxRunRate)
+    to->maxRunRate = from->maxRunRate;
+  to->sampledInstructions += from->sampledInstructions;
+  to->sampledDecodeSeconds += from->sampledDecodeSeconds;
+  to->sampledExecuteSeconds += from->sampledExecuteSeconds;
+  to->commands += from->commands;
+  to->commandSeconds += from->commandSeconds;
+  to->printSeconds += from->printSeconds;
+  to->breakpointChecks += from->breakpointChecks;
+  to->memoryReads += from->memoryReads;
+  to->memoryWrites += from->memoryWrites;
+}
+
+/* Called when a thread exits: keeps its counters in the totals. */
+static void telemetryRetire(void *data) {
+
+  telemetry_t *t = data, **link;
+
+  pthread_mutex_lock(&telemetryLock);
+  telemetryAdd(&retired, t);
+  for (link = &threads; *link; link = &(*link)->next)
+    if (*link == t)
+    {
+      *link = t->next;
+      break;
+    }
+  pthread_mutex_unlock(&telemetryLock);
+  free(t);
+}
+
+static void telemetryCreateKey(void) {
+
+  pthread_key_create(&telemetryKey, telemetryRetire);
+}
+
+/* Gives the calling thread its own counters, the first time it counts
+   something. Use telemetryThread() instead. */
+telemetry_t *telemetryRegister(void) {
+
+  telemetry_t *t = calloc(1, sizeof(telemetry_t));
+
+  if (!t)
+    return &fallback;
+
+  pthread_once(&telemetryOnce, telemetryCreateKey);
+  pthread_mutex_lock(&telemetryLock);
+  t->next = threads;
+  threads = t;
+  pthread_mutex_unlock(&telemetryLock);
+  pthread_setspecific(telemetryKey, t);
+  return threadTelemetry = t;
+}
+
+/* Stores in total the sum of the counters of all threads, including
+   those that have finished. Counters of running threads are read
+   without synchronization, so they may be slightly behind. */
+void telemetryTotal(telemetry_t *total) {
+
+  memset(total, 0, sizeof(*total));
+  pthread_mutex_lock(&telemetryLock);
+  telemetryAdd(total, &retired);
+  telemetryAdd(total, &fallback);
+  for (const telemetry_t *t = threads; t; t = t->next)
+    telemetryAdd(total, t);
+  pthread_mutex_unlock(&telemetryLock);
+  total->next = NULL;
+}
+
+/* Returns a monotonic time in seconds, for timing. */
+double telemetryNow(void) {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double clockOverhead;
+
+static void measureClockOverhead(void) {
+
+  clockOverhead = 1;
+  for (int i = 0; i < 64; i++)
+  {
+    double start = telemetryNow(), end = telemetryNow();
+    if (end - start < clockOverhead)
+      clockOverhead = end - start;
+  }
+}
+
+/* Returns the time that two consecutive telemetryNow() calls measure,
+   i.e. the cost of one call that the time between two calls includes:
+   the least of a few measurements, made the first time. Timed samples
+   subtract it. */
+double telemetryClockOverhead(void) {
+
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+  pthread_once(&once, measureClockOverhead);
+  return clockOverhead;
+}
+
+static double rate(double count, double seconds) {
+
+  return seconds > 0 ? count / seconds : 0;
+}
+
+/* Counts a run that executed instructions in seconds, ending now. */
+void telemetryRecordRun(telemetry_t *t, uint64_t instructions, double seconds) {
+
+  t->instructions += instructions;
+  t->runInstructions += instructions;
+  t->runs++;
+  t->runSeconds += seconds;
+  t->lastRunInstructions = instructions;
+  t->lastRunSeconds = seconds;
+  t->lastRunEnd = telemetryNow();
+  if (rate(instructions, seconds) > t->maxRunRate)
+    t->maxRunRate = rate(instructions, seconds);
+}
+
+/* Estimates of the total time spent decoding and executing in runs,
+   from the sampled instructions: the run time, split in the proportion
+   of the sampled times. */
+static void estimateTimes(const telemetry_t *total, double *decode,
+			  double *execute) {
+
+  double sampled = total->sampledDecodeSeconds + total->sampledExecuteSeconds;
+  double scale = rate(total->runSeconds, sampled);
+
+  *decode = total->sampledDecodeSeconds * scale;
+  *execute = total->sampledExecuteSeconds * scale;
+}
+
+static void printText(FILE *file, const telemetry_t *total,
+		      const telemetry_cache_t *caches, int numCaches) {
+
+  double decode, execute;
+
+  fprintf(file, "    # Instructions executed: %" PRIu64 ", %" PRIu64
+	  " of them in %" PRIu64 " runs\n", total->instructions,
+	  total->runInstructions, total->runs);
+  fprintf(file, "    # Runs: %.6f s, %.0f instructions/s (fastest run %.0f/s)\n",
+	  total->runSeconds, rate(total->runInstructions, total->runSeconds),
+	  total->maxRunRate);
+  if (total->runs)
+    fprintf(file, "    # Last run: %" PRIu64 " instructions, %.6f s, "
+	    "%.0f instructions/s\n", total->lastRunInstructions,
+	    total->lastRunSeconds,
+	    rate(total->lastRunInstructions, total->lastRunSeconds));
+  if (total->sampledInstructions)
+  {
+    estimateTimes(total, &decode, &execute);
+    fprintf(file, "    # Run time: %.6f s decoding, %.6f s executing "
+	    "(estimated from %" PRIu64 " timed instructions)\n", decode, execute,
+	    total->sampledInstructions);
+  }
+  fprintf(file, "    # Commands: %" PRIu64 ", %.6f s handling outside of runs, "
+	  "%.6f s printing\n", total->commands, total->commandSeconds,
+	  total->printSeconds);
+  fprintf(file, "    # Breakpoint checks: %" PRIu64 "\n", total->breakpointChecks);
+  fprintf(file, "    # Memory accesses: %" PRIu64 " reads, %" PRIu64 " writes\n",
+	  total->memoryReads, total->memoryWrites);
+  for (int i = 0; i < numCaches; i++)
+    fprintf(file, "    # %s: %" PRIu64 " hits, %" PRIu64 " misses, "
+	    "%.2f%% hit rate\n", caches[i].name, caches[i].hits, caches[i].misses,
+	    100 * rate(caches[i].hits, caches[i].hits + caches[i].misses));
+}
+
+static void printJSON(FILE *file, const telemetry_t *total,
+		      const telemetry_cache_t *caches, int numCaches) {
+
+  double decode, execute;
+
+  estimateTimes(total, &decode, &execute);
+  fprintf(file, "{\n");
+  fprintf(file, "  \"instructions\": %" PRIu64 ",\n", total->instructions);
+  fprintf(file, "  \"run_instructions\": %" PRIu64 ",\n", total->runInstructions);
+  fprintf(file, "  \"runs\": %" PRIu64 ",\n", total->runs);
+  fprintf(file, "  \"run_seconds\": %.6f,\n", total->runSeconds);
+  fprintf(file, "  \"instructions_per_second\": %.0f,\n",
+	  rate(total->runInstructions, total->runSeconds));
+  fprintf(file, "  \"max_run_instructions_per_second\": %.0f,\n", total->maxRunRate);
+  fprintf(file, "  \"last_run\": {\"instructions\": %" PRIu64 ", \"seconds\": %.6f, "
+	  "\"instructions_per_second\": %.0f},\n", total->lastRunInstructions,
+	  total->lastRunSeconds,
+	  rate(total->lastRunInstructions, total->lastRunSeconds));
+  fprintf(file, "  \"timed_instructions\": %" PRIu64 ",\n", total->sampledInstructions);
+  fprintf(file, "  \"estimated_decode_seconds\": %.6f,\n", decode);
+  fprintf(file, "  \"estimated_execute_seconds\": %.6f,\n", execute);
+  fprintf(file, "  \"commands\": %" PRIu64 ",\n", total->commands);
+  fprintf(file, "  \"command_seconds\": %.6f,\n", total->commandSeconds);
+  fprintf(file, "  \"print_seconds\": %.6f,\n", total->printSeconds);
+  fprintf(file, "  \"breakpoint_checks\": %" PRIu64 ",\n", total->breakpointChecks);
+  fprintf(file, "  \"memory_reads\": %" PRIu64 ",\n", total->memoryReads);
+  fprintf(file, "  \"memory_writes\": %" PRIu64 ",\n", total->memoryWrites);
+  fprintf(file, "  \"caches\": [");
+  for (int i = 0; i < numCaches; i++)
+    fprintf(file, "%s\n    {\"name\": \"%s\", \"hits\": %" PRIu64 ", \"misses\": %"
+	    PRIu64 ", \"hit_rate\": %.6f}", i ? "," : "", caches[i].name,
+	    caches[i].hits, caches[i].misses,
+	    rate(caches[i].hits, caches[i].hits + caches[i].misses));
+  fprintf(file, "%s]\n}\n", numCaches ? "\n  " : "");
+}
+
+static void printMetric(FILE *file, const char *name, const char *type,
+			const char *help, double value) {
+
+  fprintf(file, "# HELP y86_debugger_%s %s\n", name, help);
+  fprintf(file, "# TYPE y86_debugger_%s %s\n", name, type);
+  fprintf(file, "y86_debugger_%s %.17g\n", name, value);
+}
+
+static void printPrometheus(FILE *file, const telemetry_t *total,
+			    const telemetry_cache_t *caches, int numCaches) {
+
+  double decode, execute;
+
+  estimateTimes(total, &decode, &execute);
+  printMetric(file, "instructions_total", "counter",
+	      "Instructions executed.", total->instructions);
+  printMetric(file, "run_instructions_total", "counter",
+	      "Instructions executed by runs.", total->runInstructions);
+  printMetric(file, "runs_total", "counter", "Runs.", total->runs);
+  printMetric(file, "run_seconds_total", "counter",
+	      "Time spent running the program.", total->runSeconds);
+  printMetric(file, "last_run_instructions", "gauge",
+	      "Instructions executed by the last run.", total->lastRunInstructions);
+  printMetric(file, "last_run_seconds", "gauge",
+	      "Duration of the last run.", total->lastRunSeconds);
+  printMetric(file, "max_run_instructions_per_second", "gauge",
+	      "Instructions per second of the fastest run.", total->maxRunRate);
+  printMetric(file, "decode_seconds_total", "counter",
+	      "Estimated time spent decoding in runs.", decode);
+  printMetric(file, "execute_seconds_total", "counter",
+	      "Estimated time spent executing in runs.", execute);
+  printMetric(file, "commands_total", "counter", "Commands handled.",
+	      total->commands);
+  printMetric(file, "command_seconds_total", "counter",
+	      "Time spent handling commands outside of runs.", total->commandSeconds);
+  printMetric(file, "print_seconds_total", "counter",
+	      "Time spent writing the output of commands.", total->printSeconds);
+  printMetric(file, "breakpoint_checks_total", "counter",
+	      "Breakpoint checks.", total->breakpointChecks);
+  printMetric(file, "memory_reads_total", "counter",
+	      "Data memory reads.", total->memoryReads);
+  printMetric(file, "memory_writes_total", "counter",
+	      "Data memory writes.", total->memoryWrites);
+
+  if (!numCaches)
+    return;
+  fprintf(file, "# HELP y86_debugger_cache_hits_total Cache hits.\n");
+  fprintf(file, "# TYPE y86_debugger_cache_hits_total counter\n");
+  for (int i = 0; i < numCaches; i++)
+    fprintf(file, "y86_debugger_cache_hits_total{cache=\"%s\"} %" PRIu64 "\n",
+	    caches[i].name, caches[i].hits);
+  fprintf(file, "# HELP y86_debugger_cache_misses_total Cache misses.\n");
+  fprintf(file, "# TYPE y86_debugger_cache_misses_total counter\n");
+  for (int i = 0; i < numCaches; i++)
+    fprintf(file, "y86_debugger_cache_misses_total{cache=\"%s\"} %" PRIu64 "\n",
+	    caches[i].name, caches[i].misses);
+}
+
+/* Prints the counters in total and the hit rates of caches in format:
+   human-readable lines, a JSON object, or Prometheus text exposition.
+   Returns 1 in case of success, or 0 if the output failed. */
+int telemetryPrint(FILE *file, telemetry_format_t format,
+		   const telemetry_t *total, const telemetry_cache_t *caches,
+		   int numCaches) {
+
+  switch (format)
+  {
+  case TELEMETRY_TEXT:
+    printText(file, total, caches, numCaches);
+    break;
+  case TELEMETRY_JSON:
+    printJSON(file, total, caches, numCaches);
+    break;
+  case TELEMETRY_PROMETHEUS:
+    printPrometheus(file, total, caches, numCaches);
+    break;
+  }
+  return !ferror(file);
+}
+
+/* Writes the counters to fileName as telemetryPrint does. The file is
+   written under a temporary name and then renamed, so that a scraper
+   never reads a partial file. Returns 1 in case of success, or 0 if
+   the file could not be written. */
+int telemetryWriteFile(const char *fileName, telemetry_format_t format,
+		       const telemetry_t *total,
+		       const telemetry_cache_t *caches, int numCaches) {
+
+  size_t length = strlen(fileName);
+  char *tempName = malloc(length + 5);
+  FILE *file;
+  int result;
+
+  if (!tempName)
+    return 0;
+  memcpy(tempName, fileName, length);
+  memcpy(tempName + length, ".tmp", 5);
+
+  if (!(file = fopen(tempName, "w")))
+  {
+    free(tempName);
+    return 0;
+  }
+  result = telemetryPrint(file, format, total, caches, numCaches);
+  result = fclose(file) == 0 && result;
+  if (result)
+    result = rename(tempName, fileName) == 0;
+  if (!result)
+    remove(tempName);
+  free(tempName);
+  return result;
+}
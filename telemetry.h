@@ -0,0 +1,75 @@
+/* This file contains the prototypes and constants needed to use the
+   runtime telemetry defined in telemetry.c
+*/
+
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Counters of the debugger's own work. Each thread counts into its own
+   telemetry_t, returned by telemetryThread(), so counting needs no
+   synchronization; telemetryTotal() adds them up. */
+typedef struct telemetry {
+
+  uint64_t instructions;         // executed by runs and single steps
+  uint64_t runInstructions;      // executed by runs
+  uint64_t runs;
+  double   runSeconds;
+  uint64_t lastRunInstructions;
+  double   lastRunSeconds;
+  double   lastRunEnd;           // telemetryNow() at the end of the last run
+  double   maxRunRate;           // instructions per second of the fastest run
+
+  // Decoding and execution are timed for a sample of the instructions
+  // executed by runs, less the cost of reading the clock
+  uint64_t sampledInstructions;
+  double   sampledDecodeSeconds;
+  double   sampledExecuteSeconds;
+
+  uint64_t commands;
+  double   commandSeconds;       // handling commands, outside of runs
+  double   printSeconds;         // writing the output of commands
+
+  uint64_t breakpointChecks;
+  uint64_t memoryReads;
+  uint64_t memoryWrites;
+
+  struct telemetry *next;        // in the list of all threads' counters
+
+} telemetry_t;
+
+/* Hits and misses of a cache, for the reports. */
+typedef struct telemetry_cache {
+  const char *name;
+  uint64_t    hits;
+  uint64_t    misses;
+} telemetry_cache_t;
+
+typedef enum telemetry_format {
+  TELEMETRY_TEXT,
+  TELEMETRY_JSON,
+  TELEMETRY_PROMETHEUS
+} telemetry_format_t;
+
+extern __thread telemetry_t *threadTelemetry;
+
+telemetry_t *telemetryRegister(void);
+void   telemetryTotal(telemetry_t *total);
+double telemetryNow(void);
+double telemetryClockOverhead(void);
+void   telemetryRecordRun(telemetry_t *t, uint64_t instructions, double seconds);
+int    telemetryPrint(FILE *file, telemetry_format_t format,
+		      const telemetry_t *total, const telemetry_cache_t *caches,
+		      int numCaches);
+int    telemetryWriteFile(const char *fileName, telemetry_format_t format,
+			  const telemetry_t *total,
+			  const telemetry_cache_t *caches, int numCaches);
+
+/* Returns the counters of the calling thread. */
+static inline telemetry_t *telemetryThread(void) {
+  return threadTelemetry ? threadTelemetry : telemetryRegister();
+}
+
+#endif /* TELEMETRY */
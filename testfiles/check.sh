@@ -0,0 +1,273 @@
+#!/bin/bash
+# Regression checks for the debugger, driven by the programs in this
+# directory. Each check feeds commands to the debugger and looks for
+# the expected lines in its output, or compares two sessions that must
+# agree.
+#
+# Usage: testfiles/check.sh [DEBUGGER]   (default ./debugger)
+
+debugger=${1:-./debugger}
+dir=$(dirname "$0")
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+failures=0
+
+pass() {
+  echo "ok   $1"
+}
+
+fail() {
+  echo "FAIL $1"
+  failures=$((failures + 1))
+}
+
+# debug COMMANDS ARGS...: runs the debugger with ARGS on COMMANDS, in
+# which \n separates commands
+debug() {
+  local commands=$1
+  shift
+  printf '%b' "$commands" | "$debugger" "$@" 2>&1
+}
+
+# expect NAME OUTPUT LINE...: checks that OUTPUT holds every LINE
+expect() {
+  local name=$1 output=$2 line
+  shift 2
+  for line; do
+    if ! grep -qxF -- "$line" <<< "$output"; then
+      fail "$name: no line '$line' in"
+      echo "$output"
+      return
+    fi
+  done
+  pass "$name"
+}
+
+# same NAME A B: checks that the outputs A and B are identical
+same() {
+  if [ "$2" == "$3" ]; then
+    pass "$1"
+  else
+    fail "$1"
+    diff <(echo "$2") <(echo "$3")
+  fi
+}
+
+# yo2mem LISTING IMAGE: writes the memory image that a yas listing
+# (lines "0xADDRESS: BYTES | source") describes to IMAGE
+yo2mem() {
+  local address bytes end size=0
+  : > "$2"
+  while read -r address bytes; do
+    if [ -n "$bytes" ]; then
+      printf "$(sed 's/../\\x&/g' <<< "$bytes")" |
+	dd of="$2" bs=1 seek=$((16#$address)) conv=notrunc 2> /dev/null
+    fi
+    end=$((16#$address + ${#bytes} / 2))
+    [ $end -gt $size ] && size=$end
+  done < <(sed -n 's/^0x\([0-9a-f]*\): *\([0-9a-f]*\) *|.*/\1 \2/p' "$1")
+  truncate -s $size "$2"
+}
+
+yo2mem "$dir/loops.yo" "$work/loops.mem"
+
+# A snapshot restores the registers and PC it saved, and resumes to
+# the same result as a run that was never interrupted
+result='registers\nexamine 0x3f0 2\n'
+plain=$(debug "run\n$result" "$work/loops.mem")
+saved=$(debug "break 0x51\nrun\nstep\nstep\nsave $work/loops.snap\nstep\n$result" \
+	      "$work/loops.mem")
+output=$(debug "restore $work/loops.snap\nstep\n$result" "$work/loops.mem")
+same "snapshot: restore" "$(echo "$saved" | tail -n 18)" \
+  "$(echo "$output" | tail -n 18)"
+output=$(debug "restore $work/loops.snap\ndelete 0x51\nrun\n$result" \
+	       "$work/loops.mem")
+same "snapshot: resume" "$(echo "$plain" | tail -n 17)" \
+  "$(echo "$output" | tail -n 17)"
+
+# Saving over the snapshot just restored from leaves a snapshot of the
+# same state
+debug "restore $work/loops.snap\nsave $work/loops.snap\n" "$work/loops.mem" > /dev/null
+output=$(debug "restore $work/loops.snap\nstep\n$result" "$work/loops.mem")
+same "snapshot: saved over" "$(echo "$saved" | tail -n 18)" \
+  "$(echo "$output" | tail -n 18)"
+
+# A snapshot taken before anything was written reverts to the image
+debug "save $work/empty.snap\n" "$work/loops.mem" > /dev/null
+output=$(debug "break 0x51\nrun\nrestore $work/empty.snap\nstep\n$result" \
+	       "$work/loops.mem")
+same "snapshot: nothing written" \
+  "$(debug "step\n$result" "$work/loops.mem" | tail -n 18)" \
+  "$(echo "$output" | tail -n 18)"
+
+# A snapshot cut short is refused before anything is restored
+head -c 4100 "$work/loops.snap" > "$work/short.snap"
+output=$(debug "restore $work/short.snap\nstep\n$result" "$work/loops.mem")
+expect "snapshot: cut short" "$output" \
+  "    # Failed to restore $work/short.snap: not a snapshot of this image"
+same "snapshot: cut short, state kept" \
+  "$(debug "step\n$result" "$work/loops.mem" | tail -n 18)" \
+  "$(echo "$output" | tail -n 18)"
+
+# fusion.ys has the size of loops.mem, but not its contents
+output=$(debug "restore $work/loops.snap\n" "$dir/fusion.ys")
+expect "snapshot: other image" "$output" \
+  "    # Failed to restore $work/loops.snap: not a snapshot of this image"
+
+# Loops are found from their back edges, inner ones counted per entry
+output=$(debug 'loops on\nrun\nloops\n' "$work/loops.mem")
+expect "loops" "$output" \
+  "    # Loops: 3, instructions: 179" \
+  "    # 0x47                        3           12        4.0          4       13.0            117" \
+  "    # 0x51                       12           60        5.0          5        2.0             96"
+
+# 511 loops inside an outer one: the outer loop is found while an inner
+# one is active, just as the loop table grows
+{
+  echo ' irmovq $1, %rdx'
+  echo ' irmovq $2, %rcx'
+  echo 'outer:'
+  for i in $(seq 510); do
+    printf ' irmovq $2, %%rbx\nl%d: subq %%rdx, %%rbx\n jne l%d\n' $i $i
+  done
+  printf ' irmovq $2, %%rbx\ninner: subq %%rdx, %%rbx\n jne far\n'
+  printf ' subq %%rdx, %%rcx\n jne outer\n halt\nfar: jmp inner\n'
+} > "$work/manyloops.ys"
+output=$(debug 'loops on\nrun\nloops\n' "$work/manyloops.ys")
+expect "loops: table growth" "$output" \
+  "    # Loops: 512, instructions: 5118" \
+  "    # Loops still executing: 1"
+
+# A .ys source assembles to the image its yas listing describes, no
+# larger and no smaller
+image='examine 0 129\n'
+same "assembler: image" "$(debug "$image" "$work/loops.mem" | tail -n +3)" \
+  "$(debug "$image" "$dir/loops.ys" | tail -n +3)"
+
+# A quad-word that is only partly within memory is reported as invalid
+# from its start
+size=$(stat -c %s "$work/loops.mem")
+expect "examine: partial quad" \
+  "$(debug "examine $(printf %x $((size - 12))) 2\n" "$work/loops.mem")" \
+  "$(printf '    # Invalid memory access: 0x%16x' $((size - 4)))"
+
+# A saved coverage map merges back into a session that ran nothing,
+# in the same image only
+saved=$(debug "coverage on\nrun\ncoverage save $work/loops.cov\ncoverage\n" \
+	      "$dir/loops.ys")
+merged=$(debug "coverage on\ncoverage merge $work/loops.cov\ncoverage\n" \
+	       "$dir/loops.ys")
+same "coverage: merge" "$(echo "$saved" | tail -n 3)" \
+  "$(echo "$merged" | tail -n 3)"
+output=$(debug "coverage on\ncoverage merge $work/loops.cov\n" "$dir/fusion.ys")
+expect "coverage: other image" "$output" \
+  "    # Could not merge $work/loops.cov: not a coverage file for this image"
+
+# Lanes run the same code from the same state, with different inputs
+output=$(debug 'break go\nrun\nsweep 4 %rdi=1:1 show %rax\n' "$dir/sweep.ys")
+expect "sweep" "$output" \
+  "    # lane 0: halted after 17 instructions, %rax = 0x1" \
+  "    # lane 1: halted after 26 instructions, %rax = 0x2" \
+  "    # lane 2: halted after 35 instructions, %rax = 0x6" \
+  "    # lane 3: halted after 44 instructions, %rax = 0x18"
+
+# A location that is neither a register, a label nor an address in hex
+# is rejected, as by the fork server
+expect "sweep: invalid location" \
+  "$(debug 'sweep 2 %rdi=1:1 show results\n' "$dir/sweep.ys")" \
+  "    # Invalid command or parameters: sweep "
+
+# Lanes start from memory written before the sweep, not from the image
+printf ' irmovq data, %%rcx\n irmovq $7, %%rax\n rmmovq %%rax, 0(%%rcx)\ngo: mrmovq 0(%%rcx), %%rbx\n addq %%rdi, %%rbx\n rmmovq %%rbx, 0(%%rcx)\n halt\n .pos 0x2000\ndata: .quad 0\n' > "$work/written.ys"
+output=$(debug 'break go\nrun\nsweep 2 %rdi=1:1 show data\nexamine 2000\n' "$work/written.ys")
+expect "sweep: written memory" "$output" \
+  "    # lane 0: halted after 3 instructions, data = 0x8" \
+  "    # lane 1: halted after 3 instructions, data = 0x9" \
+  "    # M_8[0x2000] = 0x7"
+
+# A lane that never halts is stopped by the limits on runs, like run
+printf ' andq %%rdi, %%rdi\n je spin\n halt\nspin: jmp spin\n' > "$work/spin.ys"
+output=$(debug 'sweep 2 %rdi=0:1\n' --max-seconds 0.2 "$work/spin.ys" |
+	   sed 's/after [0-9]* /after N /')
+expect "sweep: time limit" "$output" \
+  "    # lane 0: limit after N instructions, %rdi = 0x0, %rax = 0x0" \
+  "    # lane 1: halted after N instructions, %rdi = 0x1, %rax = 0x0"
+
+# Superinstructions and guard pages must not change what a run computes
+result='run\nregisters\nexamine 0x200 10\n'
+plain=$(debug "$result" "$dir/fusion.ys")
+expect "fusion: sum and count" "$plain" \
+  "    # 0000000000000240  000000000000001c 0000000000000003"
+same "fusion: --no-fusion" "$plain" \
+  "$(debug "$result" --no-fusion "$dir/fusion.ys")"
+same "fusion: --guard-pages" "$plain" \
+  "$(debug "$result" --guard-pages "$dir/fusion.ys")"
+
+# A store from a read-only segment into a writable one writes nothing,
+# with guard pages as with bounds checks
+printf ' irmovq $-1, %%rax\n irmovq $0x1ffc, %%rcx\n rmmovq %%rax, 0(%%rcx)\n halt\n' > "$work/straddle.ys"
+debug "xdump 0 0x20 $work/code.mem raw\n" "$work/straddle.ys" > /dev/null
+head -c 4096 /dev/zero > "$work/ro.mem"
+head -c 4096 /dev/zero > "$work/rw.mem"
+layout="--segment $work/code.mem@0:r-x --segment $work/ro.mem@0x1000:r-- --segment $work/rw.mem@0x2000:rw-"
+output=$(debug 'run\nexamine 2000\n' $layout)
+expect "segments: store across pages" "$output" "    # M_8[0x2000] = 0x0"
+same "segments: store across pages, --guard-pages" "$output" \
+  "$(debug 'run\nexamine 2000\n' --guard-pages $layout | grep -v 'Invalid memory access')"
+
+# Coverage and memstats of segments far apart only cover what was used
+printf ' irmovq $0x40000000, %%rcx\n mrmovq 0(%%rcx), %%rax\n rmmovq %%rax, 8(%%rcx)\n halt\n' > "$work/far.ys"
+debug "xdump 0 0x20 $work/far.mem raw\n" "$work/far.ys" > /dev/null
+layout="--segment $work/far.mem@0:r-x --segment $work/rw.mem@0x40000000:rw-"
+debug "coverage on\nmemstats on\nrun\ncoverage save $work/far.cov\nmemstats export $work/far.csv\n" \
+  $layout > /dev/null
+expect "segments: memstats export" "$(cat "$work/far.csv")" "0x40000000,1,1"
+expect "segments: coverage saved" "$(wc -c < "$work/far.cov")" "4128"
+output=$(debug "coverage on\ncoverage merge $work/far.cov\ncoverage\n" $layout)
+expect "segments: coverage merged" "$output" "    # Instructions executed: 4, blocks: 0"
+
+# Taint flows through loads, arithmetic, stores, push and pop only
+output=$(debug 'taint on\ntaint mark src 8\nrun\ntaint\ntaint %r8\ntaint %rax\n' \
+	       "$dir/taint.ys")
+expect "taint" "$output" \
+  "    #   %rcx: 0 (0x100+8)" \
+  "    #   %rsi: 0 (0x100+8)" \
+  "    #   0x110 <dst>+8: 0 (0x100+8)" \
+  "    # %r8: clean" \
+  "    # %rax: clean"
+
+# The index is written on the first load and used by the next one, but
+# not for code written since, and not once its records are corrupt
+cp "$dir/selfmod.ys" "$work"
+index=$work/selfmod.ys.idx
+output=$(debug 'run\ndisassemble patch 1\n' --index "$work/selfmod.ys")
+expect "index: built" "$output" \
+  "# Built $index: 5 instructions, 1 blocks, 1 functions"
+same "index: written code" "    halt                                # PC = 0x1e" \
+  "$(echo "$output" | sed -n '/^patch:$/{n;p;}')"
+output=$(debug 'disassemble patch 1\n' --index "$work/selfmod.ys")
+expect "index: loaded" "$output" \
+  "# Loaded $index: 5 instructions, 1 blocks, 1 functions"
+same "index: loaded code" "    irmovq  \$0x7, %rsi                  # PC = 0x1e" \
+  "$(echo "$output" | sed -n '/^patch:$/{n;p;}')"
+printf '\377' | dd of="$index" bs=1 seek=63 conv=notrunc 2> /dev/null
+output=$(debug 'quit\n' --index "$work/selfmod.ys")
+expect "index: corrupt" "$output" \
+  "# Built $index: 5 instructions, 1 blocks, 1 functions"
+
+# An event stream never replaces shared memory that already exists
+if [ -d /dev/shm ]; then
+  stream=/y86-check-$$
+  echo keep > /dev/shm$stream
+  output=$(debug 'quit\n' --events $stream "$work/loops.mem")
+  expect "events: existing object" "$output" \
+    "Event stream not available: Shared memory $stream already exists; if no debugger is using it, remove it (/dev/shm$stream on Linux)"
+  same "events: existing object kept" "keep" "$(cat /dev/shm$stream)"
+  rm -f /dev/shm$stream
+fi
+
+if [ $failures -ne 0 ]; then
+  echo "$failures checks failed"
+  exit 1
+fi
+echo "All checks passed"